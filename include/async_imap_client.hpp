@@ -0,0 +1,106 @@
+#ifndef ASYNC_IMAP_CLIENT_HPP
+#define ASYNC_IMAP_CLIENT_HPP
+
+#include "async_task.hpp"
+#include "imap_client.hpp"
+#include "io_executor.hpp"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+
+namespace Pens {
+
+/**
+ * @brief Coroutine IMAP client on a non-blocking socket
+ *
+ * The same protocol subset as ImapClient, but every network operation is
+ * a Task that suspends on the IoExecutor instead of blocking a thread, so
+ * thousands of sessions can share a few threads:
+ *
+ *     co_await client.connect();
+ *     co_await client.authenticate(user, password);
+ *     co_await client.selectMailbox("INBOX");
+ *     auto emails = client.fetch("1:*");
+ *     while (auto email = co_await emails.next()) { ... }
+ *
+ * fetch() yields each message as soon as its FETCH response has arrived.
+ * A session runs one command at a time: finish (or drop) a fetch stream
+ * before the next command; a stream dropped halfway leaves the session
+ * out of step, so it is closed. Use syncWait() to call any of this from
+ * blocking code. Name resolution still uses blocking getaddrinfo.
+ */
+class AsyncImapClient {
+public:
+    AsyncImapClient(IoExecutor& executor, const std::string& server, int port, bool useSsl);
+    ~AsyncImapClient();
+
+    AsyncImapClient(const AsyncImapClient&) = delete;
+    AsyncImapClient& operator=(const AsyncImapClient&) = delete;
+
+    // connectSeconds and commandSeconds apply; the TCP keepalive fields do not
+    void setTimeouts(const ImapTimeouts& timeouts);
+    // As ImapClient::setKernelTls(); applies from the next connect()
+    void setKernelTls(bool enabled) { kernelTls_ = enabled; }
+    // Where fetch() puts message text too large to hold in memory
+    void setSpillSettings(const MessageSpillSettings& settings) { spillSettings_ = settings; }
+
+    Task<bool> connect();
+    Task<bool> authenticate(std::string username, std::string password);
+    Task<bool> authenticateOAuth(std::string username, std::string accessToken);
+    Task<bool> selectMailbox(std::string mailbox);
+    // UIDs above uid in the selected mailbox, ascending
+    Task<std::vector<uint32_t>> searchUidsAfter(uint32_t uid);
+    // Messages in a UID set such as "1:*" or "4,7,9", yielded as they arrive
+    AsyncGenerator<Email> fetch(std::string uidSet);
+    Task<bool> noop();
+    Task<void> logout();
+
+    bool isConnected() const { return fd_ >= 0; }
+    const std::string& getCurrentMailbox() const { return currentMailbox_; }
+    uint32_t getUidValidity() const { return uidValidity_; }
+
+private:
+    struct Response {
+        bool ok = false;   // tagged OK
+        std::string text;  // untagged lines, literals inline, then the tagged line
+    };
+
+    IoExecutor& executor_;
+    std::string server_;
+    int port_;
+    bool useSsl_;
+    ImapTimeouts timeouts_;
+    bool kernelTls_;
+    MessageSpillSettings spillSettings_;
+    int fd_;
+    SSL_CTX* sslContext_;
+    SSL* ssl_;
+    std::string buffer_;  // received but not yet consumed
+    unsigned nextTag_;
+    bool streaming_;      // a fetch() stream owns the connection
+    std::string currentMailbox_;
+    uint32_t uidValidity_;
+
+    Task<Response> command(std::string command);
+    // One response item: a line plus any literals it announces. With
+    // bodySpill, literals over the spill threshold stream to a file and
+    // only their prefix lands in the item; BODY[TEXT]'s spill is kept there.
+    Task<std::optional<std::string>> readItem(std::shared_ptr<MessageSpill>* bodySpill = nullptr);
+    Task<std::optional<std::string>> readLine();
+    Task<bool> fill();
+    Task<bool> writeAll(std::string data);
+    Task<bool> handshake();
+    std::string makeTag();
+    int commandTimeoutMs() const;
+    void drop(const std::string& reason);
+    void closeSocket();
+};
+
+} // namespace Pens
+
+#endif // ASYNC_IMAP_CLIENT_HPP
@@ -0,0 +1,302 @@
+#ifndef ASYNC_TASK_HPP
+#define ASYNC_TASK_HPP
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace Pens {
+
+template <typename T>
+class Task;
+
+namespace detail {
+
+// At the end of a task, resume whoever was awaiting it
+struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+        std::coroutine_handle<> continuation = handle.promise().continuation;
+        return continuation ? continuation : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    void return_value(T result) { value.emplace(std::move(result)); }
+    T take() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+    void take() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+// Starts on creation and frees itself when done; the building block for
+// spawn() and syncWait()
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+struct SyncWaitState {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+
+    void finish() {
+        // Notify under the lock: the waiter destroys this state once it sees done
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        cv.notify_all();
+    }
+};
+
+template <typename T>
+DetachedTask runSync(Task<T> task, std::optional<T>* result, std::exception_ptr* error, SyncWaitState* state) {
+    try {
+        result->emplace(co_await std::move(task));
+    } catch (...) {
+        *error = std::current_exception();
+    }
+    state->finish();
+}
+
+inline DetachedTask runSync(Task<void> task, std::exception_ptr* error, SyncWaitState* state);
+
+inline DetachedTask runDetached(Task<void> task);
+
+} // namespace detail
+
+/**
+ * @brief Lazily started coroutine producing one T
+ *
+ * Nothing runs until the task is co_awaited; the awaiting coroutine is then
+ * resumed directly when the task finishes (symmetric transfer), so chains
+ * of tasks do not grow the stack. A Task owns its coroutine frame and is
+ * move-only.
+ */
+template <typename T = void>
+class Task {
+public:
+    using promise_type = detail::Promise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    explicit Task(Handle handle) : handle_(handle) {}
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle_) {
+                handle_.destroy();
+            }
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle_.promise().continuation = awaiting;
+        return handle_;
+    }
+    T await_resume() { return handle_.promise().take(); }
+
+private:
+    Handle handle_;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+inline DetachedTask runSync(Task<void> task, std::exception_ptr* error, SyncWaitState* state) {
+    try {
+        co_await std::move(task);
+    } catch (...) {
+        *error = std::current_exception();
+    }
+    state->finish();
+}
+
+inline DetachedTask runDetached(Task<void> task) {
+    co_await std::move(task);
+}
+
+} // namespace detail
+
+/**
+ * @brief Coroutine that yields a sequence of T asynchronously
+ *
+ * The producer runs only while the consumer waits in next(): each co_yield
+ * hands one value over and suspends the producer until it is asked for the
+ * next one. next() gives std::nullopt once the producer returns.
+ *
+ *     auto emails = client.fetch("1:*");
+ *     while (auto email = co_await emails.next()) { ... }
+ */
+template <typename T>
+class AsyncGenerator {
+public:
+    struct promise_type {
+        std::optional<T> current;
+        std::coroutine_handle<> consumer;
+        std::exception_ptr exception;
+
+        // Hands control back to the consumer waiting in next()
+        struct Handoff {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                return handle.promise().consumer;
+            }
+            void await_resume() noexcept {}
+        };
+
+        AsyncGenerator get_return_object() {
+            return AsyncGenerator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        Handoff final_suspend() noexcept { return {}; }
+        Handoff yield_value(T value) {
+            current.emplace(std::move(value));
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct NextAwaiter {
+        Handle handle;
+
+        bool await_ready() const noexcept { return !handle || handle.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) noexcept {
+            handle.promise().current.reset();
+            handle.promise().consumer = consumer;
+            return handle;
+        }
+        std::optional<T> await_resume() {
+            if (!handle) {
+                return std::nullopt;
+            }
+            if (handle.promise().exception) {
+                std::rethrow_exception(std::exchange(handle.promise().exception, nullptr));
+            }
+            if (handle.done()) {
+                return std::nullopt;
+            }
+            return std::move(handle.promise().current);
+        }
+    };
+
+    explicit AsyncGenerator(Handle handle) : handle_(handle) {}
+    AsyncGenerator(AsyncGenerator&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    AsyncGenerator& operator=(AsyncGenerator&& other) noexcept {
+        if (this != &other) {
+            if (handle_) {
+                handle_.destroy();
+            }
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+    AsyncGenerator(const AsyncGenerator&) = delete;
+    AsyncGenerator& operator=(const AsyncGenerator&) = delete;
+    ~AsyncGenerator() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    // Resume the producer until its next value (or its end)
+    NextAwaiter next() { return NextAwaiter{handle_}; }
+
+private:
+    Handle handle_;
+};
+
+/**
+ * @brief Run a task and block the calling thread until it finishes
+ *
+ * The blocking bridge for synchronous callers. The task may hop to
+ * executor threads while it runs; the result is handed back here.
+ */
+template <typename T>
+T syncWait(Task<T> task) {
+    detail::SyncWaitState state;
+    std::optional<T> result;
+    std::exception_ptr error;
+    detail::runSync(std::move(task), &result, &error, &state);
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.cv.wait(lock, [&state]() { return state.done; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return std::move(*result);
+}
+
+inline void syncWait(Task<void> task) {
+    detail::SyncWaitState state;
+    std::exception_ptr error;
+    detail::runSync(std::move(task), &error, &state);
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.cv.wait(lock, [&state]() { return state.done; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// Start a task without waiting for it; it frees itself when done
+inline void spawn(Task<void> task) {
+    detail::runDetached(std::move(task));
+}
+
+} // namespace Pens
+
+#endif // ASYNC_TASK_HPP
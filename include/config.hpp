@@ -3,6 +3,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 namespace Pens {
 
@@ -21,6 +22,7 @@ public:
     std::string getImapServer() const;
     int getImapPort() const;
     bool getImapUseSsl() const;
+    bool getImapKernelTls() const;  // kTLS offload when the kernel supports it
     std::string getImapUsername() const;
     std::string getImapPassword() const;
     
@@ -35,8 +37,33 @@ public:
     std::string getOAuthClientSecret() const;
     std::string getOAuthCertificatePath() const;
     std::string getOAuthPrivateKeyPath() const;
+    std::string getOAuthAuthority() const;
+    std::string getOAuthCaFile() const;
+    int getOAuthRefreshLeadSeconds() const;
+    int getOAuthRefreshJitterSeconds() const;
+    std::string getTokenBrokerSocket() const;
+    std::string getTokenCachePath() const;
+    std::string getImapMailbox() const;
+    std::string getSyncStateFile() const;
+    std::vector<std::string> getImapFolders() const;  // empty = just imap_mailbox
+    int getImapMaxConnections() const;
+    int getImapSpillThresholdKb() const;  // larger messages are fetched to a temp file
+    std::string getImapSpillDir() const;   // empty = $TMPDIR or /tmp
     bool useOAuth() const;
     
+    // SMTP settings (verification code delivery)
+    std::string getSmtpServer() const;
+    int getSmtpPort() const;
+    bool getSmtpUseSsl() const;
+    std::string getSmtpUsername() const;  // defaults to the IMAP username
+    std::string getSmtpPassword() const;  // defaults to the IMAP password
+    int getSmtpMaxConnections() const;
+    
+    // Verification API
+    std::string getVerificationSocket() const;  // empty = not served
+    int getVerificationWorkers() const;
+    int getVerificationBudgetMs() const;
+    
     // PENS settings
     int getPriorityThreshold() const;
     int getCheckInterval() const;
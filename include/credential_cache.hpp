@@ -0,0 +1,126 @@
+#ifndef CREDENTIAL_CACHE_HPP
+#define CREDENTIAL_CACHE_HPP
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ctime>
+#include <sys/types.h>
+#include <openssl/evp.h>
+
+namespace Pens {
+
+/**
+ * @brief Process-wide cache for OAuth signing material
+ *
+ * Loads private keys and certificate thumbprints once, re-reading a file
+ * only when its inode, size, mtime or ctime changes, and reuses signed
+ * client assertion JWTs until shortly before they expire. A file modified
+ * within a second of being read could be rewritten again inside the same
+ * timestamp tick, so until its mtime is safely older than the last read
+ * its contents are compared by SHA-256 instead of trusting the stamp.
+ */
+class CredentialCache {
+public:
+    static CredentialCache& getInstance();
+
+    /**
+     * @brief Get a parsed private key, reloading it if the file changed
+     * @return Shared key or nullptr on error
+     */
+    std::shared_ptr<EVP_PKEY> getPrivateKey(const std::string& privateKeyPath);
+
+    /**
+     * @brief Get the base64url SHA-1 thumbprint of a certificate
+     * @return Thumbprint or empty on error
+     */
+    std::string getCertificateThumbprint(const std::string& certificatePath);
+
+    /**
+     * @brief Get a signed client assertion, reusing a cached one if still fresh
+     *
+     * A cached assertion is reused until reuseMargin seconds before its exp
+     * claim, and discarded as soon as the key or certificate file changes.
+     *
+     * @return JWT assertion string or empty on error
+     */
+    std::string getClientAssertion(
+        const std::string& clientId,
+        const std::string& tenantId,
+        const std::string& certificatePath,
+        const std::string& privateKeyPath
+    );
+
+    // Seconds before exp at which a cached assertion is re-signed (default: 300)
+    void setAssertionReuseMargin(int seconds);
+    // Minimum seconds between stat() checks of a watched file (default: 1)
+    void setFileCheckInterval(int seconds);
+
+    void clear();
+
+    // Counters for diagnostics
+    size_t getFileLoadCount() const;
+    size_t getSignatureCount() const;
+
+private:
+    CredentialCache();
+    CredentialCache(const CredentialCache&) = delete;
+    CredentialCache& operator=(const CredentialCache&) = delete;
+
+    struct FileStamp {
+        ino_t inode = 0;
+        off_t size = 0;
+        long mtimeSec = 0;
+        long mtimeNsec = 0;
+        long ctimeSec = 0;
+        long ctimeNsec = 0;
+        bool operator==(const FileStamp& other) const;
+    };
+
+    struct WatchedFile {
+        FileStamp stamp;
+        std::string digest;            // SHA-256 of the contents when last read
+        std::time_t readAt = 0;        // when digest was taken
+        std::time_t lastChecked = 0;
+        unsigned long generation = 0;  // Bumped on every reload
+    };
+
+    struct KeyEntry {
+        WatchedFile file;
+        std::shared_ptr<EVP_PKEY> key;
+    };
+
+    struct CertEntry {
+        WatchedFile file;
+        std::string thumbprint;
+    };
+
+    struct AssertionEntry {
+        std::string jwt;
+        long expiresAt = 0;
+        unsigned long keyGeneration = 0;
+        unsigned long certGeneration = 0;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<std::string, KeyEntry> keys_;
+    std::map<std::string, CertEntry> certs_;
+    std::map<std::string, AssertionEntry> assertions_;
+    int reuseMargin_;
+    int checkInterval_;
+    size_t fileLoads_;
+    size_t signatures_;
+
+    static bool statFile(const std::string& path, FileStamp& stamp);
+    static bool hashFile(const std::string& path, std::string& digest);
+    bool needsReload(WatchedFile& file, const std::string& path, bool loaded);
+
+    // Callers must hold mutex_
+    KeyEntry* loadKeyLocked(const std::string& path);
+    CertEntry* loadCertLocked(const std::string& path);
+};
+
+} // namespace Pens
+
+#endif // CREDENTIAL_CACHE_HPP
@@ -0,0 +1,88 @@
+#ifndef DKIM_SIGNER_HPP
+#define DKIM_SIGNER_HPP
+
+#include "message_writer.hpp"
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <openssl/evp.h>
+
+namespace Pens {
+
+struct DkimSettings {
+    std::string domain;          // d=
+    std::string selector;        // s=
+    std::string privateKeyPath;  // PEM RSA key, loaded through CredentialCache
+
+    // Header fields signed when present (lower case)
+    std::vector<std::string> headers = {"from", "to", "cc", "subject", "date", "message-id",
+                                        "reply-to", "mime-version", "content-type"};
+};
+
+/**
+ * @brief Streaming relaxed body canonicalization and SHA-256 (RFC 6376 3.4.4)
+ *
+ * Input may arrive in arbitrary pieces; bare LF counts as a line break like
+ * it does on the wire. Only pending whitespace and a count of trailing empty
+ * lines are held back, so the body is hashed without being copied.
+ */
+class DkimBodyHash {
+public:
+    DkimBodyHash();
+    ~DkimBodyHash();
+
+    DkimBodyHash(const DkimBodyHash&) = delete;
+    DkimBodyHash& operator=(const DkimBodyHash&) = delete;
+
+    void update(std::string_view data);
+
+    // Base64 of the digest (bh= value); the hasher is reset afterwards
+    std::string finish();
+
+private:
+    EVP_MD_CTX* ctx_;
+    bool pendingSpace_;
+    bool pendingCr_;
+    bool lineHasContent_;
+    size_t emptyLines_;
+    char out_[256];
+    size_t outLength_;
+
+    void reset();
+    void emit(const char* data, size_t length);
+    void content(char c);
+    void endLine();
+    void flush();
+};
+
+/**
+ * @brief DKIM signer (rsa-sha256, relaxed/relaxed)
+ *
+ * Signs a message laid out in a MessageWriter and sets the DKIM-Signature
+ * field as the writer's prefix. Headers are read in place and only the
+ * fields being signed are canonicalized into a small buffer; the body is
+ * hashed piece by piece.
+ */
+class DkimSigner {
+public:
+    explicit DkimSigner(DkimSettings settings);
+
+    // Sign the writer's message; false (message left unsigned) on error
+    bool sign(MessageWriter& writer, std::time_t now = std::time(nullptr));
+
+    // Relaxed header canonicalization of one field ("Name: value", unfolded or not)
+    static std::string canonicalizeHeader(std::string_view field);
+
+    const DkimSettings& settings() const { return settings_; }
+
+private:
+    DkimSettings settings_;
+
+    bool signData(const std::string& data, std::string& signature) const;
+};
+
+} // namespace Pens
+
+#endif // DKIM_SIGNER_HPP
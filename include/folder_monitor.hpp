@@ -0,0 +1,163 @@
+#ifndef FOLDER_MONITOR_HPP
+#define FOLDER_MONITOR_HPP
+
+#include "imap_client.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Pens {
+
+class ImapKeepalive;
+
+struct FolderMonitorSettings {
+    std::vector<std::string> folders = {"INBOX"};
+    int maxConnections = 4;                    // per account; providers cap concurrent sessions
+    int64_t pollIntervalMs = 60 * 1000;        // for connections watching several folders
+    int idleTimeoutMs = 5 * 60 * 1000;         // IDLE is renewed this often
+    int64_t rebalanceIntervalMs = 10 * 60 * 1000;
+    int fetchBatch = 50;                       // messages fetched per folder per pass
+    int initialBacklog = 10;                   // newest messages delivered on a folder's first sync
+    std::string statePath;                     // per-folder UID watermarks; empty = memory only
+    int64_t backoffBaseMs = 1000;
+    int64_t backoffMaxMs = 5 * 60 * 1000;
+    bool useNotify = true;                     // one NOTIFY session for every folder if the server has it
+};
+
+struct FolderEmail {
+    std::string folder;
+    uint32_t uid;
+    Email email;
+    uint32_t uidValidity = 0;
+};
+
+/**
+ * @brief Watches many folders of one account over a small connection pool
+ *
+ * Folders are spread over at most maxConnections sessions, each driven by
+ * its own thread, so SELECT round trips for different folders overlap. A
+ * session that ends up with a single folder IDLEs on it; the others cycle
+ * through their folders every pollInterval. Every pass records how much
+ * new mail each folder produced, and the assignment is periodically redone
+ * (longest-processing-time first) so busy folders are spread out and quiet
+ * ones share a session. New messages from all folders are merged into one
+ * stream ordered by INTERNALDATE. As with the single-mailbox
+ * ImapSessionSupervisor, a folder's persisted UID watermark only moves
+ * when the caller commits messages it has handled, so mail taken but not
+ * committed is fetched again after a restart.
+ *
+ * A folder belongs to one connection at a time. A new assignment takes
+ * effect at pass boundaries: a connection claims its folders when a pass
+ * starts, skipping any still in another connection's pass, and gives up
+ * the ones no longer assigned to it when the pass ends. A connection
+ * IDLEing on a folder that was reassigned stops IDLE early so the handover
+ * is not held up.
+ *
+ * When the server supports NOTIFY (RFC 5465) none of that is needed: a
+ * single session subscribes to every folder, and only folders whose
+ * reported UIDNEXT moved past their watermark are re-synced. Without
+ * NOTIFY but with LIST-STATUS (RFC 5819), a polling pass starts with one
+ * LIST that reports UIDNEXT for the connection's own folders, and only
+ * changed folders are selected.
+ */
+class FolderMonitor {
+public:
+    // A connected, authenticated session, or nullptr on failure
+    using ConnectionFactory = std::function<std::shared_ptr<ImapClient>()>;
+
+    FolderMonitor(FolderMonitorSettings settings, ConnectionFactory factory);
+    ~FolderMonitor();
+
+    FolderMonitor(const FolderMonitor&) = delete;
+    FolderMonitor& operator=(const FolderMonitor&) = delete;
+
+    // Register every session with a keepalive scheduler (must outlive the monitor)
+    void setKeepalive(ImapKeepalive* keepalive);
+
+    void start();
+    void stop();
+
+    // Wait up to timeoutMs for new mail; returns all pending messages, oldest first
+    std::vector<FolderEmail> take(int timeoutMs = 0);
+    // Persist the watermarks past messages from take() once they are handled
+    void commit(const std::vector<FolderEmail>& emails);
+    bool hasPending() const;
+
+    // Folders handled by each connection
+    std::vector<std::vector<std::string>> assignments() const;
+    // Whether one NOTIFY session is watching every folder
+    bool usingNotify() const;
+
+    /**
+     * @brief Spread folders over connections by activity
+     * @param folders Folder names with their recent activity (new messages per pass)
+     * @return One folder list per connection, busiest folders first
+     */
+    static std::vector<std::vector<std::string>> assignByActivity(
+        const std::vector<std::pair<std::string, double>>& folders, size_t connections);
+
+private:
+    struct FolderState {
+        uint32_t uidValidity = 0;
+        uint32_t watermark = 0;   // highest UID fetched
+        uint32_t committed = 0;   // highest UID handled; what is persisted
+        bool synced = false;      // watermarks are meaningful
+        double activity = 0;   // decaying count of new messages per pass
+        int owner = -1;        // connection whose pass covers the folder
+    };
+
+    struct Worker {
+        std::thread thread;
+        std::shared_ptr<ImapClient> client;
+        uint64_t keepaliveId = 0;
+    };
+
+    FolderMonitorSettings settings_;
+    ConnectionFactory factory_;
+    ImapKeepalive* keepalive_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wakeCv_;    // workers' poll and backoff waits
+    std::condition_variable readyCv_;   // take()
+    bool running_;
+    bool notifyMode_;
+    std::map<std::string, FolderState> folders_;
+    std::vector<std::vector<std::string>> assignment_;
+    int64_t lastRebalanceMs_;
+    std::atomic<uint64_t> assignmentEpoch_;  // bumped whenever assignment_ changes
+    std::vector<FolderEmail> ready_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    void run(size_t index);
+    std::shared_ptr<ImapClient> openSession(size_t index);
+    bool enableNotify(ImapClient& client);
+    void spawnWorkersLocked();
+    // Of folders, those LIST-STATUS shows new mail in (all of them without LIST-STATUS)
+    std::vector<std::string> changedFolders(ImapClient& client, const std::vector<std::string>& folders);
+    bool needsSyncLocked(const ImapMailboxEvent& event);
+    bool syncFolder(ImapClient& client, const std::string& folder, size_t index);
+    // Take the folders assigned to connection index that no other pass holds;
+    // the rest go to waiting
+    std::vector<std::string> claimFoldersLocked(size_t index, std::vector<std::string>& waiting);
+    // Give up the folders connection index holds but is no longer assigned
+    void releaseFoldersLocked(size_t index);
+    void rebalanceLocked();
+    // Wait ms or until stopped or until wake() (if given) returns true
+    bool waitLocked(std::unique_lock<std::mutex>& lock, int64_t ms,
+                    const std::function<bool()>& wake = nullptr);
+    bool loadState();
+    void saveStateLocked() const;
+};
+
+} // namespace Pens
+
+#endif // FOLDER_MONITOR_HPP
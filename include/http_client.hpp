@@ -0,0 +1,90 @@
+#ifndef HTTP_CLIENT_HPP
+#define HTTP_CLIENT_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <curl/curl.h>
+
+namespace Pens {
+
+struct HttpRequest {
+    std::string url;
+    std::string body;                  // POST body (empty = GET)
+    std::vector<std::string> headers;  // "Name: value"
+    long timeoutSeconds = 30;
+};
+
+struct HttpResponse {
+    bool transportOk = false;  // false on DNS/connect/TLS/timeout errors
+    long status = 0;
+    std::string body;
+    std::string error;
+};
+
+/**
+ * @brief Shared HTTP client for token endpoints
+ *
+ * One libcurl multi handle driven by a worker thread. All requests share
+ * its connection, DNS and TLS session caches, so repeated refreshes to the
+ * same endpoint reuse a warm connection, and requests from many accounts
+ * overlap instead of running one after another.
+ */
+class HttpClient {
+public:
+    using Callback = std::function<void(const HttpResponse&)>;
+
+    static HttpClient& getInstance();
+
+    // Queue a request; the callback runs on the HTTP worker thread
+    void submit(HttpRequest request, Callback callback);
+    std::future<HttpResponse> submit(HttpRequest request);
+
+    // Blocking helpers built on submit()
+    HttpResponse post(const std::string& url,
+                      const std::string& body,
+                      const std::vector<std::string>& headers = {});
+
+    // TLS settings, e.g. to trust a local stand-in endpoint
+    void setCaInfo(const std::string& caFile);
+    void setVerifyPeer(bool verify);
+    void setMaxConnectionsPerHost(long maxConnections);
+
+    // Number of new connections opened so far (diagnostics)
+    long getConnectionsOpened() const;
+
+private:
+    HttpClient();
+    ~HttpClient();
+    HttpClient(const HttpClient&) = delete;
+    HttpClient& operator=(const HttpClient&) = delete;
+
+    struct Transfer;
+
+    CURLM* multi_;
+    std::vector<CURL*> idleHandles_;  // Reset and reused for later transfers
+    std::set<CURL*> active_;
+    std::deque<Transfer*> pending_;
+    std::mutex mutex_;
+    std::thread worker_;
+    bool running_;
+
+    std::string caInfo_;
+    bool verifyPeer_;
+    std::atomic<long> connectionsOpened_;
+
+    void run();
+    void startTransfer(Transfer* transfer, const std::string& caInfo, bool verifyPeer);
+    void finishTransfer(CURL* easy, CURLcode result);
+    static size_t writeCallback(void* contents, size_t size, size_t nmemb, void* userp);
+};
+
+} // namespace Pens
+
+#endif // HTTP_CLIENT_HPP
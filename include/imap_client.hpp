@@ -1,10 +1,15 @@
 #ifndef IMAP_CLIENT_HPP
 #define IMAP_CLIENT_HPP
 
+#include "message_spill.hpp"
 #include <string>
 #include <vector>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <map>
+#include <atomic>
+#include <cstdint>
 
 namespace Pens {
 
@@ -15,10 +20,46 @@ struct Email {
     std::string id;
     std::string from;
     std::string subject;
-    std::string body;
+    std::string body;  // only a prefix when spill is set
     std::string date;
     bool isRead;
     int priority;  // Email priority score
+    long internalDate = 0;  // server arrival time (epoch seconds), 0 if unknown
+    size_t size = 0;        // RFC822.SIZE, 0 if not reported
+    std::shared_ptr<const MessageSpill> spill;  // full BODY[TEXT] of a large message, or null
+};
+
+// One mailbox from LIST, with LIST-STATUS counters when they were asked for
+struct ImapMailboxInfo {
+    std::string name;
+    char delimiter = 0;                   // hierarchy separator, 0 for NIL (flat)
+    std::vector<std::string> attributes;  // as sent, e.g. "\\HasNoChildren"
+    std::string specialUse;               // "\\Junk", "\\Sent", ... (RFC 6154), or empty
+    bool selectable = true;               // false for \Noselect and \NonExistent
+    bool hasStatus = false;               // the counters below are valid
+    uint32_t messages = 0;
+    uint32_t unseen = 0;
+    uint32_t uidNext = 0;
+    uint32_t uidValidity = 0;
+};
+
+// A mailbox change reported by NOTIFY (an unsolicited STATUS, or EXISTS on the selected mailbox)
+struct ImapMailboxEvent {
+    std::string mailbox;
+    uint32_t messages = 0;     // 0 if not reported
+    uint32_t uidNext = 0;      // 0 if not reported
+    uint32_t uidValidity = 0;  // 0 if not reported
+};
+
+/**
+ * @brief Socket deadlines and TCP keepalive for an IMAP session
+ */
+struct ImapTimeouts {
+    int connectSeconds = 15;
+    int commandSeconds = 60;            // longest silence while a response is due (0 = wait forever)
+    int keepaliveIdleSeconds = 30;      // TCP keepalive: idle time before the first probe (0 = off)
+    int keepaliveIntervalSeconds = 10;
+    int keepaliveProbes = 3;            // unanswered probes (or unacked data time) before the kernel gives up
 };
 
 /**
@@ -26,6 +67,9 @@ struct Email {
  * 
  * This is the Silly Email Notification System (SENS) IMAP client
  * that connects to servers and processes emails in amusing ways.
+ *
+ * Commands are serialized by an internal lock, so a keepalive thread may
+ * probe a session that another thread is using.
  */
 class ImapClient {
 public:
@@ -37,15 +81,134 @@ public:
     bool authenticate(const std::string& username, const std::string& password);
     bool authenticateOAuth(const std::string& username, const std::string& accessToken);
     bool disconnect();
+
+    // Replace the OAuth token used when this session (re-)authenticates.
+    // Safe to call from another thread (e.g. the TokenRefresher).
+    void updateOAuthToken(const std::string& accessToken);
+    // Authenticate again with the stored credentials if the session lost auth
+    bool reauthenticate();
     bool isConnected() const;
 
+    // Round-trip a NOOP; a failure means the session is gone (see isConnected)
+    bool noop();
+
+    // Seconds a read or write may block before the session is declared dead
+    // (0 = wait forever); applies from the next connect()
+    void setCommandTimeout(int seconds);
+    void setTimeouts(const ImapTimeouts& timeouts);
+    // Hand TLS records to the kernel after the handshake when it can take
+    // them (see KernelTls; on by default); applies from the next connect()
+    void setKernelTls(bool enabled);
+    // Where fetchEmail() puts message text too large to hold in memory
+    void setSpillSettings(const MessageSpillSettings& settings);
+
+    /**
+     * @brief NOOP if no command has run for idleMs
+     * @param timeoutMs Reply deadline for the NOOP
+     * @return false only if the session is (now) dead; a session busy in
+     *         another thread counts as alive and is not probed
+     */
+    bool probeIfIdle(int64_t idleMs, int timeoutMs);
+
+    enum class ProbeResult { Skipped, Pending, Alive, Dead };
+
+    /**
+     * @brief Send a NOOP if no command has run for idleMs, without waiting
+     * @return Pending once a NOOP is outstanding; Skipped for a session that
+     *         is busy in another thread or not idle yet; Dead if it is gone
+     */
+    ProbeResult startProbe(int64_t idleMs);
+
+    /**
+     * @brief Take in whatever part of the NOOP reply has arrived, without blocking
+     * @param deadlinePassed Drop the session if the reply is still incomplete
+     * @return Alive once answered (or when the next command will read the
+     *         reply), Pending while waiting, Dead if the session is gone
+     */
+    ProbeResult checkProbe(bool deadlinePassed);
+
+    // steady_clock milliseconds of the last completed command or connect
+    int64_t getLastActivityMs() const;
+
+    // Unblock a command running in another thread; the session is lost
+    void abortConnection();
+
+    // Whether the server advertises a capability (asked once per connection)
+    bool hasCapability(const std::string& name);
+
+    /**
+     * @brief IDLE on the selected mailbox (RFC 2177)
+     * @param timeoutMs How long to wait for a change before sending DONE
+     * @param changed Set when the server reported new or expunged messages
+     * @param interrupted Checked a few times a second; true ends IDLE early
+     * @return false if IDLE was refused or the session died
+     */
+    bool idle(int timeoutMs, bool& changed, const std::function<bool()>& interrupted = nullptr);
+
+    /**
+     * @brief Ask for change events on many mailboxes at once (RFC 5465)
+     * @param filters filter-mailboxes, e.g. "personal", "inboxes",
+     *        "subtree " + mailboxList({...}), "mailboxes " + mailboxList({...})
+     * @param sendStatus Have the server report the current STATUS of each
+     *        matching mailbox right away
+     * @return false if the server lacks NOTIFY or rejected the request
+     *
+     * New and expunged messages are reported for the matching mailboxes and
+     * for the selected one, until the next notifySet() or notifyNone().
+     */
+    bool notifySet(const std::vector<std::string>& filters, bool sendStatus = false);
+    bool notifyNone();
+
+    /**
+     * @brief Wait for NOTIFY events while no command is running
+     * @param events Receives the changed mailboxes, including any reported
+     *        while earlier commands ran
+     * @return false if the session died
+     */
+    bool waitForEvents(int timeoutMs, std::vector<ImapMailboxEvent>& events);
+
+    // "(name1 name2 ...)" with each name as an IMAP quoted string
+    static std::string mailboxList(const std::vector<std::string>& names);
+    static std::string quoteString(const std::string& value);
+    // Parse "* STATUS <mailbox> (<item> <n> ...)"
+    static bool parseStatusLine(const std::string& line, ImapMailboxEvent& event);
+    // Parse a FETCH response (FLAGS INTERNALDATE BODY[HEADER] BODY[TEXT])
+    static Email parseEmailData(const std::string& data, const std::string& uid);
+    // Whether a response line ends by announcing the BODY[TEXT] literal
+    static bool announcesBodyText(const std::string& line);
+    // The UID in the first line of a FETCH response item ("?" if none)
+    static std::string fetchUid(const std::string& item);
+    static int calculatePriorityScore(const Email& email);
+
     // Mailbox operations
     bool selectMailbox(const std::string& mailbox = "INBOX");
     std::vector<std::string> listMailboxes();
+
+    /**
+     * @brief LIST with attributes, hierarchy delimiters and special-use flags
+     * @param withStatus Also fill in MESSAGES/UNSEEN/UIDNEXT/UIDVALIDITY; one
+     *        round trip with LIST-STATUS (RFC 5819), else a STATUS per mailbox
+     */
+    std::vector<ImapMailboxInfo> listMailboxInfo(const std::string& pattern = "*", bool withStatus = false);
+    // The same for several names or patterns: one LIST with LIST-EXTENDED
+    // (RFC 5258, implied by LIST-STATUS), else one LIST per pattern
+    std::vector<ImapMailboxInfo> listMailboxInfo(const std::vector<std::string>& patterns, bool withStatus);
+    // Parse the LIST (and LIST-STATUS STATUS) lines of a response; literals inline
+    static std::vector<ImapMailboxInfo> parseListResponse(const std::string& response);
+    // First mailbox with a special use such as "\\Junk", or nullptr
+    static const ImapMailboxInfo* findSpecialUse(const std::vector<ImapMailboxInfo>& mailboxes,
+                                                 const std::string& use);
     int getMessageCount();
 
+    // UIDVALIDITY and UIDNEXT reported by the last SELECT (0 if not sent)
+    uint32_t getUidValidity() const;
+    uint32_t getUidNext() const;
+    std::string getCurrentMailbox() const;
+
     // Email operations
     std::vector<Email> fetchRecentEmails(int count = 10);
+    // UIDs above uid in the selected mailbox, ascending
+    std::vector<uint32_t> searchUidsAfter(uint32_t uid);
     Email fetchEmail(const std::string& uid);
     bool markAsRead(const std::string& uid);
     bool deleteEmail(const std::string& uid);
@@ -60,15 +223,58 @@ private:
     std::string server_;
     int port_;
     bool useSsl_;
-    bool connected_;
-    bool authenticated_;
+    std::atomic<bool> connected_;
+    std::atomic<bool> authenticated_;
     std::string currentMailbox_;
+    uint32_t uidValidity_;
+    uint32_t uidNext_;
+    ImapTimeouts timeouts_;
+    bool kernelTls_;
+    MessageSpillSettings spillSettings_;
+    bool spillLiterals_;                       // fetchEmail() in progress
+    std::string spillUid_;                     // the UID it is fetching
+    std::shared_ptr<MessageSpill> bodySpill_;  // its BODY[TEXT], when spilled
+    int readTimeoutMs_;  // deadline for each wait on the current response
+    unsigned nextTag_;
+    std::atomic<int64_t> lastActivityMs_;
+    mutable std::recursive_mutex commandMutex_;
+    std::vector<std::string> capabilities_;  // upper case; empty until asked
+    bool lastReadTimedOut_;
+    std::mutex socketMutex_;  // guards activeSocket_ for abortConnection()
+    int activeSocket_;
+    std::vector<ImapMailboxEvent> pendingEvents_;  // NOTIFY events seen during commands
+    std::string probeTag_;  // keepalive NOOP whose reply is still unread
+
+    // Credentials kept for re-authentication
+    mutable std::mutex credentialsMutex_;
+    std::string username_;
+    std::string password_;
+    std::string oauthToken_;
+    bool useOAuth_ = false;
 
     // Helper methods
-    std::string sendCommand(const std::string& command);
+
+    // Send a command under a fresh tag and read up to its tagged completion
+    // (literals included). An empty command reads the server greeting.
+    // Read/write errors, timeouts and BYE drop the session.
+    std::string sendCommand(const std::string& command, int timeoutMs = -1);
+    // LIST with an already encoded pattern argument
+    std::vector<ImapMailboxInfo> runList(const std::string& patterns, bool withStatus);
+    // Whether the tagged completion at the end of a response is OK
     bool parseResponse(const std::string& response);
-    Email parseEmailData(const std::string& data, const std::string& uid);
-    int calculatePriorityScore(const Email& email);
+    // Read the rest of an outstanding probe reply within readTimeoutMs_;
+    // false if it is not complete (lastReadTimedOut_) or the session died
+    bool readProbeReply();
+    bool writeAll(const std::string& data);
+    bool readLine(std::string& line);
+    bool readBytes(size_t count, std::string& out);
+    // Stream a literal of length bytes to a spill file, appending only the prefix to out
+    bool spillLiteral(const std::string& line, size_t length, std::string& out);
+    void dropConnection(const std::string& reason);
+    void resetConnection();
+    std::string makeTag();
+    bool openSocket();
+    void applySocketOptions();
 };
 
 } // namespace Pens
@@ -0,0 +1,91 @@
+#ifndef IMAP_KEEPALIVE_HPP
+#define IMAP_KEEPALIVE_HPP
+
+#include "imap_client.hpp"
+#include "timing_wheel.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace Pens {
+
+struct ImapKeepaliveSettings {
+    int64_t idleMs = 60 * 1000;      // NOOP a session after this long without traffic
+    int probeTimeoutMs = 10 * 1000;  // NOOP reply deadline before the session is declared dead
+    int64_t tickMs = 250;            // timing wheel resolution
+};
+
+/**
+ * @brief Application-level keepalive for many IMAP sessions
+ *
+ * Each registered session has a single timer in a shared timing wheel,
+ * set for when it will have been idle for idleMs. On expiry a session that
+ * saw traffic in the meantime is simply rescheduled; an idle one is sent a
+ * NOOP and its timer is replaced by the reply deadline, which catches
+ * half-open connections (NAT timeouts, silently rebooted servers) that TCP
+ * would only notice hours later. Sending never waits for the reply, so any
+ * number of probes are outstanding at once and a tick costs no more than
+ * the writes. Sessions busy in another thread are never probed. Dead
+ * sessions are dropped by the client itself; the callback lets owners
+ * react at once.
+ */
+class ImapKeepalive {
+public:
+    using DeadCallback = std::function<void(uint64_t id)>;
+
+    explicit ImapKeepalive(ImapKeepaliveSettings settings = ImapKeepaliveSettings());
+    ~ImapKeepalive();
+
+    ImapKeepalive(const ImapKeepalive&) = delete;
+    ImapKeepalive& operator=(const ImapKeepalive&) = delete;
+
+    // Watch a session across reconnects until removed
+    uint64_t add(std::shared_ptr<ImapClient> client);
+    void remove(uint64_t id);
+
+    // Called on the keepalive thread when a probe finds a session dead
+    void setDeadCallback(DeadCallback callback);
+
+    void start();
+    void stop();
+
+    // Expire due timers: probe idle sessions and check probes whose reply
+    // deadline has come (what the thread runs each tick); never blocks on I/O
+    void runDue(int64_t nowMs);
+
+    size_t size() const;
+    uint64_t getProbesSent() const { return probesSent_.load(); }
+    uint64_t getDeadDetected() const { return deadDetected_.load(); }
+
+    // steady_clock milliseconds, the clock ImapClient activity is stamped with
+    static int64_t nowMs();
+
+private:
+    struct Timer {
+        uint64_t id;
+        bool replyDeadline;  // else the session's idle timer
+    };
+
+    ImapKeepaliveSettings settings_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::unordered_map<uint64_t, std::shared_ptr<ImapClient>> sessions_;
+    TimingWheel<Timer> wheel_;
+    uint64_t nextId_;
+    DeadCallback deadCallback_;
+    bool running_;
+    std::thread thread_;
+    std::atomic<uint64_t> probesSent_;
+    std::atomic<uint64_t> deadDetected_;
+
+    void run();
+};
+
+} // namespace Pens
+
+#endif // IMAP_KEEPALIVE_HPP
@@ -0,0 +1,111 @@
+#ifndef IMAP_SESSION_SUPERVISOR_HPP
+#define IMAP_SESSION_SUPERVISOR_HPP
+
+#include "imap_client.hpp"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace Pens {
+
+struct ImapSessionSettings {
+    std::string mailbox = "INBOX";
+    std::string watermarkPath;           // empty: keep the sync position in memory only
+    int64_t backoffBaseMs = 1000;        // first reconnect delay, doubled per failure
+    int64_t backoffMaxMs = 5 * 60 * 1000;
+    int fetchBatch = 50;                 // messages fetched per poll once synced
+    int initialBacklog = 10;             // newest messages delivered on a first sync
+    std::function<int64_t()> clock;      // milliseconds; defaults to steady_clock
+};
+
+/**
+ * @brief Keeps one IMAP session alive and resumes sync after failures
+ *
+ * A session counts as dead once the client reports a read or write error,
+ * a command timeout, or an untagged BYE. The supervisor then reconnects with
+ * jittered exponential backoff, re-authenticates (asking the token provider
+ * for a fresh OAuth token, and forcing a refresh if the server rejects it),
+ * re-selects the mailbox and continues from the persisted UID watermark.
+ * poll() does not move the watermark: the caller commits the returned UID
+ * once the batch has been handled, so mail fetched but not yet handled when
+ * the process dies or the session drops is delivered again rather than
+ * lost. A changed UIDVALIDITY invalidates the watermark.
+ */
+class ImapSessionSupervisor {
+public:
+    // Returns the access token to use; forceRefresh after a rejected token
+    using TokenProvider = std::function<std::string(bool forceRefresh)>;
+
+    ImapSessionSupervisor(std::shared_ptr<ImapClient> client, ImapSessionSettings settings);
+
+    // Use OAuth with tokens from provider instead of the client's stored credentials
+    void setTokenProvider(const std::string& username, TokenProvider provider);
+
+    /**
+     * @brief Make sure a usable session exists
+     * @return true when connected, authenticated and the mailbox is selected;
+     *         false while waiting out the backoff or after a failed attempt
+     */
+    bool ensureSession();
+
+    // Probe the session with NOOP; a dead session is scheduled for reconnect
+    bool checkAlive();
+
+    /**
+     * @brief New messages since the watermark, oldest first
+     * @param lastUid Set to the UID of the last message returned (0 if none);
+     *        pass it to commit() once the messages have been handled
+     */
+    std::vector<Email> poll(uint32_t& lastUid);
+
+    // Advance and persist the watermark to a UID returned by poll()
+    void commit(uint32_t uid);
+
+    // Whether a reconnect attempt is due now
+    bool reconnectDue() const;
+
+    int getConsecutiveFailures() const { return failures_; }
+    int getReconnectCount() const { return reconnects_; }
+    uint32_t getWatermark() const { return watermark_; }
+    uint32_t getUidValidity() const { return uidValidity_; }
+
+    /**
+     * @brief Delay before the next reconnect attempt
+     * @param failures Consecutive failures so far (>= 1)
+     * @param jitter Random fraction in [0, 1) already drawn by the caller
+     * @return Between half and all of min(base * 2^(failures-1), max)
+     */
+    static int64_t backoffDelayMs(int failures, int64_t baseMs, int64_t maxMs, double jitter);
+
+private:
+    std::shared_ptr<ImapClient> client_;
+    ImapSessionSettings settings_;
+    std::string username_;
+    TokenProvider tokenProvider_;
+
+    int failures_;
+    int reconnects_;
+    bool everConnected_;
+    int64_t nextAttemptAt_;
+    uint32_t uidValidity_;
+    uint32_t watermark_;
+    bool haveWatermark_;
+    uint32_t pollValidity_;   // UIDVALIDITY the last poll's UIDs belong to
+    std::mt19937 rng_;
+
+    int64_t nowMs() const;
+    bool reconnect();
+    bool authenticate();
+    bool selectMailbox();
+    void recordFailure(const std::string& reason);
+    void setWatermark(uint32_t uid);
+    bool loadWatermark();
+    bool saveWatermark() const;
+};
+
+} // namespace Pens
+
+#endif // IMAP_SESSION_SUPERVISOR_HPP
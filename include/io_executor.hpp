@@ -0,0 +1,132 @@
+#ifndef IO_EXECUTOR_HPP
+#define IO_EXECUTOR_HPP
+
+#include "async_task.hpp"
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Pens {
+
+enum class IoBackend {
+    Auto,     // io_uring when the kernel supports it, else epoll
+    Epoll,
+    IoUring
+};
+
+/**
+ * @brief A few event-loop threads that coroutines wait for sockets on
+ *
+ * Each thread runs its own event loop. A socket belongs to one loop
+ * (chosen by descriptor), and a coroutine waiting on it is resumed on that
+ * loop's thread, so a session's code stays on one thread between waits
+ * while thousands of sessions share a handful of threads. Waits carry a
+ * deadline; a timed-out wait resumes with false.
+ *
+ * Loops run on epoll or on io_uring. With io_uring, the poll requests a
+ * loop iteration queues go to the kernel in the same io_uring_enter() that
+ * waits for completions, and receive() keeps a multishot receive armed
+ * that fills kernel-provided buffers, so a busy socket costs no read
+ * syscall at all. A socket is read either through receive() or through
+ * readable() plus its own reads (as TLS does), not both.
+ */
+class IoExecutor {
+public:
+    // A pending wait; lives in the awaiting coroutine's frame
+    struct Waiter {
+        std::coroutine_handle<> handle;
+        int fd = -1;
+        bool write = false;
+        bool receive = false;  // woken by received data rather than readiness
+        bool ready = false;
+        bool hasTimer = false;
+        std::multimap<int64_t, Waiter*>::iterator timer;
+    };
+
+    class IoAwaiter {
+    public:
+        IoAwaiter(IoExecutor& executor, int fd, bool write, int timeoutMs, bool receive = false)
+            : executor_(executor), timeoutMs_(timeoutMs) {
+            waiter_.fd = fd;
+            waiter_.write = write;
+            waiter_.receive = receive;
+        }
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            waiter_.handle = handle;
+            executor_.arm(waiter_, timeoutMs_);
+        }
+        bool await_resume() const noexcept { return waiter_.ready; }
+
+    private:
+        IoExecutor& executor_;
+        int timeoutMs_;
+        Waiter waiter_;
+    };
+
+    class ScheduleAwaiter {
+    public:
+        explicit ScheduleAwaiter(IoExecutor& executor) : executor_(executor) {}
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { executor_.post(handle); }
+        void await_resume() const noexcept {}
+
+    private:
+        IoExecutor& executor_;
+    };
+
+    explicit IoExecutor(int threads = 2, IoBackend backend = IoBackend::Auto);
+    ~IoExecutor();
+
+    IoExecutor(const IoExecutor&) = delete;
+    IoExecutor& operator=(const IoExecutor&) = delete;
+
+    // Suspend until fd is readable / writable; resumes with false after timeoutMs (-1 = never)
+    IoAwaiter readable(int fd, int timeoutMs = -1) { return IoAwaiter(*this, fd, false, timeoutMs); }
+    IoAwaiter writable(int fd, int timeoutMs = -1) { return IoAwaiter(*this, fd, true, timeoutMs); }
+    // Suspend for ms, resuming on a loop thread
+    IoAwaiter sleepFor(int ms) { return IoAwaiter(*this, -1, false, ms); }
+    // Continue on one of the loop threads
+    ScheduleAwaiter schedule() { return ScheduleAwaiter(*this); }
+
+    // Append what arrives on a non-blocking socket to out: the byte count,
+    // 0 at end of stream, -1 on error or after timeoutMs
+    Task<ssize_t> receive(int fd, std::string& out, int timeoutMs = -1);
+
+    // Start a task on a loop thread without waiting for it
+    void spawn(Task<void> task);
+
+    // Drop a socket's registration; call before close(). On io_uring this
+    // waits for the loop thread to hand the cancellations to the kernel.
+    void forget(int fd);
+
+    size_t threadCount() const { return loops_.size(); }
+    IoBackend backend() const { return backend_; }
+
+private:
+    struct Loop;
+
+    IoBackend backend_;
+    std::vector<std::unique_ptr<Loop>> loops_;
+    std::atomic<size_t> nextLoop_;
+
+    Loop& loopFor(int fd);
+    void arm(Waiter& waiter, int timeoutMs);
+    void post(std::coroutine_handle<> handle);
+    // Data already received for fd: byte count, 0 / -1 at end / error, -2 if none yet
+    ssize_t takeReceived(int fd, std::string& out);
+    void run(Loop& loop);
+    void runRing(Loop& loop);
+};
+
+} // namespace Pens
+
+#endif // IO_EXECUTOR_HPP
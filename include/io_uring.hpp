@@ -0,0 +1,97 @@
+#ifndef IO_URING_HPP
+#define IO_URING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Pens {
+
+/**
+ * @brief Minimal io_uring submission/completion ring
+ *
+ * Talks to the kernel through the raw syscalls, so no liburing is needed.
+ * Only the operations PENS uses are wrapped. Queued operations reach the
+ * kernel on the next submit(); one io_uring_enter() carries a whole
+ * batch. The ring is not thread-safe: callers serialize queueing,
+ * submit() and completions(); wait() may run while others queue.
+ *
+ * Create, submit to and destroy a ring on one thread that owns it. The
+ * kernel runs completion and teardown work on the creating and submitting
+ * threads by interrupting them, and a blocking recv() with SO_RCVTIMEO
+ * in such a thread would fail with EINTR.
+ *
+ * supported() probes the running kernel once (ring setup, opcodes,
+ * timed waits and provided-buffer rings); callers fall back to
+ * epoll and plain write() when it says no.
+ */
+class IoUring {
+public:
+    struct Completion {
+        uint64_t userData;
+        int32_t result;   // bytes / 0, or -errno
+        uint32_t flags;   // IORING_CQE_F_*
+
+        bool more() const;       // a multishot operation stays armed
+        bool hasBuffer() const;  // result landed in a provided buffer
+    };
+
+    IoUring();
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    static bool supported();
+
+    bool init(unsigned entries);
+    bool valid() const { return ringFd_ >= 0; }
+
+    // Queue one operation; false if the submission queue stays full
+    bool pollAdd(int fd, bool write, uint64_t userData);
+    bool read(int fd, void* data, unsigned length, uint64_t userData);
+    bool write(int fd, const void* data, unsigned length, uint64_t userData, bool link);
+    // data must lie inside the buffer given to registerBuffer()
+    bool writeFixed(int fd, const void* data, unsigned length, uint64_t userData, bool link);
+    bool fdatasync(int fd, uint64_t userData);
+    // Receive into the provided-buffer ring until cancelled or out of buffers
+    bool recvMultishot(int fd, uint64_t userData);
+    bool cancel(uint64_t target, uint64_t userData);
+
+    // Hand queued operations to the kernel; returns false on a ring error
+    bool submit();
+    // Block until a completion arrives or timeoutMs passes (-1 = no limit);
+    // submits nothing, so it is safe while another thread queues
+    bool wait(int timeoutMs);
+    // Move finished completions into out (appended); returns how many
+    size_t completions(std::vector<Completion>& out);
+
+    // One fixed buffer for writeFixed(), pinned by the kernel
+    bool registerBuffer(void* data, size_t length);
+
+    // Provided buffers for recvMultishot(): count must be a power of two
+    bool setupReceiveBuffers(unsigned count, unsigned size);
+    const char* receiveBuffer(uint32_t flags) const;
+    void recycleReceiveBuffer(uint32_t flags);
+
+private:
+    struct Rings;
+
+    int ringFd_;
+    uint32_t features_;
+    Rings* rings_;
+    unsigned queued_;   // in the submission ring, not yet entered
+    std::vector<char> receiveStorage_;
+    void* bufferRing_;
+    unsigned bufferCount_;
+    unsigned bufferSize_;
+
+    void* nextEntry();
+    void commit();
+    bool probe();
+    void release();
+};
+
+} // namespace Pens
+
+#endif // IO_URING_HPP
@@ -0,0 +1,120 @@
+#ifndef JSON_HPP
+#define JSON_HPP
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+namespace Pens {
+
+/**
+ * @brief SAX-style callbacks for JsonReader
+ *
+ * String views passed to callbacks are only valid for the duration of the
+ * call. Return false from any callback to stop parsing early.
+ */
+class JsonHandler {
+public:
+    virtual ~JsonHandler() = default;
+
+    virtual bool onObjectStart() { return true; }
+    virtual bool onObjectEnd() { return true; }
+    virtual bool onArrayStart() { return true; }
+    virtual bool onArrayEnd() { return true; }
+    virtual bool onKey(std::string_view key) { (void)key; return true; }
+    virtual bool onString(std::string_view value) { (void)value; return true; }
+    // Raw number text as it appears in the input (see JsonReader::toInt64)
+    virtual bool onNumber(std::string_view raw) { (void)raw; return true; }
+    virtual bool onBool(bool value) { (void)value; return true; }
+    virtual bool onNull() { return true; }
+};
+
+/**
+ * @brief Streaming JSON reader over a string_view
+ *
+ * Strings without escape sequences are handed to the handler as views into
+ * the input, so the common case performs no allocation. Escaped strings are
+ * decoded into a scratch buffer that is reused across calls.
+ */
+class JsonReader {
+public:
+    static constexpr int kMaxDepth = 64;
+
+    /**
+     * @brief Parse a complete JSON document
+     * @return true if the document is valid and the handler never stopped
+     */
+    bool parse(std::string_view input, JsonHandler& handler);
+
+    // Description of the last parse error (empty on success)
+    const std::string& getError() const { return error_; }
+
+    static bool toInt64(std::string_view raw, int64_t& value);
+
+    /**
+     * @brief Look up a top-level string member
+     * @return true if key exists at depth 1 and holds a string
+     */
+    static bool findString(std::string_view json, std::string_view key, std::string& value);
+
+    /**
+     * @brief Look up a top-level integer member
+     * @return true if key exists at depth 1 and holds an integer
+     */
+    static bool findInt(std::string_view json, std::string_view key, int64_t& value);
+
+private:
+    std::string_view input_;
+    size_t pos_ = 0;
+    int depth_ = 0;
+    std::string scratch_;
+    std::string error_;
+
+    bool parseValue(JsonHandler& handler);
+    bool parseObject(JsonHandler& handler);
+    bool parseArray(JsonHandler& handler);
+    bool parseString(std::string_view& out);
+    bool parseNumber(std::string_view& out);
+    bool parseLiteral(std::string_view literal);
+    void skipWhitespace();
+    bool fail(const char* message);
+};
+
+/**
+ * @brief Append-only JSON writer with correct string escaping
+ *
+ * Writes directly into a caller-owned std::string so the buffer can be
+ * reused between documents.
+ */
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& out, bool pretty = false);
+
+    JsonWriter& beginObject();
+    JsonWriter& endObject();
+    JsonWriter& beginArray();
+    JsonWriter& endArray();
+    JsonWriter& key(std::string_view name);
+    JsonWriter& value(std::string_view text);
+    JsonWriter& value(const char* text);
+    JsonWriter& value(int64_t number);
+    JsonWriter& value(int number);
+    JsonWriter& value(bool flag);
+    JsonWriter& null();
+
+    static void appendEscaped(std::string& out, std::string_view text);
+
+private:
+    std::string& out_;
+    bool pretty_;
+    int depth_;
+    bool first_[JsonReader::kMaxDepth + 1];
+    bool afterKey_;
+
+    void beforeValue();
+    void newline();
+};
+
+} // namespace Pens
+
+#endif // JSON_HPP
@@ -0,0 +1,44 @@
+#ifndef KERNEL_TLS_HPP
+#define KERNEL_TLS_HPP
+
+#include <string>
+
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+
+namespace Pens {
+
+/**
+ * @brief Kernel TLS (kTLS) offload for OpenSSL sessions
+ *
+ * With SSL_OP_ENABLE_KTLS set, OpenSSL hands the record keys to the kernel
+ * once the handshake is done; SSL_read()/SSL_write() then move plaintext
+ * through the socket and the kernel does the AES-GCM/ChaCha20 work.
+ * OpenSSL decides per direction and per cipher, and keeps userspace
+ * records for anything the kernel does not take, so enabling it never
+ * breaks a session.
+ *
+ * supported() probes once whether OpenSSL was built with kTLS and the
+ * kernel offers the "tls" TCP upper layer protocol.
+ */
+class KernelTls {
+public:
+    static bool supported();
+
+    // Ask for offload on sessions made from ctx; false if not supported
+    static bool enable(SSL_CTX* ctx);
+
+    // Whether the handshake on ssl moved each direction into the kernel
+    static bool sendOffloaded(SSL* ssl);
+    static bool receiveOffloaded(SSL* ssl);
+
+    // Debug-log which directions of a finished handshake are offloaded
+    static void report(SSL* ssl, const std::string& peer);
+
+private:
+    static bool probe();
+};
+
+} // namespace Pens
+
+#endif // KERNEL_TLS_HPP
@@ -0,0 +1,150 @@
+#ifndef MAIL_QUEUE_HPP
+#define MAIL_QUEUE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Pens {
+
+class SmtpConnectionPool;
+
+struct OutboundMessage {
+    uint64_t id = 0;
+    std::string from;
+    std::string to;
+    std::string subject;
+    std::string body;
+    int attempts = 0;       // delivery attempts so far
+    int64_t notBefore = 0;  // epoch milliseconds of the next attempt
+};
+
+struct MailQueueSettings {
+    std::string spoolDir;
+    int workers = 4;                       // 0 = persist only, no delivery
+    int flushIntervalMs = 5;               // group-commit window
+    size_t segmentMaxBytes = 4 * 1024 * 1024;
+    int64_t retryBaseMs = 30 * 1000;       // first retry delay, doubled per attempt
+    int64_t retryMaxMs = 60 * 60 * 1000;
+    int maxAttempts = 8;                   // then the message is dead-lettered
+    bool useIoUring = true;                // linked io_uring writes when the kernel has them
+};
+
+/**
+ * @brief Persistent outbound mail queue
+ *
+ * Messages are appended to segment files in the spool directory and made
+ * durable by a background flusher that fsyncs in batches, so enqueue() only
+ * copies into memory. Where io_uring is available a batch goes to the
+ * kernel as one chain of writes from a registered buffer plus the sync. Worker threads deliver through a Sender; 4xx replies
+ * (or no reply) are retried with exponential backoff, 5xx replies and
+ * exhausted retries move the message to the dead-letter file. Completed
+ * messages are recorded in the log, and fully delivered segments are
+ * deleted. On start() the log is replayed, so every message that reached
+ * disk is delivered at least once across restarts.
+ */
+class MailQueue {
+public:
+    // Delivers one message and returns the SMTP reply code
+    // (2xx delivered, 4xx retry, 5xx permanent failure, 0 no server reply)
+    using Sender = std::function<int(const OutboundMessage&)>;
+
+    MailQueue(MailQueueSettings settings, Sender sender);
+    ~MailQueue();
+
+    MailQueue(const MailQueue&) = delete;
+    MailQueue& operator=(const MailQueue&) = delete;
+
+    // Replay the spool and start the flusher and worker threads
+    bool start();
+    void stop();
+
+    /**
+     * @brief Queue a message for delivery
+     * @return Message id, or 0 if the queue is not running
+     */
+    uint64_t enqueue(const std::string& from,
+                     const std::string& to,
+                     const std::string& subject,
+                     const std::string& body);
+
+    // Block until everything enqueued so far is on disk (false if the
+    // spool write failed; the flusher keeps retrying it)
+    bool flush();
+
+    // Block until no message is pending or in flight (false on timeout)
+    bool waitIdle(int timeoutMs);
+
+    size_t getPendingCount() const;
+    size_t getDeliveredCount() const;
+    size_t getDeadLetterCount() const;
+
+    // Messages that were given up on, oldest first
+    std::vector<OutboundMessage> getDeadLetters() const;
+
+    // Sender that delivers through a pooled SMTP connection
+    static Sender smtpSender(SmtpConnectionPool& pool);
+
+private:
+    struct Chunk {
+        uint32_t segment;
+        std::string data;
+    };
+
+    MailQueueSettings settings_;
+    Sender sender_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable workAvailable_;
+    std::condition_variable flushWake_;
+    std::condition_variable durable_;
+    std::condition_variable idle_;
+    bool running_;
+    bool stopFlusher_;
+
+    std::map<uint64_t, OutboundMessage> messages_;
+    std::map<uint64_t, uint32_t> messageSegment_;
+    std::map<uint32_t, size_t> segmentLive_;    // undelivered messages per segment
+    std::priority_queue<std::pair<int64_t, uint64_t>,
+                        std::vector<std::pair<int64_t, uint64_t>>,
+                        std::greater<std::pair<int64_t, uint64_t>>> schedule_;
+    size_t inFlight_;
+    uint64_t nextId_;
+
+    // Append buffer consumed by the flusher
+    std::vector<Chunk> pending_;
+    uint32_t appendSegment_;
+    size_t appendSegmentBytes_;
+    uint64_t appendedSeq_;
+    uint64_t durableSeq_;
+    bool flushFailed_;
+
+    std::atomic<size_t> delivered_;
+    std::atomic<size_t> deadLettered_;
+    mutable std::mutex deadLetterMutex_;
+
+    std::thread flusher_;
+    std::vector<std::thread> workers_;
+
+    bool recover();
+    void replaySegment(uint32_t segment, const std::string& path);
+    uint64_t append(uint8_t type, const std::string& payload);
+    void flushLoop();
+    void workerLoop();
+    void complete(uint64_t id);
+    std::vector<uint32_t> takeDrainedSegments(uint32_t writeSegment);
+    bool writeDeadLetter(const OutboundMessage& message, int replyCode);
+    int64_t retryDelayMs(int attempts) const;
+    std::string segmentPath(uint32_t segment) const;
+};
+
+} // namespace Pens
+
+#endif // MAIL_QUEUE_HPP
@@ -0,0 +1,59 @@
+#ifndef MESSAGE_SPILL_HPP
+#define MESSAGE_SPILL_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace Pens {
+
+/**
+ * @brief Where fetched message text over a size limit goes
+ */
+struct MessageSpillSettings {
+    size_t thresholdBytes = 1024 * 1024;  // literals larger than this are spilled (0 = never)
+    size_t prefixBytes = 64 * 1024;       // of a spilled literal, kept in memory (Email::body)
+    std::string directory;                // empty: $TMPDIR, else /tmp
+};
+
+/**
+ * @brief A large message literal streamed to a temporary file
+ *
+ * Fetching writes the literal here chunk by chunk, so memory use stays at
+ * one read buffer however big the message is; only a bounded prefix is
+ * kept in the Email for classification. The file is removed when the
+ * spill is destroyed, i.e. with the last Email that refers to it.
+ *
+ * A descriptor is held only while the literal is being written: finish()
+ * closes it, and later reads open the file for the call, so fetched mail
+ * kept around in memory does not eat into the process's descriptor limit.
+ */
+class MessageSpill {
+public:
+    explicit MessageSpill(const std::string& directory = "");
+    ~MessageSpill();
+
+    MessageSpill(const MessageSpill&) = delete;
+    MessageSpill& operator=(const MessageSpill&) = delete;
+
+    // false if the file could not be created, or a write failed
+    bool valid() const { return !path_.empty() && !failed_; }
+    bool append(const char* data, size_t length);
+    // Done writing: close the file; returns valid()
+    bool finish();
+
+    size_t size() const { return size_; }
+    const std::string& path() const { return path_; }
+
+    // Up to length bytes from offset; false on a read error
+    bool read(size_t offset, size_t length, std::string& out) const;
+
+private:
+    int fd_;  // open for writing until finish()
+    std::string path_;
+    size_t size_;
+    bool failed_;
+};
+
+} // namespace Pens
+
+#endif // MESSAGE_SPILL_HPP
@@ -0,0 +1,100 @@
+#ifndef MESSAGE_TEMPLATE_HPP
+#define MESSAGE_TEMPLATE_HPP
+
+#include "message_writer.hpp"
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Pens {
+
+struct TemplateValue {
+    std::string_view name;
+    std::string_view value;
+};
+
+// Fixed-capacity set of placeholder values; never allocates
+class TemplateValues {
+public:
+    static constexpr size_t kMaxValues = 16;
+
+    // Set or replace a value; false when full. The strings must outlive rendering.
+    bool set(std::string_view name, std::string_view value);
+    const std::string_view* find(std::string_view name) const;
+
+private:
+    TemplateValue values_[kMaxValues];
+    size_t count_ = 0;
+};
+
+/**
+ * @brief RFC 5322 Date header value, formatted at most once per second per thread
+ */
+class MailDate {
+public:
+    static std::string_view now();
+    static std::string format(std::time_t time);
+};
+
+/**
+ * @brief Message template compiled once into literal segments and slots
+ *
+ * Templates are a block of header lines plus a text part and an optional
+ * HTML part (sent as multipart/alternative), with {{name}} placeholders
+ * anywhere. Date, MIME-Version and Content-Type headers are added
+ * automatically; {{date}} is filled from MailDate unless given. Parsing
+ * normalizes line endings and lays out the whole message, so rendering
+ * only appends views of the literals and the values to a MessageWriter.
+ */
+class MessageTemplate {
+public:
+    MessageTemplate() = default;
+
+    /**
+     * @brief Compile a template
+     * @param headers Header lines, e.g. "From: {{from}}\nTo: {{to}}\nSubject: ..."
+     * @return false on an unterminated placeholder
+     */
+    bool parse(const std::string& headers, const std::string& text, const std::string& html = "");
+
+    // Read the parts from files; the HTML part is optional
+    bool loadFromFiles(const std::string& headersPath, const std::string& textPath,
+                       const std::string& htmlPath = "");
+
+    /**
+     * @brief Lay out the message in the writer, replacing its contents
+     *
+     * The writer refers to this template and to the values' strings until it
+     * is cleared. Fails when a placeholder has no value, or a header value
+     * contains a line break (which would let it inject headers).
+     */
+    bool render(const TemplateValues& values, MessageWriter& writer) const;
+
+    // Placeholder names in order of first use
+    const std::vector<std::string>& slots() const { return slotNames_; }
+
+    bool empty() const { return parts_.empty(); }
+
+    // Built-in verification code message (slots: from, to, code)
+    static const MessageTemplate& verificationCode();
+
+private:
+    struct Part {
+        bool isSlot;
+        bool inHeader;      // slot values here must be a single line
+        size_t offset;      // literal: into storage_; slot: index into slotNames_
+        size_t length;
+    };
+
+    std::string storage_;
+    std::vector<Part> parts_;
+    std::vector<std::string> slotNames_;
+
+    bool compile(const std::string& source, size_t headerEnd);
+};
+
+} // namespace Pens
+
+#endif // MESSAGE_TEMPLATE_HPP
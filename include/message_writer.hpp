@@ -0,0 +1,70 @@
+#ifndef MESSAGE_WRITER_HPP
+#define MESSAGE_WRITER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/uio.h>
+
+namespace Pens {
+
+/**
+ * @brief Lays out an RFC 5322 message as scatter/gather segments
+ *
+ * The body is never copied: segments point into the caller's buffer, with
+ * small static inserts for what the wire format needs. Bare LF line endings
+ * become CRLF, and in DATA mode lines starting with "." are dot-stuffed and
+ * the "<CRLF>.<CRLF>" terminator is appended. In BDAT mode the content goes
+ * out as-is (apart from line endings), with its exact size known up front.
+ * The body may be given as several pieces (e.g. template literals and
+ * substituted values); a writer that is cleared and reused keeps its
+ * buffers, so laying out a message again does not allocate.
+ */
+class MessageWriter {
+public:
+    enum class Mode { Data, Bdat };
+
+    explicit MessageWriter(Mode mode);
+
+    void setMode(Mode mode);
+
+    // Drop headers and body, keeping allocated capacity
+    void clear();
+
+    // Header block, including the blank line that ends it
+    void setHeaders(std::string headers);
+
+    // The body must outlive the writer
+    void setBody(std::string_view body);
+
+    // Append to the body; the piece must outlive the writer
+    void appendBody(std::string_view piece);
+
+    // Header field(s) sent before everything else, e.g. a DKIM-Signature
+    void setPrefix(std::string prefix);
+
+    // The message as given, before line-ending conversion and dot-stuffing
+    const std::string& headers() const { return headers_; }
+    const std::vector<std::string_view>& body() const { return body_; }
+
+    const std::vector<struct iovec>& segments();
+
+    // Bytes on the wire, including any DATA terminator
+    size_t size();
+
+private:
+    Mode mode_;
+    std::string prefix_;
+    std::string headers_;
+    std::vector<std::string_view> body_;
+    std::vector<struct iovec> segments_;
+    size_t size_;
+    bool built_;
+
+    void build();
+    void add(const char* data, size_t length);
+};
+
+} // namespace Pens
+
+#endif // MESSAGE_WRITER_HPP
@@ -2,6 +2,8 @@
 #define NOTIFICATION_PROCESSOR_HPP
 
 #include "imap_client.hpp"
+#include "folder_monitor.hpp"
+#include "imap_session_supervisor.hpp"
 #include <string>
 #include <vector>
 #include <functional>
@@ -65,6 +67,10 @@ public:
     void setCheckInterval(int seconds);
     void enableRealTimeNotifications(bool enable);
     void setNotificationCallback(std::function<void(const std::string&)> callback);
+    // Poll through the supervisor: reconnects dead sessions, resumes from the watermark
+    void setSessionSupervisor(std::shared_ptr<ImapSessionSupervisor> supervisor);
+    // Take mail from a multi-folder monitor instead; takes precedence over the supervisor
+    void setFolderMonitor(std::shared_ptr<FolderMonitor> monitor);
     
     // Statistics
     int getProcessedEmailCount() const;
@@ -74,6 +80,8 @@ public:
 private:
     std::shared_ptr<ImapClient> client_;
     std::shared_ptr<NotificationProcessor> processor_;
+    std::shared_ptr<ImapSessionSupervisor> supervisor_;
+    std::shared_ptr<FolderMonitor> folderMonitor_;
     bool running_;
     int checkInterval_;
     int processedCount_;
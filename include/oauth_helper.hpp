@@ -3,6 +3,7 @@
 
 #include <string>
 #include <map>
+#include <openssl/evp.h>
 
 namespace Pens {
 
@@ -80,6 +81,26 @@ public:
         const std::string& privateKeyPath
     );
     
+    /**
+     * @brief Sign a client assertion JWT with an already loaded key
+     * 
+     * @param clientId Azure AD application client ID
+     * @param tenantId Azure AD tenant ID
+     * @param thumbprint Base64url certificate thumbprint (x5t header)
+     * @param privateKey Private key used for RS256 (not freed)
+     * @param issuedAt nbf claim (Unix timestamp)
+     * @param expiresAt exp claim (Unix timestamp)
+     * @return JWT assertion string or empty on error
+     */
+    static std::string signClientAssertion(
+        const std::string& clientId,
+        const std::string& tenantId,
+        const std::string& thumbprint,
+        EVP_PKEY* privateKey,
+        long issuedAt,
+        long expiresAt
+    );
+    
     /**
      * @brief Calculate SHA-1 thumbprint of certificate
      * 
@@ -4,9 +4,13 @@
 #include "config.hpp"
 #include <string>
 #include <optional>
+#include <memory>
+#include <mutex>
 
 namespace Pens {
 
+class SharedTokenTable;
+
 struct OAuthTokenData {
     std::string accessToken;
     std::string refreshToken;
@@ -14,22 +18,48 @@ struct OAuthTokenData {
     int expiresIn;  // seconds
 };
 
+// Per-account OAuth settings (one set per mailbox/token file)
+struct OAuthAccountSettings {
+    std::string tokenFile;
+    std::string clientId;
+    std::string tenantId;
+    std::string scope;
+    std::string certificatePath;
+    std::string privateKeyPath;
+    std::string clientSecret;
+    std::string authority;
+
+    static OAuthAccountSettings fromConfig(const Config& config);
+};
+
 class OAuthTokenManager {
 public:
     explicit OAuthTokenManager(const Config& config);
+    explicit OAuthTokenManager(const OAuthAccountSettings& settings);
     ~OAuthTokenManager();
 
     // Ensure we have a valid access token (refresh if necessary)
     bool ensureValidToken();
 
+    // Refresh the access token now, regardless of its remaining lifetime
+    bool forceRefresh();
+
     // Access the current token (ensureValidToken must be called first)
     std::string getAccessToken() const;
+
+    // Lock-free snapshot of the published token (nullptr before first load)
+    std::shared_ptr<const OAuthTokenData> getTokenSnapshot() const;
+
+    // Whether the token can be renewed without user interaction
+    bool canRefresh() const;
     
     // Get certificate thumbprint (for Azure AD registration)
     std::string getCertificateThumbprint() const;
 
+    // Also publish access tokens to a host-wide shared table under account
+    void setSharedTable(SharedTokenTable* table, const std::string& account);
+
 private:
-    const Config& config_;
     std::string tokenFile_;
     std::string clientId_;
     std::string tenantId_;
@@ -37,9 +67,18 @@ private:
     std::string certificatePath_;
     std::string privateKeyPath_;
     std::string clientSecret_;
+    std::string authority_;
 
+    // token_ is the working copy guarded by mutex_; readers use the
+    // immutable snapshot in published_, swapped atomically after each update
     OAuthTokenData token_{};
     bool tokenLoaded_ = false;
+    mutable std::mutex mutex_;
+    std::shared_ptr<const OAuthTokenData> published_;
+    SharedTokenTable* sharedTable_ = nullptr;
+    std::string sharedAccount_;
+
+    void publishToken();
 
     bool loadTokenFromFile();
     bool saveTokenToFile() const;
@@ -47,10 +86,6 @@ private:
     bool acquireTokenWithCertificate();
     bool acquireTokenWithSecret();
     bool performTokenRequest(const std::string& tokenEndpoint, const std::string& postData);
-
-    static bool parseJsonString(const std::string& json, const std::string& key, std::string& value);
-    static bool parseJsonInt(const std::string& json, const std::string& key, long& value);
-    static size_t writeCallback(void* contents, size_t size, size_t nmemb, void* userp);
 };
 
 } // namespace Pens
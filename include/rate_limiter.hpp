@@ -0,0 +1,108 @@
+#ifndef RATE_LIMITER_HPP
+#define RATE_LIMITER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace Pens {
+
+// At most count sends per period, spread evenly; count 0 disables the limit
+struct RateLimit {
+    uint32_t count = 0;
+    int64_t periodMs = 0;
+};
+
+struct RateLimiterSettings {
+    RateLimit perRecipient{5, 60 * 60 * 1000};
+    RateLimit perDomain{1000, 60 * 1000};
+    RateLimit global{10000, 60 * 1000};
+    size_t tableSlots = 1 << 16;   // per table, rounded up to a power of two
+
+    // Microseconds on a monotonic clock; tests substitute their own
+    std::function<int64_t()> clock;
+};
+
+enum class RateDecision {
+    Allowed,
+    RecipientLimited,
+    DomainLimited,
+    GlobalLimited
+};
+
+struct RateCheck {
+    RateDecision decision = RateDecision::Allowed;
+    int64_t retryAfterMs = 0;   // when the send would be allowed again
+
+    bool allowed() const { return decision == RateDecision::Allowed; }
+};
+
+/**
+ * @brief Per-recipient, per-domain and global send rate limits
+ *
+ * Each limit is a GCRA: the only state per key is its theoretical arrival
+ * time, updated with a compare-and-swap, so checks take no locks. Keys live
+ * in fixed-size open-addressed tables keyed by a 64-bit hash of the
+ * lowercased address or domain. A slot whose arrival time has passed holds
+ * no information and is reused by the next key that needs room, so entries
+ * expire without a sweeper. If a later limit rejects a send, the earlier
+ * ones are refunded. When a table has no free slot near a key's home
+ * position the send is refused rather than left unlimited.
+ */
+class RateLimiter {
+public:
+    explicit RateLimiter(RateLimiterSettings settings = RateLimiterSettings());
+    ~RateLimiter();
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // Count one send to the recipient if every limit allows it
+    RateCheck acquire(const std::string& recipient);
+
+    // Give back a send acquire() allowed that then did not happen
+    void release(const std::string& recipient);
+
+    static const char* decisionName(RateDecision decision);
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> key;
+        std::atomic<int64_t> tat;   // theoretical arrival time, microseconds
+    };
+
+    struct Limiter {
+        int64_t interval = 0;       // microseconds between sends at the steady rate
+        int64_t tolerance = 0;      // how far ahead of now the arrival time may run
+        bool enabled() const { return interval > 0; }
+    };
+
+    struct Table {
+        std::unique_ptr<Slot[]> slots;
+        size_t mask = 0;
+    };
+
+    RateLimiterSettings settings_;
+    Limiter recipientLimit_;
+    Limiter domainLimit_;
+    Limiter globalLimit_;
+    Table recipients_;
+    Table domains_;
+    std::atomic<int64_t> globalTat_;
+
+    static Limiter makeLimiter(const RateLimit& limit);
+    static void initTable(Table& table, size_t slots);
+    static std::atomic<int64_t>* lookupSlot(Table& table, uint64_t key);
+    static std::atomic<int64_t>* findSlot(Table& table, uint64_t key, int64_t now);
+    static uint64_t domainKey(const std::string& recipient);
+    static bool take(std::atomic<int64_t>& tat, const Limiter& limit, int64_t now, int64_t& retryAfter);
+    static uint64_t hashKey(const char* data, size_t length);
+    int64_t now() const;
+};
+
+} // namespace Pens
+
+#endif // RATE_LIMITER_HPP
@@ -1,11 +1,32 @@
 #ifndef SMTP_CLIENT_HPP
 #define SMTP_CLIENT_HPP
 
+#include "message_template.hpp"
+#include "message_writer.hpp"
 #include <string>
+#include <vector>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <sys/uio.h>
 
 namespace Pens {
 
+class DkimSigner;
+
+/**
+ * @brief One (possibly multi-line) SMTP reply
+ *
+ * For "250-first / 250 last" style replies, lines holds the text after the
+ * code and separator of every line, in order.
+ */
+struct SmtpReply {
+    int code = 0;
+    std::vector<std::string> lines;
+
+    std::string text() const;
+};
+
 /**
  * @brief SMTP Client for sending emails
  * 
@@ -21,18 +42,60 @@ public:
     bool authenticate(const std::string& username, const std::string& password);
     bool authenticateOAuth(const std::string& username, const std::string& accessToken);
     bool disconnect();
+
+    // Replace the OAuth token used when this session (re-)authenticates.
+    // Safe to call from another thread (e.g. the TokenRefresher).
+    void updateOAuthToken(const std::string& accessToken);
+    // Authenticate again with the stored credentials if the session lost auth
+    bool reauthenticate();
     bool isConnected() const;
+
+    // Sign outgoing messages (nullptr to stop); the signer must outlive the client
+    void setDkimSigner(DkimSigner* signer);
+
+    // Session upkeep for reused connections
+    bool reset();   // RSET: abort any transaction, keep the session
+    bool noop();    // NOOP: keepalive and liveness probe
     
     // Email sending
     bool sendEmail(const std::string& from,
                    const std::string& to,
                    const std::string& subject,
                    const std::string& body);
+
+    /**
+     * @brief Send one message to several recipients in a single transaction
+     * @param rejected If set, receives the recipients the server refused
+     * @return true if the message was accepted for at least one recipient
+     */
+    bool sendEmailToRecipients(const std::string& from,
+                               const std::vector<std::string>& recipients,
+                               const std::string& subject,
+                               const std::string& body,
+                               std::vector<std::string>* rejected = nullptr);
+    
+    /**
+     * @brief Send a message rendered from a template
+     *
+     * from and to are added to the values; the rendered message is laid out
+     * in a writer owned by the client, so repeated sends do not allocate it.
+     */
+    bool sendTemplate(const MessageTemplate& message,
+                      const std::string& from,
+                      const std::string& to,
+                      TemplateValues values = TemplateValues());
     
     bool sendVerificationCode(const std::string& to,
                              const std::string& code);
     
     std::string getConnectionStatus() const;
+
+    // ESMTP extensions advertised in the last EHLO reply (keywords are upper case)
+    bool hasCapability(const std::string& keyword) const;
+    std::string getCapabilityParams(const std::string& keyword) const;
+
+    // Code of the most recent server reply (0 if the connection failed)
+    int getLastReplyCode() const;
     
 private:
     struct SmtpConnection;
@@ -44,14 +107,34 @@ private:
     bool connected_;
     bool authenticated_;
     std::string username_;
+
+    // Credentials kept for re-authentication
+    mutable std::mutex credentialsMutex_;
+    std::string password_;
+    std::string oauthToken_;
+    bool useOAuth_ = false;
+
+    std::map<std::string, std::string> capabilities_;
+    int lastReplyCode_ = 0;
+
+    // Reused for every message so its segment buffers are kept
+    MessageWriter writer_;
+    DkimSigner* dkimSigner_ = nullptr;
     
     // Helper methods
-    std::string sendCommand(const std::string& command);
+    bool sendCommand(const std::string& command);
+    bool sendSegments(const std::vector<struct iovec>& segments);
+    void abortTransaction(int failedCode);
+    bool transmit(const std::string& from,
+                  const std::vector<std::string>& recipients,
+                  std::vector<std::string>* rejected);
+    bool readLine(std::string& line);
+    bool readReply(SmtpReply& reply);
     bool readResponse(int expectedCode = 250);
-    std::string formatEmail(const std::string& from,
-                           const std::string& to,
-                           const std::string& subject,
-                           const std::string& body);
+    bool ehlo();
+    std::string formatHeaders(const std::string& from,
+                              const std::vector<std::string>& recipients,
+                              const std::string& subject);
 };
 
 } // namespace Pens
@@ -0,0 +1,124 @@
+#ifndef SMTP_CONNECTION_POOL_HPP
+#define SMTP_CONNECTION_POOL_HPP
+
+#include "smtp_client.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+namespace Pens {
+
+// Connection and authentication settings for one SMTP host
+struct SmtpPoolSettings {
+    std::string server;
+    int port = 587;
+    bool useSsl = true;
+    std::string username;
+    std::string password;
+
+    // When set, connections authenticate with XOAUTH2 using the token it
+    // returns at connect time (e.g. OAuthTokenManager::getAccessToken)
+    std::function<std::string()> tokenProvider;
+
+    // When set, every message sent through the pool is DKIM-signed
+    DkimSigner* dkimSigner = nullptr;
+
+    size_t maxConnections = 8;          // per host
+    int keepaliveSeconds = 30;          // NOOP idle connections this often
+    int maxIdleSeconds = 300;           // close connections idle this long
+    int maxMessagesPerConnection = 100; // recycle after this many messages
+};
+
+/**
+ * @brief Pool of authenticated SMTP sessions to one host
+ *
+ * Sessions are handed out through Lease objects and returned to the pool
+ * when the lease goes out of scope. Reused sessions skip TCP, TLS, EHLO and
+ * AUTH; a failed transaction is cleared with RSET and the session is only
+ * discarded if the server stops answering. A maintenance thread sends NOOP
+ * to idle sessions and closes ones that have been idle too long.
+ */
+class SmtpConnectionPool {
+public:
+    explicit SmtpConnectionPool(SmtpPoolSettings settings);
+    ~SmtpConnectionPool();
+
+    SmtpConnectionPool(const SmtpConnectionPool&) = delete;
+    SmtpConnectionPool& operator=(const SmtpConnectionPool&) = delete;
+
+    struct Entry;
+
+    // Exclusive use of one pooled session
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(SmtpConnectionPool* pool, std::unique_ptr<Entry> entry);
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        ~Lease();
+
+        explicit operator bool() const { return entry_ != nullptr; }
+        SmtpClient* operator->() const;
+        SmtpClient& operator*() const;
+
+        // Drop the session instead of returning it to the pool
+        void discard();
+
+    private:
+        SmtpConnectionPool* pool_ = nullptr;
+        std::unique_ptr<Entry> entry_;
+
+        void release();
+    };
+
+    /**
+     * @brief Borrow a session, opening one if the host limit allows
+     * @return Empty lease if no session could be obtained within timeoutMs
+     */
+    Lease acquire(int timeoutMs = 30000);
+
+    // Send through a pooled session, retrying once on a stale connection.
+    // replyCode receives the final SMTP reply (0 if no server answered).
+    bool sendEmail(const std::string& from,
+                   const std::string& to,
+                   const std::string& subject,
+                   const std::string& body,
+                   int* replyCode = nullptr);
+
+    bool sendVerificationCode(const std::string& to, const std::string& code);
+
+    // Close every idle session (leased sessions close when returned)
+    void closeIdle();
+
+    size_t getIdleCount() const;
+    size_t getOpenCount() const;
+    size_t getConnectionsOpened() const;
+
+private:
+    SmtpPoolSettings settings_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable available_;
+    std::vector<std::unique_ptr<Entry>> idle_; // most recently used at the back
+    size_t open_;                              // idle + leased + connecting
+    bool stopping_;
+    std::atomic<size_t> connectionsOpened_;
+
+    std::thread maintenanceThread_;
+    std::condition_variable maintenanceWake_;
+
+    std::unique_ptr<Entry> openConnection();
+    void release(std::unique_ptr<Entry> entry, bool reusable);
+    void maintenanceLoop();
+    bool sendWithRetry(const std::function<bool(SmtpClient&)>& send, int* replyCode = nullptr);
+};
+
+} // namespace Pens
+
+#endif // SMTP_CONNECTION_POOL_HPP
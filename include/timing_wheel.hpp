@@ -0,0 +1,119 @@
+#ifndef TIMING_WHEEL_HPP
+#define TIMING_WHEEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace Pens {
+
+/**
+ * @brief Hierarchical timing wheel
+ *
+ * Four levels of 64 slots; level 0 has tickMs resolution and each level
+ * above covers 64 times the span of the one below, so scheduling and
+ * expiring are O(1) amortized regardless of how many timers are pending.
+ * Timers cannot be cancelled: owners check on expiry whether the item is
+ * still current. Not thread-safe; callers provide their own locking.
+ */
+template <typename T>
+class TimingWheel {
+public:
+    TimingWheel(int64_t tickMs, int64_t nowMs)
+        : tickMs_(tickMs > 0 ? tickMs : 1), currentTick_(nowMs / tickMs_), size_(0) {
+    }
+
+    void schedule(int64_t deadlineMs, T item) {
+        // Round up so an item never fires before its deadline
+        int64_t tick = (deadlineMs + tickMs_ - 1) / tickMs_;
+        place(Timer{tick, std::move(item)});
+        size_++;
+    }
+
+    // Move every item whose deadline is at or before nowMs into expired
+    void advance(int64_t nowMs, std::vector<T>& expired) {
+        int64_t target = nowMs / tickMs_;
+        while (currentTick_ < target) {
+            if (size_ == due_.size()) {
+                currentTick_ = target; // nothing in the wheel; skip the empty ticks
+                break;
+            }
+            tick();
+        }
+        for (auto& timer : due_) {
+            expired.push_back(std::move(timer.item));
+        }
+        size_ -= due_.size();
+        due_.clear();
+    }
+
+    size_t size() const { return size_; }
+
+private:
+    static constexpr int kLevels = 4;
+    static constexpr int kBits = 6;
+    static constexpr int kSlots = 1 << kBits;
+
+    struct Timer {
+        int64_t tick;
+        T item;
+    };
+
+    int64_t tickMs_;
+    int64_t currentTick_;
+    size_t size_;
+    std::vector<Timer> slots_[kLevels][kSlots];
+    std::vector<Timer> overflow_; // beyond the span of the top level
+    std::vector<Timer> due_;
+
+    void place(Timer timer) {
+        if (timer.tick <= currentTick_) {
+            due_.push_back(std::move(timer));
+            return;
+        }
+        // The lowest level whose enclosing block contains both now and the deadline
+        for (int level = 0; level < kLevels; level++) {
+            int shift = kBits * (level + 1);
+            if ((timer.tick >> shift) == (currentTick_ >> shift)) {
+                slots_[level][(timer.tick >> (kBits * level)) & (kSlots - 1)].push_back(std::move(timer));
+                return;
+            }
+        }
+        overflow_.push_back(std::move(timer));
+    }
+
+    void redistribute(std::vector<Timer>& timers) {
+        std::vector<Timer> moving;
+        moving.swap(timers);
+        for (auto& timer : moving) {
+            place(std::move(timer));
+        }
+    }
+
+    void tick() {
+        currentTick_++;
+
+        // Crossing into a new block at level L pulls that block's slot down
+        int top = 1;
+        while (top < kLevels && (currentTick_ & ((int64_t(1) << (kBits * top)) - 1)) == 0) {
+            top++;
+        }
+        if (top == kLevels && (currentTick_ & ((int64_t(1) << (kBits * kLevels)) - 1)) == 0) {
+            redistribute(overflow_);
+        }
+        for (int level = top - 1; level >= 1; level--) {
+            redistribute(slots_[level][(currentTick_ >> (kBits * level)) & (kSlots - 1)]);
+        }
+
+        auto& slot = slots_[0][currentTick_ & (kSlots - 1)];
+        for (auto& timer : slot) {
+            due_.push_back(std::move(timer));
+        }
+        slot.clear();
+    }
+};
+
+} // namespace Pens
+
+#endif // TIMING_WHEEL_HPP
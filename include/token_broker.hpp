@@ -0,0 +1,124 @@
+#ifndef TOKEN_BROKER_HPP
+#define TOKEN_BROKER_HPP
+
+#include "oauth_token_manager.hpp"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <future>
+#include <thread>
+#include <atomic>
+
+namespace Pens {
+
+/**
+ * @brief Token broker owning the OAuth tokens of every account
+ *
+ * Worker threads read cached tokens without taking a lock; concurrent
+ * refreshes of the same account are collapsed into one request
+ * (single-flight). Other PENS processes on the host can fetch tokens
+ * over a Unix domain socket with a one-line protocol:
+ *
+ *   request:  TOKEN <account>\n
+ *   response: OK <access-token>\n  |  ERR <message>\n
+ *
+ * The server thread only ever answers from the cached tokens. Refreshes
+ * run on a per-account refresh thread; requests for an account whose
+ * token has expired are parked until its refresh finishes, so one slow
+ * token endpoint never holds up clients of other accounts. Client sockets
+ * are non-blocking and replies are buffered per client, so a client that
+ * pipelines requests without reading its replies only stalls itself.
+ */
+class TokenBroker {
+public:
+    TokenBroker();
+    ~TokenBroker();
+
+    // Register an account; returns the manager owned by the broker
+    OAuthTokenManager* addAccount(const std::string& account, const OAuthAccountSettings& settings);
+    OAuthTokenManager* addAccount(const std::string& account, std::unique_ptr<OAuthTokenManager> manager);
+
+    OAuthTokenManager* getManager(const std::string& account) const;
+    std::vector<std::string> getAccounts() const;
+
+    /**
+     * @brief Get a valid access token for an account
+     *
+     * Returns the cached token when it is not close to expiry; otherwise
+     * joins (or starts) the account's single in-flight refresh.
+     *
+     * @return Access token or empty on error
+     */
+    std::string getAccessToken(const std::string& account);
+
+    // Force a refresh; concurrent callers share the same request
+    bool refresh(const std::string& account);
+
+    // Number of refresh/load operations actually performed
+    size_t getRefreshCount() const;
+
+    // Serve tokens to other processes over a Unix domain socket
+    bool startServer(const std::string& socketPath);
+    void stopServer();
+
+    // Client side of the socket protocol
+    static std::string requestToken(const std::string& socketPath, const std::string& account);
+
+private:
+    struct Account {
+        std::unique_ptr<OAuthTokenManager> manager;
+        std::mutex flightMutex;
+        std::shared_future<bool> inFlight;
+    };
+
+    using AccountMap = std::map<std::string, std::shared_ptr<Account>>;
+
+    // Copy-on-write account table so lookups need no lock
+    std::shared_ptr<const AccountMap> accounts_;
+    std::mutex writeMutex_;
+    std::atomic<size_t> refreshCount_;
+
+    // A socket request awaiting its reply; replies go out in request order
+    struct PendingReply {
+        std::string account;  // set while parked on a refresh
+        std::string text;
+    };
+
+    // Requests are read only while the client is under its reply caps, so
+    // one that pipelines without reading cannot grow without bound
+    struct Client {
+        std::string buffer;
+        std::deque<PendingReply> replies;
+        std::string output;   // replies the socket has not taken yet
+    };
+
+    std::string socketPath_;
+    int listenFd_;
+    int wakeFds_[2];
+    std::thread serverThread_;
+
+    // Socket-driven refreshes: one thread per account (started and joined
+    // by the server thread), the accounts in flight, and those finished
+    std::map<std::string, std::thread> refreshThreads_;
+    std::mutex refreshMutex_;
+    std::set<std::string> refreshing_;
+    std::vector<std::string> refreshed_;
+
+    std::shared_ptr<Account> findAccount(const std::string& account) const;
+    bool runSingleFlight(Account& account, bool force);
+    void serve();
+    void queueRefresh(const std::string& account);
+    bool serviceClient(int fd, Client& client);
+    void handleRequest(const std::string& line, Client& client);
+    std::string cachedReply(const std::string& account) const;
+    static bool readsPaused(const Client& client);
+    static bool flushReplies(int fd, Client& client);
+};
+
+} // namespace Pens
+
+#endif // TOKEN_BROKER_HPP
@@ -0,0 +1,76 @@
+#ifndef TOKEN_REFRESHER_HPP
+#define TOKEN_REFRESHER_HPP
+
+#include "oauth_token_manager.hpp"
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+
+namespace Pens {
+
+/**
+ * @brief Background OAuth token refresher
+ *
+ * Renews the access token owned by an OAuthTokenManager at a jittered
+ * point before it expires, and hands every new token to the registered
+ * listeners so live IMAP/SMTP sessions can pick it up without reconnecting.
+ */
+class TokenRefresher {
+public:
+    using Listener = std::function<void(const std::string& accessToken)>;
+
+    /**
+     * @param manager Token manager to refresh (must outlive the refresher)
+     * @param leadSeconds Refresh this many seconds before expiry
+     * @param jitterSeconds Additional random lead in [0, jitterSeconds]
+     */
+    TokenRefresher(OAuthTokenManager& manager, int leadSeconds = 300, int jitterSeconds = 120);
+    ~TokenRefresher();
+
+    // Called on the refresher thread after every successful refresh
+    void addListener(Listener listener);
+
+    void start();
+    // Joins the refresher thread, waiting out a refresh already in flight
+    void stop();
+    bool isRunning() const;
+
+    // Epoch seconds of the next scheduled refresh (0 when not scheduled)
+    long getNextRefreshAt() const;
+
+    /**
+     * @brief Compute when a token expiring at expiresAt should be refreshed
+     *
+     * @param expiresAt Token expiry (epoch seconds, 0 = unknown)
+     * @param now Current time (epoch seconds)
+     * @param lead Seconds before expiry to refresh
+     * @param jitter Random extra lead already drawn by the caller
+     * @return Epoch seconds at which to refresh (never before now)
+     */
+    static long computeRefreshTime(long expiresAt, long now, int lead, int jitter);
+
+private:
+    OAuthTokenManager& manager_;
+    int leadSeconds_;
+    int jitterSeconds_;
+
+    std::vector<Listener> listeners_;
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    bool running_;
+    long nextRefreshAt_;
+    std::mt19937 rng_;
+
+    void run();
+    int drawJitter();
+    void notifyListeners(const std::string& accessToken);
+};
+
+} // namespace Pens
+
+#endif // TOKEN_REFRESHER_HPP
@@ -0,0 +1,79 @@
+#ifndef TOKEN_STORE_HPP
+#define TOKEN_STORE_HPP
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace Pens {
+
+/**
+ * @brief Crash-safe token file persistence
+ *
+ * Files are written to a temporary sibling, fsynced and renamed over the
+ * target, so readers see either the old or the new contents and a crash
+ * mid-write never loses the refresh token.
+ */
+class TokenStore {
+public:
+    /**
+     * @brief Atomically replace a file's contents
+     * @param path Target file
+     * @param contents New contents
+     * @param mode Permission bits for the new file (default: owner read/write)
+     * @return true on success; the original file is untouched on failure
+     */
+    static bool writeFileAtomically(const std::string& path, const std::string& contents, unsigned mode = 0600);
+
+    static bool readFile(const std::string& path, std::string& contents);
+};
+
+/**
+ * @brief Memory-mapped token table shared by PENS processes on one host
+ *
+ * A fixed array of slots in a shared file (typically under /dev/shm).
+ * Each slot is protected by a sequence lock: writers (serialized across
+ * processes with flock) bump the sequence to odd, copy the token and bump
+ * it back to even; readers copy without locking and retry if the sequence
+ * changed underneath them. Only access tokens are shared, never refresh
+ * tokens.
+ */
+class SharedTokenTable {
+public:
+    static constexpr uint32_t kSlotCount = 64;
+    static constexpr size_t kSlotSize = 8192;
+    static constexpr size_t kMaxAccountLength = 127;
+
+    SharedTokenTable();
+    ~SharedTokenTable();
+    SharedTokenTable(const SharedTokenTable&) = delete;
+    SharedTokenTable& operator=(const SharedTokenTable&) = delete;
+
+    // Map the table, creating and initializing it if necessary
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const;
+
+    // Publish a token for an account (claims a slot on first use)
+    bool publish(const std::string& account, const std::string& accessToken, long expiresAt);
+
+    // Lock-free read; false if the account has no published token
+    bool read(const std::string& account, std::string& accessToken, long& expiresAt) const;
+
+    static size_t maxTokenLength();
+
+private:
+    struct Header;
+    struct Slot;
+
+    int fd_;
+    void* base_;
+    size_t size_;
+
+    Slot* slot(uint32_t index) const;
+    Slot* findSlot(const std::string& account) const;
+};
+
+} // namespace Pens
+
+#endif // TOKEN_STORE_HPP
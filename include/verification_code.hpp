@@ -1,40 +1,66 @@
 #ifndef VERIFICATION_CODE_HPP
 #define VERIFICATION_CODE_HPP
 
+#include <cstddef>
 #include <string>
-#include <random>
+#include <vector>
 
 namespace Pens {
 
 /**
  * @brief Verification Code Generator
- * 
- * Generates secure 6-digit verification codes for email verification
+ *
+ * Generates secure 6-digit verification codes for email verification.
+ * Randomness comes from the kernel CSPRNG (getrandom), read in bulk into
+ * a per-thread buffer, so generators need no locking and may be created
+ * freely on any thread. Codes are uniform over 000000-999999.
+ *
+ * If no randomness can be had, generation fails rather than reusing old
+ * bytes: generate() returns an empty string and generateBatch() an empty
+ * vector.
  */
 class VerificationCodeGenerator {
 public:
+    static constexpr size_t kCodeLength = 6;
+
+    // Fills length bytes with randomness; false if none is available
+    using EntropySource = bool (*)(unsigned char* out, size_t length);
+
     VerificationCodeGenerator();
-    
+
     /**
      * Generate a random 6-digit verification code
-     * @return String containing 6 digits (000000-999999)
+     * @return String containing 6 digits (000000-999999), or empty when no
+     *         randomness is available
      */
     std::string generate();
-    
+
+    /**
+     * Generate codes without allocating
+     * @param out Receives count * kCodeLength digits, codes back to back
+     *            with no separators or terminator
+     * @return false when no randomness is available (out is then unusable)
+     */
+    static bool generate(char* out, size_t count = 1);
+
+    // Generate many codes at once
+    std::vector<std::string> generateBatch(size_t count);
+
     /**
      * Validate a verification code format
      * @param code The code to validate
      * @return true if code is 6 digits
      */
     bool validate(const std::string& code);
-    
-private:
-    std::random_device rd_;
-    std::mt19937 gen_;
-    std::uniform_int_distribution<int> dist_;
+
+    /**
+     * Replace the kernel CSPRNG that refills the per-thread buffers
+     * (tests substitute their own); nullptr restores getrandom. Bytes a
+     * thread has already buffered are still handed out first.
+     */
+    static void setEntropySource(EntropySource source);
 };
 
 } // namespace Pens
 
 #endif // VERIFICATION_CODE_HPP
-
@@ -0,0 +1,125 @@
+#ifndef VERIFICATION_SERVER_HPP
+#define VERIFICATION_SERVER_HPP
+
+#include "verification_service.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Pens {
+
+class RateLimiter;
+class SmtpConnectionPool;
+
+struct VerificationServerSettings {
+    std::string socketPath;
+    int deliveryWorkers = 4;
+    size_t maxQueuedDeliveries = 10000;  // ISSUE answers "ERR busy" beyond this
+    int requestBudgetMs = 50;            // requests older than this are shed
+    size_t maxConnections = 1024;
+    size_t statusHistory = 100000;       // delivery statuses remembered for STATUS
+};
+
+/**
+ * @brief Local verification API on a Unix domain socket
+ *
+ * A single epoll thread accepts connections and answers newline-terminated
+ * requests; clients may pipeline any number of them and replies come back
+ * in order, batched into one write per read:
+ *
+ *   ISSUE <recipient>        -> OK <delivery-id> | ERR rate_limited <retry-after-ms>
+ *   VERIFY <recipient> <code> -> OK | ERR <mismatch|expired|not_found|too_many_attempts>
+ *   STATUS <delivery-id>     -> OK <queued|sent|failed> | ERR unknown id
+ *
+ * ISSUE stores the code and hands the email to delivery worker threads, so
+ * it answers without waiting for SMTP; its recipient must be a plain
+ * local@domain address. A request's wait is timed from the event-loop
+ * wakeup that read its final bytes, so a client's own slow send does not
+ * count against it but a loop held up by other work does: a request that
+ * has waited longer than the latency budget gets "ERR deadline" instead of
+ * being processed.
+ */
+class VerificationServer {
+public:
+    // Sends one code email; true once the server accepted it
+    using Sender = std::function<bool(const std::string& to, const std::string& code)>;
+
+    enum class DeliveryStatus { Queued, Sent, Failed };
+
+    VerificationServer(VerificationServerSettings settings, VerificationService& service, Sender sender);
+    ~VerificationServer();
+
+    VerificationServer(const VerificationServer&) = delete;
+    VerificationServer& operator=(const VerificationServer&) = delete;
+
+    // Check ISSUE requests against send rate limits (set before start)
+    void setRateLimiter(RateLimiter* limiter);
+
+    bool start();
+    void stop();
+
+    // Sender that delivers through a pooled SMTP connection
+    static Sender smtpSender(SmtpConnectionPool& pool);
+
+    // Client side: send one request line and return the reply line (empty on error)
+    static std::string request(const std::string& socketPath, const std::string& line);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Connection {
+        std::string input;
+        std::string output;
+    };
+
+    struct Delivery {
+        uint64_t id;
+        std::string to;
+        std::string code;
+    };
+
+    VerificationServerSettings settings_;
+    VerificationService& service_;
+    Sender sender_;
+    RateLimiter* rateLimiter_;
+
+    int listenFd_;
+    int epollFd_;
+    int wakeFd_;
+    std::atomic<bool> running_;
+    std::thread loopThread_;
+    std::map<int, Connection> connections_;
+
+    std::mutex deliveryMutex_;
+    std::condition_variable deliveryReady_;
+    std::deque<Delivery> deliveries_;
+    std::vector<std::thread> workers_;
+    bool stopWorkers_;
+
+    mutable std::mutex statusMutex_;
+    std::map<uint64_t, DeliveryStatus> statuses_;
+    uint64_t nextId_;
+
+    void loop();
+    void acceptClients();
+    void readClient(int fd, Clock::time_point woke);
+    void writeClient(int fd);
+    void closeClient(int fd);
+    std::string handleRequest(const std::string& line, Clock::time_point woke);
+    std::string issue(const std::string& recipient);
+    static bool isValidRecipient(const std::string& recipient);
+    void deliveryLoop();
+    void setStatus(uint64_t id, DeliveryStatus status);
+};
+
+} // namespace Pens
+
+#endif // VERIFICATION_SERVER_HPP
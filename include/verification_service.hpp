@@ -0,0 +1,103 @@
+#ifndef VERIFICATION_SERVICE_HPP
+#define VERIFICATION_SERVICE_HPP
+
+#include "timing_wheel.hpp"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Pens {
+
+struct VerificationSettings {
+    int ttlSeconds = 600;          // codes are valid this long
+    int maxAttempts = 5;           // wrong guesses before the code is burned
+    size_t maxEntries = 1000000;   // outstanding codes across all shards
+    size_t shards = 64;
+
+    // Epoch milliseconds; defaults to the system clock (tests substitute their own)
+    std::function<int64_t()> clock;
+};
+
+enum class VerifyResult {
+    Ok,
+    Mismatch,
+    NotFound,        // never issued, already used, or expired and swept
+    Expired,
+    TooManyAttempts
+};
+
+/**
+ * @brief Store of outstanding verification codes
+ *
+ * Only a salted SHA-256 of each code is kept, compared in constant time.
+ * Recipients are spread over independently locked shards so issue and
+ * verify on different recipients do not contend. Each shard has a timing
+ * wheel that reclaims expired entries as the shard is touched, so memory
+ * stays proportional to codes issued within one TTL and is capped by
+ * maxEntries. A code is single-use, and is burned after maxAttempts wrong
+ * guesses.
+ */
+class VerificationService {
+public:
+    explicit VerificationService(VerificationSettings settings = VerificationSettings());
+    ~VerificationService();
+
+    VerificationService(const VerificationService&) = delete;
+    VerificationService& operator=(const VerificationService&) = delete;
+
+    /**
+     * @brief Issue a fresh code, replacing any outstanding one for the recipient
+     * @return The code to send, or empty if the store is full or no
+     *         randomness is available
+     */
+    std::string issue(const std::string& recipient);
+
+    // Register a code generated elsewhere (false if the store is full)
+    bool store(const std::string& recipient, const std::string& code);
+
+    VerifyResult verify(const std::string& recipient, const std::string& code);
+
+    // Sweep expired entries in every shard
+    void purgeExpired();
+
+    size_t size() const;
+
+    static const char* resultName(VerifyResult result);
+
+private:
+    struct Entry {
+        unsigned char salt[16];
+        unsigned char digest[32];
+        int64_t expiresAt;
+        int attempts;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+        std::unique_ptr<TimingWheel<std::string>> wheel;
+        std::vector<std::string> expired; // scratch for wheel sweeps
+    };
+
+    VerificationSettings settings_;
+    size_t shardCapacity_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    unsigned char pepper_[32];    // per-process secret mixed into every digest
+
+    Shard& shardFor(const std::string& key);
+    void sweep(Shard& shard, int64_t now);
+    VerifyResult check(Shard& shard, const std::string& key,
+                       const std::string& code, int64_t now);
+    bool digest(const unsigned char* salt, const std::string& key,
+                const std::string& code, unsigned char* out) const;
+    int64_t now() const;
+    static std::string normalize(const std::string& recipient);
+};
+
+} // namespace Pens
+
+#endif // VERIFICATION_SERVICE_HPP
@@ -0,0 +1,448 @@
+#include "async_imap_client.hpp"
+#include "kernel_tls.hpp"
+#include "oauth_helper.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+namespace Pens {
+
+AsyncImapClient::AsyncImapClient(IoExecutor& executor, const std::string& server, int port, bool useSsl)
+    : executor_(executor), server_(server), port_(port), useSsl_(useSsl), kernelTls_(true),
+      fd_(-1), sslContext_(nullptr), ssl_(nullptr), nextTag_(1), streaming_(false), uidValidity_(0) {}
+
+AsyncImapClient::~AsyncImapClient() {
+    closeSocket();
+}
+
+void AsyncImapClient::setTimeouts(const ImapTimeouts& timeouts) {
+    timeouts_ = timeouts;
+}
+
+int AsyncImapClient::commandTimeoutMs() const {
+    return timeouts_.commandSeconds > 0 ? timeouts_.commandSeconds * 1000 : -1;
+}
+
+std::string AsyncImapClient::makeTag() {
+    return "A" + std::to_string(nextTag_++);
+}
+
+void AsyncImapClient::closeSocket() {
+    if (ssl_) {
+        SSL_free(ssl_);
+        ssl_ = nullptr;
+    }
+    if (sslContext_) {
+        SSL_CTX_free(sslContext_);
+        sslContext_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        executor_.forget(fd_);
+        close(fd_);
+        fd_ = -1;
+    }
+    buffer_.clear();
+    streaming_ = false;
+    currentMailbox_.clear();
+    uidValidity_ = 0;
+}
+
+void AsyncImapClient::drop(const std::string& reason) {
+    if (fd_ >= 0) {
+        LOG_WARNING("IMAP connection to " + server_ + " dropped: " + reason);
+    }
+    closeSocket();
+}
+
+Task<bool> AsyncImapClient::connect() {
+    closeSocket();
+
+    // Resolve up front so the address list is not held across suspensions
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = nullptr;
+    int status = getaddrinfo(server_.c_str(), std::to_string(port_).c_str(), &hints, &addresses);
+    if (status != 0) {
+        LOG_ERROR("Failed to resolve IMAP server " + server_ + ": " + gai_strerror(status));
+        co_return false;
+    }
+    std::vector<std::pair<struct sockaddr_storage, socklen_t>> candidates;
+    for (struct addrinfo* address = addresses; address; address = address->ai_next) {
+        struct sockaddr_storage storage;
+        std::memcpy(&storage, address->ai_addr, address->ai_addrlen);
+        candidates.emplace_back(storage, address->ai_addrlen);
+    }
+    freeaddrinfo(addresses);
+
+    int connectMs = timeouts_.connectSeconds > 0 ? timeouts_.connectSeconds * 1000 : -1;
+    for (const auto& candidate : candidates) {
+        int fd = socket(candidate.first.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            continue;
+        }
+        bool connected = ::connect(fd, reinterpret_cast<const struct sockaddr*>(&candidate.first), candidate.second) == 0;
+        if (!connected && errno == EINPROGRESS && co_await executor_.writable(fd, connectMs)) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            connected = getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0;
+        }
+        if (connected) {
+            fd_ = fd;
+            break;
+        }
+        executor_.forget(fd);
+        close(fd);
+    }
+    if (fd_ < 0) {
+        LOG_ERROR("Failed to connect to IMAP server " + server_);
+        co_return false;
+    }
+    int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (useSsl_ && !co_await handshake()) {
+        drop("SSL handshake failed");
+        co_return false;
+    }
+
+    auto greeting = co_await readItem();
+    if (!greeting || greeting->compare(0, 4, "* OK") != 0) {
+        LOG_ERROR("IMAP server " + server_ + " refused the connection");
+        drop("greeting refused");
+        co_return false;
+    }
+    LOG_DEBUG("Server welcome: " + *greeting);
+    co_return true;
+}
+
+Task<bool> AsyncImapClient::handshake() {
+    sslContext_ = SSL_CTX_new(TLS_client_method());
+    if (!sslContext_) {
+        co_return false;
+    }
+    // Writes may be split and retried from a moved buffer
+    SSL_CTX_set_mode(sslContext_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    if (kernelTls_) {
+        KernelTls::enable(sslContext_);
+    }
+    ssl_ = SSL_new(sslContext_);
+    if (!ssl_) {
+        co_return false;
+    }
+    SSL_set_fd(ssl_, fd_);
+    SSL_set_tlsext_host_name(ssl_, server_.c_str());
+
+    int waitMs = timeouts_.connectSeconds > 0 ? timeouts_.connectSeconds * 1000 : -1;
+    while (true) {
+        int result = SSL_connect(ssl_);
+        if (result == 1) {
+            KernelTls::report(ssl_, server_);
+            co_return true;
+        }
+        int error = SSL_get_error(ssl_, result);
+        if (error == SSL_ERROR_WANT_READ) {
+            if (!co_await executor_.readable(fd_, waitMs)) {
+                co_return false;
+            }
+        } else if (error == SSL_ERROR_WANT_WRITE) {
+            if (!co_await executor_.writable(fd_, waitMs)) {
+                co_return false;
+            }
+        } else {
+            co_return false;
+        }
+    }
+}
+
+Task<bool> AsyncImapClient::fill() {
+    if (fd_ >= 0 && !ssl_) {
+        // The executor reads plain sockets itself (a multishot receive on io_uring)
+        ssize_t received = co_await executor_.receive(fd_, buffer_, commandTimeoutMs());
+        if (received < 0) {
+            LOG_WARNING("IMAP server " + server_ + " went silent");
+        }
+        co_return received > 0;
+    }
+    char chunk[16384];
+    while (fd_ >= 0) {
+        ssize_t received = SSL_read(ssl_, chunk, sizeof(chunk));
+        bool wantWrite = false;
+        if (received <= 0) {
+            int error = SSL_get_error(ssl_, static_cast<int>(received));
+            if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+                co_return false;
+            }
+            wantWrite = error == SSL_ERROR_WANT_WRITE;
+        }
+        if (received > 0) {
+            buffer_.append(chunk, static_cast<size_t>(received));
+            co_return true;
+        }
+        bool ready = wantWrite ? co_await executor_.writable(fd_, commandTimeoutMs())
+                               : co_await executor_.readable(fd_, commandTimeoutMs());
+        if (!ready) {
+            LOG_WARNING("IMAP server " + server_ + " went silent");
+            co_return false;
+        }
+    }
+    co_return false;
+}
+
+Task<bool> AsyncImapClient::writeAll(std::string data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        if (fd_ < 0) {
+            co_return false;
+        }
+        ssize_t written;
+        bool wantRead = false;
+        if (ssl_) {
+            written = SSL_write(ssl_, data.data() + offset, static_cast<int>(data.size() - offset));
+            if (written <= 0) {
+                int error = SSL_get_error(ssl_, static_cast<int>(written));
+                if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+                    co_return false;
+                }
+                wantRead = error == SSL_ERROR_WANT_READ;
+            }
+        } else {
+            written = send(fd_, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                co_return false;
+            }
+        }
+        if (written > 0) {
+            offset += static_cast<size_t>(written);
+            continue;
+        }
+        bool ready = wantRead ? co_await executor_.readable(fd_, commandTimeoutMs())
+                              : co_await executor_.writable(fd_, commandTimeoutMs());
+        if (!ready) {
+            co_return false;
+        }
+    }
+    co_return true;
+}
+
+Task<std::optional<std::string>> AsyncImapClient::readLine() {
+    size_t end;
+    while ((end = buffer_.find("\r\n")) == std::string::npos) {
+        if (!co_await fill()) {
+            co_return std::nullopt;
+        }
+    }
+    std::string line = buffer_.substr(0, end);
+    buffer_.erase(0, end + 2);
+    co_return line;
+}
+
+Task<std::optional<std::string>> AsyncImapClient::readItem(std::shared_ptr<MessageSpill>* bodySpill) {
+    // Same shape as ImapClient::sendCommand output: literals inline, CRLF after each line
+    std::string item;
+    while (true) {
+        auto line = co_await readLine();
+        if (!line) {
+            co_return std::nullopt;
+        }
+        item += *line;
+        item += "\r\n";
+        size_t open = line->rfind('{');
+        if (line->empty() || line->back() != '}' || open == std::string::npos) {
+            co_return item;
+        }
+        size_t length = std::strtoul(line->c_str() + open + 1, nullptr, 10);
+        if (bodySpill && spillSettings_.thresholdBytes > 0 && length > spillSettings_.thresholdBytes) {
+            auto spill = std::make_shared<MessageSpill>(spillSettings_.directory);
+            size_t done = 0;
+            while (done < length) {
+                if (buffer_.empty() && !co_await fill()) {
+                    co_return std::nullopt;
+                }
+                size_t take = std::min(length - done, buffer_.size());
+                if (done < spillSettings_.prefixBytes) {
+                    item.append(buffer_, 0, std::min(take, spillSettings_.prefixBytes - done));
+                }
+                spill->append(buffer_.data(), take);
+                buffer_.erase(0, take);
+                done += take;
+            }
+            if (!spill->finish()) {
+                LOG_WARNING("Could not spill the " + std::to_string(length) + " byte literal of UID " +
+                            ImapClient::fetchUid(item) + "; keeping only its first " +
+                            std::to_string(std::min(length, spillSettings_.prefixBytes)) + " bytes");
+            } else if (ImapClient::announcesBodyText(*line)) {
+                *bodySpill = std::move(spill);
+            }
+            continue;
+        }
+        while (buffer_.size() < length) {
+            if (!co_await fill()) {
+                co_return std::nullopt;
+            }
+        }
+        item.append(buffer_, 0, length);
+        buffer_.erase(0, length);
+    }
+}
+
+Task<AsyncImapClient::Response> AsyncImapClient::command(std::string command) {
+    Response response;
+    if (streaming_) {
+        drop("previous FETCH abandoned before its end");
+    }
+    if (fd_ < 0) {
+        co_return response;
+    }
+    std::string tag = makeTag();
+    if (!co_await writeAll(tag + " " + command + "\r\n")) {
+        drop("write failed");
+        co_return response;
+    }
+    while (true) {
+        auto item = co_await readItem();
+        if (!item) {
+            drop("no response to " + command.substr(0, command.find(' ')));
+            co_return response;
+        }
+        if (item->compare(0, 1, "+") == 0) {
+            // A SASL challenge means the credentials were refused; cancel the exchange
+            if (!co_await writeAll("\r\n")) {
+                drop("write failed");
+                co_return response;
+            }
+            continue;
+        }
+        response.text += *item;
+        if (item->compare(0, tag.size() + 1, tag + " ") == 0) {
+            response.ok = item->compare(tag.size() + 1, 2, "OK") == 0;
+            co_return response;
+        }
+    }
+}
+
+Task<bool> AsyncImapClient::authenticate(std::string username, std::string password) {
+    Response response = co_await command("LOGIN " + ImapClient::quoteString(username) + " " +
+                                         ImapClient::quoteString(password));
+    if (!response.ok) {
+        LOG_ERROR("IMAP authentication failed for " + username);
+    }
+    co_return response.ok;
+}
+
+Task<bool> AsyncImapClient::authenticateOAuth(std::string username, std::string accessToken) {
+    Response response = co_await command("AUTHENTICATE XOAUTH2 " +
+                                         OAuthHelper::generateXOAuth2String(username, accessToken));
+    if (!response.ok) {
+        LOG_ERROR("IMAP OAuth authentication failed for " + username);
+    }
+    co_return response.ok;
+}
+
+Task<bool> AsyncImapClient::selectMailbox(std::string mailbox) {
+    Response response = co_await command("SELECT " + ImapClient::quoteString(mailbox));
+    if (!response.ok) {
+        LOG_ERROR("Failed to select mailbox: " + mailbox);
+        co_return false;
+    }
+    currentMailbox_ = mailbox;
+    uidValidity_ = 0;
+    size_t pos = response.text.find("[UIDVALIDITY ");
+    if (pos != std::string::npos) {
+        uidValidity_ = static_cast<uint32_t>(std::strtoul(response.text.c_str() + pos + 13, nullptr, 10));
+    }
+    co_return true;
+}
+
+Task<std::vector<uint32_t>> AsyncImapClient::searchUidsAfter(uint32_t uid) {
+    std::vector<uint32_t> uids;
+    Response response = co_await command("UID SEARCH UID " + std::to_string(uid + 1) + ":*");
+    if (!response.ok) {
+        co_return uids;
+    }
+    // "n:*" always matches the highest UID, even when it is below n
+    std::istringstream lines(response.text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, 9, "* SEARCH ") != 0) {
+            continue;
+        }
+        std::istringstream words(line.substr(9));
+        unsigned long value;
+        while (words >> value) {
+            if (value > uid) {
+                uids.push_back(static_cast<uint32_t>(value));
+            }
+        }
+    }
+    std::sort(uids.begin(), uids.end());
+    co_return uids;
+}
+
+AsyncGenerator<Email> AsyncImapClient::fetch(std::string uidSet) {
+    if (streaming_) {
+        drop("previous FETCH abandoned before its end");
+    }
+    if (fd_ < 0) {
+        co_return;
+    }
+    std::string tag = makeTag();
+    if (!co_await writeAll(tag + " UID FETCH " + uidSet +
+                           " (FLAGS INTERNALDATE RFC822.SIZE BODY[HEADER] BODY[TEXT])\r\n")) {
+        drop("write failed");
+        co_return;
+    }
+    streaming_ = true;
+    while (true) {
+        std::shared_ptr<MessageSpill> bodySpill;
+        auto item = co_await readItem(&bodySpill);
+        if (!item) {
+            drop("FETCH response cut short");
+            co_return;
+        }
+        if (item->compare(0, tag.size() + 1, tag + " ") == 0) {
+            streaming_ = false;
+            co_return;
+        }
+        // Look for the UID in the first line only, before any literal
+        std::string first = item->substr(0, item->find("\r\n"));
+        size_t uidPos = first.find("UID ");
+        if (first.compare(0, 2, "* ") != 0 || first.find(" FETCH (") == std::string::npos ||
+            uidPos == std::string::npos) {
+            continue;
+        }
+        std::string uid = std::to_string(std::strtoul(item->c_str() + uidPos + 4, nullptr, 10));
+        Email email = ImapClient::parseEmailData(*item, uid);
+        email.spill = std::move(bodySpill);
+        email.priority = ImapClient::calculatePriorityScore(email);
+        co_yield email;
+    }
+}
+
+Task<bool> AsyncImapClient::noop() {
+    Response response = co_await command("NOOP");
+    co_return response.ok;
+}
+
+Task<void> AsyncImapClient::logout() {
+    if (fd_ >= 0 && !streaming_) {
+        co_await command("LOGOUT");
+    }
+    closeSocket();
+}
+
+} // namespace Pens
@@ -3,6 +3,7 @@
 #include <fstream>
 #include <sstream>
 #include <cstdlib>
+#include <algorithm>
 
 namespace Pens {
 
@@ -34,6 +35,25 @@ Config::Config() {
     config_["oauth_client_secret"] = "";
     config_["oauth_certificate_path"] = "";
     config_["oauth_private_key_path"] = "";
+    config_["oauth_authority"] = "https://login.microsoftonline.com";
+    config_["oauth_ca_file"] = "";
+    config_["oauth_refresh_lead_seconds"] = "300";
+    config_["oauth_refresh_jitter_seconds"] = "120";
+    config_["token_broker_socket"] = "";
+    config_["token_cache_path"] = "";
+    config_["imap_mailbox"] = "INBOX";
+    config_["sync_state_file"] = ".pens_sync_state";
+    config_["imap_folders"] = "";
+    config_["imap_max_connections"] = "4";
+
+    // SMTP and verification API defaults
+    config_["smtp_server"] = "";
+    config_["smtp_port"] = "587";
+    config_["smtp_use_ssl"] = "true";
+    config_["smtp_max_connections"] = "8";
+    config_["verification_socket"] = "";
+    config_["verification_workers"] = "4";
+    config_["verification_budget_ms"] = "50";
 }
 
 bool Config::loadFromFile(const std::string& filename) {
@@ -107,6 +127,9 @@ bool Config::loadFromEnv() {
     const char* useSsl = std::getenv("PENS_IMAP_USE_SSL");
     if (useSsl) config_["imap_use_ssl"] = useSsl;
     
+    const char* kernelTls = std::getenv("PENS_IMAP_KERNEL_TLS");
+    if (kernelTls) config_["imap_kernel_tls"] = kernelTls;
+    
     const char* priorityThreshold = std::getenv("PENS_PRIORITY_THRESHOLD");
     if (priorityThreshold) config_["priority_threshold"] = priorityThreshold;
     
@@ -149,6 +172,49 @@ bool Config::loadFromEnv() {
 
     const char* oauthPrivateKeyPath = std::getenv("PENS_OAUTH_PRIVATE_KEY_PATH");
     if (oauthPrivateKeyPath) config_["oauth_private_key_path"] = oauthPrivateKeyPath;
+
+    const char* oauthAuthority = std::getenv("PENS_OAUTH_AUTHORITY");
+    if (oauthAuthority) config_["oauth_authority"] = oauthAuthority;
+
+    const char* oauthCaFile = std::getenv("PENS_OAUTH_CA_FILE");
+    if (oauthCaFile) config_["oauth_ca_file"] = oauthCaFile;
+
+    const char* oauthRefreshLead = std::getenv("PENS_OAUTH_REFRESH_LEAD_SECONDS");
+    if (oauthRefreshLead) config_["oauth_refresh_lead_seconds"] = oauthRefreshLead;
+
+    const char* oauthRefreshJitter = std::getenv("PENS_OAUTH_REFRESH_JITTER_SECONDS");
+    if (oauthRefreshJitter) config_["oauth_refresh_jitter_seconds"] = oauthRefreshJitter;
+
+    const char* tokenBrokerSocket = std::getenv("PENS_TOKEN_BROKER_SOCKET");
+    if (tokenBrokerSocket) config_["token_broker_socket"] = tokenBrokerSocket;
+
+    const char* tokenCachePath = std::getenv("PENS_TOKEN_CACHE_PATH");
+    if (tokenCachePath) config_["token_cache_path"] = tokenCachePath;
+
+    const char* imapMailbox = std::getenv("PENS_IMAP_MAILBOX");
+    if (imapMailbox) config_["imap_mailbox"] = imapMailbox;
+
+    const char* syncStateFile = std::getenv("PENS_SYNC_STATE_FILE");
+    if (syncStateFile) config_["sync_state_file"] = syncStateFile;
+
+    const char* imapFolders = std::getenv("PENS_IMAP_FOLDERS");
+    if (imapFolders) config_["imap_folders"] = imapFolders;
+
+    // SMTP and verification API configuration
+    const char* smtpServer = std::getenv("PENS_SMTP_SERVER");
+    if (smtpServer) config_["smtp_server"] = smtpServer;
+
+    const char* smtpPort = std::getenv("PENS_SMTP_PORT");
+    if (smtpPort) config_["smtp_port"] = smtpPort;
+
+    const char* smtpUsername = std::getenv("PENS_SMTP_USERNAME");
+    if (smtpUsername) config_["smtp_username"] = smtpUsername;
+
+    const char* smtpPassword = std::getenv("PENS_SMTP_PASSWORD");
+    if (smtpPassword) config_["smtp_password"] = smtpPassword;
+
+    const char* verificationSocket = std::getenv("PENS_VERIFICATION_SOCKET");
+    if (verificationSocket) config_["verification_socket"] = verificationSocket;
     
     LOG_INFO("Configuration loaded from environment variables");
     return true;
@@ -166,6 +232,10 @@ bool Config::getImapUseSsl() const {
     return getValueBool("imap_use_ssl", true);
 }
 
+bool Config::getImapKernelTls() const {
+    return getValueBool("imap_kernel_tls", true);
+}
+
 std::string Config::getImapUsername() const {
     return getValue("imap_username", "");
 }
@@ -230,6 +300,100 @@ std::string Config::getOAuthPrivateKeyPath() const {
     return getValue("oauth_private_key_path", "");
 }
 
+std::string Config::getOAuthAuthority() const {
+    return getValue("oauth_authority", "https://login.microsoftonline.com");
+}
+
+std::string Config::getOAuthCaFile() const {
+    return getValue("oauth_ca_file", "");
+}
+
+int Config::getOAuthRefreshLeadSeconds() const {
+    return getValueInt("oauth_refresh_lead_seconds", 300);
+}
+
+int Config::getOAuthRefreshJitterSeconds() const {
+    return getValueInt("oauth_refresh_jitter_seconds", 120);
+}
+
+std::string Config::getTokenBrokerSocket() const {
+    return getValue("token_broker_socket", "");
+}
+
+std::string Config::getTokenCachePath() const {
+    return getValue("token_cache_path", "");
+}
+
+std::string Config::getImapMailbox() const {
+    return getValue("imap_mailbox", "INBOX");
+}
+
+std::string Config::getSyncStateFile() const {
+    return getValue("sync_state_file", ".pens_sync_state");
+}
+
+std::vector<std::string> Config::getImapFolders() const {
+    std::vector<std::string> folders;
+    std::istringstream in(getValue("imap_folders", ""));
+    std::string folder;
+    while (std::getline(in, folder, ',')) {
+        folder.erase(0, folder.find_first_not_of(" \t"));
+        folder.erase(folder.find_last_not_of(" \t") + 1);
+        if (!folder.empty()) {
+            folders.push_back(folder);
+        }
+    }
+    return folders;
+}
+
+int Config::getImapMaxConnections() const {
+    return getValueInt("imap_max_connections", 4);
+}
+
+int Config::getImapSpillThresholdKb() const {
+    return getValueInt("imap_spill_threshold_kb", 1024);
+}
+
+std::string Config::getImapSpillDir() const {
+    return getValue("imap_spill_dir", "");
+}
+
+std::string Config::getSmtpServer() const {
+    return getValue("smtp_server", "");
+}
+
+int Config::getSmtpPort() const {
+    return getValueInt("smtp_port", 587);
+}
+
+bool Config::getSmtpUseSsl() const {
+    return getValueBool("smtp_use_ssl", true);
+}
+
+std::string Config::getSmtpUsername() const {
+    return getValue("smtp_username", getImapUsername());
+}
+
+std::string Config::getSmtpPassword() const {
+    return getValue("smtp_password", getImapPassword());
+}
+
+int Config::getSmtpMaxConnections() const {
+    return getValueInt("smtp_max_connections", 8);
+}
+
+std::string Config::getVerificationSocket() const {
+    return getValue("verification_socket", "");
+}
+
+int Config::getVerificationWorkers() const {
+    return getValueInt("verification_workers", 4);
+}
+
+int Config::getVerificationBudgetMs() const {
+    return getValueInt("verification_budget_ms", 50);
+}
+
 bool Config::useOAuth() const {
     std::string method = getAuthMethod();
     return (method == "oauth" || method == "OAuth" || method == "OAUTH");
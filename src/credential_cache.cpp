@@ -0,0 +1,246 @@
+#include "credential_cache.hpp"
+#include "oauth_helper.hpp"
+#include "logger.hpp"
+#include <cstdio>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+namespace Pens {
+
+namespace {
+// Lifetime of a freshly signed client assertion
+constexpr long kAssertionLifetimeSeconds = 3600;
+}
+
+bool CredentialCache::FileStamp::operator==(const FileStamp& other) const {
+    return inode == other.inode && size == other.size &&
+           mtimeSec == other.mtimeSec && mtimeNsec == other.mtimeNsec &&
+           ctimeSec == other.ctimeSec && ctimeNsec == other.ctimeNsec;
+}
+
+CredentialCache& CredentialCache::getInstance() {
+    static CredentialCache instance;
+    return instance;
+}
+
+CredentialCache::CredentialCache()
+    : reuseMargin_(300),
+      checkInterval_(1),
+      fileLoads_(0),
+      signatures_(0) {
+}
+
+bool CredentialCache::statFile(const std::string& path, FileStamp& stamp) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    stamp.inode = st.st_ino;
+    stamp.size = st.st_size;
+    stamp.mtimeSec = st.st_mtim.tv_sec;
+    stamp.mtimeNsec = st.st_mtim.tv_nsec;
+    stamp.ctimeSec = st.st_ctim.tv_sec;
+    stamp.ctimeNsec = st.st_ctim.tv_nsec;
+    return true;
+}
+
+bool CredentialCache::hashFile(const std::string& path, std::string& digest) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    bool ok = ctx && EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) == 1;
+    char chunk[4096];
+    size_t n;
+    while (ok && (n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        ok = EVP_DigestUpdate(ctx, chunk, n) == 1;
+    }
+    unsigned char out[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    ok = ok && !ferror(file) && EVP_DigestFinal_ex(ctx, out, &length) == 1;
+    EVP_MD_CTX_free(ctx);
+    fclose(file);
+    if (ok) {
+        digest.assign(reinterpret_cast<char*>(out), length);
+    }
+    return ok;
+}
+
+bool CredentialCache::needsReload(WatchedFile& file, const std::string& path, bool loaded) {
+    std::time_t now = std::time(nullptr);
+    if (loaded && now - file.lastChecked < checkInterval_) {
+        return false;
+    }
+    file.lastChecked = now;
+
+    FileStamp stamp;
+    if (!statFile(path, stamp)) {
+        // Keep serving the cached copy while a file is being replaced
+        return !loaded;
+    }
+    std::string digest;
+    if (loaded && stamp == file.stamp) {
+        // Timestamps have coarse ticks: a rewrite keeping size and inode
+        // within the tick of the last read leaves the stamp unchanged, so
+        // compare contents until the file is visibly older than that read
+        if (stamp.mtimeSec < file.readAt - 1) {
+            return false;
+        }
+        if (!hashFile(path, digest)) {
+            return false;
+        }
+        if (digest == file.digest) {
+            file.readAt = now;
+            return false;
+        }
+    } else if (!hashFile(path, digest)) {
+        digest.clear();
+    }
+    file.stamp = stamp;
+    file.digest = digest;
+    file.readAt = now;
+    return true;
+}
+
+CredentialCache::KeyEntry* CredentialCache::loadKeyLocked(const std::string& path) {
+    KeyEntry& entry = keys_[path];
+    if (!needsReload(entry.file, path, entry.key != nullptr)) {
+        return entry.key ? &entry : nullptr;
+    }
+
+    FILE* keyFile = fopen(path.c_str(), "r");
+    if (!keyFile) {
+        LOG_ERROR("Failed to open private key file: " + path);
+        return entry.key ? &entry : nullptr;
+    }
+
+    EVP_PKEY* key = PEM_read_PrivateKey(keyFile, nullptr, nullptr, nullptr);
+    fclose(keyFile);
+    fileLoads_++;
+
+    if (!key) {
+        LOG_ERROR("Failed to load private key: " + path);
+        return entry.key ? &entry : nullptr;
+    }
+
+    entry.key = std::shared_ptr<EVP_PKEY>(key, EVP_PKEY_free);
+    entry.file.generation++;
+    LOG_INFO("Loaded private key: " + path);
+    return &entry;
+}
+
+CredentialCache::CertEntry* CredentialCache::loadCertLocked(const std::string& path) {
+    CertEntry& entry = certs_[path];
+    bool loaded = !entry.thumbprint.empty();
+    if (!needsReload(entry.file, path, loaded)) {
+        return loaded ? &entry : nullptr;
+    }
+
+    std::string thumbprint = OAuthHelper::calculateCertificateThumbprint(path);
+    fileLoads_++;
+
+    if (thumbprint.empty()) {
+        return loaded ? &entry : nullptr;
+    }
+
+    if (thumbprint != entry.thumbprint) {
+        entry.thumbprint = thumbprint;
+        entry.file.generation++;
+        LOG_INFO("Loaded certificate thumbprint: " + path);
+    }
+    return &entry;
+}
+
+std::shared_ptr<EVP_PKEY> CredentialCache::getPrivateKey(const std::string& privateKeyPath) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    KeyEntry* entry = loadKeyLocked(privateKeyPath);
+    return entry ? entry->key : nullptr;
+}
+
+std::string CredentialCache::getCertificateThumbprint(const std::string& certificatePath) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CertEntry* entry = loadCertLocked(certificatePath);
+    return entry ? entry->thumbprint : "";
+}
+
+std::string CredentialCache::getClientAssertion(
+    const std::string& clientId,
+    const std::string& tenantId,
+    const std::string& certificatePath,
+    const std::string& privateKeyPath
+) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    KeyEntry* key = loadKeyLocked(privateKeyPath);
+    if (!key) {
+        return "";
+    }
+
+    CertEntry* cert = loadCertLocked(certificatePath);
+    if (!cert) {
+        LOG_ERROR("Failed to calculate certificate thumbprint");
+        return "";
+    }
+
+    std::string cacheKey = clientId + '\n' + tenantId + '\n' + certificatePath + '\n' + privateKeyPath;
+    AssertionEntry& assertion = assertions_[cacheKey];
+    long now = std::time(nullptr);
+
+    if (!assertion.jwt.empty() &&
+        assertion.keyGeneration == key->file.generation &&
+        assertion.certGeneration == cert->file.generation &&
+        now < assertion.expiresAt - reuseMargin_) {
+        LOG_DEBUG("Reusing cached client assertion");
+        return assertion.jwt;
+    }
+
+    long expiresAt = now + kAssertionLifetimeSeconds;
+    std::string jwt = OAuthHelper::signClientAssertion(
+        clientId, tenantId, cert->thumbprint, key->key.get(), now, expiresAt
+    );
+    signatures_++;
+
+    if (jwt.empty()) {
+        assertions_.erase(cacheKey);
+        return "";
+    }
+
+    assertion.jwt = jwt;
+    assertion.expiresAt = expiresAt;
+    assertion.keyGeneration = key->file.generation;
+    assertion.certGeneration = cert->file.generation;
+    return jwt;
+}
+
+void CredentialCache::setAssertionReuseMargin(int seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reuseMargin_ = seconds;
+}
+
+void CredentialCache::setFileCheckInterval(int seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    checkInterval_ = seconds;
+}
+
+void CredentialCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    keys_.clear();
+    certs_.clear();
+    assertions_.clear();
+    fileLoads_ = 0;
+    signatures_ = 0;
+}
+
+size_t CredentialCache::getFileLoadCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return fileLoads_;
+}
+
+size_t CredentialCache::getSignatureCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return signatures_;
+}
+
+} // namespace Pens
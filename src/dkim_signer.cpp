@@ -0,0 +1,318 @@
+#include "dkim_signer.hpp"
+#include "credential_cache.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <cctype>
+
+namespace Pens {
+
+namespace {
+
+std::string base64(const unsigned char* data, size_t length) {
+    std::string encoded(4 * ((length + 2) / 3), '\0');
+    int written = EVP_EncodeBlock(reinterpret_cast<unsigned char*>(&encoded[0]), data, static_cast<int>(length));
+    encoded.resize(written < 0 ? 0 : static_cast<size_t>(written));
+    return encoded;
+}
+
+bool isWsp(char c) {
+    return c == ' ' || c == '\t';
+}
+
+} // namespace
+
+DkimBodyHash::DkimBodyHash()
+    : ctx_(EVP_MD_CTX_new()) {
+    reset();
+}
+
+DkimBodyHash::~DkimBodyHash() {
+    EVP_MD_CTX_free(ctx_);
+}
+
+void DkimBodyHash::reset() {
+    pendingSpace_ = false;
+    pendingCr_ = false;
+    lineHasContent_ = false;
+    emptyLines_ = 0;
+    outLength_ = 0;
+    if (ctx_) {
+        EVP_DigestInit_ex(ctx_, EVP_sha256(), nullptr);
+    }
+}
+
+void DkimBodyHash::update(std::string_view data) {
+    for (char c : data) {
+        if (pendingCr_) {
+            pendingCr_ = false;
+            if (c == '\n') {
+                endLine();
+                continue;
+            }
+            content('\r'); // a lone CR is ordinary content
+        }
+
+        if (c == '\r') {
+            pendingCr_ = true;
+        } else if (c == '\n') {
+            endLine();
+        } else if (isWsp(c)) {
+            pendingSpace_ = true;
+        } else {
+            content(c);
+        }
+    }
+}
+
+std::string DkimBodyHash::finish() {
+    if (pendingCr_) {
+        pendingCr_ = false;
+        content('\r');
+    }
+    if (lineHasContent_) {
+        emit("\r\n", 2);
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    if (!ctx_ ||
+        (outLength_ > 0 && EVP_DigestUpdate(ctx_, out_, outLength_) != 1) ||
+        EVP_DigestFinal_ex(ctx_, digest, &length) != 1) {
+        reset();
+        return "";
+    }
+    reset();
+    return base64(digest, length);
+}
+
+void DkimBodyHash::emit(const char* data, size_t length) {
+    if (outLength_ + length > sizeof(out_)) {
+        EVP_DigestUpdate(ctx_, out_, outLength_);
+        outLength_ = 0;
+    }
+    std::copy(data, data + length, out_ + outLength_);
+    outLength_ += length;
+}
+
+void DkimBodyHash::content(char c) {
+    flush();
+    emit(&c, 1);
+    lineHasContent_ = true;
+}
+
+void DkimBodyHash::endLine() {
+    // Trailing whitespace is dropped; empty lines wait until content follows
+    pendingSpace_ = false;
+    if (lineHasContent_) {
+        emit("\r\n", 2);
+        lineHasContent_ = false;
+    } else {
+        emptyLines_++;
+    }
+}
+
+void DkimBodyHash::flush() {
+    // Emit what was held back now that more content follows on this line
+    for (; emptyLines_ > 0; emptyLines_--) {
+        emit("\r\n", 2);
+    }
+    if (pendingSpace_) {
+        emit(" ", 1);
+        pendingSpace_ = false;
+    }
+}
+
+DkimSigner::DkimSigner(DkimSettings settings)
+    : settings_(std::move(settings)) {
+    for (auto& name : settings_.headers) {
+        std::transform(name.begin(), name.end(), name.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+    }
+}
+
+bool DkimSigner::sign(MessageWriter& writer, std::time_t now) {
+    writer.setPrefix("");
+
+    // Walk the header block field by field, keeping the last instance of
+    // each signed field, then hand the rest of the stream to the body hash
+    std::vector<std::string> signedFields(settings_.headers.size());
+    std::string field;
+    std::string line;
+    bool inHeaders = true;
+    bool pendingCr = false;
+    DkimBodyHash bodyHash;
+
+    auto finishField = [&]() {
+        if (field.empty()) {
+            return;
+        }
+        size_t colon = field.find(':');
+        if (colon != std::string::npos) {
+            std::string name = field.substr(0, colon);
+            while (!name.empty() && isWsp(name.back())) {
+                name.pop_back();
+            }
+            std::transform(name.begin(), name.end(), name.begin(),
+                           [](unsigned char c) { return std::tolower(c); });
+            for (size_t i = 0; i < settings_.headers.size(); i++) {
+                if (settings_.headers[i] == name) {
+                    signedFields[i] = canonicalizeHeader(field);
+                }
+            }
+        }
+        field.clear();
+    };
+
+    auto endLine = [&]() {
+        if (line.empty()) {
+            finishField();
+            inHeaders = false;
+        } else if (isWsp(line[0]) && !field.empty()) {
+            field += "\r\n";
+            field += line;
+        } else {
+            finishField();
+            field = line;
+        }
+        line.clear();
+    };
+
+    auto consume = [&](std::string_view piece) {
+        for (size_t i = 0; i < piece.size(); i++) {
+            if (!inHeaders) {
+                bodyHash.update(piece.substr(i));
+                return;
+            }
+            char c = piece[i];
+            if (pendingCr) {
+                pendingCr = false;
+                if (c == '\n') {
+                    endLine();
+                    continue;
+                }
+                line += '\r';
+            }
+            if (c == '\r') {
+                pendingCr = true;
+            } else if (c == '\n') {
+                endLine();
+            } else {
+                line += c;
+            }
+        }
+    };
+
+    consume(writer.headers());
+    for (std::string_view piece : writer.body()) {
+        consume(piece);
+    }
+    if (inHeaders) {
+        // No body: the header block ends with the message
+        if (!line.empty()) {
+            endLine();
+        }
+        finishField();
+    }
+
+    std::string headerList;
+    std::string data;
+    for (size_t i = 0; i < signedFields.size(); i++) {
+        if (signedFields[i].empty()) {
+            continue;
+        }
+        headerList += (headerList.empty() ? "" : ":") + settings_.headers[i];
+        data += signedFields[i];
+        data += "\r\n";
+    }
+    if (headerList.empty()) {
+        LOG_ERROR("DKIM: message has none of the headers to sign");
+        return false;
+    }
+
+    std::string bodyHashValue = bodyHash.finish();
+    if (bodyHashValue.empty()) {
+        LOG_ERROR("DKIM: body hash failed");
+        return false;
+    }
+
+    std::string header = "DKIM-Signature: v=1; a=rsa-sha256; c=relaxed/relaxed; d=" + settings_.domain +
+                         "; s=" + settings_.selector + "; t=" + std::to_string(now) +
+                         "; h=" + headerList + "; bh=" + bodyHashValue + "; b=";
+    data += canonicalizeHeader(header);
+
+    std::string signature;
+    if (!signData(data, signature)) {
+        return false;
+    }
+    writer.setPrefix(header + signature + "\r\n");
+    return true;
+}
+
+std::string DkimSigner::canonicalizeHeader(std::string_view field) {
+    size_t colon = field.find(':');
+    std::string_view rawName = field.substr(0, colon);
+    while (!rawName.empty() && isWsp(rawName.back())) {
+        rawName.remove_suffix(1);
+    }
+
+    std::string canonical;
+    canonical.reserve(field.size());
+    for (char c : rawName) {
+        canonical += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    canonical += ':';
+    if (colon == std::string_view::npos) {
+        return canonical;
+    }
+
+    // Unfold, squeeze whitespace runs to one space, trim both ends of the value
+    bool pendingSpace = false;
+    for (size_t i = colon + 1; i < field.size(); i++) {
+        char c = field[i];
+        if (c == '\r' || c == '\n') {
+            continue;
+        }
+        if (isWsp(c)) {
+            pendingSpace = true;
+            continue;
+        }
+        if (pendingSpace && canonical.back() != ':') {
+            canonical += ' ';
+        }
+        pendingSpace = false;
+        canonical += c;
+    }
+    return canonical;
+}
+
+bool DkimSigner::signData(const std::string& data, std::string& signature) const {
+    std::shared_ptr<EVP_PKEY> key = CredentialCache::getInstance().getPrivateKey(settings_.privateKeyPath);
+    if (!key) {
+        LOG_ERROR("DKIM: cannot load signing key " + settings_.privateKeyPath);
+        return false;
+    }
+
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    if (!ctx) {
+        return false;
+    }
+    size_t length = 0;
+    std::vector<unsigned char> raw;
+    bool ok = EVP_DigestSignInit(ctx, nullptr, EVP_sha256(), nullptr, key.get()) == 1 &&
+              EVP_DigestSign(ctx, nullptr, &length,
+                             reinterpret_cast<const unsigned char*>(data.data()), data.size()) == 1;
+    if (ok) {
+        raw.resize(length);
+        ok = EVP_DigestSign(ctx, raw.data(), &length,
+                            reinterpret_cast<const unsigned char*>(data.data()), data.size()) == 1;
+    }
+    EVP_MD_CTX_free(ctx);
+    if (!ok) {
+        LOG_ERROR("DKIM: signing failed");
+        return false;
+    }
+    signature = base64(raw.data(), length);
+    return true;
+}
+
+} // namespace Pens
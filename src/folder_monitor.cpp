@@ -0,0 +1,574 @@
+#include "folder_monitor.hpp"
+#include "imap_keepalive.hpp"
+#include "imap_session_supervisor.hpp"
+#include "token_store.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <sstream>
+#include <tuple>
+
+namespace Pens {
+
+namespace {
+
+// Weight of the latest pass in a folder's activity score
+const double kActivityDecay = 0.7;
+
+int64_t steadyNowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool olderFirst(const FolderEmail& a, const FolderEmail& b) {
+    return std::tie(a.email.internalDate, a.folder, a.uid) <
+           std::tie(b.email.internalDate, b.folder, b.uid);
+}
+
+} // namespace
+
+FolderMonitor::FolderMonitor(FolderMonitorSettings settings, ConnectionFactory factory)
+    : settings_(std::move(settings)),
+      factory_(std::move(factory)),
+      keepalive_(nullptr),
+      running_(false),
+      notifyMode_(false),
+      lastRebalanceMs_(0),
+      assignmentEpoch_(0) {
+    settings_.maxConnections = std::max(1, settings_.maxConnections);
+    settings_.fetchBatch = std::max(1, settings_.fetchBatch);
+    settings_.initialBacklog = std::max(0, settings_.initialBacklog);
+    for (const auto& folder : settings_.folders) {
+        folders_[folder];
+    }
+    if (!settings_.statePath.empty() && loadState()) {
+        LOG_INFO("Resuming folder sync state from " + settings_.statePath);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    rebalanceLocked();
+}
+
+FolderMonitor::~FolderMonitor() {
+    stop();
+}
+
+void FolderMonitor::setKeepalive(ImapKeepalive* keepalive) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    keepalive_ = keepalive;
+}
+
+void FolderMonitor::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_ || assignment_.empty()) {
+        return;
+    }
+    running_ = true;
+    notifyMode_ = settings_.useNotify;
+    if (notifyMode_) {
+        // Try a single NOTIFY session first; its worker falls back to the pool
+        assignment_ = {settings_.folders};
+        workers_.push_back(std::make_unique<Worker>());
+        workers_[0]->thread = std::thread(&FolderMonitor::run, this, 0);
+    } else {
+        spawnWorkersLocked();
+    }
+    LOG_INFO("Monitoring " + std::to_string(folders_.size()) + " folders");
+}
+
+void FolderMonitor::stop() {
+    std::vector<std::unique_ptr<Worker>> workers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+        // Break out of IDLE and any blocking read
+        for (auto& worker : workers_) {
+            if (worker->client) {
+                worker->client->abortConnection();
+            }
+        }
+        workers.swap(workers_);
+    }
+    wakeCv_.notify_all();
+    readyCv_.notify_all();
+    for (auto& worker : workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+        if (keepalive_ && worker->keepaliveId) {
+            keepalive_->remove(worker->keepaliveId);
+        }
+    }
+}
+
+std::vector<FolderEmail> FolderMonitor::take(int timeoutMs) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (ready_.empty() && timeoutMs > 0) {
+        readyCv_.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                          [this]() { return !ready_.empty() || !running_; });
+    }
+    std::vector<FolderEmail> emails;
+    emails.swap(ready_);
+    lock.unlock();
+
+    std::sort(emails.begin(), emails.end(), olderFirst);
+    return emails;
+}
+
+void FolderMonitor::commit(const std::vector<FolderEmail>& emails) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool changed = false;
+    for (const auto& email : emails) {
+        auto it = folders_.find(email.folder);
+        if (it == folders_.end() || !it->second.synced || it->second.uidValidity != email.uidValidity) {
+            continue;  // resynced since it was fetched; its old UIDs mean nothing now
+        }
+        if (email.uid > it->second.committed) {
+            it->second.committed = email.uid;
+            changed = true;
+        }
+    }
+    if (changed) {
+        saveStateLocked();
+    }
+}
+
+bool FolderMonitor::hasPending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !ready_.empty();
+}
+
+std::vector<std::vector<std::string>> FolderMonitor::assignments() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return assignment_;
+}
+
+bool FolderMonitor::usingNotify() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return notifyMode_;
+}
+
+std::vector<std::vector<std::string>> FolderMonitor::assignByActivity(
+    const std::vector<std::pair<std::string, double>>& folders, size_t connections) {
+    connections = std::min(connections, folders.size());
+    std::vector<std::vector<std::string>> result(connections);
+    if (connections == 0) {
+        return result;
+    }
+
+    // Longest processing time first: busiest folder to the least loaded
+    // connection. Every folder costs at least a SELECT per pass, hence the +1.
+    std::vector<std::pair<std::string, double>> sorted = folders;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second > b.second;
+    });
+    std::vector<double> load(connections, 0.0);
+    for (const auto& folder : sorted) {
+        size_t target = static_cast<size_t>(std::min_element(load.begin(), load.end()) - load.begin());
+        result[target].push_back(folder.first);
+        load[target] += folder.second + 1.0;
+    }
+    return result;
+}
+
+void FolderMonitor::run(size_t index) {
+    std::mt19937 rng(std::random_device{}());
+    std::shared_ptr<ImapClient> client;
+    int failures = 0;
+    std::set<std::string> dirty;  // NOTIFY mode: folders due a sync
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        if (!client || !client->isConnected()) {
+            lock.unlock();
+            client = openSession(index);
+            lock.lock();
+            if (!running_) {
+                break;
+            }
+            if (!client) {
+                failures++;
+                int64_t delay = ImapSessionSupervisor::backoffDelayMs(
+                    failures, settings_.backoffBaseMs, settings_.backoffMaxMs,
+                    std::uniform_real_distribution<double>(0.0, 1.0)(rng));
+                LOG_WARNING("Folder connection " + std::to_string(index) + " unavailable; retrying in " +
+                            std::to_string(delay) + " ms");
+                waitLocked(lock, delay);
+                continue;
+            }
+            failures = 0;
+
+            if (notifyMode_) {
+                lock.unlock();
+                bool enabled = enableNotify(*client);
+                lock.lock();
+                if (!running_) {
+                    break;
+                }
+                if (!enabled && client->isConnected()) {
+                    LOG_INFO("Server lacks NOTIFY; spreading folders over a connection pool");
+                    notifyMode_ = false;
+                    spawnWorkersLocked();
+                }
+                // Whatever changed while we were away
+                dirty.insert(settings_.folders.begin(), settings_.folders.end());
+            }
+        }
+
+        if (notifyMode_) {
+            std::vector<std::string> waiting;
+            claimFoldersLocked(index, waiting);
+            lock.unlock();
+            for (auto it = dirty.begin(); it != dirty.end() && client->isConnected();) {
+                if (syncFolder(*client, *it, index)) {
+                    it = dirty.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            std::vector<ImapMailboxEvent> events;
+            bool alive = client->isConnected() && client->waitForEvents(settings_.idleTimeoutMs, events);
+            lock.lock();
+            if (!alive) {
+                continue;
+            }
+            if (events.empty()) {
+                // Quiet for a whole idleTimeout: resync everything in case an event was missed
+                dirty.insert(settings_.folders.begin(), settings_.folders.end());
+            }
+            for (const auto& event : events) {
+                if (needsSyncLocked(event)) {
+                    dirty.insert(event.mailbox);
+                }
+            }
+            continue;
+        }
+
+        if (index == 0 && steadyNowMs() - lastRebalanceMs_ >= settings_.rebalanceIntervalMs) {
+            rebalanceLocked();
+        }
+        uint64_t epoch = assignmentEpoch_;
+        int64_t rebalanceAt = index == 0 ? lastRebalanceMs_ + settings_.rebalanceIntervalMs : INT64_MAX;
+        std::vector<std::string> waiting;
+        std::vector<std::string> folders = claimFoldersLocked(index, waiting);
+        lock.unlock();
+
+        for (const auto& folder : changedFolders(*client, folders)) {
+            if (!syncFolder(*client, folder, index)) {
+                break;
+            }
+        }
+
+        bool waited = false;
+        if (client->isConnected() && folders.size() == 1 && waiting.empty() && client->hasCapability("IDLE")) {
+            // Sole folder on this connection: let the server push changes,
+            // until a rebalance is due or hands the folder to another connection
+            bool changed = false;
+            waited = client->idle(settings_.idleTimeoutMs, changed, [this, epoch, rebalanceAt]() {
+                return assignmentEpoch_.load() != epoch || steadyNowMs() >= rebalanceAt;
+            });
+        }
+        lock.lock();
+        releaseFoldersLocked(index);
+        if (!waited && client->isConnected()) {
+            // A new assignment, or a folder handed over by another pass, starts the next pass early
+            waitLocked(lock, settings_.pollIntervalMs, [this, epoch, &waiting]() {
+                if (assignmentEpoch_.load() != epoch) {
+                    return true;
+                }
+                return std::any_of(waiting.begin(), waiting.end(), [this](const std::string& folder) {
+                    return folders_[folder].owner < 0;
+                });
+            });
+        }
+    }
+}
+
+std::shared_ptr<ImapClient> FolderMonitor::openSession(size_t index) {
+    std::shared_ptr<ImapClient> client = factory_ ? factory_() : nullptr;
+    if (!client || !client->isConnected()) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index >= workers_.size()) {
+        return nullptr;
+    }
+    Worker& worker = *workers_[index];
+    if (keepalive_) {
+        if (worker.keepaliveId) {
+            keepalive_->remove(worker.keepaliveId);
+        }
+        worker.keepaliveId = keepalive_->add(client);
+    }
+    worker.client = client;
+    if (!running_) {
+        // stop() ran while we were connecting and could not abort this one
+        client->abortConnection();
+        return nullptr;
+    }
+    return client;
+}
+
+bool FolderMonitor::enableNotify(ImapClient& client) {
+    if (!client.hasCapability("NOTIFY")) {
+        return false;
+    }
+    if (!client.notifySet({"mailboxes " + ImapClient::mailboxList(settings_.folders)})) {
+        return false;
+    }
+    LOG_INFO("Watching " + std::to_string(settings_.folders.size()) + " folders on one connection with NOTIFY");
+    return true;
+}
+
+void FolderMonitor::spawnWorkersLocked() {
+    rebalanceLocked();
+    for (size_t i = workers_.size(); i < assignment_.size(); i++) {
+        workers_.push_back(std::make_unique<Worker>());
+        workers_[i]->thread = std::thread(&FolderMonitor::run, this, i);
+    }
+    LOG_INFO("Monitoring folders over " + std::to_string(workers_.size()) + " connections");
+}
+
+std::vector<std::string> FolderMonitor::changedFolders(ImapClient& client,
+                                                       const std::vector<std::string>& folders) {
+    if (folders.size() < 2 || !client.hasCapability("LIST-STATUS")) {
+        return folders;
+    }
+    // One LIST-STATUS for just this connection's folders instead of a SELECT
+    // and SEARCH per folder; other connections ask about their own
+    std::vector<ImapMailboxInfo> mailboxes = client.listMailboxInfo(folders, true);
+    if (!client.isConnected()) {
+        return {};
+    }
+    std::map<std::string, const ImapMailboxInfo*> byName;
+    for (const auto& info : mailboxes) {
+        byName[info.name] = &info;
+    }
+
+    std::vector<std::string> changed;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& folder : folders) {
+        auto it = byName.find(folder);
+        if (it != byName.end() && it->second->hasStatus) {
+            ImapMailboxEvent status;
+            status.mailbox = folder;
+            status.messages = it->second->messages;
+            status.uidNext = it->second->uidNext;
+            status.uidValidity = it->second->uidValidity;
+            if (!needsSyncLocked(status)) {
+                continue;
+            }
+        }
+        changed.push_back(folder);
+    }
+    return changed;
+}
+
+bool FolderMonitor::needsSyncLocked(const ImapMailboxEvent& event) {
+    auto it = folders_.find(event.mailbox);
+    if (it == folders_.end()) {
+        return false;
+    }
+    const FolderState& state = it->second;
+    if (!state.synced || event.uidNext == 0) {
+        return true;  // an EXISTS on the selected folder, or nothing to compare with
+    }
+    if (event.uidValidity != 0 && event.uidValidity != state.uidValidity) {
+        return true;
+    }
+    // Expunges leave UIDNEXT alone and need no sync
+    return event.uidNext - 1 > state.watermark;
+}
+
+bool FolderMonitor::syncFolder(ImapClient& client, const std::string& folder, size_t index) {
+    if (client.getCurrentMailbox() != folder && !client.selectMailbox(folder)) {
+        if (client.isConnected()) {
+            LOG_WARNING("Cannot select folder " + folder);
+            return true;  // the folder is the problem, not the session
+        }
+        return false;
+    }
+
+    bool synced;
+    uint32_t watermark;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        FolderState& state = folders_[folder];
+        if (state.owner != static_cast<int>(index)) {
+            return true;  // handed to another connection; it syncs the folder
+        }
+        uint32_t validity = client.getUidValidity();
+        if (state.synced && state.uidValidity != 0 && validity != 0 && validity != state.uidValidity) {
+            LOG_WARNING("UIDVALIDITY of " + folder + " changed; resetting sync position");
+            state.synced = false;
+            state.watermark = 0;
+            state.committed = 0;
+        }
+        state.uidValidity = validity;
+        synced = state.synced;
+        watermark = state.watermark;
+    }
+
+    std::vector<uint32_t> uids = client.searchUidsAfter(synced ? watermark : 0);
+    if (!client.isConnected()) {
+        return false;
+    }
+
+    size_t first = 0;
+    size_t last = std::min(uids.size(), static_cast<size_t>(settings_.fetchBatch));
+    if (!synced) {
+        // First sync: deliver only the newest few and start from there
+        size_t backlog = std::min(uids.size(), static_cast<size_t>(settings_.initialBacklog));
+        first = uids.size() - backlog;
+        last = uids.size();
+        watermark = first > 0 ? uids[first - 1] : 0;
+    }
+
+    std::vector<FolderEmail> fetched;
+    for (size_t i = first; i < last; i++) {
+        Email email = client.fetchEmail(std::to_string(uids[i]));
+        if (!client.isConnected()) {
+            break;
+        }
+        fetched.push_back(FolderEmail{folder, uids[i], std::move(email), client.getUidValidity()});
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    FolderState& state = folders_[folder];
+    if (state.owner != static_cast<int>(index)) {
+        LOG_WARNING("Folder " + folder + " changed hands mid-sync; leaving its messages to the new owner");
+        return client.isConnected();
+    }
+    // The persisted watermark waits for commit(); only a first sync's
+    // starting point is saved straight away
+    if (!state.synced) {
+        state.synced = true;
+        state.committed = watermark;
+        saveStateLocked();
+    }
+    state.watermark = fetched.empty() ? watermark : fetched.back().uid;
+    state.activity = state.activity * kActivityDecay + static_cast<double>(fetched.size());
+    if (!fetched.empty()) {
+        for (auto& email : fetched) {
+            ready_.push_back(std::move(email));
+        }
+        readyCv_.notify_all();
+    }
+    return client.isConnected();
+}
+
+std::vector<std::string> FolderMonitor::claimFoldersLocked(size_t index, std::vector<std::string>& waiting) {
+    std::vector<std::string> claimed;
+    if (index >= assignment_.size()) {
+        return claimed;
+    }
+    for (const auto& folder : assignment_[index]) {
+        FolderState& state = folders_[folder];
+        if (state.owner < 0 || state.owner == static_cast<int>(index)) {
+            state.owner = static_cast<int>(index);
+            claimed.push_back(folder);
+        } else {
+            waiting.push_back(folder);
+        }
+    }
+    return claimed;
+}
+
+void FolderMonitor::releaseFoldersLocked(size_t index) {
+    const std::vector<std::string> none;
+    const std::vector<std::string>& kept = index < assignment_.size() ? assignment_[index] : none;
+    bool released = false;
+    for (auto& entry : folders_) {
+        if (entry.second.owner == static_cast<int>(index) &&
+            std::find(kept.begin(), kept.end(), entry.first) == kept.end()) {
+            entry.second.owner = -1;
+            released = true;
+        }
+    }
+    if (released) {
+        wakeCv_.notify_all();
+    }
+}
+
+void FolderMonitor::rebalanceLocked() {
+    std::vector<std::pair<std::string, double>> activity;
+    for (const auto& folder : settings_.folders) {
+        activity.emplace_back(folder, folders_[folder].activity);
+    }
+    size_t connections = std::min(folders_.size(), static_cast<size_t>(settings_.maxConnections));
+    std::vector<std::vector<std::string>> assignment = assignByActivity(activity, connections);
+
+    // Workers pick up their new folder set on their next pass
+    bool changed = assignment != assignment_;
+    if (!assignment_.empty() && changed) {
+        LOG_DEBUG("Rebalanced folders across " + std::to_string(connections) + " connections");
+    }
+    assignment_ = std::move(assignment);
+    if (changed) {
+        assignmentEpoch_++;
+        wakeCv_.notify_all();
+    }
+    lastRebalanceMs_ = steadyNowMs();
+}
+
+bool FolderMonitor::waitLocked(std::unique_lock<std::mutex>& lock, int64_t ms,
+                               const std::function<bool()>& wake) {
+    wakeCv_.wait_for(lock, std::chrono::milliseconds(ms), [this, &wake]() {
+        return !running_ || (wake && wake());
+    });
+    return running_;
+}
+
+bool FolderMonitor::loadState() {
+    std::string contents;
+    if (!TokenStore::readFile(settings_.statePath, contents)) {
+        return false;
+    }
+    // One folder per line: "<uidvalidity> <uid> <folder name>"
+    std::istringstream in(contents);
+    std::string line;
+    bool loaded = false;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        unsigned long validity = 0;
+        unsigned long uid = 0;
+        std::string folder;
+        if (!(fields >> validity >> uid) || !std::getline(fields >> std::ws, folder) || folder.empty()) {
+            LOG_WARNING("Ignoring malformed line in " + settings_.statePath);
+            continue;
+        }
+        auto it = folders_.find(folder);
+        if (it == folders_.end()) {
+            continue;  // no longer monitored
+        }
+        it->second.uidValidity = static_cast<uint32_t>(validity);
+        it->second.watermark = static_cast<uint32_t>(uid);
+        it->second.committed = it->second.watermark;
+        it->second.synced = true;
+        loaded = true;
+    }
+    return loaded;
+}
+
+void FolderMonitor::saveStateLocked() const {
+    if (settings_.statePath.empty()) {
+        return;
+    }
+    std::string contents;
+    for (const auto& entry : folders_) {
+        if (entry.second.synced) {
+            contents += std::to_string(entry.second.uidValidity) + " " +
+                        std::to_string(entry.second.committed) + " " + entry.first + "\n";
+        }
+    }
+    if (!TokenStore::writeFileAtomically(settings_.statePath, contents, 0644)) {
+        LOG_ERROR("Failed to save sync state: " + settings_.statePath);
+    }
+}
+
+} // namespace Pens
@@ -0,0 +1,234 @@
+#include "http_client.hpp"
+#include "logger.hpp"
+#include <memory>
+
+namespace Pens {
+
+struct HttpClient::Transfer {
+    HttpRequest request;
+    HttpResponse response;
+    Callback callback;
+    struct curl_slist* headers = nullptr;
+
+    ~Transfer() {
+        if (headers) {
+            curl_slist_free_all(headers);
+        }
+    }
+};
+
+HttpClient& HttpClient::getInstance() {
+    static HttpClient instance;
+    return instance;
+}
+
+HttpClient::HttpClient()
+    : multi_(nullptr),
+      running_(true),
+      verifyPeer_(true),
+      connectionsOpened_(0) {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    multi_ = curl_multi_init();
+    curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS, 8L);
+    curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    worker_ = std::thread(&HttpClient::run, this);
+    LOG_DEBUG("Shared HTTP client initialized");
+}
+
+HttpClient::~HttpClient() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    curl_multi_wakeup(multi_);
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    for (CURL* easy : idleHandles_) {
+        curl_easy_cleanup(easy);
+    }
+    curl_multi_cleanup(multi_);
+    curl_global_cleanup();
+}
+
+void HttpClient::submit(HttpRequest request, Callback callback) {
+    auto* transfer = new Transfer();
+    transfer->request = std::move(request);
+    transfer->callback = std::move(callback);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (running_) {
+            pending_.push_back(transfer);
+            transfer = nullptr;
+        }
+    }
+    if (transfer) {
+        transfer->response.error = "HTTP client shut down";
+        transfer->callback(transfer->response);
+        delete transfer;
+        return;
+    }
+    curl_multi_wakeup(multi_);
+}
+
+std::future<HttpResponse> HttpClient::submit(HttpRequest request) {
+    auto promise = std::make_shared<std::promise<HttpResponse>>();
+    std::future<HttpResponse> future = promise->get_future();
+    submit(std::move(request), [promise](const HttpResponse& response) {
+        promise->set_value(response);
+    });
+    return future;
+}
+
+HttpResponse HttpClient::post(const std::string& url,
+                              const std::string& body,
+                              const std::vector<std::string>& headers) {
+    HttpRequest request;
+    request.url = url;
+    request.body = body;
+    request.headers = headers;
+    return submit(std::move(request)).get();
+}
+
+void HttpClient::setCaInfo(const std::string& caFile) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    caInfo_ = caFile;
+}
+
+void HttpClient::setVerifyPeer(bool verify) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    verifyPeer_ = verify;
+}
+
+void HttpClient::setMaxConnectionsPerHost(long maxConnections) {
+    curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS, maxConnections);
+}
+
+long HttpClient::getConnectionsOpened() const {
+    return connectionsOpened_.load();
+}
+
+void HttpClient::run() {
+    while (true) {
+        std::deque<Transfer*> incoming;
+        std::string caInfo;
+        bool verifyPeer;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!running_) {
+                break;
+            }
+            incoming.swap(pending_);
+            caInfo = caInfo_;
+            verifyPeer = verifyPeer_;
+        }
+
+        for (Transfer* transfer : incoming) {
+            startTransfer(transfer, caInfo, verifyPeer);
+        }
+
+        int stillRunning = 0;
+        curl_multi_perform(multi_, &stillRunning);
+
+        CURLMsg* msg;
+        int queued = 0;
+        while ((msg = curl_multi_info_read(multi_, &queued)) != nullptr) {
+            if (msg->msg == CURLMSG_DONE) {
+                finishTransfer(msg->easy_handle, msg->data.result);
+            }
+        }
+
+        curl_multi_poll(multi_, nullptr, 0, 1000, nullptr);
+    }
+
+    // Fail whatever is still queued or in flight
+    std::deque<Transfer*> leftover;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        leftover.swap(pending_);
+    }
+    for (Transfer* transfer : leftover) {
+        transfer->response.error = "HTTP client shut down";
+        transfer->callback(transfer->response);
+        delete transfer;
+    }
+    while (!active_.empty()) {
+        finishTransfer(*active_.begin(), CURLE_ABORTED_BY_CALLBACK);
+    }
+}
+
+void HttpClient::startTransfer(Transfer* transfer, const std::string& caInfo, bool verifyPeer) {
+    CURL* easy = nullptr;
+    if (!idleHandles_.empty()) {
+        easy = idleHandles_.back();
+        idleHandles_.pop_back();
+        curl_easy_reset(easy);
+    } else {
+        easy = curl_easy_init();
+    }
+
+    if (!easy) {
+        transfer->response.error = "Failed to initialize CURL handle";
+        transfer->callback(transfer->response);
+        delete transfer;
+        return;
+    }
+
+    for (const auto& header : transfer->request.headers) {
+        transfer->headers = curl_slist_append(transfer->headers, header.c_str());
+    }
+
+    curl_easy_setopt(easy, CURLOPT_URL, transfer->request.url.c_str());
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, transfer->headers);
+    if (!transfer->request.body.empty()) {
+        curl_easy_setopt(easy, CURLOPT_POST, 1L);
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDS, transfer->request.body.c_str());
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE, static_cast<long>(transfer->request.body.size()));
+    }
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, HttpClient::writeCallback);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, &transfer->response.body);
+    curl_easy_setopt(easy, CURLOPT_TIMEOUT, transfer->request.timeoutSeconds);
+    curl_easy_setopt(easy, CURLOPT_SSL_VERIFYPEER, verifyPeer ? 1L : 0L);
+    curl_easy_setopt(easy, CURLOPT_SSL_VERIFYHOST, verifyPeer ? 2L : 0L);
+    curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+    if (!caInfo.empty()) {
+        curl_easy_setopt(easy, CURLOPT_CAINFO, caInfo.c_str());
+    }
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, transfer);
+
+    curl_multi_add_handle(multi_, easy);
+    active_.insert(easy);
+}
+
+void HttpClient::finishTransfer(CURL* easy, CURLcode result) {
+    Transfer* transfer = nullptr;
+    curl_easy_getinfo(easy, CURLINFO_PRIVATE, reinterpret_cast<char**>(&transfer));
+
+    long newConnections = 0;
+    curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &newConnections);
+    connectionsOpened_ += newConnections;
+
+    if (result == CURLE_OK) {
+        transfer->response.transportOk = true;
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &transfer->response.status);
+    } else {
+        transfer->response.error = curl_easy_strerror(result);
+    }
+
+    curl_multi_remove_handle(multi_, easy);
+    active_.erase(easy);
+    idleHandles_.push_back(easy);
+
+    transfer->callback(transfer->response);
+    delete transfer;
+}
+
+size_t HttpClient::writeCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+    size_t totalSize = size * nmemb;
+    std::string* str = static_cast<std::string*>(userp);
+    str->append(static_cast<char*>(contents), totalSize);
+    return totalSize;
+}
+
+} // namespace Pens
@@ -1,12 +1,22 @@
 #include "imap_client.hpp"
+#include "kernel_tls.hpp"
 #include "oauth_helper.hpp"
 #include "logger.hpp"
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <cerrno>
+#include <cstdio>
 #include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -15,11 +25,151 @@
 
 namespace Pens {
 
+namespace {
+
+int64_t steadyNowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Walks an IMAP response as sendCommand returns it: CRLF-separated lines
+// with literal bytes inline after each "{N}"
+class ResponseCursor {
+public:
+    explicit ResponseCursor(const std::string& text) : text_(text), pos_(0) {}
+    
+    bool atEnd() const { return pos_ >= text_.size(); }
+    
+    bool startsWith(const char* prefix) const {
+        return text_.compare(pos_, std::strlen(prefix), prefix) == 0;
+    }
+    
+    void skip(size_t count) { pos_ = std::min(text_.size(), pos_ + count); }
+    
+    bool consume(char c) {
+        skipSpaces();
+        if (pos_ < text_.size() && text_[pos_] == c) {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+    
+    // Atom, quoted string or literal; isNil is set for the atom NIL
+    bool readString(std::string& out, bool* isNil = nullptr) {
+        skipSpaces();
+        out.clear();
+        if (isNil) {
+            *isNil = false;
+        }
+        if (pos_ >= text_.size()) {
+            return false;
+        }
+        if (text_[pos_] == '"') {
+            for (pos_++; pos_ < text_.size() && text_[pos_] != '"'; pos_++) {
+                if (text_[pos_] == '\\' && pos_ + 1 < text_.size()) {
+                    pos_++;
+                }
+                out += text_[pos_];
+            }
+            pos_++;
+            return pos_ <= text_.size();
+        }
+        if (text_[pos_] == '{') {
+            size_t close = text_.find('}', pos_);
+            if (close == std::string::npos || text_.compare(close + 1, 2, "\r\n") != 0) {
+                return false;
+            }
+            size_t length = std::strtoul(text_.c_str() + pos_ + 1, nullptr, 10);
+            pos_ = close + 3;
+            out = text_.substr(pos_, length);
+            skip(length);
+            return out.size() == length;
+        }
+        size_t end = text_.find_first_of(" ()\r", pos_);
+        end = end == std::string::npos ? text_.size() : end;
+        out = text_.substr(pos_, end - pos_);
+        pos_ = end;
+        if (isNil && (out == "NIL" || out == "nil")) {
+            *isNil = true;
+        }
+        return !out.empty();
+    }
+    
+    // Past the end of the current line, stepping over any literals in it
+    void nextLine() {
+        while (pos_ < text_.size()) {
+            size_t eol = text_.find("\r\n", pos_);
+            if (eol == std::string::npos) {
+                pos_ = text_.size();
+                return;
+            }
+            size_t open = text_.rfind('{', eol);
+            if (eol > pos_ && text_[eol - 1] == '}' && open != std::string::npos && open >= pos_) {
+                pos_ = eol + 2;
+                skip(std::strtoul(text_.c_str() + open + 1, nullptr, 10));
+                continue;
+            }
+            pos_ = eol + 2;
+            return;
+        }
+    }
+    
+private:
+    const std::string& text_;
+    size_t pos_;
+    
+    void skipSpaces() {
+        while (pos_ < text_.size() && text_[pos_] == ' ') {
+            pos_++;
+        }
+    }
+};
+
+// "(NAME n NAME n ...)" as in STATUS responses; false if malformed
+bool parseStatusItems(ResponseCursor& cursor, uint32_t& messages, uint32_t& unseen,
+                      uint32_t& uidNext, uint32_t& uidValidity) {
+    if (!cursor.consume('(')) {
+        return false;
+    }
+    std::string name;
+    std::string value;
+    while (true) {
+        if (cursor.consume(')')) {
+            return true;
+        }
+        if (!cursor.readString(name) || !cursor.readString(value)) {
+            return false;
+        }
+        std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+        uint32_t number = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        if (name == "MESSAGES") {
+            messages = number;
+        } else if (name == "UNSEEN") {
+            unseen = number;
+        } else if (name == "UIDNEXT") {
+            uidNext = number;
+        } else if (name == "UIDVALIDITY") {
+            uidValidity = number;
+        }
+    }
+}
+
+bool equalsIgnoreCase(const std::string& a, const std::string& b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+           });
+}
+
+} // namespace
+
 // Internal connection structure
 struct ImapClient::ImapConnection {
     int socket;
     SSL* ssl;
     SSL_CTX* sslContext;
+    std::string readBuffer;  // bytes received but not yet consumed
     
     ImapConnection() : socket(-1), ssl(nullptr), sslContext(nullptr) {}
     
@@ -44,7 +194,16 @@ ImapClient::ImapClient(const std::string& server, int port, bool useSsl)
       useSsl_(useSsl),
       connected_(false),
       authenticated_(false),
-      currentMailbox_("") {
+      currentMailbox_(""),
+      uidValidity_(0),
+      uidNext_(0),
+      kernelTls_(true),
+      spillLiterals_(false),
+      readTimeoutMs_(-1),
+      nextTag_(1),
+      lastActivityMs_(steadyNowMs()),
+      lastReadTimedOut_(false),
+      activeSocket_(-1) {
     
     LOG_INFO("PENS IMAP Client initialized for server: " + server);
 }
@@ -56,33 +215,18 @@ ImapClient::~ImapClient() {
 }
 
 bool ImapClient::connect() {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
     LOG_INFO("Attempting to connect to " + server_ + ":" + std::to_string(port_));
     
-    // Resolve hostname
-    struct hostent* host = gethostbyname(server_.c_str());
-    if (!host) {
-        LOG_ERROR("Failed to resolve hostname: " + server_);
-        return false;
-    }
-    
-    // Create socket
-    connection_->socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (connection_->socket < 0) {
-        LOG_ERROR("Failed to create socket");
-        return false;
-    }
-    
-    // Connect
-    struct sockaddr_in serverAddr;
-    std::memset(&serverAddr, 0, sizeof(serverAddr));
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(port_);
-    std::memcpy(&serverAddr.sin_addr, host->h_addr_list[0], host->h_length);
+    // Start from a clean slate; a previous session may have died mid-command
+    resetConnection();
+    connected_ = false;
+    authenticated_ = false;
+    currentMailbox_.clear();
+    uidValidity_ = 0;
+    uidNext_ = 0;
     
-    if (::connect(connection_->socket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
-        LOG_ERROR("Failed to connect to server");
-        close(connection_->socket);
-        connection_->socket = -1;
+    if (!openSocket()) {
         return false;
     }
     
@@ -95,46 +239,146 @@ bool ImapClient::connect() {
         connection_->sslContext = SSL_CTX_new(TLS_client_method());
         if (!connection_->sslContext) {
             LOG_ERROR("Failed to create SSL context");
+            resetConnection();
             return false;
         }
+        if (kernelTls_) {
+            KernelTls::enable(connection_->sslContext);
+        }
         
         connection_->ssl = SSL_new(connection_->sslContext);
         SSL_set_fd(connection_->ssl, connection_->socket);
         
         if (SSL_connect(connection_->ssl) != 1) {
             LOG_ERROR("SSL handshake failed");
+            resetConnection();
             return false;
         }
         
         LOG_INFO("SSL connection established");
+        KernelTls::report(connection_->ssl, server_);
     }
     
     connected_ = true;
-    LOG_INFO("Successfully connected to IMAP server");
     
     // Read welcome message
     std::string welcome = sendCommand("");
     LOG_DEBUG("Server welcome: " + welcome);
+    if (!connected_ || welcome.compare(0, 5, "* BYE") == 0) {
+        LOG_ERROR("IMAP server refused the connection");
+        dropConnection("greeting refused");
+        return false;
+    }
     
+    LOG_INFO("Successfully connected to IMAP server");
     return true;
 }
 
+bool ImapClient::openSocket() {
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = nullptr;
+    if (getaddrinfo(server_.c_str(), std::to_string(port_).c_str(), &hints, &addresses) != 0 || !addresses) {
+        LOG_ERROR("Failed to resolve hostname: " + server_);
+        return false;
+    }
+    
+    // Non-blocking connect so an unreachable host fails after connectSeconds
+    // rather than the kernel's SYN retry budget (minutes)
+    int timeoutMs = timeouts_.connectSeconds > 0 ? timeouts_.connectSeconds * 1000 : -1;
+    for (struct addrinfo* address = addresses; address; address = address->ai_next) {
+        int fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        
+        bool ok = ::connect(fd, address->ai_addr, address->ai_addrlen) == 0;
+        if (!ok && errno == EINPROGRESS) {
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            int ready;
+            do {
+                ready = poll(&pfd, 1, timeoutMs);
+            } while (ready < 0 && errno == EINTR);
+            int error = 0;
+            socklen_t length = sizeof(error);
+            ok = ready > 0 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0;
+        }
+        if (ok) {
+            fcntl(fd, F_SETFL, flags);
+            connection_->socket = fd;
+            std::lock_guard<std::mutex> lock(socketMutex_);
+            activeSocket_ = fd;
+            break;
+        }
+        close(fd);
+    }
+    freeaddrinfo(addresses);
+    
+    if (connection_->socket < 0) {
+        LOG_ERROR("Failed to connect to server");
+        return false;
+    }
+    applySocketOptions();
+    return true;
+}
+
+void ImapClient::applySocketOptions() {
+    int fd = connection_->socket;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    if (timeouts_.commandSeconds > 0) {
+        // Backstop for blocking reads inside SSL; readBytes polls with the real deadline
+        struct timeval timeout;
+        timeout.tv_sec = timeouts_.commandSeconds;
+        timeout.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+    
+    if (timeouts_.keepaliveIdleSeconds > 0) {
+        // The kernel probes an idle connection and resets it when the peer
+        // (or a NAT box that forgot us) stops answering. TCP_USER_TIMEOUT
+        // does the same for data that is never acknowledged.
+        int idle = timeouts_.keepaliveIdleSeconds;
+        int interval = std::max(1, timeouts_.keepaliveIntervalSeconds);
+        int probes = std::max(1, timeouts_.keepaliveProbes);
+        unsigned int userTimeoutMs = static_cast<unsigned int>(idle + interval * probes) * 1000;
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+        setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &userTimeoutMs, sizeof(userTimeoutMs));
+    }
+}
+
 bool ImapClient::authenticate(const std::string& username, const std::string& password) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
     if (!connected_) {
         LOG_ERROR("Cannot authenticate: not connected");
         return false;
     }
     
     LOG_INFO("Authenticating as: " + username);
+    {
+        std::lock_guard<std::mutex> lock(credentialsMutex_);
+        username_ = username;
+        password_ = password;
+        useOAuth_ = false;
+    }
     
     // Send LOGIN command with properly quoted credentials
     // Gmail IMAP requires quoted strings for username and password
-    std::string loginCmd = "A001 LOGIN \"" + username + "\" \"" + password + "\"\r\n";
+    std::string loginCmd = "LOGIN \"" + username + "\" \"" + password + "\"";
     std::string response = sendCommand(loginCmd);
     
     LOG_DEBUG("IMAP LOGIN response: " + response);
     
-    if (response.find("OK") != std::string::npos) {
+    if (parseResponse(response)) {
         authenticated_ = true;
         LOG_INFO("Authentication successful");
         return true;
@@ -145,23 +389,30 @@ bool ImapClient::authenticate(const std::string& username, const std::string& pa
 }
 
 bool ImapClient::authenticateOAuth(const std::string& username, const std::string& accessToken) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
     if (!connected_) {
         LOG_ERROR("Cannot authenticate: not connected");
         return false;
     }
     
     LOG_INFO("Authenticating with OAuth 2.0 as: " + username);
+    {
+        std::lock_guard<std::mutex> lock(credentialsMutex_);
+        username_ = username;
+        oauthToken_ = accessToken;
+        useOAuth_ = true;
+    }
     
     // Generate XOAUTH2 authentication string
     std::string xoauth2String = OAuthHelper::generateXOAuth2String(username, accessToken);
     
     // AUTHENTICATE XOAUTH2 command
-    std::string authCmd = "A002 AUTHENTICATE XOAUTH2 " + xoauth2String + "\r\n";
+    std::string authCmd = "AUTHENTICATE XOAUTH2 " + xoauth2String;
     std::string response = sendCommand(authCmd);
     
     LOG_DEBUG("IMAP OAUTH response: " + response);
     
-    if (response.find("OK") != std::string::npos) {
+    if (parseResponse(response)) {
         authenticated_ = true;
         LOG_INFO("OAuth authentication successful");
         return true;
@@ -177,38 +428,447 @@ bool ImapClient::authenticateOAuth(const std::string& username, const std::strin
 }
 
 bool ImapClient::disconnect() {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
     if (!connected_) {
         return true;
     }
     
     if (authenticated_) {
-        sendCommand("A999 LOGOUT\r\n");
+        sendCommand("LOGOUT");
     }
     
-    connection_.reset(new ImapConnection());
+    resetConnection();
     connected_ = false;
     authenticated_ = false;
+    currentMailbox_.clear();
     
     LOG_INFO("Disconnected from IMAP server");
     
     return true;
 }
 
+void ImapClient::updateOAuthToken(const std::string& accessToken) {
+    std::lock_guard<std::mutex> lock(credentialsMutex_);
+    oauthToken_ = accessToken;
+    LOG_DEBUG("IMAP session received refreshed OAuth token");
+}
+
+bool ImapClient::reauthenticate() {
+    if (authenticated_) {
+        // IMAP forbids AUTHENTICATE in the authenticated state; the session
+        // stays valid and the stored token is used the next time around.
+        return true;
+    }
+    
+    std::string username;
+    std::string secret;
+    bool useOAuth;
+    {
+        std::lock_guard<std::mutex> lock(credentialsMutex_);
+        username = username_;
+        secret = useOAuth_ ? oauthToken_ : password_;
+        useOAuth = useOAuth_;
+    }
+    
+    if (username.empty()) {
+        LOG_ERROR("Cannot re-authenticate: no stored credentials");
+        return false;
+    }
+    
+    return useOAuth ? authenticateOAuth(username, secret) : authenticate(username, secret);
+}
+
 bool ImapClient::isConnected() const {
     return connected_ && authenticated_;
 }
 
+bool ImapClient::noop() {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    if (!connected_) {
+        return false;
+    }
+    std::string response = sendCommand("NOOP");
+    return connected_ && parseResponse(response);
+}
+
+void ImapClient::setCommandTimeout(int seconds) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    timeouts_.commandSeconds = std::max(0, seconds);
+}
+
+void ImapClient::setTimeouts(const ImapTimeouts& timeouts) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    timeouts_ = timeouts;
+}
+
+void ImapClient::setKernelTls(bool enabled) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    kernelTls_ = enabled;
+}
+
+void ImapClient::setSpillSettings(const MessageSpillSettings& settings) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    spillSettings_ = settings;
+}
+
+bool ImapClient::probeIfIdle(int64_t idleMs, int timeoutMs) {
+    std::unique_lock<std::recursive_mutex> lock(commandMutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return true;  // a command is in flight; its own deadline covers it
+    }
+    if (!connected_) {
+        return false;
+    }
+    if (steadyNowMs() - lastActivityMs_.load() < idleMs) {
+        return true;
+    }
+    std::string response = sendCommand("NOOP", timeoutMs);
+    return connected_ && parseResponse(response);
+}
+
+ImapClient::ProbeResult ImapClient::startProbe(int64_t idleMs) {
+    std::unique_lock<std::recursive_mutex> lock(commandMutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return ProbeResult::Skipped;  // a command is in flight; its own deadline covers it
+    }
+    if (!connected_) {
+        return ProbeResult::Dead;
+    }
+    if (!probeTag_.empty()) {
+        return ProbeResult::Pending;
+    }
+    if (steadyNowMs() - lastActivityMs_.load() < idleMs) {
+        return ProbeResult::Skipped;
+    }
+    probeTag_ = makeTag();
+    if (!writeAll(probeTag_ + " NOOP\r\n")) {
+        dropConnection("write failed");
+        return ProbeResult::Dead;
+    }
+    return ProbeResult::Pending;
+}
+
+ImapClient::ProbeResult ImapClient::checkProbe(bool deadlinePassed) {
+    std::unique_lock<std::recursive_mutex> lock(commandMutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return ProbeResult::Alive;  // the command in flight reads the reply first
+    }
+    if (!connected_) {
+        return ProbeResult::Dead;
+    }
+    readTimeoutMs_ = 0;
+    bool answered = readProbeReply();
+    readTimeoutMs_ = timeouts_.commandSeconds > 0 ? timeouts_.commandSeconds * 1000 : -1;
+    if (answered) {
+        return ProbeResult::Alive;
+    }
+    if (connected_ && !lastReadTimedOut_) {
+        dropConnection("read failed");
+    } else if (connected_ && deadlinePassed) {
+        dropConnection("keepalive NOOP went unanswered");
+    }
+    return connected_ ? ProbeResult::Pending : ProbeResult::Dead;
+}
+
+bool ImapClient::readProbeReply() {
+    std::string line;
+    while (!probeTag_.empty()) {
+        if (!readLine(line)) {
+            return false;
+        }
+        ImapMailboxEvent event;
+        if (line.compare(0, 5, "* BYE") == 0) {
+            dropConnection("server sent BYE");
+            return false;
+        } else if (parseStatusLine(line, event)) {
+            pendingEvents_.push_back(event);
+        } else if (line.compare(0, probeTag_.size() + 1, probeTag_ + " ") == 0) {
+            probeTag_.clear();
+            lastActivityMs_ = steadyNowMs();
+        }
+    }
+    return true;
+}
+
+int64_t ImapClient::getLastActivityMs() const {
+    return lastActivityMs_.load();
+}
+
+void ImapClient::abortConnection() {
+    std::lock_guard<std::mutex> lock(socketMutex_);
+    if (activeSocket_ >= 0) {
+        shutdown(activeSocket_, SHUT_RDWR);
+    }
+}
+
+bool ImapClient::hasCapability(const std::string& name) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    if (capabilities_.empty() && connected_) {
+        std::string response = sendCommand("CAPABILITY");
+        std::istringstream lines(response);
+        std::string line;
+        while (std::getline(lines, line)) {
+            if (line.compare(0, 13, "* CAPABILITY ") != 0) {
+                continue;
+            }
+            std::istringstream words(line.substr(13));
+            std::string word;
+            while (words >> word) {
+                std::transform(word.begin(), word.end(), word.begin(), ::toupper);
+                capabilities_.push_back(word);
+            }
+        }
+    }
+    std::string wanted = name;
+    std::transform(wanted.begin(), wanted.end(), wanted.begin(), ::toupper);
+    return std::find(capabilities_.begin(), capabilities_.end(), wanted) != capabilities_.end();
+}
+
+bool ImapClient::idle(int timeoutMs, bool& changed, const std::function<bool()>& interrupted) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    changed = false;
+    if (!connected_ || currentMailbox_.empty()) {
+        return false;
+    }
+    
+    // Untagged EXISTS/EXPUNGE mean the mailbox changed
+    auto noteChange = [&changed](const std::string& line) {
+        if (line.compare(0, 2, "* ") == 0 &&
+            (line.find(" EXISTS") != std::string::npos || line.find(" EXPUNGE") != std::string::npos)) {
+            changed = true;
+        }
+    };
+    
+    std::string tag = makeTag();
+    readTimeoutMs_ = timeouts_.commandSeconds > 0 ? timeouts_.commandSeconds * 1000 : -1;
+    if (!readProbeReply()) {
+        dropConnection("read failed or timed out");
+        return false;
+    }
+    if (!writeAll(tag + " IDLE\r\n")) {
+        dropConnection("write failed");
+        return false;
+    }
+    
+    std::string line;
+    while (true) {
+        if (!readLine(line)) {
+            dropConnection("read failed or timed out");
+            return false;
+        }
+        if (line.compare(0, 1, "+") == 0) {
+            break;
+        }
+        if (line.compare(0, tag.size() + 1, tag + " ") == 0) {
+            LOG_WARNING("IMAP server refused IDLE");
+            return false;
+        }
+        noteChange(line);
+    }
+    
+    // Idling: wait for a change, the timeout, an interruption, or the session
+    // to die. A timed-out read keeps any partial line buffered.
+    const int sliceMs = 100;
+    int64_t deadline = steadyNowMs() + std::max(0, timeoutMs);
+    while (!changed) {
+        int64_t remaining = deadline - steadyNowMs();
+        if (remaining <= 0 || (interrupted && interrupted())) {
+            break;
+        }
+        readTimeoutMs_ = static_cast<int>(interrupted ? std::min<int64_t>(remaining, sliceMs) : remaining);
+        if (!readLine(line)) {
+            if (lastReadTimedOut_) {
+                continue;
+            }
+            dropConnection("read failed during IDLE");
+            return false;
+        }
+        if (line.compare(0, 5, "* BYE") == 0) {
+            dropConnection("server sent BYE");
+            return false;
+        }
+        noteChange(line);
+    }
+    
+    readTimeoutMs_ = timeouts_.commandSeconds > 0 ? timeouts_.commandSeconds * 1000 : -1;
+    if (!writeAll("DONE\r\n")) {
+        dropConnection("write failed");
+        return false;
+    }
+    while (true) {
+        if (!readLine(line)) {
+            dropConnection("read failed or timed out");
+            return false;
+        }
+        if (line.compare(0, tag.size() + 1, tag + " ") == 0) {
+            lastActivityMs_ = steadyNowMs();
+            return parseResponse(line);
+        }
+        noteChange(line);
+    }
+}
+
+bool ImapClient::notifySet(const std::vector<std::string>& filters, bool sendStatus) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    if (!authenticated_ || !hasCapability("NOTIFY")) {
+        return false;
+    }
+    
+    // MessageNew and MessageExpunge must be asked for together; for
+    // non-selected mailboxes they arrive as unsolicited STATUS responses
+    const std::string events = " (MessageNew MessageExpunge))";
+    std::string cmd = "NOTIFY SET";
+    if (sendStatus) {
+        cmd += " STATUS";
+    }
+    cmd += " (SELECTED" + events;
+    for (const auto& filter : filters) {
+        cmd += " (" + filter + events;
+    }
+    
+    if (!parseResponse(sendCommand(cmd))) {
+        LOG_WARNING("IMAP server rejected NOTIFY");
+        return false;
+    }
+    LOG_INFO("NOTIFY enabled for " + std::to_string(filters.size()) + " mailbox filters");
+    return true;
+}
+
+bool ImapClient::notifyNone() {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    pendingEvents_.clear();
+    return authenticated_ && parseResponse(sendCommand("NOTIFY NONE"));
+}
+
+bool ImapClient::waitForEvents(int timeoutMs, std::vector<ImapMailboxEvent>& events) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    events.swap(pendingEvents_);
+    pendingEvents_.clear();
+    if (!connected_) {
+        return false;
+    }
+    if (!events.empty()) {
+        return true;
+    }
+    readTimeoutMs_ = timeouts_.commandSeconds > 0 ? timeouts_.commandSeconds * 1000 : -1;
+    if (!readProbeReply()) {
+        dropConnection("read failed or timed out");
+        return false;
+    }
+    events.swap(pendingEvents_);
+    if (!events.empty()) {
+        return true;
+    }
+    
+    const int burstMs = 20;  // once something arrives, collect what follows it
+    int64_t deadline = steadyNowMs() + std::max(0, timeoutMs);
+    std::string line;
+    while (true) {
+        int64_t remaining = deadline - steadyNowMs();
+        if (!events.empty()) {
+            remaining = std::min<int64_t>(remaining, burstMs);
+        }
+        if (remaining <= 0) {
+            break;
+        }
+        readTimeoutMs_ = static_cast<int>(remaining);
+        if (!readLine(line)) {
+            if (lastReadTimedOut_) {
+                break;
+            }
+            dropConnection("read failed while waiting for events");
+            return false;
+        }
+        
+        // A mailbox name sent as a literal: inline it as a quoted string
+        if (!line.empty() && line.back() == '}') {
+            size_t open = line.rfind('{');
+            std::string name;
+            std::string rest;
+            if (open != std::string::npos &&
+                (!readBytes(std::strtoul(line.c_str() + open + 1, nullptr, 10), name) || !readLine(rest))) {
+                dropConnection("read failed while waiting for events");
+                return false;
+            }
+            if (open != std::string::npos) {
+                line = line.substr(0, open) + quoteString(name) + rest;
+            }
+        }
+        lastActivityMs_ = steadyNowMs();
+        
+        ImapMailboxEvent event;
+        if (line.compare(0, 5, "* BYE") == 0) {
+            dropConnection("server sent BYE");
+            return false;
+        } else if (parseStatusLine(line, event)) {
+            events.push_back(event);
+        } else if (line.compare(0, 2, "* ") == 0 && !currentMailbox_.empty() &&
+                   (line.find(" EXISTS") != std::string::npos || line.find(" EXPUNGE") != std::string::npos)) {
+            event.mailbox = currentMailbox_;
+            if (line.find(" EXISTS") != std::string::npos) {
+                event.messages = static_cast<uint32_t>(std::strtoul(line.c_str() + 2, nullptr, 10));
+            }
+            events.push_back(event);
+        }
+    }
+    
+    readTimeoutMs_ = timeouts_.commandSeconds > 0 ? timeouts_.commandSeconds * 1000 : -1;
+    return true;
+}
+
+std::string ImapClient::mailboxList(const std::vector<std::string>& names) {
+    std::string list = "(";
+    for (size_t i = 0; i < names.size(); i++) {
+        list += (i ? " " : "") + quoteString(names[i]);
+    }
+    return list + ")";
+}
+
+std::string ImapClient::quoteString(const std::string& value) {
+    std::string quoted = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+bool ImapClient::parseStatusLine(const std::string& line, ImapMailboxEvent& event) {
+    if (line.compare(0, 9, "* STATUS ") != 0) {
+        return false;
+    }
+    ResponseCursor cursor(line);
+    cursor.skip(9);
+    event = ImapMailboxEvent();
+    uint32_t unseen = 0;
+    return cursor.readString(event.mailbox) &&
+           parseStatusItems(cursor, event.messages, unseen, event.uidNext, event.uidValidity);
+}
+
 bool ImapClient::selectMailbox(const std::string& mailbox) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
     if (!authenticated_) {
         LOG_ERROR("Cannot select mailbox: not authenticated");
         return false;
     }
     
-    std::string cmd = "A002 SELECT " + mailbox + "\r\n";
+    std::string cmd = "SELECT " + quoteString(mailbox);
     std::string response = sendCommand(cmd);
     
-    if (response.find("OK") != std::string::npos) {
+    if (parseResponse(response)) {
+        // Response codes such as "* OK [UIDVALIDITY 3857529045] UIDs valid"
+        auto responseCode = [&response](const std::string& name) -> uint32_t {
+            size_t pos = response.find("[" + name + " ");
+            if (pos == std::string::npos) {
+                return 0;
+            }
+            return static_cast<uint32_t>(std::strtoul(response.c_str() + pos + name.size() + 2, nullptr, 10));
+        };
         currentMailbox_ = mailbox;
+        uidValidity_ = responseCode("UIDVALIDITY");
+        uidNext_ = responseCode("UIDNEXT");
         LOG_INFO("Selected mailbox: " + mailbox);
         return true;
     }
@@ -219,23 +879,77 @@ bool ImapClient::selectMailbox(const std::string& mailbox) {
 
 std::vector<std::string> ImapClient::listMailboxes() {
     std::vector<std::string> mailboxes;
+    for (const auto& info : listMailboxInfo()) {
+        mailboxes.push_back(info.name);
+    }
+    return mailboxes;
+}
+
+std::vector<ImapMailboxInfo> ImapClient::listMailboxInfo(const std::string& pattern, bool withStatus) {
+    return runList(quoteString(pattern), withStatus);
+}
+
+std::vector<ImapMailboxInfo> ImapClient::listMailboxInfo(const std::vector<std::string>& patterns, bool withStatus) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    if (patterns.empty()) {
+        return {};
+    }
+    if (patterns.size() == 1 || hasCapability("LIST-EXTENDED") || hasCapability("LIST-STATUS")) {
+        return runList(mailboxList(patterns), withStatus);
+    }
+    std::vector<ImapMailboxInfo> mailboxes;
+    for (const auto& pattern : patterns) {
+        std::vector<ImapMailboxInfo> found = runList(quoteString(pattern), withStatus);
+        mailboxes.insert(mailboxes.end(), found.begin(), found.end());
+        if (!connected_) {
+            break;
+        }
+    }
+    return mailboxes;
+}
+
+std::vector<ImapMailboxInfo> ImapClient::runList(const std::string& patterns, bool withStatus) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    std::vector<ImapMailboxInfo> mailboxes;
     
     if (!authenticated_) {
         LOG_ERROR("Cannot list mailboxes: not authenticated");
         return mailboxes;
     }
     
-    std::string cmd = "A003 LIST \"\" \"*\"\r\n";
+    const std::string statusItems = "(MESSAGES UNSEEN UIDNEXT UIDVALIDITY)";
+    std::string cmd = "LIST \"\" " + patterns;
+    bool listStatus = withStatus && hasCapability("LIST-STATUS");
+    if (listStatus) {
+        // LIST-STATUS implies LIST-EXTENDED, so RETURN options are allowed
+        cmd += hasCapability("SPECIAL-USE") ? " RETURN (SPECIAL-USE STATUS " : " RETURN (STATUS ";
+        cmd += statusItems + ")";
+    }
     std::string response = sendCommand(cmd);
+    if (!parseResponse(response)) {
+        LOG_ERROR("LIST failed");
+        return mailboxes;
+    }
+    mailboxes = parseListResponse(response);
     
-    // Parse mailbox list (simplified)
-    std::istringstream iss(response);
-    std::string line;
-    while (std::getline(iss, line)) {
-        if (line.find("* LIST") != std::string::npos) {
-            size_t start = line.find_last_of("\"") + 1;
-            if (start != std::string::npos) {
-                mailboxes.push_back(line.substr(start));
+    if (withStatus && !listStatus) {
+        // No LIST-STATUS: one STATUS round trip per mailbox
+        for (auto& info : mailboxes) {
+            if (!info.selectable) {
+                continue;
+            }
+            std::string status = sendCommand("STATUS " + quoteString(info.name) + " " + statusItems);
+            if (!connected_) {
+                break;
+            }
+            for (const auto& entry : parseListResponse(status)) {
+                if (entry.hasStatus) {
+                    info.hasStatus = true;
+                    info.messages = entry.messages;
+                    info.unseen = entry.unseen;
+                    info.uidNext = entry.uidNext;
+                    info.uidValidity = entry.uidValidity;
+                }
             }
         }
     }
@@ -244,12 +958,91 @@ std::vector<std::string> ImapClient::listMailboxes() {
     return mailboxes;
 }
 
+std::vector<ImapMailboxInfo> ImapClient::parseListResponse(const std::string& response) {
+    static const char* const specialUses[] = {
+        "\\All", "\\Archive", "\\Drafts", "\\Flagged", "\\Junk", "\\Sent", "\\Trash"
+    };
+    std::vector<ImapMailboxInfo> mailboxes;
+    std::map<std::string, ImapMailboxInfo> statuses;  // STATUS lines may precede their LIST
+    
+    ResponseCursor cursor(response);
+    for (; !cursor.atEnd(); cursor.nextLine()) {
+        if (cursor.startsWith("* LIST ")) {
+            cursor.skip(7);
+            ImapMailboxInfo info;
+            std::string value;
+            bool isNil = false;
+            if (!cursor.consume('(')) {
+                continue;
+            }
+            while (!cursor.consume(')') && cursor.readString(value)) {
+                if (equalsIgnoreCase(value, "\\Noselect") || equalsIgnoreCase(value, "\\NonExistent")) {
+                    info.selectable = false;
+                }
+                for (const char* use : specialUses) {
+                    if (equalsIgnoreCase(value, use) && info.specialUse.empty()) {
+                        info.specialUse = use;
+                    }
+                }
+                info.attributes.push_back(value);
+            }
+            if (!cursor.readString(value, &isNil)) {
+                continue;
+            }
+            info.delimiter = isNil || value.empty() ? 0 : value[0];
+            if (!cursor.readString(info.name, &isNil) || isNil) {
+                continue;
+            }
+            mailboxes.push_back(info);
+        } else if (cursor.startsWith("* STATUS ")) {
+            cursor.skip(9);
+            ImapMailboxInfo status;
+            if (!cursor.readString(status.name)) {
+                continue;
+            }
+            if (!parseStatusItems(cursor, status.messages, status.unseen, status.uidNext, status.uidValidity)) {
+                continue;
+            }
+            status.hasStatus = true;
+            statuses[status.name] = status;
+        }
+    }
+    
+    for (auto& info : mailboxes) {
+        auto it = statuses.find(info.name);
+        if (it != statuses.end()) {
+            info.hasStatus = true;
+            info.messages = it->second.messages;
+            info.unseen = it->second.unseen;
+            info.uidNext = it->second.uidNext;
+            info.uidValidity = it->second.uidValidity;
+            statuses.erase(it);
+        }
+    }
+    // A bare STATUS response (no LIST) still carries counters
+    for (auto& entry : statuses) {
+        mailboxes.push_back(entry.second);
+    }
+    return mailboxes;
+}
+
+const ImapMailboxInfo* ImapClient::findSpecialUse(const std::vector<ImapMailboxInfo>& mailboxes,
+                                                  const std::string& use) {
+    for (const auto& info : mailboxes) {
+        if (equalsIgnoreCase(info.specialUse, use)) {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
 int ImapClient::getMessageCount() {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
     if (currentMailbox_.empty()) {
         selectMailbox("INBOX");
     }
     
-    std::string cmd = "A004 STATUS " + currentMailbox_ + " (MESSAGES)\r\n";
+    std::string cmd = "STATUS " + quoteString(currentMailbox_) + " (MESSAGES)";
     std::string response = sendCommand(cmd);
     
     // Parse message count (simplified)
@@ -267,7 +1060,23 @@ int ImapClient::getMessageCount() {
     return 0;
 }
 
+uint32_t ImapClient::getUidValidity() const {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    return uidValidity_;
+}
+
+uint32_t ImapClient::getUidNext() const {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    return uidNext_;
+}
+
+std::string ImapClient::getCurrentMailbox() const {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    return currentMailbox_;
+}
+
 std::vector<Email> ImapClient::fetchRecentEmails(int count) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
     std::vector<Email> emails;
     
     if (currentMailbox_.empty()) {
@@ -277,7 +1086,7 @@ std::vector<Email> ImapClient::fetchRecentEmails(int count) {
     LOG_INFO("Fetching " + std::to_string(count) + " recent emails");
     
     // Fetch UIDs
-    std::string cmd = "A005 UID SEARCH ALL\r\n";
+    std::string cmd = "UID SEARCH ALL";
     std::string response = sendCommand(cmd);
     
     // Parse UIDs (simplified - in reality this would be more robust)
@@ -309,33 +1118,73 @@ std::vector<Email> ImapClient::fetchRecentEmails(int count) {
     return emails;
 }
 
+std::vector<uint32_t> ImapClient::searchUidsAfter(uint32_t uid) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    std::vector<uint32_t> uids;
+    if (currentMailbox_.empty()) {
+        return uids;
+    }
+    
+    std::string response = sendCommand("UID SEARCH UID " + std::to_string(uid + 1) + ":*");
+    if (!parseResponse(response)) {
+        return uids;
+    }
+    
+    // "n:*" always matches the highest UID, even when it is below n
+    std::istringstream lines(response);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, 9, "* SEARCH ") != 0) {
+            continue;
+        }
+        std::istringstream words(line.substr(9));
+        unsigned long value;
+        while (words >> value) {
+            if (value > uid) {
+                uids.push_back(static_cast<uint32_t>(value));
+            }
+        }
+    }
+    std::sort(uids.begin(), uids.end());
+    return uids;
+}
+
 Email ImapClient::fetchEmail(const std::string& uid) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
     Email email;
     email.id = uid;
     email.isRead = false;
     
-    // Fetch email headers and body
-    std::string cmd = "A006 UID FETCH " + uid + " (FLAGS BODY[HEADER] BODY[TEXT])\r\n";
+    // Fetch email headers and body; RFC822.SIZE comes ahead of the literals,
+    // and a literal over the spill threshold never sits in memory whole
+    std::string cmd = "UID FETCH " + uid + " (FLAGS INTERNALDATE RFC822.SIZE BODY[HEADER] BODY[TEXT])";
+    spillLiterals_ = true;
+    spillUid_ = uid;
+    bodySpill_.reset();
     std::string response = sendCommand(cmd);
+    spillLiterals_ = false;
     
     email = parseEmailData(response, uid);
+    email.spill = std::move(bodySpill_);
     email.priority = calculatePriorityScore(email);
     
     return email;
 }
 
 bool ImapClient::markAsRead(const std::string& uid) {
-    std::string cmd = "A007 UID STORE " + uid + " +FLAGS (\\Seen)\r\n";
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    std::string cmd = "UID STORE " + uid + " +FLAGS (\\Seen)";
     std::string response = sendCommand(cmd);
-    return response.find("OK") != std::string::npos;
+    return parseResponse(response);
 }
 
 bool ImapClient::deleteEmail(const std::string& uid) {
-    std::string cmd = "A008 UID STORE " + uid + " +FLAGS (\\Deleted)\r\n";
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
+    std::string cmd = "UID STORE " + uid + " +FLAGS (\\Deleted)";
     std::string response = sendCommand(cmd);
     
-    if (response.find("OK") != std::string::npos) {
-        sendCommand("A009 EXPUNGE\r\n");
+    if (parseResponse(response)) {
+        sendCommand("EXPUNGE");
         return true;
     }
     return false;
@@ -350,43 +1199,253 @@ std::string ImapClient::getConnectionStatus() const {
     return "Not connected";
 }
 
-std::string ImapClient::sendCommand(const std::string& command) {
+std::string ImapClient::sendCommand(const std::string& command, int timeoutMs) {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex_);
     if (!connected_) {
         return "";
     }
+    readTimeoutMs_ = timeoutMs >= 0 ? timeoutMs :
+                     (timeouts_.commandSeconds > 0 ? timeouts_.commandSeconds * 1000 : -1);
+    if (!readProbeReply()) {
+        dropConnection("read failed or timed out");
+        return "";
+    }
     
-    // Send command
+    std::string tag;
     if (!command.empty()) {
-        if (useSsl_ && connection_->ssl) {
-            SSL_write(connection_->ssl, command.c_str(), command.length());
-        } else {
-            send(connection_->socket, command.c_str(), command.length(), 0);
+        tag = makeTag();
+        if (!writeAll(tag + " " + command + "\r\n")) {
+            dropConnection("write failed");
+            return "";
         }
     }
     
-    // Receive response
-    char buffer[4096];
     std::string response;
-    int bytes;
+    std::string line;
+    bool lineStart = true;  // false while reading the rest of a line after a literal
+    bool sawBye = false;
     
-    do {
+    while (true) {
+        if (!readLine(line)) {
+            dropConnection(sawBye ? "server sent BYE" : "read failed or timed out");
+            return response;
+        }
+        response += line;
+        response += "\r\n";
+        
+        bool startsLine = lineStart;
+        lineStart = true;
+        
+        // "{N}" (or the non-synchronizing "{N+}") ends a line before N raw bytes
+        if (!line.empty() && line.back() == '}') {
+            size_t open = line.rfind('{');
+            if (open != std::string::npos) {
+                size_t length = std::strtoul(line.c_str() + open + 1, nullptr, 10);
+                bool spill = spillLiterals_ && spillSettings_.thresholdBytes > 0 &&
+                             length > spillSettings_.thresholdBytes;
+                if (!(spill ? spillLiteral(line, length, response) : readBytes(length, response))) {
+                    dropConnection("read failed or timed out");
+                    return response;
+                }
+                lineStart = false;
+                continue;
+            }
+        }
+        
+        if (!startsLine) {
+            continue;
+        }
+        ImapMailboxEvent event;
+        if (command.compare(0, 7, "STATUS ") != 0 && command.compare(0, 5, "LIST ") != 0 &&
+            parseStatusLine(line, event)) {
+            pendingEvents_.push_back(event);  // unsolicited, from NOTIFY
+        }
+        if (tag.empty()) {
+            lastActivityMs_ = steadyNowMs();
+            return response;  // greeting
+        }
+        if (line.compare(0, 1, "+") == 0) {
+            // We never send literals, so this is a SASL challenge (an
+            // XOAUTH2 error); an empty reply ends the exchange
+            if (!writeAll("\r\n")) {
+                dropConnection("write failed");
+                return response;
+            }
+            continue;
+        }
+        if (line.compare(0, 5, "* BYE") == 0) {
+            sawBye = true;
+        } else if (line.compare(0, tag.size() + 1, tag + " ") == 0) {
+            if (sawBye && command != "LOGOUT") {
+                dropConnection("server sent BYE");
+            }
+            lastActivityMs_ = steadyNowMs();
+            return response;
+        }
+    }
+}
+
+bool ImapClient::parseResponse(const std::string& response) {
+    // The tagged completion is the last line: "<tag> OK ..."
+    size_t end = response.size();
+    if (end >= 2 && response.compare(end - 2, 2, "\r\n") == 0) {
+        end -= 2;
+    }
+    size_t start = response.rfind("\r\n", end == 0 ? 0 : end - 1);
+    start = start == std::string::npos ? 0 : start + 2;
+    size_t space = response.find(' ', start);
+    if (space == std::string::npos || space >= end || response.compare(start, 1, "*") == 0) {
+        return false;
+    }
+    return response.compare(space + 1, 2, "OK") == 0 && (space + 3 >= end || response[space + 3] == ' ');
+}
+
+bool ImapClient::writeAll(const std::string& data) {
+    const char* cursor = data.data();
+    size_t remaining = data.size();
+    while (remaining > 0) {
+        int written;
         if (useSsl_ && connection_->ssl) {
-            bytes = SSL_read(connection_->ssl, buffer, sizeof(buffer) - 1);
+            written = SSL_write(connection_->ssl, cursor, static_cast<int>(remaining));
         } else {
-            bytes = recv(connection_->socket, buffer, sizeof(buffer) - 1, 0);
+            written = static_cast<int>(send(connection_->socket, cursor, remaining, MSG_NOSIGNAL));
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+        }
+        if (written <= 0) {
+            return false;
+        }
+        cursor += written;
+        remaining -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool ImapClient::readLine(std::string& line) {
+    std::string& buffer = connection_->readBuffer;
+    size_t scanned = 0;
+    
+    while (true) {
+        size_t newline = buffer.find('\n', scanned);
+        if (newline != std::string::npos) {
+            size_t end = (newline > 0 && buffer[newline - 1] == '\r') ? newline - 1 : newline;
+            line.assign(buffer, 0, end);
+            buffer.erase(0, newline + 1);
+            return true;
         }
+        scanned = buffer.size();
         
-        if (bytes > 0) {
-            buffer[bytes] = '\0';
-            response += buffer;
+        if (!readBytes(0, buffer)) {
+            return false;
         }
-    } while (bytes == sizeof(buffer) - 1);
+    }
+}
+
+bool ImapClient::readBytes(size_t count, std::string& out) {
+    std::string& buffer = connection_->readBuffer;
+    lastReadTimedOut_ = false;
     
-    return response;
+    // count == 0 appends whatever a single read returns
+    while (count == 0 || buffer.size() < count) {
+        // Wait for data with the response deadline; bytes already decrypted
+        // inside SSL don't show up on the socket
+        if (!(connection_->ssl && SSL_pending(connection_->ssl) > 0)) {
+            struct pollfd pfd = {connection_->socket, POLLIN, 0};
+            int ready = poll(&pfd, 1, readTimeoutMs_);
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready <= 0) {
+                lastReadTimedOut_ = ready == 0;
+                return false;
+            }
+        }
+        
+        char chunk[4096];
+        int bytes;
+        if (useSsl_ && connection_->ssl) {
+            bytes = SSL_read(connection_->ssl, chunk, sizeof(chunk));
+        } else {
+            bytes = static_cast<int>(recv(connection_->socket, chunk, sizeof(chunk), 0));
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+        }
+        if (bytes <= 0) {
+            return false;
+        }
+        if (count == 0) {
+            out.append(chunk, static_cast<size_t>(bytes));
+            return true;
+        }
+        buffer.append(chunk, static_cast<size_t>(bytes));
+    }
+    out.append(buffer, 0, count);
+    buffer.erase(0, count);
+    return true;
 }
 
-bool ImapClient::parseResponse(const std::string& response) {
-    return response.find("OK") != std::string::npos;
+bool ImapClient::spillLiteral(const std::string& line, size_t length, std::string& out) {
+    std::string& buffer = connection_->readBuffer;
+    auto spill = std::make_shared<MessageSpill>(spillSettings_.directory);
+    size_t done = 0;
+    while (done < length) {
+        if (buffer.empty() && !readBytes(0, buffer)) {
+            return false;
+        }
+        size_t take = std::min(length - done, buffer.size());
+        if (done < spillSettings_.prefixBytes) {
+            out.append(buffer, 0, std::min(take, spillSettings_.prefixBytes - done));
+        }
+        // A failed write is logged; the message still gets its prefix
+        spill->append(buffer.data(), take);
+        buffer.erase(0, take);
+        done += take;
+    }
+    if (!spill->finish()) {
+        LOG_WARNING("Could not spill the " + std::to_string(length) + " byte literal of UID " +
+                    spillUid_ + "; keeping only its first " +
+                    std::to_string(std::min(length, spillSettings_.prefixBytes)) + " bytes");
+        return true;
+    }
+    LOG_DEBUG("Spilled a " + std::to_string(length) + " byte literal to " + spill->path());
+    if (announcesBodyText(line)) {
+        bodySpill_ = std::move(spill);
+    }
+    return true;
+}
+
+std::string ImapClient::makeTag() {
+    char buffer[16];
+    std::snprintf(buffer, sizeof(buffer), "A%04u", nextTag_++);
+    return buffer;
+}
+
+void ImapClient::resetConnection() {
+    {
+        std::lock_guard<std::mutex> lock(socketMutex_);
+        activeSocket_ = -1;
+    }
+    connection_.reset(new ImapConnection());
+    capabilities_.clear();
+    pendingEvents_.clear();
+    probeTag_.clear();
+}
+
+void ImapClient::dropConnection(const std::string& reason) {
+    if (!connected_) {
+        return;
+    }
+    LOG_WARNING("IMAP session to " + server_ + " lost: " + reason);
+    if (connection_->ssl) {
+        // The peer is gone; don't try to send close_notify
+        SSL_set_quiet_shutdown(connection_->ssl, 1);
+    }
+    resetConnection();
+    connected_ = false;
+    authenticated_ = false;
+    currentMailbox_.clear();
 }
 
 Email ImapClient::parseEmailData(const std::string& data, const std::string& uid) {
@@ -415,9 +1474,44 @@ Email ImapClient::parseEmailData(const std::string& data, const std::string& uid
     
     email.isRead = data.find("\\Seen") != std::string::npos;
     
+    size_t sizePos = data.find("RFC822.SIZE ");
+    if (sizePos != std::string::npos) {
+        email.size = static_cast<size_t>(std::strtoull(data.c_str() + sizePos + 12, nullptr, 10));
+    }
+    
+    // INTERNALDATE "17-Jul-1996 02:44:25 -0700"
+    size_t datePos = data.find("INTERNALDATE \"");
+    if (datePos != std::string::npos) {
+        std::tm parts = {};
+        int offset = 0;
+        const char* rest = strptime(data.c_str() + datePos + 14, "%d-%b-%Y %H:%M:%S", &parts);
+        if (rest && std::sscanf(rest, " %d", &offset) == 1) {
+            long offsetSeconds = (std::abs(offset) / 100) * 3600 + (std::abs(offset) % 100) * 60;
+            email.internalDate = static_cast<long>(timegm(&parts)) - (offset < 0 ? -offsetSeconds : offsetSeconds);
+        }
+    }
+    
     return email;
 }
 
+bool ImapClient::announcesBodyText(const std::string& line) {
+    size_t open = line.rfind('{');
+    return open != std::string::npos && open >= 11 && line.compare(open - 11, 11, "BODY[TEXT] ") == 0;
+}
+
+std::string ImapClient::fetchUid(const std::string& item) {
+    std::string first = item.substr(0, item.find("\r\n"));
+    size_t pos = first.find(" FETCH (");
+    pos = pos == std::string::npos ? pos : first.find("UID ", pos);
+    if (first.compare(0, 2, "* ") != 0 || pos == std::string::npos) {
+        return "?";
+    }
+    pos += 4;
+    size_t end = first.find_first_not_of("0123456789", pos);
+    end = end == std::string::npos ? first.size() : end;
+    return end == pos ? "?" : first.substr(pos, end - pos);
+}
+
 int ImapClient::calculatePriorityScore(const Email& email) {
     int score = 5;  // Default medium priority
     
@@ -0,0 +1,155 @@
+#include "imap_keepalive.hpp"
+#include "logger.hpp"
+#include <chrono>
+#include <vector>
+
+namespace Pens {
+
+ImapKeepalive::ImapKeepalive(ImapKeepaliveSettings settings)
+    : settings_(settings),
+      wheel_(settings.tickMs, nowMs()),
+      nextId_(1),
+      running_(false),
+      probesSent_(0),
+      deadDetected_(0) {
+    if (settings_.idleMs < 1) {
+        settings_.idleMs = 1;
+    }
+}
+
+ImapKeepalive::~ImapKeepalive() {
+    stop();
+}
+
+uint64_t ImapKeepalive::add(std::shared_ptr<ImapClient> client) {
+    int64_t deadline = client->getLastActivityMs() + settings_.idleMs;
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t id = nextId_++;
+    sessions_[id] = std::move(client);
+    wheel_.schedule(deadline, Timer{id, false});
+    return id;
+}
+
+void ImapKeepalive::remove(uint64_t id) {
+    // The wheel entry stays until it expires and is then ignored
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_.erase(id);
+}
+
+void ImapKeepalive::setDeadCallback(DeadCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    deadCallback_ = std::move(callback);
+}
+
+void ImapKeepalive::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    thread_ = std::thread(&ImapKeepalive::run, this);
+    LOG_INFO("IMAP keepalive started (idle " + std::to_string(settings_.idleMs / 1000) + "s)");
+}
+
+void ImapKeepalive::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void ImapKeepalive::runDue(int64_t now) {
+    std::vector<Timer> expired;
+    std::vector<std::pair<Timer, std::shared_ptr<ImapClient>>> due;
+    DeadCallback callback;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wheel_.advance(now, expired);
+        for (const Timer& timer : expired) {
+            auto it = sessions_.find(timer.id);
+            if (it != sessions_.end()) {
+                due.emplace_back(timer, it->second);
+            }
+        }
+        callback = deadCallback_;
+    }
+
+    // Clients are touched outside the lock; none of these calls waits on the network
+    std::vector<Timer> reschedule;
+    std::vector<int64_t> deadlines;
+    for (auto& entry : due) {
+        const Timer& timer = entry.first;
+        ImapClient& client = *entry.second;
+        ImapClient::ProbeResult result;
+        if (timer.replyDeadline) {
+            result = client.checkProbe(true);
+        } else if (!client.isConnected()) {
+            // Nothing to probe until the owner reconnects
+            reschedule.push_back(Timer{timer.id, false});
+            deadlines.push_back(now + settings_.idleMs);
+            continue;
+        } else if (now < client.getLastActivityMs() + settings_.idleMs) {
+            result = ImapClient::ProbeResult::Skipped;
+        } else {
+            result = client.startProbe(settings_.idleMs);
+            if (result == ImapClient::ProbeResult::Pending) {
+                probesSent_++;
+            }
+        }
+
+        if (result == ImapClient::ProbeResult::Pending) {
+            reschedule.push_back(Timer{timer.id, true});
+            deadlines.push_back(now + settings_.probeTimeoutMs);
+            continue;
+        }
+        if (result == ImapClient::ProbeResult::Dead) {
+            deadDetected_++;
+            LOG_WARNING("IMAP keepalive: session " + std::to_string(timer.id) + " is dead");
+            if (callback) {
+                callback(timer.id);
+            }
+        }
+        int64_t next = client.getLastActivityMs() + settings_.idleMs;
+        reschedule.push_back(Timer{timer.id, false});
+        deadlines.push_back(next > now ? next : now + settings_.idleMs);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < reschedule.size(); i++) {
+        if (sessions_.count(reschedule[i].id)) {
+            wheel_.schedule(deadlines[i], reschedule[i]);
+        }
+    }
+}
+
+size_t ImapKeepalive::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sessions_.size();
+}
+
+int64_t ImapKeepalive::nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ImapKeepalive::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        cv_.wait_for(lock, std::chrono::milliseconds(settings_.tickMs));
+        if (!running_) {
+            break;
+        }
+        lock.unlock();
+        runDue(nowMs());
+        lock.lock();
+    }
+}
+
+} // namespace Pens
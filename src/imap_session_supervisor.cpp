@@ -0,0 +1,243 @@
+#include "imap_session_supervisor.hpp"
+#include "token_store.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+namespace Pens {
+
+ImapSessionSupervisor::ImapSessionSupervisor(std::shared_ptr<ImapClient> client, ImapSessionSettings settings)
+    : client_(std::move(client)),
+      settings_(std::move(settings)),
+      failures_(0),
+      reconnects_(0),
+      everConnected_(false),
+      nextAttemptAt_(0),
+      uidValidity_(0),
+      watermark_(0),
+      haveWatermark_(false),
+      pollValidity_(0),
+      rng_(std::random_device{}()) {
+    settings_.fetchBatch = std::max(1, settings_.fetchBatch);
+    settings_.initialBacklog = std::max(0, settings_.initialBacklog);
+    if (!settings_.watermarkPath.empty() && loadWatermark()) {
+        LOG_INFO("Resuming " + settings_.mailbox + " after UID " + std::to_string(watermark_));
+    }
+}
+
+void ImapSessionSupervisor::setTokenProvider(const std::string& username, TokenProvider provider) {
+    username_ = username;
+    tokenProvider_ = std::move(provider);
+}
+
+bool ImapSessionSupervisor::ensureSession() {
+    if (client_->isConnected()) {
+        if (client_->getCurrentMailbox() == settings_.mailbox) {
+            everConnected_ = true;
+            return true;
+        }
+        if (selectMailbox()) {
+            return true;
+        }
+        if (client_->isConnected()) {
+            return false;  // the mailbox itself is the problem, not the session
+        }
+    }
+    if (nowMs() < nextAttemptAt_) {
+        return false;
+    }
+    return reconnect();
+}
+
+bool ImapSessionSupervisor::checkAlive() {
+    if (!client_->isConnected()) {
+        return false;
+    }
+    if (!client_->noop()) {
+        recordFailure("keepalive NOOP failed");
+        return false;
+    }
+    failures_ = 0;
+    return true;
+}
+
+std::vector<Email> ImapSessionSupervisor::poll(uint32_t& lastUid) {
+    std::vector<Email> emails;
+    lastUid = 0;
+    if (!ensureSession()) {
+        return emails;
+    }
+
+    std::vector<uint32_t> uids = client_->searchUidsAfter(haveWatermark_ ? watermark_ : 0);
+    if (!client_->isConnected()) {
+        recordFailure("connection lost during search");
+        return emails;
+    }
+    failures_ = 0;
+
+    size_t first = 0;
+    size_t last = std::min(uids.size(), static_cast<size_t>(settings_.fetchBatch));
+    if (!haveWatermark_) {
+        // First sync: deliver only the newest few and start from there
+        size_t backlog = std::min(uids.size(), static_cast<size_t>(settings_.initialBacklog));
+        first = uids.size() - backlog;
+        last = uids.size();
+        setWatermark(first > 0 ? uids[first - 1] : 0);
+    }
+
+    for (size_t i = first; i < last; i++) {
+        Email email = client_->fetchEmail(std::to_string(uids[i]));
+        if (!client_->isConnected()) {
+            recordFailure("connection lost during fetch");
+            break;
+        }
+        emails.push_back(std::move(email));
+        lastUid = uids[i];
+    }
+    pollValidity_ = uidValidity_;
+    return emails;
+}
+
+void ImapSessionSupervisor::commit(uint32_t uid) {
+    if (uid == 0 || (haveWatermark_ && uid <= watermark_)) {
+        return;
+    }
+    if (uidValidity_ != pollValidity_) {
+        // The mailbox was renumbered since that poll; the UID means nothing now
+        LOG_WARNING("Dropping sync position from before a UIDVALIDITY change");
+        return;
+    }
+    setWatermark(uid);
+}
+
+bool ImapSessionSupervisor::reconnectDue() const {
+    return !client_->isConnected() && nowMs() >= nextAttemptAt_;
+}
+
+int64_t ImapSessionSupervisor::backoffDelayMs(int failures, int64_t baseMs, int64_t maxMs, double jitter) {
+    int64_t cap = std::max<int64_t>(baseMs, 1);
+    for (int i = 1; i < failures && cap < maxMs; i++) {
+        cap *= 2;
+    }
+    cap = std::min(cap, std::max<int64_t>(maxMs, 1));
+    // Equal jitter: never less than half the cap, so retries stay spread out
+    // but a herd of clients still backs off
+    int64_t half = cap / 2;
+    return half + static_cast<int64_t>(jitter * static_cast<double>(cap - half));
+}
+
+int64_t ImapSessionSupervisor::nowMs() const {
+    if (settings_.clock) {
+        return settings_.clock();
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool ImapSessionSupervisor::reconnect() {
+    if (everConnected_) {
+        LOG_INFO("Re-establishing IMAP session (attempt " + std::to_string(failures_ + 1) + ")");
+    }
+    if (!client_->connect()) {
+        recordFailure("connect failed");
+        return false;
+    }
+    if (!authenticate()) {
+        recordFailure("authentication failed");
+        return false;
+    }
+    if (!selectMailbox()) {
+        recordFailure("cannot select " + settings_.mailbox);
+        return false;
+    }
+    if (everConnected_) {
+        reconnects_++;
+        LOG_INFO("IMAP session restored");
+    }
+    everConnected_ = true;
+    nextAttemptAt_ = 0;
+    return true;
+}
+
+bool ImapSessionSupervisor::authenticate() {
+    if (!tokenProvider_) {
+        return client_->reauthenticate();
+    }
+
+    std::string token = tokenProvider_(false);
+    if (!token.empty() && client_->authenticateOAuth(username_, token)) {
+        return true;
+    }
+
+    // The token was rejected or missing: refresh it and try once more on a
+    // fresh connection, since some servers hang up after a failed AUTHENTICATE
+    LOG_WARNING("IMAP rejected the OAuth token; forcing a refresh");
+    token = tokenProvider_(true);
+    if (token.empty() || !client_->connect()) {
+        return false;
+    }
+    return client_->authenticateOAuth(username_, token);
+}
+
+bool ImapSessionSupervisor::selectMailbox() {
+    if (!client_->selectMailbox(settings_.mailbox)) {
+        return false;
+    }
+    uint32_t validity = client_->getUidValidity();
+    if (haveWatermark_ && uidValidity_ != 0 && validity != 0 && validity != uidValidity_) {
+        // UIDs from the old epoch mean nothing now; start over like a first sync
+        LOG_WARNING("UIDVALIDITY of " + settings_.mailbox + " changed; resetting sync position");
+        haveWatermark_ = false;
+        watermark_ = 0;
+    }
+    uidValidity_ = validity;
+    return true;
+}
+
+void ImapSessionSupervisor::recordFailure(const std::string& reason) {
+    failures_++;
+    int64_t delay = backoffDelayMs(failures_, settings_.backoffBaseMs, settings_.backoffMaxMs,
+                                   std::uniform_real_distribution<double>(0.0, 1.0)(rng_));
+    nextAttemptAt_ = nowMs() + delay;
+    LOG_WARNING("IMAP session unavailable (" + reason + "); retrying in " +
+                std::to_string(delay) + " ms");
+}
+
+void ImapSessionSupervisor::setWatermark(uint32_t uid) {
+    watermark_ = uid;
+    haveWatermark_ = true;
+    saveWatermark();
+}
+
+bool ImapSessionSupervisor::loadWatermark() {
+    std::string contents;
+    if (!TokenStore::readFile(settings_.watermarkPath, contents)) {
+        return false;
+    }
+    std::istringstream in(contents);
+    unsigned long validity = 0;
+    unsigned long uid = 0;
+    if (!(in >> validity >> uid)) {
+        LOG_WARNING("Ignoring malformed sync state: " + settings_.watermarkPath);
+        return false;
+    }
+    uidValidity_ = static_cast<uint32_t>(validity);
+    watermark_ = static_cast<uint32_t>(uid);
+    haveWatermark_ = true;
+    return true;
+}
+
+bool ImapSessionSupervisor::saveWatermark() const {
+    if (settings_.watermarkPath.empty()) {
+        return true;
+    }
+    std::string contents = std::to_string(uidValidity_) + " " + std::to_string(watermark_) + "\n";
+    if (!TokenStore::writeFileAtomically(settings_.watermarkPath, contents, 0644)) {
+        LOG_ERROR("Failed to save sync state: " + settings_.watermarkPath);
+        return false;
+    }
+    return true;
+}
+
+} // namespace Pens
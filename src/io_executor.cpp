@@ -0,0 +1,631 @@
+#include "io_executor.hpp"
+#include "io_uring.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace Pens {
+
+namespace {
+
+int64_t steadyNowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Task<void> startOn(IoExecutor& executor, Task<void> task) {
+    co_await executor.schedule();
+    co_await std::move(task);
+}
+
+// io_uring user data below kFirstOp is reserved
+constexpr uint64_t kWakeOp = 1;
+constexpr uint64_t kCancelOp = 2;
+constexpr uint64_t kFirstOp = 16;
+
+constexpr unsigned kRingEntries = 256;
+constexpr unsigned kReceiveBuffers = 64;
+constexpr unsigned kReceiveBufferSize = 16384;
+
+} // namespace
+
+struct IoExecutor::Loop {
+    enum class OpKind { PollRead, PollWrite, Receive };
+
+    struct Op {
+        int fd;
+        OpKind kind;
+    };
+
+    struct FdState {
+        Waiter* reader = nullptr;
+        Waiter* writer = nullptr;
+        bool registered = false;    // epoll
+        uint64_t readPoll = 0;      // io_uring operations in flight
+        uint64_t writePoll = 0;
+        uint64_t receiveOp = 0;
+        std::string received;       // multishot receive output not yet taken
+        bool receiveEnded = false;
+        bool receiveFailed = false;
+    };
+
+    int epollFd = -1;
+    int wakeFd = -1;
+    std::unique_ptr<IoUring> ring;
+    uint64_t wakeValue = 0;         // target of the ring's eventfd read
+    uint64_t nextOp = kFirstOp;
+    std::unordered_map<uint64_t, Op> ops;
+    std::thread thread;
+    std::atomic<std::thread::id> threadId;
+    std::mutex mutex;
+    bool stopping = false;
+    uint64_t submits = 0;           // io_uring: submission passes of the loop thread
+    std::condition_variable submitted;
+    std::vector<std::coroutine_handle<>> posted;
+    std::multimap<int64_t, Waiter*> timers;
+    std::unordered_map<int, FdState> fds;
+
+    // The loop thread itself picks up new work before it next blocks
+    void wake() {
+        if (std::this_thread::get_id() == threadId.load()) {
+            return;
+        }
+        uint64_t one = 1;
+        ssize_t written = write(wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+
+    // Interest follows the waiters; a socket nobody waits on is removed
+    // entirely, since epoll reports hang-ups even with an empty mask
+    bool updateInterest(int fd, FdState& state) {
+        uint32_t events = 0;
+        if (state.reader) {
+            events |= EPOLLIN | EPOLLRDHUP;
+        }
+        if (state.writer) {
+            events |= EPOLLOUT;
+        }
+        if (events == 0) {
+            if (state.registered) {
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+            }
+            fds.erase(fd);
+            return true;
+        }
+        struct epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        int op = state.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        if (epoll_ctl(epollFd, op, fd, &event) != 0) {
+            return false;
+        }
+        state.registered = true;
+        return true;
+    }
+
+    // io_uring: forget a socket's state once nothing refers to it
+    void releaseIfIdle(int fd, const FdState& state) {
+        if (!state.reader && !state.writer && !state.readPoll && !state.writePoll && !state.receiveOp &&
+            state.received.empty() && !state.receiveEnded && !state.receiveFailed) {
+            fds.erase(fd);
+        }
+    }
+
+    void release(int fd, FdState& state) {
+        if (ring) {
+            releaseIfIdle(fd, state);
+        } else {
+            updateInterest(fd, state);
+        }
+    }
+
+    uint64_t startOp(int fd, OpKind kind) {
+        uint64_t id = nextOp++;
+        ops[id] = Op{fd, kind};
+        return id;
+    }
+
+    // io_uring: make sure an operation that will wake the waiter is in flight;
+    // ready is set when there is nothing to wait for
+    bool armRing(const Waiter& waiter, FdState& state, bool& ready) {
+        if (waiter.receive) {
+            if (!state.received.empty() || state.receiveEnded || state.receiveFailed) {
+                ready = true;
+                return true;
+            }
+            if (!state.receiveOp) {
+                uint64_t id = startOp(waiter.fd, OpKind::Receive);
+                if (!ring->recvMultishot(waiter.fd, id)) {
+                    ops.erase(id);
+                    return false;
+                }
+                state.receiveOp = id;
+            }
+            return true;
+        }
+        // A poll still in flight from an earlier, timed-out wait is reused
+        uint64_t& poll = waiter.write ? state.writePoll : state.readPoll;
+        if (!poll) {
+            uint64_t id = startOp(waiter.fd, waiter.write ? OpKind::PollWrite : OpKind::PollRead);
+            if (!ring->pollAdd(waiter.fd, waiter.write, id)) {
+                ops.erase(id);
+                return false;
+            }
+            poll = id;
+        }
+        return true;
+    }
+
+    void handleCompletion(const IoUring::Completion& completion, std::vector<std::coroutine_handle<>>& resume) {
+        if (completion.userData == kWakeOp) {
+            ring->read(wakeFd, &wakeValue, sizeof(wakeValue), kWakeOp);
+            return;
+        }
+        auto it = ops.find(completion.userData);
+        if (it == ops.end()) {
+            if (completion.hasBuffer()) {
+                ring->recycleReceiveBuffer(completion.flags);
+            }
+            return;
+        }
+        Op op = it->second;
+        if (!completion.more()) {
+            ops.erase(it);
+        }
+
+        // Completions of cancelled operations, or for an earlier socket
+        // with the same descriptor, no longer match the socket's state
+        auto found = fds.find(op.fd);
+        FdState* state = nullptr;
+        if (found != fds.end()) {
+            uint64_t current = op.kind == OpKind::PollRead ? found->second.readPoll
+                             : op.kind == OpKind::PollWrite ? found->second.writePoll
+                             : found->second.receiveOp;
+            if (current == completion.userData) {
+                state = &found->second;
+            }
+        }
+
+        if (op.kind == OpKind::Receive) {
+            if (completion.hasBuffer()) {
+                if (state && completion.result > 0) {
+                    state->received.append(ring->receiveBuffer(completion.flags),
+                                           static_cast<size_t>(completion.result));
+                }
+                ring->recycleReceiveBuffer(completion.flags);
+            }
+            if (!state) {
+                return;
+            }
+            if (completion.result == 0) {
+                state->receiveEnded = true;
+            } else if (completion.result < 0 && completion.result != -ENOBUFS) {
+                state->receiveFailed = true;
+            }
+            if (!completion.more()) {
+                state->receiveOp = 0;
+            }
+            if (state->reader) {
+                bool ready = false;
+                if (state->received.empty() && !state->receiveEnded && !state->receiveFailed) {
+                    // Ran out of provided buffers; those are back now, so rearm
+                    if (armRing(*state->reader, *state, ready)) {
+                        return;
+                    }
+                    state->receiveFailed = true;
+                }
+                complete(std::exchange(state->reader, nullptr), true, resume);
+            }
+        } else if (state) {
+            bool write = op.kind == OpKind::PollWrite;
+            (write ? state->writePoll : state->readPoll) = 0;
+            Waiter*& waiter = write ? state->writer : state->reader;
+            if (waiter) {
+                complete(std::exchange(waiter, nullptr), true, resume);
+            }
+        }
+        if (state) {
+            releaseIfIdle(op.fd, *state);
+        }
+    }
+
+    // Detach a waiter from its socket and timer and queue it for resumption
+    void complete(Waiter* waiter, bool ready, std::vector<std::coroutine_handle<>>& resume) {
+        if (waiter->hasTimer) {
+            timers.erase(waiter->timer);
+            waiter->hasTimer = false;
+        }
+        waiter->ready = ready;
+        resume.push_back(waiter->handle);
+    }
+
+    int nextTimeoutMs() {
+        if (!posted.empty()) {
+            return 0;
+        }
+        if (!timers.empty()) {
+            return static_cast<int>(std::max<int64_t>(0, timers.begin()->first - steadyNowMs()));
+        }
+        return -1;
+    }
+
+    void expireTimers(std::vector<std::coroutine_handle<>>& resume) {
+        int64_t now = steadyNowMs();
+        while (!timers.empty() && timers.begin()->first <= now) {
+            Waiter* waiter = timers.begin()->second;
+            if (waiter->fd >= 0) {
+                auto it = fds.find(waiter->fd);
+                if (it != fds.end()) {
+                    Waiter*& slot = waiter->write ? it->second.writer : it->second.reader;
+                    if (slot == waiter) {
+                        slot = nullptr;
+                    }
+                    release(waiter->fd, it->second);
+                }
+                waiter->ready = false;
+            }
+            timers.erase(timers.begin());
+            waiter->hasTimer = false;
+            resume.push_back(waiter->handle);
+        }
+    }
+};
+
+IoExecutor::IoExecutor(int threads, IoBackend backend)
+    : backend_(backend), nextLoop_(0) {
+    if (backend_ == IoBackend::Auto) {
+        backend_ = IoUring::supported() ? IoBackend::IoUring : IoBackend::Epoll;
+    } else if (backend_ == IoBackend::IoUring && !IoUring::supported()) {
+        LOG_WARNING("io_uring requested but not available; using epoll");
+        backend_ = IoBackend::Epoll;
+    }
+
+    threads = std::max(1, threads);
+    for (int i = 0; i < threads; i++) {
+        auto loop = std::make_unique<Loop>();
+        loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->epollFd < 0 || loop->wakeFd < 0) {
+            LOG_ERROR("Failed to create I/O event loop");
+        }
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = loop->wakeFd;
+        epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &event);
+        loops_.push_back(std::move(loop));
+    }
+
+    // Each loop thread sets up and tears down its own ring (see IoUring);
+    // if any of them fails, all loops run on epoll
+    bool wantRing = backend_ == IoBackend::IoUring;
+    std::promise<bool> useRing;
+    std::shared_future<bool> decided = useRing.get_future().share();
+    std::vector<std::future<bool>> ringsReady;
+    for (auto& loop : loops_) {
+        Loop* raw = loop.get();
+        auto ready = std::make_shared<std::promise<bool>>();
+        ringsReady.push_back(ready->get_future());
+        loop->thread = std::thread([this, raw, wantRing, ready, decided]() {
+            if (wantRing) {
+                raw->ring = std::make_unique<IoUring>();
+                ready->set_value(raw->ring->init(kRingEntries) &&
+                                 raw->ring->setupReceiveBuffers(kReceiveBuffers, kReceiveBufferSize) &&
+                                 raw->ring->read(raw->wakeFd, &raw->wakeValue, sizeof(raw->wakeValue), kWakeOp));
+                if (!decided.get()) {
+                    raw->ring.reset();
+                }
+            }
+            run(*raw);
+            raw->ring.reset();
+        });
+    }
+    if (wantRing) {
+        for (auto& ready : ringsReady) {
+            if (!ready.get() && backend_ == IoBackend::IoUring) {
+                LOG_WARNING("Failed to set up io_uring loop; using epoll");
+                backend_ = IoBackend::Epoll;
+            }
+        }
+    }
+    useRing.set_value(backend_ == IoBackend::IoUring);
+}
+
+IoExecutor::~IoExecutor() {
+    // Coroutines still waiting are abandoned; finish sessions before this
+    for (auto& loop : loops_) {
+        {
+            std::lock_guard<std::mutex> lock(loop->mutex);
+            loop->stopping = true;
+        }
+        loop->submitted.notify_all();
+        loop->wake();
+    }
+    for (auto& loop : loops_) {
+        if (loop->thread.joinable()) {
+            loop->thread.join();
+        }
+        close(loop->epollFd);
+        close(loop->wakeFd);
+    }
+}
+
+void IoExecutor::spawn(Task<void> task) {
+    Pens::spawn(startOn(*this, std::move(task)));
+}
+
+Task<ssize_t> IoExecutor::receive(int fd, std::string& out, int timeoutMs) {
+    if (backend_ == IoBackend::IoUring) {
+        while (true) {
+            ssize_t taken = takeReceived(fd, out);
+            if (taken != -2) {
+                co_return taken;
+            }
+            if (!co_await IoAwaiter(*this, fd, false, timeoutMs, true)) {
+                co_return -1;
+            }
+        }
+    }
+    char chunk[kReceiveBufferSize];
+    while (true) {
+        ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received >= 0) {
+            out.append(chunk, static_cast<size_t>(received));
+            co_return received;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if ((errno != EAGAIN && errno != EWOULDBLOCK) || !co_await readable(fd, timeoutMs)) {
+            co_return -1;
+        }
+    }
+}
+
+ssize_t IoExecutor::takeReceived(int fd, std::string& out) {
+    Loop& loop = loopFor(fd);
+    std::lock_guard<std::mutex> lock(loop.mutex);
+    auto it = loop.fds.find(fd);
+    if (it == loop.fds.end()) {
+        return -2;
+    }
+    Loop::FdState& state = it->second;
+    if (!state.received.empty()) {
+        ssize_t taken = static_cast<ssize_t>(state.received.size());
+        if (out.empty()) {
+            out.swap(state.received);
+        } else {
+            out += state.received;
+            state.received.clear();
+        }
+        loop.releaseIfIdle(fd, state);
+        return taken;
+    }
+    if (state.receiveFailed) {
+        return -1;
+    }
+    return state.receiveEnded ? 0 : -2;
+}
+
+void IoExecutor::forget(int fd) {
+    Loop& loop = loopFor(fd);
+    std::vector<std::coroutine_handle<>> resume;
+    {
+        std::unique_lock<std::mutex> lock(loop.mutex);
+        auto it = loop.fds.find(fd);
+        if (it == loop.fds.end()) {
+            return;
+        }
+        // Anyone still waiting on the socket gets a failed wait
+        for (Waiter* waiter : {it->second.reader, it->second.writer}) {
+            if (waiter) {
+                loop.complete(waiter, false, resume);
+            }
+        }
+        bool ring = loop.ring != nullptr;
+        if (ring) {
+            // The ring keeps the socket open while operations on it are in flight
+            for (uint64_t id : {it->second.readPoll, it->second.writePoll, it->second.receiveOp}) {
+                if (id) {
+                    loop.ring->cancel(id, kCancelOp);
+                }
+            }
+        } else if (it->second.registered) {
+            epoll_ctl(loop.epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        }
+        loop.fds.erase(it);
+        loop.posted.insert(loop.posted.end(), resume.begin(), resume.end());
+
+        if (ring) {
+            // Everything queued for the socket must reach the kernel before the
+            // caller closes it, or the descriptor may already name another socket.
+            // Only the loop thread enters the ring: completions run task work on
+            // the submitting thread, which interrupts its blocking syscalls.
+            if (std::this_thread::get_id() == loop.threadId.load()) {
+                loop.ring->submit();
+            } else {
+                uint64_t target = loop.submits + 1;
+                loop.wake();
+                loop.submitted.wait(lock, [&loop, target] { return loop.submits >= target || loop.stopping; });
+            }
+            return;
+        }
+    }
+    if (!resume.empty()) {
+        loop.wake();
+    }
+}
+
+IoExecutor::Loop& IoExecutor::loopFor(int fd) {
+    if (fd < 0) {
+        return *loops_[nextLoop_++ % loops_.size()];
+    }
+    return *loops_[static_cast<size_t>(fd) % loops_.size()];
+}
+
+void IoExecutor::arm(Waiter& waiter, int timeoutMs) {
+    Loop& loop = loopFor(waiter.fd);
+    {
+        std::lock_guard<std::mutex> lock(loop.mutex);
+        if (waiter.fd >= 0) {
+            Loop::FdState& state = loop.fds[waiter.fd];
+            Waiter*& slot = waiter.write ? state.writer : state.reader;
+            slot = &waiter;
+            bool ready = false;
+            bool armed = loop.ring ? loop.armRing(waiter, state, ready) : loop.updateInterest(waiter.fd, state);
+            if (!armed || ready) {
+                // Nothing to wait for, or not a pollable descriptor (closed?)
+                slot = nullptr;
+                loop.release(waiter.fd, state);
+                waiter.ready = ready;
+                loop.posted.push_back(waiter.handle);
+                timeoutMs = -1;
+            }
+        } else {
+            waiter.ready = true;  // a plain sleep always "succeeds"
+            timeoutMs = std::max(0, timeoutMs);
+        }
+        if (timeoutMs >= 0) {
+            // The clock reads whole milliseconds, so a deadline of now + timeoutMs
+            // could come up to 1 ms early; a timer must never fire before its time
+            int64_t deadline = steadyNowMs() + timeoutMs + (timeoutMs > 0 ? 1 : 0);
+            waiter.timer = loop.timers.emplace(deadline, &waiter);
+            waiter.hasTimer = true;
+        }
+        // The waiter may be resumed on the loop thread as soon as the lock
+        // is released; it must not be touched after this point
+    }
+    loop.wake();
+}
+
+void IoExecutor::post(std::coroutine_handle<> handle) {
+    Loop& loop = loopFor(-1);
+    {
+        std::lock_guard<std::mutex> lock(loop.mutex);
+        loop.posted.push_back(handle);
+    }
+    loop.wake();
+}
+
+void IoExecutor::run(Loop& loop) {
+    loop.threadId = std::this_thread::get_id();
+    if (loop.ring) {
+        runRing(loop);
+        return;
+    }
+
+    std::vector<struct epoll_event> events(256);
+    std::vector<std::coroutine_handle<>> resume;
+
+    while (true) {
+        int timeoutMs;
+        {
+            std::lock_guard<std::mutex> lock(loop.mutex);
+            if (loop.stopping) {
+                break;
+            }
+            timeoutMs = loop.nextTimeoutMs();
+        }
+
+        int count = epoll_wait(loop.epollFd, events.data(), static_cast<int>(events.size()), timeoutMs);
+        if (count < 0 && errno != EINTR) {
+            LOG_ERROR("epoll_wait failed");
+            break;
+        }
+
+        resume.clear();
+        {
+            std::lock_guard<std::mutex> lock(loop.mutex);
+            for (int i = 0; i < count; i++) {
+                int fd = events[i].data.fd;
+                uint32_t what = events[i].events;
+                if (fd == loop.wakeFd) {
+                    uint64_t drained;
+                    ssize_t got = read(loop.wakeFd, &drained, sizeof(drained));
+                    (void)got;
+                    continue;
+                }
+                auto it = loop.fds.find(fd);
+                if (it == loop.fds.end()) {
+                    continue;
+                }
+                Loop::FdState& state = it->second;
+                bool failed = what & (EPOLLERR | EPOLLHUP);
+                if (state.reader && (failed || (what & (EPOLLIN | EPOLLRDHUP)))) {
+                    loop.complete(std::exchange(state.reader, nullptr), true, resume);
+                }
+                if (state.writer && (failed || (what & EPOLLOUT))) {
+                    loop.complete(std::exchange(state.writer, nullptr), true, resume);
+                }
+                loop.updateInterest(fd, state);
+            }
+            loop.expireTimers(resume);
+            resume.insert(resume.end(), loop.posted.begin(), loop.posted.end());
+            loop.posted.clear();
+        }
+
+        for (auto handle : resume) {
+            handle.resume();
+        }
+    }
+}
+
+void IoExecutor::runRing(Loop& loop) {
+    std::vector<IoUring::Completion> completions;
+    std::vector<std::coroutine_handle<>> resume;
+
+    while (true) {
+        int timeoutMs;
+        {
+            // Everything queued since the last pass goes in with one syscall
+            std::lock_guard<std::mutex> lock(loop.mutex);
+            if (loop.stopping) {
+                break;
+            }
+            timeoutMs = loop.nextTimeoutMs();
+            if (!loop.ring->submit()) {
+                LOG_ERROR("io_uring submission failed");
+                break;
+            }
+            loop.submits++;
+        }
+        loop.submitted.notify_all();
+
+        if (!loop.ring->wait(timeoutMs)) {
+            LOG_ERROR("io_uring wait failed");
+            break;
+        }
+
+        resume.clear();
+        completions.clear();
+        {
+            std::lock_guard<std::mutex> lock(loop.mutex);
+            loop.ring->completions(completions);
+            for (const IoUring::Completion& completion : completions) {
+                loop.handleCompletion(completion, resume);
+            }
+            loop.expireTimers(resume);
+            resume.insert(resume.end(), loop.posted.begin(), loop.posted.end());
+            loop.posted.clear();
+        }
+
+        for (auto handle : resume) {
+            handle.resume();
+        }
+    }
+    // A ring that failed takes no more submissions; don't leave forget() waiting
+    {
+        std::lock_guard<std::mutex> lock(loop.mutex);
+        loop.stopping = true;
+    }
+    loop.submitted.notify_all();
+}
+
+} // namespace Pens
@@ -0,0 +1,472 @@
+#include "io_uring.hpp"
+#include "logger.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define PENS_HAVE_IO_URING 1
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#endif
+
+namespace Pens {
+
+#ifdef PENS_HAVE_IO_URING
+
+namespace {
+
+int enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argSize) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+int registerWith(int fd, unsigned opcode, void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+} // namespace
+
+struct IoUring::Rings {
+    void* sqMap = MAP_FAILED;
+    size_t sqMapSize = 0;
+    void* cqMap = MAP_FAILED;
+    size_t cqMapSize = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqesSize = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+IoUring::IoUring()
+    : ringFd_(-1), features_(0), rings_(nullptr), queued_(0),
+      bufferRing_(nullptr), bufferCount_(0), bufferSize_(0) {}
+
+IoUring::~IoUring() {
+    release();
+}
+
+void IoUring::release() {
+    if (rings_) {
+        if (rings_->sqes != MAP_FAILED) {
+            munmap(rings_->sqes, rings_->sqesSize);
+        }
+        if (rings_->cqMap != MAP_FAILED && rings_->cqMap != rings_->sqMap) {
+            munmap(rings_->cqMap, rings_->cqMapSize);
+        }
+        if (rings_->sqMap != MAP_FAILED) {
+            munmap(rings_->sqMap, rings_->sqMapSize);
+        }
+        delete rings_;
+        rings_ = nullptr;
+    }
+    if (ringFd_ >= 0) {
+        close(ringFd_);
+        ringFd_ = -1;
+    }
+    // The kernel drops its references to the buffer ring with the ring fd
+    if (bufferRing_) {
+        munmap(bufferRing_, bufferCount_ * sizeof(io_uring_buf));
+        bufferRing_ = nullptr;
+    }
+    queued_ = 0;
+}
+
+bool IoUring::init(unsigned entries) {
+    release();
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0) {
+        return false;
+    }
+    ringFd_ = fd;
+    features_ = params.features;
+    rings_ = new Rings();
+
+    rings_->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    rings_->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (features_ & IORING_FEAT_SINGLE_MMAP) {
+        rings_->sqMapSize = rings_->cqMapSize = std::max(rings_->sqMapSize, rings_->cqMapSize);
+    }
+    rings_->sqMap = mmap(nullptr, rings_->sqMapSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (rings_->sqMap == MAP_FAILED) {
+        release();
+        return false;
+    }
+    if (features_ & IORING_FEAT_SINGLE_MMAP) {
+        rings_->cqMap = rings_->sqMap;
+    } else {
+        rings_->cqMap = mmap(nullptr, rings_->cqMapSize, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (rings_->cqMap == MAP_FAILED) {
+            release();
+            return false;
+        }
+    }
+    rings_->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    rings_->sqes = static_cast<io_uring_sqe*>(mmap(nullptr, rings_->sqesSize, PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (rings_->sqes == MAP_FAILED) {
+        release();
+        return false;
+    }
+
+    char* sq = static_cast<char*>(rings_->sqMap);
+    char* cq = static_cast<char*>(rings_->cqMap);
+    rings_->sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    rings_->sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    rings_->sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    rings_->sqEntries = params.sq_entries;
+    rings_->sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    rings_->cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    rings_->cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    rings_->cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    rings_->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+void* IoUring::nextEntry() {
+    if (!rings_) {
+        return nullptr;
+    }
+    unsigned tail = *rings_->sqTail;
+    if (tail - __atomic_load_n(rings_->sqHead, __ATOMIC_ACQUIRE) >= rings_->sqEntries) {
+        // Full: push the backlog to the kernel to make room
+        if (!submit() || tail - __atomic_load_n(rings_->sqHead, __ATOMIC_ACQUIRE) >= rings_->sqEntries) {
+            return nullptr;
+        }
+    }
+    io_uring_sqe* entry = &rings_->sqes[tail & rings_->sqMask];
+    std::memset(entry, 0, sizeof(*entry));
+    return entry;
+}
+
+void IoUring::commit() {
+    unsigned tail = *rings_->sqTail;
+    rings_->sqArray[tail & rings_->sqMask] = tail & rings_->sqMask;
+    __atomic_store_n(rings_->sqTail, tail + 1, __ATOMIC_RELEASE);
+    queued_++;
+}
+
+bool IoUring::pollAdd(int fd, bool write, uint64_t userData) {
+    auto* entry = static_cast<io_uring_sqe*>(nextEntry());
+    if (!entry) {
+        return false;
+    }
+    entry->opcode = IORING_OP_POLL_ADD;
+    entry->fd = fd;
+    entry->poll32_events = write ? POLLOUT : (POLLIN | POLLRDHUP);
+    entry->user_data = userData;
+    commit();
+    return true;
+}
+
+bool IoUring::read(int fd, void* data, unsigned length, uint64_t userData) {
+    auto* entry = static_cast<io_uring_sqe*>(nextEntry());
+    if (!entry) {
+        return false;
+    }
+    entry->opcode = IORING_OP_READ;
+    entry->fd = fd;
+    entry->addr = reinterpret_cast<uint64_t>(data);
+    entry->len = length;
+    entry->off = static_cast<uint64_t>(-1);  // current position
+    entry->user_data = userData;
+    commit();
+    return true;
+}
+
+bool IoUring::write(int fd, const void* data, unsigned length, uint64_t userData, bool link) {
+    auto* entry = static_cast<io_uring_sqe*>(nextEntry());
+    if (!entry) {
+        return false;
+    }
+    entry->opcode = IORING_OP_WRITE;
+    entry->fd = fd;
+    entry->addr = reinterpret_cast<uint64_t>(data);
+    entry->len = length;
+    entry->off = static_cast<uint64_t>(-1);
+    entry->flags = link ? IOSQE_IO_LINK : 0;
+    entry->user_data = userData;
+    commit();
+    return true;
+}
+
+bool IoUring::writeFixed(int fd, const void* data, unsigned length, uint64_t userData, bool link) {
+    auto* entry = static_cast<io_uring_sqe*>(nextEntry());
+    if (!entry) {
+        return false;
+    }
+    entry->opcode = IORING_OP_WRITE_FIXED;
+    entry->fd = fd;
+    entry->addr = reinterpret_cast<uint64_t>(data);
+    entry->len = length;
+    entry->off = static_cast<uint64_t>(-1);
+    entry->buf_index = 0;
+    entry->flags = link ? IOSQE_IO_LINK : 0;
+    entry->user_data = userData;
+    commit();
+    return true;
+}
+
+bool IoUring::fdatasync(int fd, uint64_t userData) {
+    auto* entry = static_cast<io_uring_sqe*>(nextEntry());
+    if (!entry) {
+        return false;
+    }
+    entry->opcode = IORING_OP_FSYNC;
+    entry->fd = fd;
+    entry->fsync_flags = IORING_FSYNC_DATASYNC;
+    entry->user_data = userData;
+    commit();
+    return true;
+}
+
+bool IoUring::recvMultishot(int fd, uint64_t userData) {
+    if (!bufferRing_) {
+        return false;
+    }
+    auto* entry = static_cast<io_uring_sqe*>(nextEntry());
+    if (!entry) {
+        return false;
+    }
+    entry->opcode = IORING_OP_RECV;
+    entry->fd = fd;
+    entry->ioprio = IORING_RECV_MULTISHOT;
+    entry->flags = IOSQE_BUFFER_SELECT;
+    entry->buf_group = 0;
+    entry->user_data = userData;
+    commit();
+    return true;
+}
+
+bool IoUring::cancel(uint64_t target, uint64_t userData) {
+    auto* entry = static_cast<io_uring_sqe*>(nextEntry());
+    if (!entry) {
+        return false;
+    }
+    entry->opcode = IORING_OP_ASYNC_CANCEL;
+    entry->fd = -1;
+    entry->addr = target;
+    entry->user_data = userData;
+    commit();
+    return true;
+}
+
+bool IoUring::submit() {
+    while (queued_ > 0) {
+        int submitted = enter(ringFd_, queued_, 0, 0, nullptr, 0);
+        if (submitted < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Out of completion space or memory for now: retry on the next call
+            return errno == EAGAIN || errno == EBUSY;
+        }
+        queued_ -= std::min<unsigned>(queued_, static_cast<unsigned>(submitted));
+    }
+    return true;
+}
+
+bool IoUring::wait(int timeoutMs) {
+    if (timeoutMs == 0) {
+        return true;
+    }
+    __kernel_timespec timeout = {};
+    io_uring_getevents_arg arg = {};
+    arg.sigmask_sz = _NSIG / 8;
+    if (timeoutMs > 0) {
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+        arg.ts = reinterpret_cast<uint64_t>(&timeout);
+    }
+    int result = enter(ringFd_, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    return result >= 0 || errno == ETIME || errno == EINTR;
+}
+
+size_t IoUring::completions(std::vector<Completion>& out) {
+    if (!rings_) {
+        return 0;
+    }
+    unsigned head = *rings_->cqHead;
+    unsigned tail = __atomic_load_n(rings_->cqTail, __ATOMIC_ACQUIRE);
+    size_t count = 0;
+    for (; head != tail; head++, count++) {
+        const io_uring_cqe& entry = rings_->cqes[head & rings_->cqMask];
+        out.push_back({entry.user_data, entry.res, entry.flags});
+    }
+    __atomic_store_n(rings_->cqHead, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+bool IoUring::Completion::more() const {
+    return flags & IORING_CQE_F_MORE;
+}
+
+bool IoUring::Completion::hasBuffer() const {
+    return flags & IORING_CQE_F_BUFFER;
+}
+
+bool IoUring::registerBuffer(void* data, size_t length) {
+    struct iovec buffer = {data, length};
+    return registerWith(ringFd_, IORING_REGISTER_BUFFERS, &buffer, 1) == 0;
+}
+
+bool IoUring::setupReceiveBuffers(unsigned count, unsigned size) {
+    if (count == 0 || (count & (count - 1)) != 0 || bufferRing_) {
+        return false;
+    }
+    // The ring itself must be page aligned. It is used as a plain
+    // io_uring_buf array whose first resv field is the tail: in C++ the
+    // header's io_uring_buf_ring puts its flexible array at the wrong offset.
+    void* ring = mmap(nullptr, count * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        return false;
+    }
+    io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+    reg.ring_entries = count;
+    reg.bgid = 0;
+    if (registerWith(ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        munmap(ring, count * sizeof(io_uring_buf));
+        return false;
+    }
+    bufferRing_ = ring;
+    bufferCount_ = count;
+    bufferSize_ = size;
+    receiveStorage_.assign(static_cast<size_t>(count) * size, 0);
+
+    auto* buffers = static_cast<io_uring_buf*>(ring);
+    for (unsigned i = 0; i < count; i++) {
+        buffers[i].addr = reinterpret_cast<uint64_t>(receiveStorage_.data() + static_cast<size_t>(i) * size);
+        buffers[i].len = size;
+        buffers[i].bid = static_cast<uint16_t>(i);
+    }
+    __atomic_store_n(&buffers[0].resv, static_cast<uint16_t>(count), __ATOMIC_RELEASE);
+    return true;
+}
+
+const char* IoUring::receiveBuffer(uint32_t flags) const {
+    size_t id = flags >> IORING_CQE_BUFFER_SHIFT;
+    return receiveStorage_.data() + id * bufferSize_;
+}
+
+void IoUring::recycleReceiveBuffer(uint32_t flags) {
+    auto* buffers = static_cast<io_uring_buf*>(bufferRing_);
+    uint16_t id = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+    uint16_t tail = buffers[0].resv;
+    io_uring_buf& buffer = buffers[tail & (bufferCount_ - 1)];
+    buffer.addr = reinterpret_cast<uint64_t>(receiveStorage_.data() + static_cast<size_t>(id) * bufferSize_);
+    buffer.len = bufferSize_;
+    buffer.bid = id;
+    __atomic_store_n(&buffers[0].resv, static_cast<uint16_t>(tail + 1), __ATOMIC_RELEASE);
+}
+
+bool IoUring::probe() {
+    if (!(features_ & IORING_FEAT_EXT_ARG)) {
+        return false;
+    }
+    const int opcodes[] = {IORING_OP_POLL_ADD, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_WRITE_FIXED,
+                           IORING_OP_FSYNC, IORING_OP_RECV, IORING_OP_ASYNC_CANCEL};
+    std::vector<char> storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    auto* info = reinterpret_cast<io_uring_probe*>(storage.data());
+    if (registerWith(ringFd_, IORING_REGISTER_PROBE, info, 256) != 0) {
+        return false;
+    }
+    for (int opcode : opcodes) {
+        if (opcode > info->last_op || !(info->ops[opcode].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+        }
+    }
+    if (!setupReceiveBuffers(2, 64)) {
+        return false;
+    }
+
+    // Multishot receive has no probe bit; try it on a socket pair
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+        return false;
+    }
+    bool multishot = false;
+    if (recvMultishot(pair[0], 1) && submit() && ::write(pair[1], "x", 1) == 1) {
+        std::vector<Completion> done;
+        for (int attempt = 0; attempt < 10 && done.empty(); attempt++) {
+            wait(100);
+            completions(done);
+        }
+        multishot = !done.empty() && done[0].result == 1 && (done[0].flags & IORING_CQE_F_MORE);
+    }
+    close(pair[0]);
+    close(pair[1]);
+    return multishot;
+}
+
+bool IoUring::supported() {
+    static const bool available = []() {
+        // On a thread of its own, like every ring (see the class comment)
+        bool ok = false;
+        std::thread([&ok] {
+            IoUring ring;
+            ok = ring.init(8) && ring.probe();
+        }).join();
+        if (!ok) {
+            LOG_INFO("io_uring not available; using epoll and plain writes");
+        }
+        return ok;
+    }();
+    return available;
+}
+
+#else
+
+struct IoUring::Rings {};
+
+IoUring::IoUring()
+    : ringFd_(-1), features_(0), rings_(nullptr), queued_(0),
+      bufferRing_(nullptr), bufferCount_(0), bufferSize_(0) {}
+IoUring::~IoUring() {}
+bool IoUring::Completion::more() const { return false; }
+bool IoUring::Completion::hasBuffer() const { return false; }
+void IoUring::release() {}
+bool IoUring::init(unsigned) { return false; }
+void* IoUring::nextEntry() { return nullptr; }
+void IoUring::commit() {}
+bool IoUring::pollAdd(int, bool, uint64_t) { return false; }
+bool IoUring::read(int, void*, unsigned, uint64_t) { return false; }
+bool IoUring::write(int, const void*, unsigned, uint64_t, bool) { return false; }
+bool IoUring::writeFixed(int, const void*, unsigned, uint64_t, bool) { return false; }
+bool IoUring::fdatasync(int, uint64_t) { return false; }
+bool IoUring::recvMultishot(int, uint64_t) { return false; }
+bool IoUring::cancel(uint64_t, uint64_t) { return false; }
+bool IoUring::submit() { return false; }
+bool IoUring::wait(int) { return false; }
+size_t IoUring::completions(std::vector<Completion>&) { return 0; }
+bool IoUring::registerBuffer(void*, size_t) { return false; }
+bool IoUring::setupReceiveBuffers(unsigned, unsigned) { return false; }
+const char* IoUring::receiveBuffer(uint32_t) const { return nullptr; }
+void IoUring::recycleReceiveBuffer(uint32_t) {}
+bool IoUring::probe() { return false; }
+bool IoUring::supported() { return false; }
+
+#endif
+
+} // namespace Pens
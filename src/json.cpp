@@ -0,0 +1,531 @@
+#include "json.hpp"
+#include <charconv>
+
+namespace Pens {
+
+namespace {
+
+// Handler used by findString/findInt: matches one key at depth 1
+class TopLevelLookup : public JsonHandler {
+public:
+    TopLevelLookup(std::string_view key, std::string* stringOut, int64_t* intOut)
+        : key_(key), stringOut_(stringOut), intOut_(intOut) {}
+
+    bool found = false;
+
+    bool onObjectStart() override { depth_++; matchNext_ = false; return true; }
+    bool onObjectEnd() override { depth_--; return true; }
+    bool onArrayStart() override { depth_++; matchNext_ = false; return true; }
+    bool onArrayEnd() override { depth_--; return true; }
+
+    bool onKey(std::string_view key) override {
+        matchNext_ = (depth_ == 1 && key == key_);
+        return true;
+    }
+
+    bool onString(std::string_view value) override {
+        if (matchNext_ && stringOut_) {
+            stringOut_->assign(value.data(), value.size());
+            found = true;
+            return false;
+        }
+        matchNext_ = false;
+        return true;
+    }
+
+    bool onNumber(std::string_view raw) override {
+        if (matchNext_ && intOut_) {
+            found = JsonReader::toInt64(raw, *intOut_);
+            return false;
+        }
+        matchNext_ = false;
+        return true;
+    }
+
+    bool onBool(bool) override { return stopIfMatched(); }
+    bool onNull() override { return stopIfMatched(); }
+
+private:
+    std::string_view key_;
+    std::string* stringOut_;
+    int64_t* intOut_;
+    int depth_ = 0;
+    bool matchNext_ = false;
+
+    bool stopIfMatched() {
+        // Key present with a value of the wrong type: stop without a match
+        bool matched = matchNext_;
+        matchNext_ = false;
+        return !matched;
+    }
+};
+
+void appendUtf8(std::string& out, uint32_t codepoint) {
+    if (codepoint < 0x80) {
+        out += static_cast<char>(codepoint);
+    } else if (codepoint < 0x800) {
+        out += static_cast<char>(0xC0 | (codepoint >> 6));
+        out += static_cast<char>(0x80 | (codepoint & 0x3F));
+    } else if (codepoint < 0x10000) {
+        out += static_cast<char>(0xE0 | (codepoint >> 12));
+        out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codepoint & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (codepoint >> 18));
+        out += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codepoint & 0x3F));
+    }
+}
+
+bool parseHex4(std::string_view input, size_t pos, uint32_t& value) {
+    if (pos + 4 > input.size()) {
+        return false;
+    }
+    value = 0;
+    for (size_t i = pos; i < pos + 4; i++) {
+        char c = input[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') value |= c - '0';
+        else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+        else return false;
+    }
+    return true;
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+// JsonReader
+
+bool JsonReader::parse(std::string_view input, JsonHandler& handler) {
+    input_ = input;
+    pos_ = 0;
+    depth_ = 0;
+    error_.clear();
+
+    skipWhitespace();
+    if (!parseValue(handler)) {
+        return false;
+    }
+    skipWhitespace();
+    if (pos_ != input_.size()) {
+        return fail("Trailing characters after JSON value");
+    }
+    return true;
+}
+
+bool JsonReader::fail(const char* message) {
+    if (error_.empty()) {
+        error_ = std::string(message) + " at offset " + std::to_string(pos_);
+    }
+    return false;
+}
+
+void JsonReader::skipWhitespace() {
+    while (pos_ < input_.size()) {
+        char c = input_[pos_];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            break;
+        }
+        pos_++;
+    }
+}
+
+bool JsonReader::parseValue(JsonHandler& handler) {
+    if (pos_ >= input_.size()) {
+        return fail("Unexpected end of input");
+    }
+
+    switch (input_[pos_]) {
+        case '{':
+            return parseObject(handler);
+        case '[':
+            return parseArray(handler);
+        case '"': {
+            std::string_view text;
+            if (!parseString(text)) return false;
+            return handler.onString(text) || fail("Stopped by handler");
+        }
+        case 't':
+            if (!parseLiteral("true")) return false;
+            return handler.onBool(true) || fail("Stopped by handler");
+        case 'f':
+            if (!parseLiteral("false")) return false;
+            return handler.onBool(false) || fail("Stopped by handler");
+        case 'n':
+            if (!parseLiteral("null")) return false;
+            return handler.onNull() || fail("Stopped by handler");
+        default: {
+            std::string_view raw;
+            if (!parseNumber(raw)) return false;
+            return handler.onNumber(raw) || fail("Stopped by handler");
+        }
+    }
+}
+
+bool JsonReader::parseObject(JsonHandler& handler) {
+    if (++depth_ > kMaxDepth) {
+        return fail("Maximum nesting depth exceeded");
+    }
+    pos_++;  // '{'
+    if (!handler.onObjectStart()) {
+        return fail("Stopped by handler");
+    }
+
+    skipWhitespace();
+    if (pos_ < input_.size() && input_[pos_] == '}') {
+        pos_++;
+        depth_--;
+        return handler.onObjectEnd() || fail("Stopped by handler");
+    }
+
+    while (true) {
+        skipWhitespace();
+        if (pos_ >= input_.size() || input_[pos_] != '"') {
+            return fail("Expected object key");
+        }
+        std::string_view key;
+        if (!parseString(key)) return false;
+        if (!handler.onKey(key)) return fail("Stopped by handler");
+
+        skipWhitespace();
+        if (pos_ >= input_.size() || input_[pos_] != ':') {
+            return fail("Expected ':' after object key");
+        }
+        pos_++;
+        skipWhitespace();
+        if (!parseValue(handler)) return false;
+
+        skipWhitespace();
+        if (pos_ >= input_.size()) {
+            return fail("Unterminated object");
+        }
+        if (input_[pos_] == ',') {
+            pos_++;
+            continue;
+        }
+        if (input_[pos_] == '}') {
+            pos_++;
+            depth_--;
+            return handler.onObjectEnd() || fail("Stopped by handler");
+        }
+        return fail("Expected ',' or '}' in object");
+    }
+}
+
+bool JsonReader::parseArray(JsonHandler& handler) {
+    if (++depth_ > kMaxDepth) {
+        return fail("Maximum nesting depth exceeded");
+    }
+    pos_++;  // '['
+    if (!handler.onArrayStart()) {
+        return fail("Stopped by handler");
+    }
+
+    skipWhitespace();
+    if (pos_ < input_.size() && input_[pos_] == ']') {
+        pos_++;
+        depth_--;
+        return handler.onArrayEnd() || fail("Stopped by handler");
+    }
+
+    while (true) {
+        skipWhitespace();
+        if (!parseValue(handler)) return false;
+
+        skipWhitespace();
+        if (pos_ >= input_.size()) {
+            return fail("Unterminated array");
+        }
+        if (input_[pos_] == ',') {
+            pos_++;
+            continue;
+        }
+        if (input_[pos_] == ']') {
+            pos_++;
+            depth_--;
+            return handler.onArrayEnd() || fail("Stopped by handler");
+        }
+        return fail("Expected ',' or ']' in array");
+    }
+}
+
+bool JsonReader::parseString(std::string_view& out) {
+    size_t start = ++pos_;  // skip opening quote
+
+    // Fast path: no escapes, hand out a view into the input
+    while (pos_ < input_.size()) {
+        unsigned char c = input_[pos_];
+        if (c == '"') {
+            out = input_.substr(start, pos_ - start);
+            pos_++;
+            return true;
+        }
+        if (c == '\\') {
+            break;
+        }
+        if (c < 0x20) {
+            return fail("Control character in string");
+        }
+        pos_++;
+    }
+    if (pos_ >= input_.size()) {
+        return fail("Unterminated string");
+    }
+
+    // Slow path: decode escapes into the reusable scratch buffer
+    scratch_.assign(input_.data() + start, pos_ - start);
+    while (pos_ < input_.size()) {
+        unsigned char c = input_[pos_];
+        if (c == '"') {
+            out = scratch_;
+            pos_++;
+            return true;
+        }
+        if (c < 0x20) {
+            return fail("Control character in string");
+        }
+        if (c != '\\') {
+            scratch_ += static_cast<char>(c);
+            pos_++;
+            continue;
+        }
+
+        if (++pos_ >= input_.size()) {
+            break;
+        }
+        char escape = input_[pos_++];
+        switch (escape) {
+            case '"': scratch_ += '"'; break;
+            case '\\': scratch_ += '\\'; break;
+            case '/': scratch_ += '/'; break;
+            case 'b': scratch_ += '\b'; break;
+            case 'f': scratch_ += '\f'; break;
+            case 'n': scratch_ += '\n'; break;
+            case 'r': scratch_ += '\r'; break;
+            case 't': scratch_ += '\t'; break;
+            case 'u': {
+                uint32_t codepoint;
+                if (!parseHex4(input_, pos_, codepoint)) {
+                    return fail("Invalid \\u escape");
+                }
+                pos_ += 4;
+                if (codepoint >= 0xD800 && codepoint <= 0xDBFF) {
+                    uint32_t low;
+                    if (pos_ + 6 > input_.size() || input_[pos_] != '\\' || input_[pos_ + 1] != 'u' ||
+                        !parseHex4(input_, pos_ + 2, low) || low < 0xDC00 || low > 0xDFFF) {
+                        return fail("Invalid surrogate pair");
+                    }
+                    pos_ += 6;
+                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                }
+                appendUtf8(scratch_, codepoint);
+                break;
+            }
+            default:
+                return fail("Invalid escape sequence");
+        }
+    }
+    return fail("Unterminated string");
+}
+
+bool JsonReader::parseNumber(std::string_view& out) {
+    size_t start = pos_;
+    auto digits = [this]() {
+        size_t begin = pos_;
+        while (pos_ < input_.size() && input_[pos_] >= '0' && input_[pos_] <= '9') {
+            pos_++;
+        }
+        return pos_ - begin;
+    };
+
+    if (pos_ < input_.size() && input_[pos_] == '-') {
+        pos_++;
+    }
+    if (pos_ < input_.size() && input_[pos_] == '0') {
+        pos_++;
+    } else if (digits() == 0) {
+        return fail("Invalid value");
+    }
+    if (pos_ < input_.size() && input_[pos_] == '.') {
+        pos_++;
+        if (digits() == 0) return fail("Invalid number fraction");
+    }
+    if (pos_ < input_.size() && (input_[pos_] == 'e' || input_[pos_] == 'E')) {
+        pos_++;
+        if (pos_ < input_.size() && (input_[pos_] == '+' || input_[pos_] == '-')) {
+            pos_++;
+        }
+        if (digits() == 0) return fail("Invalid number exponent");
+    }
+
+    out = input_.substr(start, pos_ - start);
+    return true;
+}
+
+bool JsonReader::parseLiteral(std::string_view literal) {
+    if (input_.substr(pos_, literal.size()) != literal) {
+        return fail("Invalid literal");
+    }
+    pos_ += literal.size();
+    return true;
+}
+
+bool JsonReader::toInt64(std::string_view raw, int64_t& value) {
+    auto result = std::from_chars(raw.data(), raw.data() + raw.size(), value);
+    return result.ec == std::errc() && result.ptr == raw.data() + raw.size();
+}
+
+bool JsonReader::findString(std::string_view json, std::string_view key, std::string& value) {
+    TopLevelLookup lookup(key, &value, nullptr);
+    JsonReader reader;
+    reader.parse(json, lookup);
+    return lookup.found;
+}
+
+bool JsonReader::findInt(std::string_view json, std::string_view key, int64_t& value) {
+    TopLevelLookup lookup(key, nullptr, &value);
+    JsonReader reader;
+    reader.parse(json, lookup);
+    return lookup.found;
+}
+
+// ---------------------------------------------------------------------------
+// JsonWriter
+
+JsonWriter::JsonWriter(std::string& out, bool pretty)
+    : out_(out), pretty_(pretty), depth_(0), afterKey_(false) {
+    first_[0] = true;
+}
+
+void JsonWriter::newline() {
+    if (pretty_) {
+        out_ += '\n';
+        out_.append(static_cast<size_t>(depth_) * 2, ' ');
+    }
+}
+
+void JsonWriter::beforeValue() {
+    if (afterKey_) {
+        afterKey_ = false;
+        return;
+    }
+    if (depth_ > 0) {
+        if (!first_[depth_]) {
+            out_ += ',';
+        }
+        first_[depth_] = false;
+        newline();
+    }
+}
+
+JsonWriter& JsonWriter::beginObject() {
+    beforeValue();
+    out_ += '{';
+    if (depth_ < JsonReader::kMaxDepth) {
+        first_[++depth_] = true;
+    }
+    return *this;
+}
+
+JsonWriter& JsonWriter::endObject() {
+    bool empty = first_[depth_];
+    if (depth_ > 0) depth_--;
+    if (!empty) newline();
+    out_ += '}';
+    return *this;
+}
+
+JsonWriter& JsonWriter::beginArray() {
+    beforeValue();
+    out_ += '[';
+    if (depth_ < JsonReader::kMaxDepth) {
+        first_[++depth_] = true;
+    }
+    return *this;
+}
+
+JsonWriter& JsonWriter::endArray() {
+    bool empty = first_[depth_];
+    if (depth_ > 0) depth_--;
+    if (!empty) newline();
+    out_ += ']';
+    return *this;
+}
+
+JsonWriter& JsonWriter::key(std::string_view name) {
+    beforeValue();
+    out_ += '"';
+    appendEscaped(out_, name);
+    out_ += pretty_ ? "\": " : "\":";
+    afterKey_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(std::string_view text) {
+    beforeValue();
+    out_ += '"';
+    appendEscaped(out_, text);
+    out_ += '"';
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(const char* text) {
+    return value(std::string_view(text));
+}
+
+JsonWriter& JsonWriter::value(int64_t number) {
+    beforeValue();
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), number);
+    out_.append(buffer, result.ptr - buffer);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(int number) {
+    return value(static_cast<int64_t>(number));
+}
+
+JsonWriter& JsonWriter::value(bool flag) {
+    beforeValue();
+    out_ += flag ? "true" : "false";
+    return *this;
+}
+
+JsonWriter& JsonWriter::null() {
+    beforeValue();
+    out_ += "null";
+    return *this;
+}
+
+void JsonWriter::appendEscaped(std::string& out, std::string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    size_t runStart = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = text[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(text.data() + runStart, i - runStart);
+        runStart = i + 1;
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            default:
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xF];
+                break;
+        }
+    }
+    out.append(text.data() + runStart, text.size() - runStart);
+}
+
+} // namespace Pens
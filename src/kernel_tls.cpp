@@ -0,0 +1,87 @@
+#include "kernel_tls.hpp"
+#include "logger.hpp"
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <openssl/bio.h>
+#include <openssl/ssl.h>
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+namespace Pens {
+
+bool KernelTls::supported() {
+    static const bool available = [] {
+        bool ok = probe();
+        if (!ok) {
+            LOG_INFO("Kernel TLS not available; OpenSSL keeps TLS records in userspace");
+        }
+        return ok;
+    }();
+    return available;
+}
+
+bool KernelTls::probe() {
+#ifdef OPENSSL_NO_KTLS
+    return false;
+#else
+    // The kernel only accepts the "tls" ULP on a connected TCP socket, so
+    // try it on a throwaway loopback connection
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        return false;
+    }
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    int client = -1;
+    int server = -1;
+    bool ok = false;
+    if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 && listen(listener, 1) == 0 &&
+        getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &length) == 0) {
+        client = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (client >= 0 && connect(client, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+            server = accept(listener, nullptr, nullptr);
+            ok = server >= 0 && setsockopt(client, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0;
+        }
+    }
+    for (int fd : {server, client, listener}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    return ok;
+#endif
+}
+
+bool KernelTls::enable(SSL_CTX* ctx) {
+    if (!ctx || !supported()) {
+        return false;
+    }
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    return true;
+}
+
+bool KernelTls::sendOffloaded(SSL* ssl) {
+    return ssl && BIO_get_ktls_send(SSL_get_wbio(ssl));
+}
+
+bool KernelTls::receiveOffloaded(SSL* ssl) {
+    return ssl && BIO_get_ktls_recv(SSL_get_rbio(ssl));
+}
+
+void KernelTls::report(SSL* ssl, const std::string& peer) {
+    bool send = sendOffloaded(ssl);
+    bool receive = receiveOffloaded(ssl);
+    std::string directions = send && receive ? "send and receive" : send ? "send only" : receive ? "receive only"
+                                                                                                 : "off";
+    LOG_DEBUG("Kernel TLS for " + peer + " (" + SSL_get_cipher_name(ssl) + "): " + directions);
+}
+
+} // namespace Pens
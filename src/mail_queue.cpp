@@ -0,0 +1,784 @@
+#include "mail_queue.hpp"
+#include "io_uring.hpp"
+#include "smtp_connection_pool.hpp"
+#include "token_store.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Pens {
+
+namespace {
+
+// Record framing: magic, type, payload length, CRC-32 of type + payload
+constexpr uint32_t kRecordMagic = 0x31514D50; // "PMQ1"
+constexpr size_t kRecordHeader = 13;
+
+constexpr uint8_t kEnqueue = 1;
+constexpr uint8_t kDone = 2;
+constexpr uint8_t kRetry = 3;
+constexpr uint8_t kDead = 4;
+constexpr uint8_t kDeadLetter = 5;
+
+constexpr size_t kLingerBytes = 64 * 1024; // flush early once this much is buffered
+constexpr int kWriteRetryMs = 100;          // pause before retrying a failed spool write
+
+// io_uring spool writes: a registered staging buffer cut into windows that
+// are written as one linked chain ending in fdatasync
+constexpr size_t kStagingWindow = 256 * 1024;
+constexpr size_t kStagingWindows = 4;
+
+const char* const kDeadLetterFile = "dead-letters.log";
+
+uint32_t crc32(uint8_t type, const char* data, size_t length) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    uint32_t crc = 0xFFFFFFFFu;
+    crc = table[(crc ^ type) & 0xFF] ^ (crc >> 8);
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void putU32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+void putU64(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; i++) out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+void putString(std::string& out, const std::string& value) {
+    putU32(out, static_cast<uint32_t>(value.size()));
+    out += value;
+}
+
+// Bounds-checked little-endian reader over one record payload
+class PayloadReader {
+public:
+    PayloadReader(const char* data, size_t length) : data_(data), length_(length), pos_(0) {}
+
+    bool u32(uint32_t& value) {
+        if (length_ - pos_ < 4) return false;
+        value = 0;
+        for (int i = 0; i < 4; i++) value |= uint32_t(static_cast<uint8_t>(data_[pos_ + i])) << (8 * i);
+        pos_ += 4;
+        return true;
+    }
+
+    bool u64(uint64_t& value) {
+        if (length_ - pos_ < 8) return false;
+        value = 0;
+        for (int i = 0; i < 8; i++) value |= uint64_t(static_cast<uint8_t>(data_[pos_ + i])) << (8 * i);
+        pos_ += 8;
+        return true;
+    }
+
+    bool string(std::string& value) {
+        uint32_t size;
+        if (!u32(size) || length_ - pos_ < size) return false;
+        value.assign(data_ + pos_, size);
+        pos_ += size;
+        return true;
+    }
+
+private:
+    const char* data_;
+    size_t length_;
+    size_t pos_;
+};
+
+std::string frame(uint8_t type, const std::string& payload) {
+    std::string record;
+    record.reserve(kRecordHeader + payload.size());
+    putU32(record, kRecordMagic);
+    record.push_back(static_cast<char>(type));
+    putU32(record, static_cast<uint32_t>(payload.size()));
+    putU32(record, crc32(type, payload.data(), payload.size()));
+    record += payload;
+    return record;
+}
+
+// Calls handler(type, reader) for each intact record; stops at the first
+// damaged or truncated one (a torn write at the tail after a crash)
+template <typename Handler>
+bool forEachRecord(const std::string& data, Handler handler) {
+    size_t pos = 0;
+    while (pos < data.size()) {
+        PayloadReader header(data.data() + pos, data.size() - pos);
+        uint32_t magic, length, crc;
+        if (!header.u32(magic) || magic != kRecordMagic || data.size() - pos < kRecordHeader) {
+            return false;
+        }
+        uint8_t type = static_cast<uint8_t>(data[pos + 4]);
+        PayloadReader rest(data.data() + pos + 5, data.size() - pos - 5);
+        if (!rest.u32(length) || !rest.u32(crc) || data.size() - pos - kRecordHeader < length) {
+            return false;
+        }
+        const char* payload = data.data() + pos + kRecordHeader;
+        if (crc32(type, payload, length) != crc) {
+            return false;
+        }
+        PayloadReader reader(payload, length);
+        handler(type, reader);
+        pos += kRecordHeader + length;
+    }
+    return true;
+}
+
+std::string encodeMessage(const OutboundMessage& message) {
+    std::string payload;
+    putU64(payload, message.id);
+    putU32(payload, static_cast<uint32_t>(message.attempts));
+    putU64(payload, static_cast<uint64_t>(message.notBefore));
+    putString(payload, message.from);
+    putString(payload, message.to);
+    putString(payload, message.subject);
+    putString(payload, message.body);
+    return payload;
+}
+
+bool decodeMessage(PayloadReader& reader, OutboundMessage& message) {
+    uint32_t attempts;
+    uint64_t notBefore;
+    if (!reader.u64(message.id) || !reader.u32(attempts) || !reader.u64(notBefore) ||
+        !reader.string(message.from) || !reader.string(message.to) ||
+        !reader.string(message.subject) || !reader.string(message.body)) {
+        return false;
+    }
+    message.attempts = static_cast<int>(attempts);
+    message.notBefore = static_cast<int64_t>(notBefore);
+    return true;
+}
+
+int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool writeAll(int fd, const char* data, size_t length) {
+    size_t offset = 0;
+    while (offset < length) {
+        ssize_t n = ::write(fd, data + offset, length - offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        offset += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool writeAll(int fd, const std::string& data) {
+    return writeAll(fd, data.data(), data.size());
+}
+
+// Append the pieces to fd and make them durable, one io_uring submission
+// per staging buffer's worth. A short or failed write breaks the chain;
+// the rest of that round is then finished with write() and fdatasync().
+bool appendWithRing(IoUring& ring, char* staging, int fd, const std::vector<const std::string*>& pieces) {
+    size_t total = 0;
+    for (const std::string* piece : pieces) {
+        total += piece->size();
+    }
+    size_t done = 0;
+    size_t pieceIndex = 0;
+    size_t pieceOffset = 0;
+    while (done < total) {
+        size_t fill = std::min(total - done, kStagingWindow * kStagingWindows);
+        for (size_t copied = 0; copied < fill;) {
+            const std::string& piece = *pieces[pieceIndex];
+            size_t take = std::min(piece.size() - pieceOffset, fill - copied);
+            std::memcpy(staging + copied, piece.data() + pieceOffset, take);
+            copied += take;
+            pieceOffset += take;
+            if (pieceOffset == piece.size()) {
+                pieceIndex++;
+                pieceOffset = 0;
+            }
+        }
+        bool last = done + fill == total;
+        size_t windows = (fill + kStagingWindow - 1) / kStagingWindow;
+        auto windowLength = [fill](size_t window) {
+            return std::min(kStagingWindow, fill - window * kStagingWindow);
+        };
+
+        // Whatever got queued is submitted and waited for; anything that
+        // did not fit is left to the write() fallback below
+        size_t expected = windows + (last ? 1 : 0);
+        size_t queued = 0;
+        while (queued < windows &&
+               ring.writeFixed(fd, staging + queued * kStagingWindow, static_cast<unsigned>(windowLength(queued)),
+                               queued + 1, queued + 1 < windows || last)) {
+            queued++;
+        }
+        if (queued == windows && last && ring.fdatasync(fd, expected)) {
+            queued++;
+        }
+        std::vector<int32_t> results(expected + 1, -ECANCELED);
+        std::vector<IoUring::Completion> completions;
+        if (ring.submit()) {
+            while (completions.size() < queued && ring.wait(-1)) {
+                ring.completions(completions);
+            }
+        }
+        for (const IoUring::Completion& completion : completions) {
+            if (completion.userData >= 1 && completion.userData <= expected) {
+                results[completion.userData] = completion.result;
+            }
+        }
+
+        size_t written = 0;
+        for (size_t w = 0; w < windows; w++) {
+            written += static_cast<size_t>(std::max(0, results[w + 1]));
+            if (results[w + 1] != static_cast<int32_t>(windowLength(w))) {
+                break;
+            }
+        }
+        if (written < fill) {
+            if (!writeAll(fd, staging + written, fill - written) || (last && ::fdatasync(fd) != 0)) {
+                return false;
+            }
+        } else if (last && results[expected] < 0) {
+            return false;
+        }
+        done += fill;
+    }
+    return true;
+}
+
+void syncDirectory(const std::string& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+} // namespace
+
+MailQueue::MailQueue(MailQueueSettings settings, Sender sender)
+    : settings_(std::move(settings)),
+      sender_(std::move(sender)),
+      running_(false),
+      stopFlusher_(false),
+      inFlight_(0),
+      nextId_(1),
+      appendSegment_(1),
+      appendSegmentBytes_(0),
+      appendedSeq_(0),
+      durableSeq_(0),
+      flushFailed_(false),
+      delivered_(0),
+      deadLettered_(0) {
+}
+
+MailQueue::~MailQueue() {
+    stop();
+}
+
+std::string MailQueue::segmentPath(uint32_t segment) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "seg-%08u.log", segment);
+    return settings_.spoolDir + "/" + name;
+}
+
+bool MailQueue::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        return true;
+    }
+
+    if (::mkdir(settings_.spoolDir.c_str(), 0700) != 0 && errno != EEXIST) {
+        LOG_ERROR("Cannot create mail spool " + settings_.spoolDir + ": " + std::strerror(errno));
+        return false;
+    }
+    if (!recover()) {
+        return false;
+    }
+
+    running_ = true;
+    stopFlusher_ = false;
+    flusher_ = std::thread(&MailQueue::flushLoop, this);
+    for (int i = 0; i < settings_.workers; i++) {
+        workers_.emplace_back(&MailQueue::workerLoop, this);
+    }
+
+    LOG_INFO("Mail queue started with " + std::to_string(messages_.size()) + " pending messages");
+    return true;
+}
+
+void MailQueue::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    workAvailable_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+
+    // Workers are done, so the flusher can write their final records and exit
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopFlusher_ = true;
+    }
+    flushWake_.notify_all();
+    flusher_.join();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    durable_.notify_all();
+    idle_.notify_all();
+}
+
+bool MailQueue::recover() {
+    messages_.clear();
+    messageSegment_.clear();
+    segmentLive_.clear();
+    schedule_ = decltype(schedule_)();
+
+    std::vector<uint32_t> segments;
+    DIR* dir = ::opendir(settings_.spoolDir.c_str());
+    if (!dir) {
+        LOG_ERROR("Cannot read mail spool " + settings_.spoolDir);
+        return false;
+    }
+    while (struct dirent* entry = ::readdir(dir)) {
+        unsigned segment;
+        char tail;
+        if (std::sscanf(entry->d_name, "seg-%8u.lo%c", &segment, &tail) == 2 && tail == 'g') {
+            segments.push_back(segment);
+        }
+    }
+    ::closedir(dir);
+    std::sort(segments.begin(), segments.end());
+
+    for (uint32_t segment : segments) {
+        replaySegment(segment, segmentPath(segment));
+    }
+
+    // Never append after a possibly torn tail: new records go to a fresh segment
+    appendSegment_ = segments.empty() ? 1 : segments.back() + 1;
+    appendSegmentBytes_ = 0;
+    segmentLive_[appendSegment_];
+
+    for (const auto& entry : messages_) {
+        schedule_.push({entry.second.notBefore, entry.first});
+    }
+    return true;
+}
+
+void MailQueue::replaySegment(uint32_t segment, const std::string& path) {
+    std::string data;
+    if (!TokenStore::readFile(path, data)) {
+        LOG_ERROR("Cannot read spool segment " + path);
+        return;
+    }
+
+    segmentLive_[segment];
+    bool intact = forEachRecord(data, [&](uint8_t type, PayloadReader& reader) {
+        uint64_t id = 0;
+        if (type == kEnqueue) {
+            OutboundMessage message;
+            if (decodeMessage(reader, message)) {
+                nextId_ = std::max(nextId_, message.id + 1);
+                messages_[message.id] = message;
+                messageSegment_[message.id] = segment;
+                segmentLive_[segment]++;
+            }
+        } else if ((type == kDone || type == kDead) && reader.u64(id)) {
+            nextId_ = std::max(nextId_, id + 1);
+            if (messages_.count(id)) {
+                complete(id);
+            }
+        } else if (type == kRetry && reader.u64(id)) {
+            uint32_t attempts;
+            uint64_t notBefore;
+            auto it = messages_.find(id);
+            if (it != messages_.end() && reader.u32(attempts) && reader.u64(notBefore)) {
+                it->second.attempts = static_cast<int>(attempts);
+                it->second.notBefore = static_cast<int64_t>(notBefore);
+            }
+        }
+    });
+
+    if (!intact) {
+        LOG_WARNING("Spool segment " + path + " ends in a damaged record; ignoring the tail");
+    }
+}
+
+uint64_t MailQueue::append(uint8_t type, const std::string& payload) {
+    // Caller holds mutex_
+    std::string record = frame(type, payload);
+
+    if (appendSegmentBytes_ > 0 && appendSegmentBytes_ + record.size() > settings_.segmentMaxBytes) {
+        appendSegment_++;
+        appendSegmentBytes_ = 0;
+        segmentLive_[appendSegment_];
+    }
+    appendSegmentBytes_ += record.size();
+
+    if (pending_.empty() || pending_.back().segment != appendSegment_) {
+        pending_.push_back(Chunk{appendSegment_, std::string()});
+    }
+    pending_.back().data += record;
+
+    flushWake_.notify_one();
+    return ++appendedSeq_;
+}
+
+uint64_t MailQueue::enqueue(const std::string& from,
+                            const std::string& to,
+                            const std::string& subject,
+                            const std::string& body) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+        return 0;
+    }
+
+    uint64_t id = nextId_++;
+    OutboundMessage message;
+    message.id = id;
+    message.from = from;
+    message.to = to;
+    message.subject = subject;
+    message.body = body;
+
+    append(kEnqueue, encodeMessage(message));
+    messageSegment_[message.id] = appendSegment_;
+    segmentLive_[appendSegment_]++;
+    schedule_.push({0, id});
+    messages_[id] = std::move(message);
+
+    workAvailable_.notify_one();
+    return id;
+}
+
+bool MailQueue::flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t target = appendedSeq_;
+    flushWake_.notify_one();
+    durable_.wait(lock, [&] { return durableSeq_ >= target; });
+    return !flushFailed_;
+}
+
+bool MailQueue::waitIdle(int timeoutMs) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return idle_.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                          [&] { return messages_.empty() && inFlight_ == 0; });
+}
+
+size_t MailQueue::getPendingCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return messages_.size();
+}
+
+size_t MailQueue::getDeliveredCount() const {
+    return delivered_.load();
+}
+
+size_t MailQueue::getDeadLetterCount() const {
+    return deadLettered_.load();
+}
+
+void MailQueue::complete(uint64_t id) {
+    // Caller holds mutex_
+    messages_.erase(id);
+    auto it = messageSegment_.find(id);
+    if (it != messageSegment_.end()) {
+        segmentLive_[it->second]--;
+        messageSegment_.erase(it);
+    }
+}
+
+std::vector<uint32_t> MailQueue::takeDrainedSegments(uint32_t writeSegment) {
+    // Caller holds mutex_. Segments are only dropped oldest-first, so a
+    // completion record can never outlive the segment holding its message.
+    std::vector<uint32_t> drained;
+    while (!segmentLive_.empty()) {
+        auto oldest = segmentLive_.begin();
+        if (oldest->first >= writeSegment || oldest->first >= appendSegment_ || oldest->second != 0) {
+            break;
+        }
+        drained.push_back(oldest->first);
+        segmentLive_.erase(oldest);
+    }
+    return drained;
+}
+
+void MailQueue::flushLoop() {
+    int fd = -1;
+    uint32_t fdSegment = 0;
+
+    // The staging buffer is pinned by the kernel, so it never moves
+    IoUring ring;
+    std::vector<char> staging;
+    bool useRing = settings_.useIoUring && IoUring::supported() && ring.init(8);
+    if (useRing) {
+        staging.resize(kStagingWindow * kStagingWindows);
+        useRing = ring.registerBuffer(staging.data(), staging.size());
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        flushWake_.wait(lock, [&] { return !pending_.empty() || stopFlusher_; });
+        if (pending_.empty()) {
+            break;
+        }
+
+        // Linger briefly so records from concurrent callers share one fsync
+        if (!stopFlusher_ && pending_.size() == 1 && pending_.front().data.size() < kLingerBytes) {
+            flushWake_.wait_for(lock, std::chrono::milliseconds(settings_.flushIntervalMs), [&] {
+                return stopFlusher_ || pending_.size() > 1 || pending_.front().data.size() >= kLingerBytes;
+            });
+        }
+
+        std::vector<Chunk> chunks;
+        chunks.swap(pending_);
+        uint64_t seq = appendedSeq_;
+        lock.unlock();
+
+        // Each run of chunks for one segment is appended and synced together.
+        // A failed run is cut back off its segment, so no torn record hides
+        // the ones written after it, and it and everything behind it is
+        // tried again.
+        size_t failedFrom = chunks.size();
+        bool truncated = true;
+        for (size_t first = 0, end; first < chunks.size(); first = end) {
+            uint32_t segment = chunks[first].segment;
+            std::vector<const std::string*> run;
+            for (end = first; end < chunks.size() && chunks[end].segment == segment; end++) {
+                run.push_back(&chunks[end].data);
+            }
+            if (fd < 0 || fdSegment != segment) {
+                if (fd >= 0) {
+                    ::close(fd);
+                }
+                fd = ::open(segmentPath(segment).c_str(),
+                            O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+                fdSegment = segment;
+                if (fd < 0) {
+                    LOG_ERROR("Cannot open spool segment " + segmentPath(segment) + ": " + std::strerror(errno));
+                    failedFrom = first;
+                    break;
+                }
+                syncDirectory(settings_.spoolDir);
+            }
+            struct stat before;
+            bool ok = ::fstat(fd, &before) == 0;
+            if (ok && useRing) {
+                ok = appendWithRing(ring, staging.data(), fd, run);
+            } else if (ok) {
+                for (const std::string* data : run) {
+                    ok = ok && writeAll(fd, *data);
+                }
+                ok = ok && ::fdatasync(fd) == 0;
+            }
+            if (!ok) {
+                LOG_ERROR("Mail spool write to " + segmentPath(segment) + " failed: " + std::strerror(errno));
+                truncated = ::ftruncate(fd, before.st_size) == 0 && ::fdatasync(fd) == 0;
+                if (!truncated) {
+                    ::close(fd);
+                    fd = -1;
+                }
+                failedFrom = first;
+                break;
+            }
+        }
+
+        lock.lock();
+        bool ok = failedFrom == chunks.size();
+        if (!ok) {
+            uint32_t broken = chunks[failedFrom].segment;
+            std::vector<Chunk> retry(std::make_move_iterator(chunks.begin() + failedFrom),
+                                     std::make_move_iterator(chunks.end()));
+            retry.insert(retry.end(), std::make_move_iterator(pending_.begin()),
+                         std::make_move_iterator(pending_.end()));
+            if (!truncated) {
+                // The segment may end in a torn record: everything not yet
+                // durable moves, in order, to a fresh segment
+                uint32_t fresh = appendSegment_ + 1;
+                appendSegment_ = fresh;
+                appendSegmentBytes_ = 0;
+                segmentLive_[fresh];
+                for (Chunk& chunk : retry) {
+                    if (chunk.segment >= broken) {
+                        chunk.segment = fresh;
+                        appendSegmentBytes_ += chunk.data.size();
+                    }
+                }
+            }
+            pending_.swap(retry);
+        }
+        durableSeq_ = seq;
+        flushFailed_ = !ok;
+        durable_.notify_all();
+        if (!ok) {
+            if (stopFlusher_) {
+                LOG_ERROR("Mail spool still failing at shutdown; unwritten messages are lost");
+                break;
+            }
+            flushWake_.wait_for(lock, std::chrono::milliseconds(kWriteRetryMs), [&] { return stopFlusher_; });
+        }
+
+        std::vector<uint32_t> drained = takeDrainedSegments(fdSegment);
+        if (!drained.empty()) {
+            lock.unlock();
+            for (uint32_t segment : drained) {
+                ::unlink(segmentPath(segment).c_str());
+            }
+            lock.lock();
+        }
+    }
+
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    durable_.notify_all();
+}
+
+int64_t MailQueue::retryDelayMs(int attempts) const {
+    int64_t delay = settings_.retryBaseMs;
+    for (int i = 1; i < attempts && delay < settings_.retryMaxMs; i++) {
+        delay *= 2;
+    }
+    return std::min(delay, settings_.retryMaxMs);
+}
+
+void MailQueue::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (running_) {
+        if (schedule_.empty()) {
+            workAvailable_.wait(lock);
+            continue;
+        }
+        auto next = schedule_.top();
+        int64_t now = nowMs();
+        if (next.first > now) {
+            workAvailable_.wait_for(lock, std::chrono::milliseconds(next.first - now));
+            continue;
+        }
+        schedule_.pop();
+
+        auto it = messages_.find(next.second);
+        if (it == messages_.end()) {
+            continue;
+        }
+        OutboundMessage message = it->second;
+        inFlight_++;
+        lock.unlock();
+
+        int code = sender_(message);
+
+        if (code >= 200 && code < 300) {
+            lock.lock();
+            complete(message.id);
+            std::string payload;
+            putU64(payload, message.id);
+            append(kDone, payload);
+            delivered_++;
+        } else if (code >= 500 || message.attempts + 1 >= settings_.maxAttempts) {
+            // Persist the dead letter before the log forgets the message
+            writeDeadLetter(message, code);
+            LOG_ERROR("Giving up on message " + std::to_string(message.id) + " to " + message.to +
+                      " (reply " + std::to_string(code) + ")");
+            lock.lock();
+            complete(message.id);
+            std::string payload;
+            putU64(payload, message.id);
+            append(kDead, payload);
+            deadLettered_++;
+        } else {
+            lock.lock();
+            auto current = messages_.find(message.id);
+            if (current != messages_.end()) {
+                current->second.attempts++;
+                current->second.notBefore = nowMs() + retryDelayMs(current->second.attempts);
+                std::string payload;
+                putU64(payload, message.id);
+                putU32(payload, static_cast<uint32_t>(current->second.attempts));
+                putU64(payload, static_cast<uint64_t>(current->second.notBefore));
+                append(kRetry, payload);
+                schedule_.push({current->second.notBefore, message.id});
+                LOG_WARNING("Delivery to " + message.to + " deferred (reply " + std::to_string(code) +
+                            "), attempt " + std::to_string(current->second.attempts));
+            }
+            workAvailable_.notify_one();
+        }
+
+        inFlight_--;
+        if (messages_.empty() && inFlight_ == 0) {
+            idle_.notify_all();
+        }
+    }
+}
+
+bool MailQueue::writeDeadLetter(const OutboundMessage& message, int replyCode) {
+    std::string payload = encodeMessage(message);
+    putU32(payload, static_cast<uint32_t>(replyCode));
+    std::string record = frame(kDeadLetter, payload);
+
+    std::lock_guard<std::mutex> lock(deadLetterMutex_);
+    std::string path = settings_.spoolDir + "/" + kDeadLetterFile;
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOG_ERROR("Cannot open dead-letter file " + path + ": " + std::strerror(errno));
+        return false;
+    }
+    bool ok = writeAll(fd, record) && ::fdatasync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+std::vector<OutboundMessage> MailQueue::getDeadLetters() const {
+    std::vector<OutboundMessage> letters;
+    std::string data;
+    {
+        std::lock_guard<std::mutex> lock(deadLetterMutex_);
+        if (!TokenStore::readFile(settings_.spoolDir + "/" + kDeadLetterFile, data)) {
+            return letters;
+        }
+    }
+    forEachRecord(data, [&](uint8_t type, PayloadReader& reader) {
+        OutboundMessage message;
+        if (type == kDeadLetter && decodeMessage(reader, message)) {
+            letters.push_back(std::move(message));
+        }
+    });
+    return letters;
+}
+
+MailQueue::Sender MailQueue::smtpSender(SmtpConnectionPool& pool) {
+    return [&pool](const OutboundMessage& message) {
+        int code = 0;
+        pool.sendEmail(message.from, message.to, message.subject, message.body, &code);
+        return code;
+    };
+}
+
+} // namespace Pens
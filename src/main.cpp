@@ -1,8 +1,19 @@
 #include "imap_client.hpp"
+#include "folder_monitor.hpp"
+#include "imap_session_supervisor.hpp"
+#include "imap_keepalive.hpp"
 #include "notification_processor.hpp"
 #include "config.hpp"
 #include "logger.hpp"
 #include "oauth_token_manager.hpp"
+#include "rate_limiter.hpp"
+#include "smtp_connection_pool.hpp"
+#include "token_refresher.hpp"
+#include "token_broker.hpp"
+#include "token_store.hpp"
+#include "verification_server.hpp"
+#include "verification_service.hpp"
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <csignal>
@@ -58,6 +69,8 @@ void printUsage(const char* program) {
     std::cout << "  PENS_PRIORITY_THRESHOLD Priority threshold (1-10)\n";
     std::cout << "  PENS_CHECK_INTERVAL     Check interval in seconds\n";
     std::cout << "  PENS_DEBUG_MODE         Enable debug mode (true/false)\n";
+    std::cout << "  PENS_SMTP_SERVER        SMTP server for verification codes\n";
+    std::cout << "  PENS_VERIFICATION_SOCKET Serve the verification API on this socket\n";
     std::cout << "\nExample:\n";
     std::cout << "  " << program << " -s imap.gmail.com -u user@gmail.com -w password123\n";
     std::cout << std::endl;
@@ -69,6 +82,8 @@ int main(int argc, char* argv[]) {
     // Setup signal handlers
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    // A server dropping a connection must surface as a write error, not kill us
+    signal(SIGPIPE, SIG_IGN);
     
     // Get configuration
     Config& config = Config::getInstance();
@@ -132,13 +147,24 @@ int main(int argc, char* argv[]) {
     
     LOG_INFO("Starting Professional Email Notification System (PENS)");
 
-    std::unique_ptr<OAuthTokenManager> oauthManager;
+    // The broker owns the account tokens and optionally serves them to
+    // other PENS processes on this host
+    SharedTokenTable sharedTokens;
+    TokenBroker tokenBroker;
+    OAuthTokenManager* oauthManager = nullptr;
     if (config.useOAuth()) {
-        oauthManager = std::make_unique<OAuthTokenManager>(config);
+        oauthManager = tokenBroker.addAccount(config.getImapUsername(),
+                                              std::make_unique<OAuthTokenManager>(config));
+        if (!config.getTokenCachePath().empty() && sharedTokens.open(config.getTokenCachePath())) {
+            oauthManager->setSharedTable(&sharedTokens, config.getImapUsername());
+        }
         if (!oauthManager->ensureValidToken()) {
             LOG_ERROR("Unable to obtain a valid OAuth access token");
             return 1;
         }
+        if (!config.getTokenBrokerSocket().empty()) {
+            tokenBroker.startServer(config.getTokenBrokerSocket());
+        }
     }
     
     // Validate configuration
@@ -170,6 +196,11 @@ int main(int argc, char* argv[]) {
             config.getImapPort(),
             config.getImapUseSsl()
         );
+        client->setKernelTls(config.getImapKernelTls());
+        MessageSpillSettings spillSettings;
+        spillSettings.thresholdBytes = static_cast<size_t>(std::max(0, config.getImapSpillThresholdKb())) * 1024;
+        spillSettings.directory = config.getImapSpillDir();
+        client->setSpillSettings(spillSettings);
         
         // Connect and authenticate
         LOG_INFO("Connecting to IMAP server...");
@@ -205,13 +236,104 @@ int main(int argc, char* argv[]) {
         
         LOG_INFO("Connected and authenticated successfully");
         
+        // Keep the OAuth token fresh for the lifetime of the session
+        std::unique_ptr<TokenRefresher> tokenRefresher;
+        if (oauthManager && oauthManager->canRefresh() && !runOnce) {
+            tokenRefresher = std::make_unique<TokenRefresher>(
+                *oauthManager,
+                config.getOAuthRefreshLeadSeconds(),
+                config.getOAuthRefreshJitterSeconds()
+            );
+            tokenRefresher->addListener([client](const std::string& accessToken) {
+                client->updateOAuthToken(accessToken);
+            });
+            tokenRefresher->start();
+        }
+        
         // Create notification processor
         auto processor = std::make_shared<NotificationProcessor>();
         processor->setPriorityThreshold(config.getPriorityThreshold());
         
+        // Reconnects dropped sessions and resumes from the persisted UID watermark
+        ImapSessionSettings sessionSettings;
+        sessionSettings.mailbox = config.getImapMailbox();
+        sessionSettings.watermarkPath = config.getSyncStateFile();
+        auto supervisor = std::make_shared<ImapSessionSupervisor>(client, sessionSettings);
+        if (oauthManager) {
+            supervisor->setTokenProvider(config.getImapUsername(), [oauthManager](bool forceRefresh) {
+                bool ok = forceRefresh ? oauthManager->forceRefresh() : oauthManager->ensureValidToken();
+                return ok ? oauthManager->getAccessToken() : std::string();
+            });
+        }
+        
         // Create PENS manager
         auto manager = std::make_shared<PensManager>(client, processor);
         manager->setCheckInterval(config.getCheckInterval());
+        manager->setSessionSupervisor(supervisor);
+        
+        // Several folders: watch them concurrently over a small session pool
+        std::shared_ptr<FolderMonitor> folderMonitor;
+        std::vector<std::string> folders = config.getImapFolders();
+        if (!folders.empty() && !runOnce) {
+            FolderMonitorSettings monitorSettings;
+            monitorSettings.folders = folders;
+            monitorSettings.maxConnections = config.getImapMaxConnections();
+            monitorSettings.pollIntervalMs = static_cast<int64_t>(config.getCheckInterval()) * 1000;
+            monitorSettings.statePath = config.getSyncStateFile() + ".folders";
+            folderMonitor = std::make_shared<FolderMonitor>(monitorSettings, [&config, oauthManager, spillSettings]() {
+                auto session = std::make_shared<ImapClient>(
+                    config.getImapServer(), config.getImapPort(), config.getImapUseSsl());
+                session->setKernelTls(config.getImapKernelTls());
+                session->setSpillSettings(spillSettings);
+                if (!session->connect()) {
+                    return std::shared_ptr<ImapClient>();
+                }
+                bool ok = oauthManager
+                    ? oauthManager->ensureValidToken() &&
+                      session->authenticateOAuth(config.getImapUsername(), oauthManager->getAccessToken())
+                    : session->authenticate(config.getImapUsername(), config.getImapPassword());
+                return ok ? session : std::shared_ptr<ImapClient>();
+            });
+            manager->setFolderMonitor(folderMonitor);
+        }
+        
+        // Serve the local verification API when a socket is configured; codes
+        // are mailed through pooled SMTP sessions, subject to send rate limits
+        VerificationService verificationService;
+        RateLimiter rateLimiter;
+        std::unique_ptr<SmtpConnectionPool> smtpPool;
+        std::unique_ptr<VerificationServer> verificationServer;
+        if (!config.getVerificationSocket().empty() && !runOnce) {
+            if (config.getSmtpServer().empty()) {
+                LOG_ERROR("verification_socket is set but smtp_server is not");
+                return 1;
+            }
+            SmtpPoolSettings smtpSettings;
+            smtpSettings.server = config.getSmtpServer();
+            smtpSettings.port = config.getSmtpPort();
+            smtpSettings.useSsl = config.getSmtpUseSsl();
+            smtpSettings.username = config.getSmtpUsername();
+            smtpSettings.password = config.getSmtpPassword();
+            smtpSettings.maxConnections = static_cast<size_t>(std::max(1, config.getSmtpMaxConnections()));
+            if (oauthManager) {
+                smtpSettings.tokenProvider = [oauthManager]() {
+                    return oauthManager->ensureValidToken() ? oauthManager->getAccessToken() : std::string();
+                };
+            }
+            smtpPool = std::make_unique<SmtpConnectionPool>(smtpSettings);
+
+            VerificationServerSettings serverSettings;
+            serverSettings.socketPath = config.getVerificationSocket();
+            serverSettings.deliveryWorkers = std::max(1, config.getVerificationWorkers());
+            serverSettings.requestBudgetMs = config.getVerificationBudgetMs();
+            verificationServer = std::make_unique<VerificationServer>(
+                serverSettings, verificationService, VerificationServer::smtpSender(*smtpPool));
+            verificationServer->setRateLimiter(&rateLimiter);
+            if (!verificationServer->start()) {
+                LOG_ERROR("Failed to start the verification server on " + serverSettings.socketPath);
+                return 1;
+            }
+        }
         
         // Print system status
         std::cout << manager->getSystemStatus() << std::endl;
@@ -223,19 +345,49 @@ int main(int argc, char* argv[]) {
             LOG_INFO("Starting continuous email monitoring...");
             LOG_INFO("Press Ctrl+C to stop");
             
+            // NOOP the session when idle so half-open connections are found
+            // in seconds; the loop below then wakes to reconnect
+            ImapKeepalive keepalive;
+            if (folderMonitor) {
+                // The monitor opens its own sessions; the initial one only
+                // checked the credentials and would count against the
+                // provider's connection limit
+                client->disconnect();
+                folderMonitor->setKeepalive(&keepalive);
+                folderMonitor->start();
+            } else {
+                keepalive.add(client);
+            }
+            keepalive.start();
+            
             // Run in a loop until interrupted
             while (running) {
                 manager->processNewEmails();
                 
-                // Sleep for check interval
+                // Sleep for check interval, waking early for a due reconnect
+                // or mail the folder monitor already has waiting
                 for (int i = 0; i < config.getCheckInterval() && running; i++) {
+                    if (folderMonitor ? folderMonitor->hasPending() : supervisor->reconnectDue()) {
+                        break;
+                    }
                     std::this_thread::sleep_for(std::chrono::seconds(1));
                 }
             }
             
+            if (verificationServer) {
+                verificationServer->stop();
+            }
+            if (folderMonitor) {
+                folderMonitor->stop();
+            }
+            keepalive.stop();
             manager->stop();
         }
         
+        if (tokenRefresher) {
+            tokenRefresher->stop();
+        }
+        
         LOG_INFO("Disconnecting...");
         client->disconnect();
         
@@ -0,0 +1,103 @@
+#include "message_spill.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Pens {
+
+MessageSpill::MessageSpill(const std::string& directory)
+    : fd_(-1), size_(0), failed_(false) {
+    std::string dir = directory;
+    if (dir.empty()) {
+        const char* tmp = std::getenv("TMPDIR");
+        dir = tmp && *tmp ? tmp : "/tmp";
+    }
+    std::vector<char> name(dir.begin(), dir.end());
+    const char suffix[] = "/pens-message-XXXXXX";
+    name.insert(name.end(), suffix, suffix + sizeof(suffix));
+    fd_ = mkostemp(name.data(), O_CLOEXEC);
+    if (fd_ < 0) {
+        LOG_ERROR("Failed to create message spill file in " + dir + ": " + std::strerror(errno));
+        return;
+    }
+    path_ = name.data();
+}
+
+MessageSpill::~MessageSpill() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+    if (!path_.empty()) {
+        unlink(path_.c_str());
+    }
+}
+
+bool MessageSpill::append(const char* data, size_t length) {
+    if (!valid() || fd_ < 0) {
+        return false;
+    }
+    while (length > 0) {
+        ssize_t written = write(fd_, data, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            LOG_ERROR("Failed to write message spill file " + path_ + ": " + std::strerror(errno));
+            failed_ = true;
+            return false;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+        size_ += static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool MessageSpill::finish() {
+    if (fd_ >= 0 && close(fd_) != 0) {
+        LOG_ERROR("Failed to close message spill file " + path_ + ": " + std::strerror(errno));
+        failed_ = true;
+    }
+    fd_ = -1;
+    return valid();
+}
+
+bool MessageSpill::read(size_t offset, size_t length, std::string& out) const {
+    if (path_.empty()) {
+        return false;
+    }
+    int fd = fd_ >= 0 ? fd_ : open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open message spill file " + path_ + ": " + std::strerror(errno));
+        return false;
+    }
+    char chunk[16384];
+    bool ok = true;
+    while (length > 0 && offset < size_) {
+        ssize_t got = pread(fd, chunk, std::min(length, sizeof(chunk)), static_cast<off_t>(offset));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            ok = false;
+            break;
+        }
+        if (got == 0) {
+            break;
+        }
+        out.append(chunk, static_cast<size_t>(got));
+        offset += static_cast<size_t>(got);
+        length -= static_cast<size_t>(got);
+    }
+    if (fd != fd_) {
+        close(fd);
+    }
+    return ok;
+}
+
+} // namespace Pens
@@ -0,0 +1,242 @@
+#include "message_template.hpp"
+#include "logger.hpp"
+#include <openssl/rand.h>
+#include <fstream>
+#include <sstream>
+
+namespace Pens {
+
+namespace {
+
+const char kDateFormat[] = "%a, %d %b %Y %H:%M:%S %z";
+
+// Bare LF and lone CR become CRLF
+std::string toCrlf(const std::string& text) {
+    std::string out;
+    out.reserve(text.size() + text.size() / 32);
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c == '\r') {
+            out += "\r\n";
+            if (i + 1 < text.size() && text[i + 1] == '\n') {
+                i++;
+            }
+        } else if (c == '\n') {
+            out += "\r\n";
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+bool readWholeFile(const std::string& path, std::string& contents) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        LOG_ERROR("Cannot open template file: " + path);
+        return false;
+    }
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    contents = buffer.str();
+    return true;
+}
+
+std::string makeBoundary() {
+    unsigned char random[12];
+    if (RAND_bytes(random, sizeof(random)) != 1) {
+        return "=_pens_boundary";
+    }
+    static const char hex[] = "0123456789abcdef";
+    std::string boundary = "=_pens_";
+    for (unsigned char byte : random) {
+        boundary += hex[byte >> 4];
+        boundary += hex[byte & 0x0f];
+    }
+    return boundary;
+}
+
+} // namespace
+
+bool TemplateValues::set(std::string_view name, std::string_view value) {
+    for (size_t i = 0; i < count_; i++) {
+        if (values_[i].name == name) {
+            values_[i].value = value;
+            return true;
+        }
+    }
+    if (count_ == kMaxValues) {
+        return false;
+    }
+    values_[count_++] = {name, value};
+    return true;
+}
+
+const std::string_view* TemplateValues::find(std::string_view name) const {
+    for (size_t i = 0; i < count_; i++) {
+        if (values_[i].name == name) {
+            return &values_[i].value;
+        }
+    }
+    return nullptr;
+}
+
+std::string_view MailDate::now() {
+    struct Cache {
+        std::time_t second = -1;
+        char text[64];
+        size_t length = 0;
+    };
+    thread_local Cache cache;
+
+    std::time_t current = std::time(nullptr);
+    if (current != cache.second) {
+        std::tm local;
+        localtime_r(&current, &local);
+        cache.length = std::strftime(cache.text, sizeof(cache.text), kDateFormat, &local);
+        cache.second = current;
+    }
+    return std::string_view(cache.text, cache.length);
+}
+
+std::string MailDate::format(std::time_t time) {
+    std::tm local;
+    localtime_r(&time, &local);
+    char text[64];
+    size_t length = std::strftime(text, sizeof(text), kDateFormat, &local);
+    return std::string(text, length);
+}
+
+bool MessageTemplate::parse(const std::string& headers, const std::string& text, const std::string& html) {
+    std::string headerBlock = toCrlf(headers);
+    while (headerBlock.size() >= 2 && headerBlock.compare(headerBlock.size() - 2, 2, "\r\n") == 0) {
+        headerBlock.resize(headerBlock.size() - 2);
+    }
+    if (!headerBlock.empty()) {
+        headerBlock += "\r\n";
+    }
+    headerBlock += "Date: {{date}}\r\nMIME-Version: 1.0\r\n";
+
+    std::string body;
+    if (html.empty()) {
+        headerBlock += "Content-Type: text/plain; charset=UTF-8\r\n";
+        body = toCrlf(text);
+    } else {
+        std::string boundary = makeBoundary();
+        headerBlock += "Content-Type: multipart/alternative; boundary=\"" + boundary + "\"\r\n";
+        body = "--" + boundary + "\r\n"
+               "Content-Type: text/plain; charset=UTF-8\r\n\r\n" + toCrlf(text) + "\r\n"
+               "--" + boundary + "\r\n"
+               "Content-Type: text/html; charset=UTF-8\r\n\r\n" + toCrlf(html) + "\r\n"
+               "--" + boundary + "--\r\n";
+    }
+    headerBlock += "\r\n";
+
+    return compile(headerBlock + body, headerBlock.size());
+}
+
+bool MessageTemplate::loadFromFiles(const std::string& headersPath, const std::string& textPath,
+                                    const std::string& htmlPath) {
+    std::string headers;
+    std::string text;
+    std::string html;
+    if (!readWholeFile(headersPath, headers) || !readWholeFile(textPath, text) ||
+        (!htmlPath.empty() && !readWholeFile(htmlPath, html))) {
+        return false;
+    }
+    if (!parse(headers, text, html)) {
+        LOG_ERROR("Invalid message template: " + textPath);
+        return false;
+    }
+    return true;
+}
+
+bool MessageTemplate::compile(const std::string& source, size_t headerEnd) {
+    storage_.clear();
+    parts_.clear();
+    slotNames_.clear();
+    storage_.reserve(source.size());
+
+    size_t position = 0;
+    while (position < source.size()) {
+        size_t open = source.find("{{", position);
+        size_t literalEnd = open == std::string::npos ? source.size() : open;
+        if (literalEnd > position) {
+            parts_.push_back({false, false, storage_.size(), literalEnd - position});
+            storage_.append(source, position, literalEnd - position);
+        }
+        if (open == std::string::npos) {
+            break;
+        }
+
+        size_t close = source.find("}}", open + 2);
+        if (close == std::string::npos) {
+            LOG_ERROR("Unterminated placeholder in message template");
+            storage_.clear();
+            parts_.clear();
+            slotNames_.clear();
+            return false;
+        }
+        std::string name = source.substr(open + 2, close - open - 2);
+        size_t first = name.find_first_not_of(' ');
+        size_t last = name.find_last_not_of(' ');
+        name = first == std::string::npos ? "" : name.substr(first, last - first + 1);
+
+        size_t index = 0;
+        while (index < slotNames_.size() && slotNames_[index] != name) {
+            index++;
+        }
+        if (index == slotNames_.size()) {
+            slotNames_.push_back(name);
+        }
+        parts_.push_back({true, open < headerEnd, index, 0});
+        position = close + 2;
+    }
+    return true;
+}
+
+bool MessageTemplate::render(const TemplateValues& values, MessageWriter& writer) const {
+    writer.clear();
+    for (const Part& part : parts_) {
+        if (!part.isSlot) {
+            writer.appendBody(std::string_view(storage_.data() + part.offset, part.length));
+            continue;
+        }
+
+        const std::string& name = slotNames_[part.offset];
+        const std::string_view* value = values.find(name);
+        std::string_view text;
+        if (value) {
+            text = *value;
+        } else if (name == "date") {
+            text = MailDate::now();
+        } else {
+            LOG_ERROR("Message template value missing: " + name);
+            return false;
+        }
+        if (part.inHeader && text.find_first_of("\r\n") != std::string_view::npos) {
+            LOG_ERROR("Line break in message header value: " + name);
+            return false;
+        }
+        writer.appendBody(text);
+    }
+    return true;
+}
+
+const MessageTemplate& MessageTemplate::verificationCode() {
+    static const MessageTemplate tmpl = []() {
+        MessageTemplate t;
+        t.parse("From: {{from}}\n"
+                "To: {{to}}\n"
+                "Subject: Your Verification Code - Velivolant\n",
+                "Your verification code is: {{code}}\n\n"
+                "This code will expire in 10 minutes.\n\n"
+                "If you did not request this code, please ignore this email.\n\n"
+                "Best regards,\n"
+                "Velivolant Team");
+        return t;
+    }();
+    return tmpl;
+}
+
+} // namespace Pens
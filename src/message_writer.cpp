@@ -0,0 +1,121 @@
+#include "message_writer.hpp"
+
+namespace Pens {
+
+namespace {
+
+const char kDot[] = ".";
+const char kCr[] = "\r";
+const char kEndAfterNewline[] = ".\r\n";
+const char kEndWithNewline[] = "\r\n.\r\n";
+
+} // namespace
+
+MessageWriter::MessageWriter(Mode mode)
+    : mode_(mode), size_(0), built_(false) {
+}
+
+void MessageWriter::setMode(Mode mode) {
+    mode_ = mode;
+    built_ = false;
+}
+
+void MessageWriter::clear() {
+    prefix_.clear();
+    headers_.clear();
+    body_.clear();
+    built_ = false;
+}
+
+void MessageWriter::setHeaders(std::string headers) {
+    headers_ = std::move(headers);
+    built_ = false;
+}
+
+void MessageWriter::setBody(std::string_view body) {
+    body_.clear();
+    appendBody(body);
+}
+
+void MessageWriter::appendBody(std::string_view piece) {
+    if (!piece.empty()) {
+        body_.push_back(piece);
+    }
+    built_ = false;
+}
+
+void MessageWriter::setPrefix(std::string prefix) {
+    prefix_ = std::move(prefix);
+    built_ = false;
+}
+
+const std::vector<struct iovec>& MessageWriter::segments() {
+    if (!built_) {
+        build();
+    }
+    return segments_;
+}
+
+size_t MessageWriter::size() {
+    if (!built_) {
+        build();
+    }
+    return size_;
+}
+
+void MessageWriter::add(const char* data, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    // Extend the previous segment when the data is contiguous with it
+    if (!segments_.empty()) {
+        struct iovec& last = segments_.back();
+        if (static_cast<const char*>(last.iov_base) + last.iov_len == data) {
+            last.iov_len += length;
+            size_ += length;
+            return;
+        }
+    }
+    segments_.push_back({const_cast<char*>(data), length});
+    size_ += length;
+}
+
+void MessageWriter::build() {
+    segments_.clear();
+    size_ = 0;
+    add(prefix_.data(), prefix_.size());
+    add(headers_.data(), headers_.size());
+
+    // Line state carries across pieces: a piece may start mid-line
+    char previous = headers_.empty() ? '\n' : headers_.back();
+    for (std::string_view piece : body_) {
+        const char* base = piece.data();
+        size_t start = 0;
+        for (size_t i = 0; i < piece.size(); i++) {
+            char before = i == 0 ? previous : piece[i - 1];
+            if (mode_ == Mode::Data && before == '\n' && piece[i] == '.') {
+                add(base + start, i - start);
+                add(kDot, 1);
+                start = i;
+            } else if (piece[i] == '\n' && before != '\r') {
+                add(base + start, i - start);
+                add(kCr, 1);
+                start = i;
+            }
+        }
+        add(base + start, piece.size() - start);
+        previous = piece.back();
+    }
+
+    if (mode_ == Mode::Data) {
+        bool endsWithNewline = size_ > 0 && previous == '\n';
+        if (endsWithNewline) {
+            add(kEndAfterNewline, sizeof(kEndAfterNewline) - 1);
+        } else {
+            add(kEndWithNewline, sizeof(kEndWithNewline) - 1);
+        }
+    }
+    built_ = true;
+}
+
+} // namespace Pens
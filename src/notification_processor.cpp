@@ -291,6 +291,33 @@ void PensManager::stop() {
 }
 
 void PensManager::processNewEmails() {
+    if (folderMonitor_) {
+        std::vector<FolderEmail> taken = folderMonitor_->take();
+        std::vector<Email> emails;
+        for (auto& entry : taken) {
+            emails.push_back(std::move(entry.email));
+        }
+        if (!emails.empty()) {
+            processEmailBatch(emails);
+            folderMonitor_->commit(taken);
+        } else {
+            LOG_DEBUG("No new emails");
+        }
+        return;
+    }
+    
+    if (supervisor_) {
+        uint32_t lastUid = 0;
+        auto emails = supervisor_->poll(lastUid);
+        if (!emails.empty()) {
+            processEmailBatch(emails);
+            supervisor_->commit(lastUid);
+        } else if (client_->isConnected()) {
+            LOG_DEBUG("No new emails");
+        }
+        return;
+    }
+    
     if (!client_->isConnected()) {
         LOG_WARNING("Not connected to IMAP server");
         return;
@@ -325,6 +352,14 @@ void PensManager::setNotificationCallback(std::function<void(const std::string&)
     LOG_INFO("Notification callback registered");
 }
 
+void PensManager::setSessionSupervisor(std::shared_ptr<ImapSessionSupervisor> supervisor) {
+    supervisor_ = supervisor;
+}
+
+void PensManager::setFolderMonitor(std::shared_ptr<FolderMonitor> monitor) {
+    folderMonitor_ = monitor;
+}
+
 int PensManager::getProcessedEmailCount() const {
     return processedCount_;
 }
@@ -1,4 +1,6 @@
 #include "oauth_helper.hpp"
+#include "credential_cache.hpp"
+#include "json.hpp"
 #include "logger.hpp"
 #include <openssl/bio.h>
 #include <openssl/evp.h>
@@ -7,6 +9,7 @@
 #include <openssl/x509.h>
 #include <openssl/sha.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
 #include <fstream>
 #include <sstream>
 #include <iomanip>
@@ -72,26 +75,13 @@ std::string OAuthHelper::generateXOAuth2String(
 }
 
 std::string OAuthHelper::parseAccessToken(const std::string& jsonResponse) {
-    // Simple JSON parsing for access_token field
     // Format: {"access_token":"TOKEN","token_type":"Bearer",...}
-    
-    const std::string tokenKey = "\"access_token\":\"";
-    size_t tokenStart = jsonResponse.find(tokenKey);
-    
-    if (tokenStart == std::string::npos) {
+    std::string token;
+    if (!JsonReader::findString(jsonResponse, "access_token", token)) {
         LOG_ERROR("Could not find access_token in response");
         return "";
     }
     
-    tokenStart += tokenKey.length();
-    size_t tokenEnd = jsonResponse.find("\"", tokenStart);
-    
-    if (tokenEnd == std::string::npos) {
-        LOG_ERROR("Malformed access_token in response");
-        return "";
-    }
-    
-    std::string token = jsonResponse.substr(tokenStart, tokenEnd - tokenStart);
     LOG_INFO("Successfully parsed access token");
     
     return token;
@@ -179,26 +169,22 @@ std::string OAuthHelper::generateClientAssertion(
     const std::string& certificatePath,
     const std::string& privateKeyPath
 ) {
-    // Load private key
-    FILE* keyFile = fopen(privateKeyPath.c_str(), "r");
-    if (!keyFile) {
-        LOG_ERROR("Failed to open private key file: " + privateKeyPath);
-        return "";
-    }
-    
-    EVP_PKEY* privateKey = PEM_read_PrivateKey(keyFile, nullptr, nullptr, nullptr);
-    fclose(keyFile);
-    
-    if (!privateKey) {
-        LOG_ERROR("Failed to load private key: " + privateKeyPath);
-        return "";
-    }
-    
-    // Load certificate to get thumbprint
-    std::string thumbprint = calculateCertificateThumbprint(certificatePath);
-    if (thumbprint.empty()) {
-        LOG_ERROR("Failed to calculate certificate thumbprint");
-        EVP_PKEY_free(privateKey);
+    // Keys, thumbprints and signed assertions are cached across calls
+    return CredentialCache::getInstance().getClientAssertion(
+        clientId, tenantId, certificatePath, privateKeyPath
+    );
+}
+
+std::string OAuthHelper::signClientAssertion(
+    const std::string& clientId,
+    const std::string& tenantId,
+    const std::string& thumbprint,
+    EVP_PKEY* privateKey,
+    long issuedAt,
+    long expiresAt
+) {
+    if (!privateKey || thumbprint.empty()) {
+        LOG_ERROR("Cannot sign client assertion without private key and thumbprint");
         return "";
     }
     
@@ -210,20 +196,27 @@ std::string OAuthHelper::generateClientAssertion(
     std::string header = base64UrlEncode(headerJson.str());
     
     // Build JWT payload
-    long now = std::time(nullptr);
-    long exp = now + 3600; // 1 hour expiration
-    
     // Generate unique JWT ID (jti) using timestamp and random component
+    // A repeated jti gets the assertion rejected as a replay, so no entropy
+    // means no assertion
+    unsigned char nonce[8];
+    if (RAND_bytes(nonce, sizeof(nonce)) != 1) {
+        LOG_ERROR("Failed to generate client assertion nonce");
+        return "";
+    }
     std::ostringstream jtiStream;
-    jtiStream << std::hex << now << "-" << (now % 1000000);
+    jtiStream << std::hex << issuedAt << "-";
+    for (unsigned char b : nonce) {
+        jtiStream << std::setw(2) << std::setfill('0') << static_cast<int>(b);
+    }
     std::string jti = jtiStream.str();
     
     std::ostringstream payloadJson;
     payloadJson << R"({"aud":"https://login.microsoftonline.com/)" << tenantId
-                << R"(/oauth2/v2.0/token","exp":)" << exp
+                << R"(/oauth2/v2.0/token","exp":)" << expiresAt
                 << R"(,"iss":")" << clientId
                 << R"(","jti":")" << jti
-                << R"(","nbf":)" << now
+                << R"(","nbf":)" << issuedAt
                 << R"(,"sub":")" << clientId << R"("})";
     std::string payload = base64UrlEncode(payloadJson.str());
     
@@ -234,21 +227,18 @@ std::string OAuthHelper::generateClientAssertion(
     EVP_MD_CTX* mdCtx = EVP_MD_CTX_new();
     if (!mdCtx) {
         LOG_ERROR("Failed to create EVP_MD_CTX");
-        EVP_PKEY_free(privateKey);
         return "";
     }
     
     if (EVP_DigestSignInit(mdCtx, nullptr, EVP_sha256(), nullptr, privateKey) != 1) {
         LOG_ERROR("Failed to initialize signature");
         EVP_MD_CTX_free(mdCtx);
-        EVP_PKEY_free(privateKey);
         return "";
     }
     
     if (EVP_DigestSignUpdate(mdCtx, signatureInput.c_str(), signatureInput.length()) != 1) {
         LOG_ERROR("Failed to update signature");
         EVP_MD_CTX_free(mdCtx);
-        EVP_PKEY_free(privateKey);
         return "";
     }
     
@@ -256,7 +246,6 @@ std::string OAuthHelper::generateClientAssertion(
     if (EVP_DigestSignFinal(mdCtx, nullptr, &sigLen) != 1) {
         LOG_ERROR("Failed to get signature length");
         EVP_MD_CTX_free(mdCtx);
-        EVP_PKEY_free(privateKey);
         return "";
     }
     
@@ -265,12 +254,10 @@ std::string OAuthHelper::generateClientAssertion(
         LOG_ERROR("Failed to finalize signature");
         delete[] signature;
         EVP_MD_CTX_free(mdCtx);
-        EVP_PKEY_free(privateKey);
         return "";
     }
     
     EVP_MD_CTX_free(mdCtx);
-    EVP_PKEY_free(privateKey);
     
     // Encode signature
     std::string sigStr(reinterpret_cast<char*>(signature), sigLen);
@@ -1,37 +1,58 @@
 #include "oauth_token_manager.hpp"
 #include "oauth_helper.hpp"
+#include "credential_cache.hpp"
+#include "http_client.hpp"
+#include "json.hpp"
+#include "token_store.hpp"
 #include "logger.hpp"
-#include <fstream>
-#include <sstream>
 #include <ctime>
 #include <sys/stat.h>
-#include <curl/curl.h>
 
 namespace Pens {
 
+OAuthAccountSettings OAuthAccountSettings::fromConfig(const Config& config) {
+    OAuthAccountSettings settings;
+    settings.tokenFile = config.getOAuthTokenFile();
+    settings.clientId = config.getOAuthClientId();
+    settings.tenantId = config.getOAuthTenantId();
+    settings.scope = config.getOAuthScope();
+    settings.certificatePath = config.getOAuthCertificatePath();
+    settings.privateKeyPath = config.getOAuthPrivateKeyPath();
+    settings.clientSecret = config.getOAuthClientSecret();
+    settings.authority = config.getOAuthAuthority();
+    return settings;
+}
+
 OAuthTokenManager::OAuthTokenManager(const Config& config)
-    : config_(config)
-    , tokenFile_(config.getOAuthTokenFile())
-    , clientId_(config.getOAuthClientId())
-    , tenantId_(config.getOAuthTenantId())
-    , scope_(config.getOAuthScope())
-    , certificatePath_(config.getOAuthCertificatePath())
-    , privateKeyPath_(config.getOAuthPrivateKeyPath())
-    , clientSecret_(config.getOAuthClientSecret()) {
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+    : OAuthTokenManager(OAuthAccountSettings::fromConfig(config)) {
+    if (!config.getOAuthCaFile().empty()) {
+        HttpClient::getInstance().setCaInfo(config.getOAuthCaFile());
+    }
 }
 
-OAuthTokenManager::~OAuthTokenManager() {
-    curl_global_cleanup();
+OAuthTokenManager::OAuthTokenManager(const OAuthAccountSettings& settings)
+    : tokenFile_(settings.tokenFile)
+    , clientId_(settings.clientId)
+    , tenantId_(settings.tenantId)
+    , scope_(settings.scope)
+    , certificatePath_(settings.certificatePath)
+    , privateKeyPath_(settings.privateKeyPath)
+    , clientSecret_(settings.clientSecret)
+    , authority_(settings.authority.empty() ? "https://login.microsoftonline.com" : settings.authority) {
 }
 
+OAuthTokenManager::~OAuthTokenManager() = default;
+
 bool OAuthTokenManager::ensureValidToken() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
     if (!tokenLoaded_) {
         if (!loadTokenFromFile()) {
             LOG_ERROR("Failed to load OAuth token file: " + tokenFile_);
             return false;
         }
         tokenLoaded_ = true;
+        publishToken();
     }
 
     long currentTime = std::time(nullptr);
@@ -62,51 +83,99 @@ bool OAuthTokenManager::ensureValidToken() {
     return true;
 }
 
+bool OAuthTokenManager::forceRefresh() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!tokenLoaded_) {
+        if (!loadTokenFromFile()) {
+            LOG_ERROR("Failed to load OAuth token file: " + tokenFile_);
+            return false;
+        }
+        tokenLoaded_ = true;
+        publishToken();
+    }
+
+    if (token_.refreshToken.empty()) {
+        LOG_ERROR("OAuth refresh token missing; token cannot be renewed");
+        return false;
+    }
+
+    if (!refreshAccessToken()) {
+        LOG_ERROR("OAuth refresh token flow failed");
+        return false;
+    }
+
+    return true;
+}
+
 std::string OAuthTokenManager::getAccessToken() const {
-    return token_.accessToken;
+    auto snapshot = getTokenSnapshot();
+    return snapshot ? snapshot->accessToken : "";
+}
+
+std::shared_ptr<const OAuthTokenData> OAuthTokenManager::getTokenSnapshot() const {
+    return std::atomic_load(&published_);
+}
+
+bool OAuthTokenManager::canRefresh() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !token_.refreshToken.empty();
+}
+
+void OAuthTokenManager::publishToken() {
+    std::atomic_store(&published_, std::shared_ptr<const OAuthTokenData>(
+        std::make_shared<OAuthTokenData>(token_)));
+    if (sharedTable_) {
+        sharedTable_->publish(sharedAccount_, token_.accessToken, token_.expiresAt);
+    }
+}
+
+void OAuthTokenManager::setSharedTable(SharedTokenTable* table, const std::string& account) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sharedTable_ = table;
+    sharedAccount_ = account;
+    if (sharedTable_ && tokenLoaded_) {
+        sharedTable_->publish(sharedAccount_, token_.accessToken, token_.expiresAt);
+    }
 }
 
 std::string OAuthTokenManager::getCertificateThumbprint() const {
     if (certificatePath_.empty()) {
         return "";
     }
-    return OAuthHelper::calculateCertificateThumbprint(certificatePath_);
+    return CredentialCache::getInstance().getCertificateThumbprint(certificatePath_);
 }
 
 bool OAuthTokenManager::loadTokenFromFile() {
-    std::ifstream file(tokenFile_);
-    if (!file.is_open()) {
+    std::string json;
+    if (!TokenStore::readFile(tokenFile_, json)) {
         LOG_ERROR("Could not open OAuth token file: " + tokenFile_);
         return false;
     }
 
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    std::string json = buffer.str();
-
-    if (!parseJsonString(json, "access_token", token_.accessToken)) {
+    if (!JsonReader::findString(json, "access_token", token_.accessToken)) {
         LOG_ERROR("access_token not found in token file");
         return false;
     }
 
-    parseJsonString(json, "refresh_token", token_.refreshToken);
+    JsonReader::findString(json, "refresh_token", token_.refreshToken);
 
-    long expiresIn = 0;
-    long acquiredAt = 0;
-    long expiresAt = 0;
+    int64_t expiresIn = 0;
+    int64_t acquiredAt = 0;
+    int64_t expiresAt = 0;
 
-    if (parseJsonInt(json, "expires_in", expiresIn)) {
+    if (JsonReader::findInt(json, "expires_in", expiresIn)) {
         token_.expiresIn = static_cast<int>(expiresIn);
     } else {
         token_.expiresIn = 3600;
     }
 
-    if (parseJsonInt(json, "acquired_at", acquiredAt)) {
+    if (JsonReader::findInt(json, "acquired_at", acquiredAt)) {
         if (acquiredAt > 1000000000000L) { // milliseconds
             acquiredAt /= 1000;
         }
         token_.expiresAt = acquiredAt + token_.expiresIn;
-    } else if (parseJsonInt(json, "expires_at", expiresAt)) {
+    } else if (JsonReader::findInt(json, "expires_at", expiresAt)) {
         if (expiresAt > 1000000000000L) {
             expiresAt /= 1000;
         }
@@ -120,20 +189,23 @@ bool OAuthTokenManager::loadTokenFromFile() {
 }
 
 bool OAuthTokenManager::saveTokenToFile() const {
-    std::ofstream file(tokenFile_, std::ios::trunc);
-    if (!file.is_open()) {
+    int64_t acquiredAt = std::time(nullptr);
+    std::string json;
+    JsonWriter writer(json, true);
+    writer.beginObject()
+          .key("access_token").value(token_.accessToken)
+          .key("refresh_token").value(token_.refreshToken)
+          .key("expires_in").value(token_.expiresIn)
+          .key("acquired_at").value(acquiredAt)
+          .endObject();
+    json += "\n";
+
+    // Replace the file atomically so a crash never leaves it half-written
+    if (!TokenStore::writeFileAtomically(tokenFile_, json)) {
         LOG_ERROR("Failed to write OAuth token file: " + tokenFile_);
         return false;
     }
 
-    long acquiredAt = std::time(nullptr);
-    file << "{\n"
-         << "  \"access_token\": \"" << token_.accessToken << "\",\n"
-         << "  \"refresh_token\": \"" << token_.refreshToken << "\",\n"
-         << "  \"expires_in\": " << token_.expiresIn << ",\n"
-         << "  \"acquired_at\": " << acquiredAt << "\n"
-         << "}\n";
-
     LOG_INFO("OAuth token updated and saved to file");
     return true;
 }
@@ -168,7 +240,7 @@ bool OAuthTokenManager::refreshAccessToken() {
 }
 
 bool OAuthTokenManager::acquireTokenWithCertificate() {
-    std::string tokenEndpoint = "https://login.microsoftonline.com/" + tenantId_ + "/oauth2/v2.0/token";
+    std::string tokenEndpoint = authority_ + "/" + tenantId_ + "/oauth2/v2.0/token";
     
     LOG_DEBUG("Generating client assertion JWT...");
     LOG_DEBUG("Client ID: " + clientId_);
@@ -204,7 +276,7 @@ bool OAuthTokenManager::acquireTokenWithCertificate() {
 }
 
 bool OAuthTokenManager::acquireTokenWithSecret() {
-    std::string tokenEndpoint = "https://login.microsoftonline.com/" + tenantId_ + "/oauth2/v2.0/token";
+    std::string tokenEndpoint = authority_ + "/" + tenantId_ + "/oauth2/v2.0/token";
     std::string postData = "client_id=" + OAuthHelper::urlEncode(clientId_)
         + "&grant_type=refresh_token"
         + "&refresh_token=" + OAuthHelper::urlEncode(token_.refreshToken)
@@ -218,36 +290,14 @@ bool OAuthTokenManager::acquireTokenWithSecret() {
 }
 
 bool OAuthTokenManager::performTokenRequest(const std::string& tokenEndpoint, const std::string& postData) {
+    HttpResponse response = HttpClient::getInstance().post(
+        tokenEndpoint, postData, {"Content-Type: application/x-www-form-urlencoded"}
+    );
+    const std::string& responseBody = response.body;
+    long httpCode = response.status;
 
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        LOG_ERROR("Failed to initialize CURL for OAuth refresh");
-        return false;
-    }
-
-    std::string responseBody;
-    struct curl_slist* headers = nullptr;
-    headers = curl_slist_append(headers, "Content-Type: application/x-www-form-urlencoded");
-
-    curl_easy_setopt(curl, CURLOPT_URL, tokenEndpoint.c_str());
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postData.c_str());
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, postData.size());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, OAuthTokenManager::writeCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &responseBody);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-
-    CURLcode res = curl_easy_perform(curl);
-    long httpCode = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
-
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-
-    if (res != CURLE_OK) {
-        LOG_ERROR("CURL error during OAuth refresh: " + std::string(curl_easy_strerror(res)));
+    if (!response.transportOk) {
+        LOG_ERROR("HTTP error during OAuth refresh: " + response.error);
         return false;
     }
 
@@ -255,8 +305,8 @@ bool OAuthTokenManager::performTokenRequest(const std::string& tokenEndpoint, co
         std::string errorCode;
         std::string errorDescription;
         
-        parseJsonString(responseBody, "error", errorCode);
-        parseJsonString(responseBody, "error_description", errorDescription);
+        JsonReader::findString(responseBody, "error", errorCode);
+        JsonReader::findString(responseBody, "error_description", errorDescription);
         
         LOG_ERROR("OAuth refresh failed with HTTP status: " + std::to_string(httpCode));
         
@@ -314,18 +364,18 @@ bool OAuthTokenManager::performTokenRequest(const std::string& tokenEndpoint, co
     }
 
     std::string newAccessToken;
-    if (!parseJsonString(responseBody, "access_token", newAccessToken)) {
+    if (!JsonReader::findString(responseBody, "access_token", newAccessToken)) {
         LOG_ERROR("OAuth refresh response missing access_token");
         return false;
     }
 
     std::string newRefreshToken;
-    if (parseJsonString(responseBody, "refresh_token", newRefreshToken) && !newRefreshToken.empty()) {
+    if (JsonReader::findString(responseBody, "refresh_token", newRefreshToken) && !newRefreshToken.empty()) {
         token_.refreshToken = newRefreshToken;
     }
 
-    long expiresIn = 0;
-    if (parseJsonInt(responseBody, "expires_in", expiresIn)) {
+    int64_t expiresIn = 0;
+    if (JsonReader::findInt(responseBody, "expires_in", expiresIn)) {
         token_.expiresIn = static_cast<int>(expiresIn);
     } else {
         token_.expiresIn = 3600;
@@ -333,61 +383,9 @@ bool OAuthTokenManager::performTokenRequest(const std::string& tokenEndpoint, co
 
     token_.accessToken = newAccessToken;
     token_.expiresAt = std::time(nullptr) + token_.expiresIn;
+    publishToken();
 
     return saveTokenToFile();
 }
 
-bool OAuthTokenManager::parseJsonString(const std::string& json, const std::string& key, std::string& value) {
-    std::string pattern = "\"" + key + "\"";
-    size_t keyPos = json.find(pattern);
-    if (keyPos == std::string::npos) {
-        return false;
-    }
-    size_t colonPos = json.find(':', keyPos);
-    if (colonPos == std::string::npos) {
-        return false;
-    }
-    size_t quoteStart = json.find('"', colonPos + 1);
-    if (quoteStart == std::string::npos) {
-        return false;
-    }
-    size_t quoteEnd = json.find('"', quoteStart + 1);
-    if (quoteEnd == std::string::npos) {
-        return false;
-    }
-    value = json.substr(quoteStart + 1, quoteEnd - quoteStart - 1);
-    return true;
-}
-
-bool OAuthTokenManager::parseJsonInt(const std::string& json, const std::string& key, long& value) {
-    std::string pattern = "\"" + key + "\"";
-    size_t keyPos = json.find(pattern);
-    if (keyPos == std::string::npos) {
-        return false;
-    }
-    size_t colonPos = json.find(':', keyPos);
-    if (colonPos == std::string::npos) {
-        return false;
-    }
-    size_t numberStart = json.find_first_of("-0123456789", colonPos + 1);
-    if (numberStart == std::string::npos) {
-        return false;
-    }
-    size_t numberEnd = json.find_first_not_of("0123456789", numberStart);
-    std::string numberStr = json.substr(numberStart, numberEnd - numberStart);
-    try {
-        value = std::stol(numberStr);
-        return true;
-    } catch (...) {
-        return false;
-    }
-}
-
-size_t OAuthTokenManager::writeCallback(void* contents, size_t size, size_t nmemb, void* userp) {
-    size_t totalSize = size * nmemb;
-    std::string* str = static_cast<std::string*>(userp);
-    str->append(static_cast<char*>(contents), totalSize);
-    return totalSize;
-}
-
 } // namespace Pens
@@ -0,0 +1,197 @@
+#include "rate_limiter.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <chrono>
+
+namespace Pens {
+
+namespace {
+// Slots examined from a key's home position before the table counts as full
+constexpr size_t kProbeLimit = 16;
+}
+
+RateLimiter::RateLimiter(RateLimiterSettings settings)
+    : settings_(std::move(settings)),
+      recipientLimit_(makeLimiter(settings_.perRecipient)),
+      domainLimit_(makeLimiter(settings_.perDomain)),
+      globalLimit_(makeLimiter(settings_.global)),
+      globalTat_(0) {
+    initTable(recipients_, settings_.tableSlots);
+    initTable(domains_, settings_.tableSlots);
+}
+
+RateLimiter::~RateLimiter() = default;
+
+RateCheck RateLimiter::acquire(const std::string& recipient) {
+    RateCheck check;
+    int64_t current = now();
+    int64_t retryAfter = 0;
+
+    std::atomic<int64_t>* recipientSlot = nullptr;
+    if (recipientLimit_.enabled()) {
+        recipientSlot = findSlot(recipients_, hashKey(recipient.data(), recipient.size()), current);
+        if (!recipientSlot || !take(*recipientSlot, recipientLimit_, current, retryAfter)) {
+            check.decision = RateDecision::RecipientLimited;
+            check.retryAfterMs = recipientSlot ? (retryAfter + 999) / 1000 : 1;
+            return check;
+        }
+    }
+
+    std::atomic<int64_t>* domainSlot = nullptr;
+    if (domainLimit_.enabled()) {
+        domainSlot = findSlot(domains_, domainKey(recipient), current);
+        if (!domainSlot || !take(*domainSlot, domainLimit_, current, retryAfter)) {
+            if (recipientSlot) {
+                recipientSlot->fetch_sub(recipientLimit_.interval);
+            }
+            check.decision = RateDecision::DomainLimited;
+            check.retryAfterMs = domainSlot ? (retryAfter + 999) / 1000 : 1;
+            return check;
+        }
+    }
+
+    if (globalLimit_.enabled() && !take(globalTat_, globalLimit_, current, retryAfter)) {
+        if (recipientSlot) {
+            recipientSlot->fetch_sub(recipientLimit_.interval);
+        }
+        if (domainSlot) {
+            domainSlot->fetch_sub(domainLimit_.interval);
+        }
+        check.decision = RateDecision::GlobalLimited;
+        check.retryAfterMs = (retryAfter + 999) / 1000;
+        return check;
+    }
+
+    return check;
+}
+
+void RateLimiter::release(const std::string& recipient) {
+    // A slot reclaimed by another key since acquire() has nothing to refund
+    if (recipientLimit_.enabled()) {
+        if (auto* slot = lookupSlot(recipients_, hashKey(recipient.data(), recipient.size()))) {
+            slot->fetch_sub(recipientLimit_.interval);
+        }
+    }
+    if (domainLimit_.enabled()) {
+        if (auto* slot = lookupSlot(domains_, domainKey(recipient))) {
+            slot->fetch_sub(domainLimit_.interval);
+        }
+    }
+    if (globalLimit_.enabled()) {
+        globalTat_.fetch_sub(globalLimit_.interval);
+    }
+}
+
+const char* RateLimiter::decisionName(RateDecision decision) {
+    switch (decision) {
+        case RateDecision::Allowed: return "allowed";
+        case RateDecision::RecipientLimited: return "recipient";
+        case RateDecision::DomainLimited: return "domain";
+        case RateDecision::GlobalLimited: return "global";
+    }
+    return "unknown";
+}
+
+RateLimiter::Limiter RateLimiter::makeLimiter(const RateLimit& limit) {
+    Limiter limiter;
+    if (limit.count == 0 || limit.periodMs <= 0) {
+        return limiter;
+    }
+    int64_t period = limit.periodMs * 1000;
+    limiter.interval = std::max<int64_t>(1, period / limit.count);
+    // A full period's worth of sends may go out back to back
+    limiter.tolerance = period - limiter.interval;
+    return limiter;
+}
+
+void RateLimiter::initTable(Table& table, size_t slots) {
+    size_t size = 1;
+    while (size < std::max(slots, kProbeLimit)) {
+        size <<= 1;
+    }
+    table.slots.reset(new Slot[size]);
+    for (size_t i = 0; i < size; i++) {
+        table.slots[i].key.store(0, std::memory_order_relaxed);
+        table.slots[i].tat.store(0, std::memory_order_relaxed);
+    }
+    table.mask = size - 1;
+}
+
+std::atomic<int64_t>* RateLimiter::lookupSlot(Table& table, uint64_t key) {
+    size_t home = static_cast<size_t>(key) & table.mask;
+    for (size_t i = 0; i < kProbeLimit; i++) {
+        Slot& slot = table.slots[(home + i) & table.mask];
+        if (slot.key.load(std::memory_order_acquire) == key) {
+            return &slot.tat;
+        }
+    }
+    return nullptr;
+}
+
+std::atomic<int64_t>* RateLimiter::findSlot(Table& table, uint64_t key, int64_t now) {
+    if (std::atomic<int64_t>* existing = lookupSlot(table, key)) {
+        return existing;
+    }
+    size_t home = static_cast<size_t>(key) & table.mask;
+
+    // Claim an empty slot, or one whose state has lapsed: an arrival time in
+    // the past behaves exactly like a fresh entry, so nothing is lost
+    for (size_t i = 0; i < kProbeLimit; i++) {
+        Slot& slot = table.slots[(home + i) & table.mask];
+        uint64_t current = slot.key.load(std::memory_order_acquire);
+        if (current == key) {
+            return &slot.tat;
+        }
+        if ((current == 0 || slot.tat.load(std::memory_order_relaxed) <= now) &&
+            slot.key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+            return &slot.tat;
+        }
+    }
+
+    LOG_WARNING("Rate limit table full");
+    return nullptr;
+}
+
+bool RateLimiter::take(std::atomic<int64_t>& tat, const Limiter& limit, int64_t now, int64_t& retryAfter) {
+    int64_t seen = tat.load(std::memory_order_relaxed);
+    while (true) {
+        int64_t base = std::max(seen, now);
+        if (base - now > limit.tolerance) {
+            retryAfter = base - limit.tolerance - now;
+            return false;
+        }
+        if (tat.compare_exchange_weak(seen, base + limit.interval, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
+uint64_t RateLimiter::domainKey(const std::string& recipient) {
+    size_t at = recipient.rfind('@');
+    size_t start = at == std::string::npos ? 0 : at + 1;
+    return hashKey(recipient.data() + start, recipient.size() - start);
+}
+
+uint64_t RateLimiter::hashKey(const char* data, size_t length) {
+    // FNV-1a over the lowercased bytes; 0 marks an empty slot
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = static_cast<unsigned char>(data[i]);
+        if (c >= 'A' && c <= 'Z') {
+            c = static_cast<unsigned char>(c - 'A' + 'a');
+        }
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash == 0 ? 1 : hash;
+}
+
+int64_t RateLimiter::now() const {
+    if (settings_.clock) {
+        return settings_.clock();
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace Pens
@@ -1,9 +1,12 @@
 #include "smtp_client.hpp"
 #include "oauth_helper.hpp"
+#include "dkim_signer.hpp"
 #include "logger.hpp"
 #include <iostream>
 #include <sstream>
 #include <cstring>
+#include <cerrno>
+#include <climits>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -14,6 +17,8 @@
 #include <openssl/bio.h>
 #include <openssl/evp.h>
 #include <openssl/buffer.h>
+#include <algorithm>
+#include <cctype>
 #include <ctime>
 
 namespace Pens {
@@ -37,11 +42,30 @@ static std::string base64Encode(const std::string& input) {
     return result;
 }
 
+// Longest reply line we accept before treating the server as broken
+static const size_t kMaxReplyLine = 64 * 1024;
+
+// A CR or LF in an envelope address would end the command early and smuggle
+// the rest into the (pipelined) session as further commands
+static bool isSafeEnvelopeAddress(const std::string& address) {
+    return address.find_first_of("\r\n") == std::string::npos;
+}
+
+std::string SmtpReply::text() const {
+    std::string result;
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (i > 0) result += "\n";
+        result += lines[i];
+    }
+    return result;
+}
+
 // Internal connection structure
 struct SmtpClient::SmtpConnection {
     int socket;
     SSL* ssl;
     SSL_CTX* sslContext;
+    std::string readBuffer;  // bytes received but not yet consumed as lines
     
     SmtpConnection() : socket(-1), ssl(nullptr), sslContext(nullptr) {}
     
@@ -66,7 +90,8 @@ SmtpClient::SmtpClient(const std::string& server, int port, bool useSsl)
       useSsl_(useSsl),
       connected_(false),
       authenticated_(false),
-      username_("") {
+      username_(""),
+      writer_(MessageWriter::Mode::Data) {
     
     LOG_INFO("PENS SMTP Client initialized for server: " + server);
 }
@@ -115,9 +140,7 @@ bool SmtpClient::connect() {
     }
     
     // Say EHLO
-    std::string ehlo = "EHLO localhost\r\n";
-    sendCommand(ehlo);
-    if (!readResponse(250)) {
+    if (!ehlo()) {
         LOG_ERROR("EHLO command failed");
         return false;
     }
@@ -140,6 +163,11 @@ bool SmtpClient::connect() {
             return false;
         }
         
+        // Anything buffered before the handshake was not protected by TLS
+        // and must not be interpreted afterwards (RFC 3207, section 6)
+        connection_->readBuffer.clear();
+        capabilities_.clear();
+
         connection_->ssl = SSL_new(connection_->sslContext);
         SSL_set_fd(connection_->ssl, connection_->socket);
         
@@ -151,8 +179,7 @@ bool SmtpClient::connect() {
         LOG_INFO("SSL connection established");
         
         // Re-send EHLO after STARTTLS
-        sendCommand("EHLO localhost\r\n");
-        if (!readResponse(250)) {
+        if (!ehlo()) {
             LOG_ERROR("EHLO after STARTTLS failed");
             return false;
         }
@@ -172,6 +199,11 @@ bool SmtpClient::authenticate(const std::string& username, const std::string& pa
     
     LOG_INFO("Authenticating as: " + username);
     username_ = username;
+    {
+        std::lock_guard<std::mutex> lock(credentialsMutex_);
+        password_ = password;
+        useOAuth_ = false;
+    }
     
     // AUTH LOGIN
     sendCommand("AUTH LOGIN\r\n");
@@ -210,6 +242,11 @@ bool SmtpClient::authenticateOAuth(const std::string& username, const std::strin
     
     LOG_INFO("Authenticating with OAuth 2.0 as: " + username);
     username_ = username;
+    {
+        std::lock_guard<std::mutex> lock(credentialsMutex_);
+        oauthToken_ = accessToken;
+        useOAuth_ = true;
+    }
     
     // Generate XOAUTH2 authentication string
     std::string xoauth2String = OAuthHelper::generateXOAuth2String(username, accessToken);
@@ -244,71 +281,238 @@ bool SmtpClient::disconnect() {
     connection_.reset(new SmtpConnection());
     connected_ = false;
     authenticated_ = false;
+    capabilities_.clear();
     
     LOG_INFO("Disconnected from SMTP server");
     
     return true;
 }
 
+void SmtpClient::updateOAuthToken(const std::string& accessToken) {
+    std::lock_guard<std::mutex> lock(credentialsMutex_);
+    oauthToken_ = accessToken;
+    LOG_DEBUG("SMTP session received refreshed OAuth token");
+}
+
+bool SmtpClient::reauthenticate() {
+    if (authenticated_) {
+        // RFC 4954 forbids a second AUTH once authenticated; the stored
+        // token is used the next time this session authenticates.
+        return true;
+    }
+    
+    std::string secret;
+    bool useOAuth;
+    {
+        std::lock_guard<std::mutex> lock(credentialsMutex_);
+        secret = useOAuth_ ? oauthToken_ : password_;
+        useOAuth = useOAuth_;
+    }
+    
+    if (username_.empty()) {
+        LOG_ERROR("Cannot re-authenticate: no stored credentials");
+        return false;
+    }
+    
+    return useOAuth ? authenticateOAuth(username_, secret) : authenticate(username_, secret);
+}
+
 bool SmtpClient::isConnected() const {
     return connected_ && authenticated_;
 }
 
+void SmtpClient::setDkimSigner(DkimSigner* signer) {
+    dkimSigner_ = signer;
+}
+
+bool SmtpClient::reset() {
+    return connected_ && sendCommand("RSET\r\n") && readResponse(250);
+}
+
+bool SmtpClient::noop() {
+    return connected_ && sendCommand("NOOP\r\n") && readResponse(250);
+}
+
 bool SmtpClient::sendEmail(const std::string& from,
                           const std::string& to,
                           const std::string& subject,
                           const std::string& body) {
+    return sendEmailToRecipients(from, {to}, subject, body);
+}
+
+bool SmtpClient::sendEmailToRecipients(const std::string& from,
+                                       const std::vector<std::string>& recipients,
+                                       const std::string& subject,
+                                       const std::string& body,
+                                       std::vector<std::string>* rejected) {
     if (!authenticated_) {
         LOG_ERROR("Cannot send email: not authenticated");
         return false;
     }
-    
-    LOG_INFO("Sending email to: " + to);
-    
-    // MAIL FROM
-    sendCommand("MAIL FROM:<" + from + ">\r\n");
-    if (!readResponse(250)) {
-        LOG_ERROR("MAIL FROM command failed");
+    if (recipients.empty()) {
+        LOG_ERROR("Cannot send email: no recipients");
         return false;
     }
     
-    // RCPT TO
-    sendCommand("RCPT TO:<" + to + ">\r\n");
-    if (!readResponse(250)) {
-        LOG_ERROR("RCPT TO command failed");
+    writer_.clear();
+    writer_.setHeaders(formatHeaders(from, recipients, subject));
+    writer_.setBody(body);
+    return transmit(from, recipients, rejected);
+}
+
+bool SmtpClient::sendTemplate(const MessageTemplate& message,
+                              const std::string& from,
+                              const std::string& to,
+                              TemplateValues values) {
+    if (!authenticated_) {
+        LOG_ERROR("Cannot send email: not authenticated");
         return false;
     }
+    values.set("from", from);
+    values.set("to", to);
+    if (!message.render(values, writer_)) {
+        LOG_ERROR("Failed to render message for: " + to);
+        return false;
+    }
+    return transmit(from, {to}, nullptr);
+}
+
+bool SmtpClient::transmit(const std::string& from,
+                          const std::vector<std::string>& recipients,
+                          std::vector<std::string>* rejected) {
+    if (!isSafeEnvelopeAddress(from) ||
+        !std::all_of(recipients.begin(), recipients.end(), isSafeEnvelopeAddress)) {
+        LOG_ERROR("Refusing to send: envelope address contains a line break");
+        return false;
+    }
+
+    std::string recipientList;
+    for (const auto& recipient : recipients) {
+        recipientList += (recipientList.empty() ? "" : ", ") + recipient;
+    }
+    LOG_INFO("Sending email to: " + recipientList);
+    
+    // CHUNKING (RFC 3030) sends the content length-prefixed, so it needs no
+    // dot-stuffing and no terminator scan on either side
+    bool pipelining = hasCapability("PIPELINING");
+    bool chunking = hasCapability("CHUNKING");
+    MessageWriter& writer = writer_;
+    writer.setMode(chunking ? MessageWriter::Mode::Bdat : MessageWriter::Mode::Data);
+    if (dkimSigner_ && !dkimSigner_->sign(writer)) {
+        LOG_WARNING("DKIM signing failed; sending unsigned");
+    }
+    
+    std::vector<std::string> commands;
+    commands.push_back("MAIL FROM:<" + from + ">\r\n");
+    for (const auto& recipient : recipients) {
+        commands.push_back("RCPT TO:<" + recipient + ">\r\n");
+    }
+    std::string contentCommand = chunking ? "BDAT " + std::to_string(writer.size()) + " LAST\r\n"
+                                          : "DATA\r\n";
+    std::vector<struct iovec> bdatSegments;
+    if (chunking) {
+        bdatSegments.push_back({const_cast<char*>(contentCommand.data()), contentCommand.size()});
+        bdatSegments.insert(bdatSegments.end(), writer.segments().begin(), writer.segments().end());
+    }
     
-    // DATA
-    sendCommand("DATA\r\n");
-    if (!readResponse(354)) {
-        LOG_ERROR("DATA command failed");
+    if (pipelining) {
+        // RFC 2920: the whole envelope (and with BDAT, the content too) goes
+        // out in one write; the replies are then collected in order
+        std::string envelope;
+        for (const auto& command : commands) {
+            envelope += command;
+        }
+        bool written;
+        if (chunking) {
+            bdatSegments.insert(bdatSegments.begin(), {const_cast<char*>(envelope.data()), envelope.size()});
+            written = sendSegments(bdatSegments);
+        } else {
+            written = sendCommand(envelope + contentCommand);
+        }
+        if (!written) {
+            LOG_ERROR("Failed to send message envelope");
+            return false;
+        }
+    }
+    
+    // MAIL FROM
+    if (!pipelining) sendCommand(commands[0]);
+    bool mailOk = readResponse(250);
+    int mailCode = lastReplyCode_;
+    if (!mailOk && !pipelining) {
+        LOG_ERROR("MAIL FROM command failed (" + std::to_string(mailCode) + ")");
+        abortTransaction(mailCode);
         return false;
     }
     
-    // Send email content
-    std::string email = formatEmail(from, to, subject, body);
-    sendCommand(email);
-    sendCommand("\r\n.\r\n");  // End of data
-    if (!readResponse(250)) {
-        LOG_ERROR("Email data transmission failed");
+    // RCPT TO, one reply per recipient
+    size_t accepted = 0;
+    int rcptCode = 0;
+    for (size_t i = 0; i < recipients.size(); i++) {
+        if (!pipelining) sendCommand(commands[i + 1]);
+        if (readResponse(250) || lastReplyCode_ == 251) {
+            accepted++;
+        } else {
+            rcptCode = lastReplyCode_;
+            LOG_WARNING("Recipient rejected: " + recipients[i] + " (" + std::to_string(rcptCode) + ")");
+            if (rejected) rejected->push_back(recipients[i]);
+        }
+    }
+    if (!pipelining && accepted == 0) {
+        LOG_ERROR("RCPT TO command failed (" + std::to_string(rcptCode) + ")");
+        abortTransaction(rcptCode);
         return false;
     }
     
-    LOG_INFO("Email sent successfully to: " + to);
+    if (chunking) {
+        if (!pipelining) sendSegments(bdatSegments);
+        bool contentOk = readResponse(250);
+        if (!mailOk || accepted == 0 || !contentOk) {
+            int failedCode = !mailOk ? mailCode : (accepted == 0 ? rcptCode : lastReplyCode_);
+            LOG_ERROR("Email transaction failed (" + std::to_string(failedCode) + ")");
+            if (failedCode != 0) abortTransaction(failedCode);
+            return false;
+        }
+    } else {
+        if (!pipelining) sendCommand(contentCommand);
+        bool dataOk = readResponse(354);
+        if (!mailOk || accepted == 0 || !dataOk) {
+            int failedCode = !mailOk ? mailCode : (accepted == 0 ? rcptCode : lastReplyCode_);
+            if (dataOk) {
+                // Server accepted DATA anyway; send an empty message and discard it
+                sendCommand(".\r\n");
+                readResponse(250);
+            }
+            LOG_ERROR(std::string(!mailOk ? "MAIL FROM" : (accepted == 0 ? "RCPT TO" : "DATA")) +
+                      " command failed (" + std::to_string(failedCode) + ")");
+            if (failedCode != 0) abortTransaction(failedCode);
+            return false;
+        }
+        
+        // Content and terminator go out as one gathered write
+        if (!sendSegments(writer.segments()) || !readResponse(250)) {
+            LOG_ERROR("Email data transmission failed");
+            return false;
+        }
+    }
+    
+    LOG_INFO("Email sent successfully to: " + recipientList);
     
     return true;
 }
 
+void SmtpClient::abortTransaction(int failedCode) {
+    // Clear the transaction so the session stays usable, but keep reporting
+    // the reply that caused the failure
+    sendCommand("RSET\r\n");
+    readResponse(250);
+    lastReplyCode_ = failedCode;
+}
+
 bool SmtpClient::sendVerificationCode(const std::string& to, const std::string& code) {
-    std::ostringstream body;
-    body << "Your verification code is: " << code << "\n\n";
-    body << "This code will expire in 10 minutes.\n\n";
-    body << "If you did not request this code, please ignore this email.\n\n";
-    body << "Best regards,\n";
-    body << "Velivolant Team";
-    
-    return sendEmail(username_, to, "Your Verification Code - Velivolant", body.str());
+    TemplateValues values;
+    values.set("code", code);
+    return sendTemplate(MessageTemplate::verificationCode(), username_, to, values);
 }
 
 std::string SmtpClient::getConnectionStatus() const {
@@ -320,69 +524,235 @@ std::string SmtpClient::getConnectionStatus() const {
     return "Not connected";
 }
 
-std::string SmtpClient::sendCommand(const std::string& command) {
-    if (!connected_) {
-        return "";
+bool SmtpClient::hasCapability(const std::string& keyword) const {
+    return capabilities_.count(keyword) > 0;
+}
+
+std::string SmtpClient::getCapabilityParams(const std::string& keyword) const {
+    auto it = capabilities_.find(keyword);
+    return it != capabilities_.end() ? it->second : "";
+}
+
+int SmtpClient::getLastReplyCode() const {
+    return lastReplyCode_;
+}
+
+bool SmtpClient::sendCommand(const std::string& command) {
+    if (connection_->socket < 0) {
+        return false;
     }
     
-    // Send command
-    if (useSsl_ && connection_->ssl) {
-        SSL_write(connection_->ssl, command.c_str(), command.length());
-    } else {
-        send(connection_->socket, command.c_str(), command.length(), 0);
+    const char* data = command.data();
+    size_t remaining = command.size();
+    while (remaining > 0) {
+        int written;
+        if (useSsl_ && connection_->ssl) {
+            written = SSL_write(connection_->ssl, data, static_cast<int>(remaining));
+        } else {
+            written = static_cast<int>(send(connection_->socket, data, remaining, MSG_NOSIGNAL));
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+        }
+        if (written <= 0) {
+            LOG_ERROR("Failed to write to SMTP server");
+            return false;
+        }
+        data += written;
+        remaining -= static_cast<size_t>(written);
     }
     
-    return "";
+    return true;
 }
 
-bool SmtpClient::readResponse(int expectedCode) {
-    char buffer[1024];
-    int bytes;
+bool SmtpClient::sendSegments(const std::vector<struct iovec>& segments) {
+    if (connection_->socket < 0) {
+        return false;
+    }
     
     if (useSsl_ && connection_->ssl) {
-        bytes = SSL_read(connection_->ssl, buffer, sizeof(buffer) - 1);
-    } else {
-        bytes = recv(connection_->socket, buffer, sizeof(buffer) - 1, 0);
+        // TLS has no gather write; coalesce into record-sized writes instead
+        // of one tiny record per segment
+        std::string buffer;
+        buffer.reserve(16384);
+        for (const auto& segment : segments) {
+            const char* data = static_cast<const char*>(segment.iov_base);
+            size_t remaining = segment.iov_len;
+            while (remaining > 0) {
+                size_t take = std::min(remaining, 16384 - buffer.size());
+                buffer.append(data, take);
+                data += take;
+                remaining -= take;
+                if (buffer.size() == 16384) {
+                    if (!sendCommand(buffer)) return false;
+                    buffer.clear();
+                }
+            }
+        }
+        return buffer.empty() || sendCommand(buffer);
     }
     
-    if (bytes <= 0) {
-        return false;
+    std::vector<struct iovec> pending(segments);
+    size_t index = 0;
+    while (index < pending.size()) {
+        struct msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &pending[index];
+        message.msg_iovlen = std::min<size_t>(pending.size() - index, IOV_MAX);
+        
+        ssize_t written = sendmsg(connection_->socket, &message, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("Failed to write to SMTP server");
+            return false;
+        }
+        
+        // Skip fully written segments and trim a partially written one
+        size_t consumed = static_cast<size_t>(written);
+        while (index < pending.size() && consumed >= pending[index].iov_len) {
+            consumed -= pending[index].iov_len;
+            index++;
+        }
+        if (index < pending.size()) {
+            pending[index].iov_base = static_cast<char*>(pending[index].iov_base) + consumed;
+            pending[index].iov_len -= consumed;
+        }
     }
     
-    buffer[bytes] = '\0';
-    std::string response(buffer);
-    
-    LOG_DEBUG("SMTP response: " + response);
-    
-    // Parse response code (first 3 characters)
-    if (response.length() >= 3) {
-        int code = std::stoi(response.substr(0, 3));
-        return code == expectedCode;
+    return true;
+}
+
+bool SmtpClient::readLine(std::string& line) {
+    std::string& buffer = connection_->readBuffer;
+    size_t scanned = 0;
+    
+    while (true) {
+        size_t newline = buffer.find('\n', scanned);
+        if (newline != std::string::npos) {
+            size_t end = (newline > 0 && buffer[newline - 1] == '\r') ? newline - 1 : newline;
+            line.assign(buffer, 0, end);
+            buffer.erase(0, newline + 1);
+            return true;
+        }
+        if (buffer.size() > kMaxReplyLine) {
+            LOG_ERROR("SMTP reply line too long");
+            return false;
+        }
+        scanned = buffer.size();
+        
+        char chunk[4096];
+        int bytes;
+        if (useSsl_ && connection_->ssl) {
+            bytes = SSL_read(connection_->ssl, chunk, sizeof(chunk));
+        } else {
+            bytes = static_cast<int>(recv(connection_->socket, chunk, sizeof(chunk), 0));
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+        }
+        if (bytes <= 0) {
+            return false;
+        }
+        buffer.append(chunk, static_cast<size_t>(bytes));
+    }
+}
+
+bool SmtpClient::readReply(SmtpReply& reply) {
+    reply.code = 0;
+    reply.lines.clear();
+    
+    std::string line;
+    while (readLine(line)) {
+        // Each line is "NNN-text" (more follows) or "NNN text" / "NNN" (last)
+        if (line.size() < 3 || !std::isdigit(static_cast<unsigned char>(line[0])) ||
+            !std::isdigit(static_cast<unsigned char>(line[1])) ||
+            !std::isdigit(static_cast<unsigned char>(line[2])) ||
+            (line.size() > 3 && line[3] != '-' && line[3] != ' ')) {
+            LOG_ERROR("Malformed SMTP reply: " + line);
+            return false;
+        }
+        
+        int code = std::stoi(line.substr(0, 3));
+        if (reply.code != 0 && code != reply.code) {
+            LOG_ERROR("Inconsistent codes in multi-line SMTP reply");
+            return false;
+        }
+        reply.code = code;
+        reply.lines.push_back(line.size() > 4 ? line.substr(4) : "");
+        
+        if (line.size() == 3 || line[3] == ' ') {
+            return true;
+        }
     }
-    
     return false;
 }
 
-std::string SmtpClient::formatEmail(const std::string& from,
-                                   const std::string& to,
-                                   const std::string& subject,
-                                   const std::string& body) {
-    std::ostringstream email;
+bool SmtpClient::readResponse(int expectedCode) {
+    SmtpReply reply;
+    if (!readReply(reply)) {
+        lastReplyCode_ = 0;
+        return false;
+    }
     
-    // Get current date/time
-    std::time_t now = std::time(nullptr);
-    char dateStr[100];
-    std::strftime(dateStr, sizeof(dateStr), "%a, %d %b %Y %H:%M:%S %z", std::localtime(&now));
+    lastReplyCode_ = reply.code;
+    LOG_DEBUG("SMTP response: " + std::to_string(reply.code) + " " + reply.text());
     
-    email << "From: " << from << "\r\n";
-    email << "To: " << to << "\r\n";
-    email << "Subject: " << subject << "\r\n";
-    email << "Date: " << dateStr << "\r\n";
-    email << "Content-Type: text/plain; charset=UTF-8\r\n";
-    email << "\r\n";
-    email << body;
+    return reply.code == expectedCode;
+}
+
+bool SmtpClient::ehlo() {
+    if (!sendCommand("EHLO localhost\r\n")) {
+        return false;
+    }
     
-    return email.str();
+    SmtpReply reply;
+    if (!readReply(reply)) {
+        lastReplyCode_ = 0;
+        return false;
+    }
+    lastReplyCode_ = reply.code;
+    if (reply.code != 250) {
+        return false;
+    }
+    
+    // The first line is the greeting; each following line is "KEYWORD [params]"
+    capabilities_.clear();
+    for (size_t i = 1; i < reply.lines.size(); i++) {
+        const std::string& line = reply.lines[i];
+        size_t space = line.find(' ');
+        std::string keyword = line.substr(0, space);
+        std::transform(keyword.begin(), keyword.end(), keyword.begin(),
+                       [](unsigned char c) { return std::toupper(c); });
+        capabilities_[keyword] = space == std::string::npos ? "" : line.substr(space + 1);
+    }
+    
+    LOG_DEBUG("SMTP server advertises " + std::to_string(capabilities_.size()) + " extensions");
+    return true;
+}
+
+std::string SmtpClient::formatHeaders(const std::string& from,
+                                      const std::vector<std::string>& recipients,
+                                      const std::string& subject) {
+    // A line break in the subject would let callers inject headers
+    std::string safeSubject = subject;
+    std::replace(safeSubject.begin(), safeSubject.end(), '\r', ' ');
+    std::replace(safeSubject.begin(), safeSubject.end(), '\n', ' ');
+    
+    std::string headers;
+    headers += "From: " + from + "\r\n";
+    headers += "To: ";
+    for (size_t i = 0; i < recipients.size(); i++) {
+        headers += (i > 0 ? ", " : "") + recipients[i];
+    }
+    headers += "\r\n";
+    headers += "Subject: " + safeSubject + "\r\n";
+    headers += "Date: ";
+    headers += MailDate::now();
+    headers += "\r\n";
+    headers += "Content-Type: text/plain; charset=UTF-8\r\n";
+    headers += "\r\n";
+    
+    return headers;
 }
 
 } // namespace Pens
@@ -0,0 +1,303 @@
+#include "smtp_connection_pool.hpp"
+#include "logger.hpp"
+#include <algorithm>
+
+namespace Pens {
+
+using Clock = std::chrono::steady_clock;
+
+struct SmtpConnectionPool::Entry {
+    std::unique_ptr<SmtpClient> client;
+    Clock::time_point lastUsed;    // last returned by a caller
+    Clock::time_point lastActive;  // last exchange with the server (incl. NOOP)
+    int messages = 0;
+    bool reusable = true;
+};
+
+// ---------------------------------------------------------------------------
+// Lease
+
+SmtpConnectionPool::Lease::Lease(SmtpConnectionPool* pool, std::unique_ptr<Entry> entry)
+    : pool_(pool), entry_(std::move(entry)) {
+}
+
+SmtpConnectionPool::Lease::Lease(Lease&& other) noexcept
+    : pool_(other.pool_), entry_(std::move(other.entry_)) {
+    other.pool_ = nullptr;
+}
+
+SmtpConnectionPool::Lease& SmtpConnectionPool::Lease::operator=(Lease&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool_ = other.pool_;
+        entry_ = std::move(other.entry_);
+        other.pool_ = nullptr;
+    }
+    return *this;
+}
+
+SmtpConnectionPool::Lease::~Lease() {
+    release();
+}
+
+SmtpClient* SmtpConnectionPool::Lease::operator->() const {
+    return entry_->client.get();
+}
+
+SmtpClient& SmtpConnectionPool::Lease::operator*() const {
+    return *entry_->client;
+}
+
+void SmtpConnectionPool::Lease::discard() {
+    if (entry_) {
+        entry_->reusable = false;
+    }
+}
+
+void SmtpConnectionPool::Lease::release() {
+    if (pool_ && entry_) {
+        bool reusable = entry_->reusable;
+        pool_->release(std::move(entry_), reusable);
+    }
+    pool_ = nullptr;
+}
+
+// ---------------------------------------------------------------------------
+// Pool
+
+SmtpConnectionPool::SmtpConnectionPool(SmtpPoolSettings settings)
+    : settings_(std::move(settings)),
+      open_(0),
+      stopping_(false),
+      connectionsOpened_(0) {
+    if (settings_.maxConnections == 0) {
+        settings_.maxConnections = 1;
+    }
+    maintenanceThread_ = std::thread(&SmtpConnectionPool::maintenanceLoop, this);
+    LOG_INFO("SMTP connection pool for " + settings_.server + " (max " +
+             std::to_string(settings_.maxConnections) + " connections)");
+}
+
+SmtpConnectionPool::~SmtpConnectionPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    maintenanceWake_.notify_all();
+    available_.notify_all();
+    if (maintenanceThread_.joinable()) {
+        maintenanceThread_.join();
+    }
+    closeIdle();
+}
+
+SmtpConnectionPool::Lease SmtpConnectionPool::acquire(int timeoutMs) {
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!stopping_) {
+        if (!idle_.empty()) {
+            std::unique_ptr<Entry> entry = std::move(idle_.back());
+            idle_.pop_back();
+            lock.unlock();
+
+            // Probe sessions that sat idle long enough for the server to drop them
+            bool stale = Clock::now() - entry->lastActive >= std::chrono::seconds(settings_.keepaliveSeconds);
+            if (!stale || entry->client->noop()) {
+                return Lease(this, std::move(entry));
+            }
+
+            LOG_DEBUG("Dropping dead pooled SMTP session");
+            entry.reset();
+            lock.lock();
+            open_--;
+            continue;
+        }
+
+        if (open_ < settings_.maxConnections) {
+            open_++;
+            lock.unlock();
+
+            std::unique_ptr<Entry> entry = openConnection();
+            if (entry) {
+                return Lease(this, std::move(entry));
+            }
+
+            lock.lock();
+            open_--;
+            available_.notify_one();
+            return Lease();
+        }
+
+        if (available_.wait_until(lock, deadline) == std::cv_status::timeout &&
+            idle_.empty() && open_ >= settings_.maxConnections) {
+            LOG_WARNING("Timed out waiting for a pooled SMTP connection");
+            return Lease();
+        }
+    }
+    return Lease();
+}
+
+std::unique_ptr<SmtpConnectionPool::Entry> SmtpConnectionPool::openConnection() {
+    auto entry = std::make_unique<Entry>();
+    entry->client = std::make_unique<SmtpClient>(settings_.server, settings_.port, settings_.useSsl);
+    entry->client->setDkimSigner(settings_.dkimSigner);
+
+    if (!entry->client->connect()) {
+        return nullptr;
+    }
+
+    bool authenticated;
+    if (settings_.tokenProvider) {
+        // Fetch the token per connection so new sessions always use the latest one
+        authenticated = entry->client->authenticateOAuth(settings_.username, settings_.tokenProvider());
+    } else {
+        authenticated = entry->client->authenticate(settings_.username, settings_.password);
+    }
+    if (!authenticated) {
+        return nullptr;
+    }
+
+    connectionsOpened_++;
+    entry->lastUsed = entry->lastActive = Clock::now();
+    return entry;
+}
+
+void SmtpConnectionPool::release(std::unique_ptr<Entry> entry, bool reusable) {
+    entry->messages++;
+    reusable = reusable && entry->client->isConnected() &&
+               entry->messages < settings_.maxMessagesPerConnection;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (reusable && !stopping_) {
+            entry->lastUsed = entry->lastActive = Clock::now();
+            idle_.push_back(std::move(entry));
+        } else {
+            open_--;
+        }
+    }
+    available_.notify_one();
+
+    // Anything left in entry is closed here, outside the lock (QUIT is network I/O)
+}
+
+bool SmtpConnectionPool::sendWithRetry(const std::function<bool(SmtpClient&)>& send, int* replyCode) {
+    if (replyCode) {
+        *replyCode = 0;
+    }
+    for (int attempt = 0; attempt < 2; attempt++) {
+        Lease lease = acquire();
+        if (!lease) {
+            return false;
+        }
+        bool sent = send(*lease);
+        if (replyCode) {
+            *replyCode = lease->getLastReplyCode();
+        }
+        if (sent) {
+            return true;
+        }
+        if (lease->getLastReplyCode() != 0) {
+            // The server answered; the transaction was rejected but the
+            // session (already RSET by the client) is still good
+            return false;
+        }
+
+        // No reply at all: the server closed the session under us
+        lease.discard();
+        LOG_INFO("Pooled SMTP session was closed by the server; retrying on a new connection");
+    }
+    return false;
+}
+
+bool SmtpConnectionPool::sendEmail(const std::string& from,
+                                   const std::string& to,
+                                   const std::string& subject,
+                                   const std::string& body,
+                                   int* replyCode) {
+    return sendWithRetry([&](SmtpClient& client) {
+        return client.sendEmail(from, to, subject, body);
+    }, replyCode);
+}
+
+bool SmtpConnectionPool::sendVerificationCode(const std::string& to, const std::string& code) {
+    return sendWithRetry([&](SmtpClient& client) {
+        return client.sendVerificationCode(to, code);
+    });
+}
+
+void SmtpConnectionPool::closeIdle() {
+    std::vector<std::unique_ptr<Entry>> closing;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closing.swap(idle_);
+        open_ -= closing.size();
+    }
+    available_.notify_all();
+}
+
+size_t SmtpConnectionPool::getIdleCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return idle_.size();
+}
+
+size_t SmtpConnectionPool::getOpenCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return open_;
+}
+
+size_t SmtpConnectionPool::getConnectionsOpened() const {
+    return connectionsOpened_.load();
+}
+
+void SmtpConnectionPool::maintenanceLoop() {
+    auto interval = std::chrono::seconds(std::max(1, settings_.keepaliveSeconds / 2));
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!stopping_) {
+        maintenanceWake_.wait_for(lock, interval);
+        if (stopping_) {
+            break;
+        }
+
+        // Take out the sessions that need attention so the NOOPs run unlocked
+        auto now = Clock::now();
+        std::vector<std::unique_ptr<Entry>> due;
+        for (auto it = idle_.begin(); it != idle_.end();) {
+            if (now - (*it)->lastActive >= std::chrono::seconds(settings_.keepaliveSeconds) ||
+                now - (*it)->lastUsed >= std::chrono::seconds(settings_.maxIdleSeconds)) {
+                due.push_back(std::move(*it));
+                it = idle_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (due.empty()) {
+            continue;
+        }
+        lock.unlock();
+
+        std::vector<std::unique_ptr<Entry>> alive;
+        for (auto& entry : due) {
+            bool expired = now - entry->lastUsed >= std::chrono::seconds(settings_.maxIdleSeconds);
+            if (!expired && entry->client->noop()) {
+                entry->lastActive = Clock::now();
+                alive.push_back(std::move(entry));
+            }
+        }
+        size_t closed = due.size() - alive.size();
+        due.clear();
+
+        lock.lock();
+        open_ -= closed;
+        // Probed sessions are the least recently used, so they go to the front
+        idle_.insert(idle_.begin(), std::make_move_iterator(alive.begin()),
+                     std::make_move_iterator(alive.end()));
+        if (closed > 0) {
+            available_.notify_all();
+        }
+    }
+}
+
+} // namespace Pens
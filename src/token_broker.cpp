@@ -0,0 +1,469 @@
+#include "token_broker.hpp"
+#include "logger.hpp"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace Pens {
+
+namespace {
+// Cached tokens closer than this to expiry are refreshed ahead of expiry
+constexpr long kRefreshMarginSeconds = 300;
+// Longest request line accepted from a socket client
+constexpr size_t kMaxRequestLine = 512;
+// Stop reading from a client while this many replies, or this much unsent
+// output, are queued for it
+constexpr size_t kMaxQueuedReplies = 64;
+constexpr size_t kMaxPendingOutput = 64 * 1024;
+
+bool fillSocketAddress(const std::string& path, sockaddr_un& addr) {
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOG_ERROR("Token broker socket path too long: " + path);
+        return false;
+    }
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return true;
+}
+}
+
+TokenBroker::TokenBroker()
+    : accounts_(std::make_shared<AccountMap>()),
+      refreshCount_(0),
+      listenFd_(-1),
+      wakeFds_{-1, -1} {
+}
+
+TokenBroker::~TokenBroker() {
+    stopServer();
+}
+
+OAuthTokenManager* TokenBroker::addAccount(const std::string& account, const OAuthAccountSettings& settings) {
+    return addAccount(account, std::make_unique<OAuthTokenManager>(settings));
+}
+
+OAuthTokenManager* TokenBroker::addAccount(const std::string& account, std::unique_ptr<OAuthTokenManager> manager) {
+    auto entry = std::make_shared<Account>();
+    entry->manager = std::move(manager);
+    OAuthTokenManager* result = entry->manager.get();
+
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    auto updated = std::make_shared<AccountMap>(*std::atomic_load(&accounts_));
+    (*updated)[account] = entry;
+    std::atomic_store(&accounts_, std::shared_ptr<const AccountMap>(updated));
+
+    LOG_INFO("Token broker registered account: " + account);
+    return result;
+}
+
+std::shared_ptr<TokenBroker::Account> TokenBroker::findAccount(const std::string& account) const {
+    auto accounts = std::atomic_load(&accounts_);
+    auto it = accounts->find(account);
+    return it != accounts->end() ? it->second : nullptr;
+}
+
+OAuthTokenManager* TokenBroker::getManager(const std::string& account) const {
+    auto entry = findAccount(account);
+    return entry ? entry->manager.get() : nullptr;
+}
+
+std::vector<std::string> TokenBroker::getAccounts() const {
+    std::vector<std::string> names;
+    for (const auto& [name, entry] : *std::atomic_load(&accounts_)) {
+        names.push_back(name);
+    }
+    return names;
+}
+
+std::string TokenBroker::getAccessToken(const std::string& account) {
+    auto entry = findAccount(account);
+    if (!entry) {
+        LOG_ERROR("Token broker: unknown account " + account);
+        return "";
+    }
+
+    // Fast path: lock-free snapshot read
+    auto snapshot = entry->manager->getTokenSnapshot();
+    long now = std::time(nullptr);
+    if (snapshot && !snapshot->accessToken.empty() &&
+        (snapshot->expiresAt == 0 || now < snapshot->expiresAt - kRefreshMarginSeconds)) {
+        return snapshot->accessToken;
+    }
+
+    if (!runSingleFlight(*entry, false)) {
+        return "";
+    }
+    return entry->manager->getAccessToken();
+}
+
+bool TokenBroker::refresh(const std::string& account) {
+    auto entry = findAccount(account);
+    if (!entry) {
+        LOG_ERROR("Token broker: unknown account " + account);
+        return false;
+    }
+    return runSingleFlight(*entry, true);
+}
+
+size_t TokenBroker::getRefreshCount() const {
+    return refreshCount_.load();
+}
+
+bool TokenBroker::runSingleFlight(Account& account, bool force) {
+    std::promise<bool> promise;
+    std::shared_future<bool> flight;
+    bool leader = false;
+
+    {
+        std::lock_guard<std::mutex> lock(account.flightMutex);
+        if (account.inFlight.valid()) {
+            flight = account.inFlight;
+        } else {
+            account.inFlight = promise.get_future().share();
+            leader = true;
+        }
+    }
+
+    if (!leader) {
+        return flight.get();
+    }
+
+    refreshCount_++;
+    bool ok = force ? account.manager->forceRefresh() : account.manager->ensureValidToken();
+
+    {
+        std::lock_guard<std::mutex> lock(account.flightMutex);
+        account.inFlight = std::shared_future<bool>();
+    }
+    promise.set_value(ok);
+    return ok;
+}
+
+bool TokenBroker::startServer(const std::string& socketPath) {
+    if (listenFd_ >= 0) {
+        return true;
+    }
+
+    sockaddr_un addr;
+    if (!fillSocketAddress(socketPath, addr)) {
+        return false;
+    }
+
+    listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd_ < 0) {
+        LOG_ERROR("Token broker: failed to create socket");
+        return false;
+    }
+
+    // Tokens are credentials: the socket file is created owner-only, so no
+    // other user can connect between bind() and the chmod() below
+    unlink(socketPath.c_str());
+    mode_t previousMask = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+    bool bound = bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    umask(previousMask);
+    if (!bound || chmod(socketPath.c_str(), S_IRUSR | S_IWUSR) < 0 || listen(listenFd_, 64) < 0) {
+        LOG_ERROR("Token broker: failed to listen on " + socketPath + ": " + std::strerror(errno));
+        close(listenFd_);
+        listenFd_ = -1;
+        if (bound) {
+            unlink(socketPath.c_str());
+        }
+        return false;
+    }
+
+    if (pipe(wakeFds_) < 0) {
+        close(listenFd_);
+        listenFd_ = -1;
+        unlink(socketPath.c_str());
+        return false;
+    }
+
+    socketPath_ = socketPath;
+    serverThread_ = std::thread(&TokenBroker::serve, this);
+    LOG_INFO("Token broker listening on " + socketPath);
+    return true;
+}
+
+void TokenBroker::stopServer() {
+    if (listenFd_ < 0) {
+        return;
+    }
+
+    char wake = 'q';
+    if (write(wakeFds_[1], &wake, 1) < 0) {
+        LOG_WARNING("Token broker: failed to signal server thread");
+    }
+    if (serverThread_.joinable()) {
+        serverThread_.join();
+    }
+    // Waits out refreshes still in flight
+    for (auto& [account, thread] : refreshThreads_) {
+        thread.join();
+    }
+    refreshThreads_.clear();
+    refreshing_.clear();
+    refreshed_.clear();
+
+    close(listenFd_);
+    close(wakeFds_[0]);
+    close(wakeFds_[1]);
+    listenFd_ = -1;
+    wakeFds_[0] = wakeFds_[1] = -1;
+    unlink(socketPath_.c_str());
+    LOG_INFO("Token broker stopped");
+}
+
+void TokenBroker::serve() {
+    std::map<int, Client> clients;
+
+    while (true) {
+        std::vector<pollfd> fds;
+        fds.push_back({wakeFds_[0], POLLIN, 0});
+        fds.push_back({listenFd_, POLLIN, 0});
+        for (const auto& [fd, client] : clients) {
+            short events = readsPaused(client) ? 0 : POLLIN;
+            if (!client.output.empty()) {
+                events |= POLLOUT;
+            }
+            fds.push_back({fd, events, 0});
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char wake[64];
+            ssize_t n = read(wakeFds_[0], wake, sizeof(wake));
+            if (n <= 0 || std::memchr(wake, 'q', static_cast<size_t>(n))) {
+                break;
+            }
+
+            // Answer the requests parked on refreshes that have finished
+            std::vector<std::string> finished;
+            {
+                std::lock_guard<std::mutex> lock(refreshMutex_);
+                finished.swap(refreshed_);
+            }
+            for (const std::string& account : finished) {
+                std::string reply = cachedReply(account);
+                for (auto& [fd, client] : clients) {
+                    for (PendingReply& pending : client.replies) {
+                        if (pending.account == account) {
+                            pending.account.clear();
+                            pending.text = reply.empty() ? "ERR token unavailable\n" : reply;
+                        }
+                    }
+                }
+            }
+            for (auto it = clients.begin(); it != clients.end();) {
+                if (finished.empty() || serviceClient(it->first, it->second)) {
+                    ++it;
+                } else {
+                    close(it->first);
+                    it = clients.erase(it);
+                }
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            int fd = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (fd >= 0) {
+                clients[fd] = Client();
+            }
+        }
+
+        for (size_t i = 2; i < fds.size(); i++) {
+            short revents = fds[i].revents;
+            int fd = fds[i].fd;
+            auto it = clients.find(fd);
+            if (!revents || it == clients.end()) {
+                continue;
+            }
+            Client& client = it->second;
+
+            bool open = true;
+            if (revents & POLLIN) {
+                char chunk[512];
+                ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+                if (n > 0 && client.buffer.size() + n <= kMaxRequestLine * 4) {
+                    client.buffer.append(chunk, n);
+                } else if (n >= 0 || (errno != EAGAIN && errno != EINTR)) {
+                    open = false;
+                }
+            } else if (!(revents & POLLOUT)) {
+                // Hung up while its reads were paused
+                open = false;
+            }
+
+            if (!open || !serviceClient(fd, client)) {
+                close(fd);
+                clients.erase(it);
+            }
+        }
+    }
+
+    for (const auto& [fd, client] : clients) {
+        close(fd);
+    }
+}
+
+bool TokenBroker::serviceClient(int fd, Client& client) {
+    // Answer complete lines while under the caps; clients may pipeline
+    // requests, and the rest wait in the buffer until replies drain
+    while (true) {
+        size_t eol;
+        while (!readsPaused(client) && (eol = client.buffer.find('\n')) != std::string::npos) {
+            std::string line = client.buffer.substr(0, eol);
+            client.buffer.erase(0, eol + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            handleRequest(line, client);
+        }
+        if (!flushReplies(fd, client)) {
+            return false;
+        }
+        if (readsPaused(client) || client.buffer.find('\n') == std::string::npos) {
+            return true;
+        }
+    }
+}
+
+bool TokenBroker::readsPaused(const Client& client) {
+    return client.replies.size() >= kMaxQueuedReplies || client.output.size() > kMaxPendingOutput;
+}
+
+bool TokenBroker::flushReplies(int fd, Client& client) {
+    while (!client.replies.empty() && !client.replies.front().text.empty()) {
+        client.output += client.replies.front().text;
+        client.replies.pop_front();
+    }
+    while (!client.output.empty()) {
+        ssize_t n = send(fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN;
+        }
+        client.output.erase(0, n);
+    }
+    return true;
+}
+
+void TokenBroker::handleRequest(const std::string& line, Client& client) {
+    const std::string prefix = "TOKEN ";
+    if (line.size() > kMaxRequestLine || line.compare(0, prefix.size(), prefix) != 0) {
+        client.replies.push_back({"", "ERR bad request\n"});
+        return;
+    }
+
+    std::string account = line.substr(prefix.size());
+    auto entry = findAccount(account);
+    if (!entry) {
+        client.replies.push_back({"", "ERR unknown account\n"});
+        return;
+    }
+
+    std::string reply = cachedReply(account);
+    if (reply.empty()) {
+        // Expired or never loaded: wait for the refresh thread
+        client.replies.push_back({account, ""});
+        queueRefresh(account);
+        return;
+    }
+    client.replies.push_back({"", reply});
+
+    // Still valid but close to expiry: refresh ahead without holding the reply
+    auto snapshot = entry->manager->getTokenSnapshot();
+    if (snapshot && snapshot->expiresAt != 0 && std::time(nullptr) >= snapshot->expiresAt - kRefreshMarginSeconds) {
+        queueRefresh(account);
+    }
+}
+
+std::string TokenBroker::cachedReply(const std::string& account) const {
+    auto entry = findAccount(account);
+    auto snapshot = entry ? entry->manager->getTokenSnapshot() : nullptr;
+    if (!snapshot || snapshot->accessToken.empty() ||
+        (snapshot->expiresAt != 0 && std::time(nullptr) >= snapshot->expiresAt)) {
+        return "";
+    }
+    return "OK " + snapshot->accessToken + "\n";
+}
+
+void TokenBroker::queueRefresh(const std::string& account) {
+    {
+        std::lock_guard<std::mutex> lock(refreshMutex_);
+        if (!refreshing_.insert(account).second) {
+            return;
+        }
+    }
+
+    // The account's previous refresh thread, if any, has finished its work
+    auto it = refreshThreads_.find(account);
+    if (it != refreshThreads_.end()) {
+        it->second.join();
+        refreshThreads_.erase(it);
+    }
+    refreshThreads_[account] = std::thread([this, account] {
+        auto entry = findAccount(account);
+        if (entry) {
+            // Shares the single flight with in-process getAccessToken() callers
+            runSingleFlight(*entry, false);
+        }
+        std::lock_guard<std::mutex> lock(refreshMutex_);
+        refreshing_.erase(account);
+        refreshed_.push_back(account);
+        char wake = 'r';
+        if (write(wakeFds_[1], &wake, 1) < 0) {
+            LOG_WARNING("Token broker: failed to signal server thread");
+        }
+    });
+}
+
+std::string TokenBroker::requestToken(const std::string& socketPath, const std::string& account) {
+    sockaddr_un addr;
+    if (!fillSocketAddress(socketPath, addr)) {
+        return "";
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return "";
+    }
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        LOG_ERROR("Token broker: cannot connect to " + socketPath);
+        close(fd);
+        return "";
+    }
+
+    std::string request = "TOKEN " + account + "\n";
+    send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+
+    std::string response;
+    char chunk[4096];
+    while (response.find('\n') == std::string::npos) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            break;
+        }
+        response.append(chunk, n);
+    }
+    close(fd);
+
+    if (response.compare(0, 3, "OK ") != 0) {
+        LOG_ERROR("Token broker request failed: " + response.substr(0, response.find('\n')));
+        return "";
+    }
+    return response.substr(3, response.find('\n') - 3);
+}
+
+} // namespace Pens
@@ -0,0 +1,141 @@
+#include "token_refresher.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+
+namespace Pens {
+
+namespace {
+// Retry schedule after a failed refresh: 30s, 60s, 120s, ... capped at 5 minutes
+constexpr int kRetryBaseSeconds = 30;
+constexpr int kRetryMaxSeconds = 300;
+// Assumed lifetime when the token file carries no expiry information
+constexpr int kDefaultLifetimeSeconds = 3600;
+}
+
+TokenRefresher::TokenRefresher(OAuthTokenManager& manager, int leadSeconds, int jitterSeconds)
+    : manager_(manager),
+      leadSeconds_(std::max(0, leadSeconds)),
+      jitterSeconds_(std::max(0, jitterSeconds)),
+      running_(false),
+      nextRefreshAt_(0),
+      rng_(std::random_device{}()) {
+}
+
+TokenRefresher::~TokenRefresher() {
+    stop();
+}
+
+void TokenRefresher::addListener(Listener listener) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    listeners_.push_back(std::move(listener));
+}
+
+void TokenRefresher::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    thread_ = std::thread(&TokenRefresher::run, this);
+    LOG_INFO("OAuth token refresher started");
+}
+
+void TokenRefresher::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    LOG_INFO("OAuth token refresher stopped");
+}
+
+bool TokenRefresher::isRunning() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return running_;
+}
+
+long TokenRefresher::getNextRefreshAt() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return nextRefreshAt_;
+}
+
+long TokenRefresher::computeRefreshTime(long expiresAt, long now, int lead, int jitter) {
+    if (expiresAt == 0) {
+        expiresAt = now + kDefaultLifetimeSeconds;
+    }
+    return std::max(now, expiresAt - lead - jitter);
+}
+
+int TokenRefresher::drawJitter() {
+    if (jitterSeconds_ == 0) {
+        return 0;
+    }
+    std::uniform_int_distribution<int> dist(0, jitterSeconds_);
+    return dist(rng_);
+}
+
+void TokenRefresher::run() {
+    int failures = 0;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        long now = std::time(nullptr);
+
+        if (failures == 0) {
+            auto snapshot = manager_.getTokenSnapshot();
+            long expiresAt = snapshot ? snapshot->expiresAt : 0;
+            nextRefreshAt_ = computeRefreshTime(expiresAt, now, leadSeconds_, drawJitter());
+        } else {
+            int shift = std::min(failures - 1, 4);
+            nextRefreshAt_ = now + std::min(kRetryBaseSeconds << shift, kRetryMaxSeconds);
+        }
+
+        LOG_DEBUG("Next OAuth token refresh in " + std::to_string(nextRefreshAt_ - now) + " seconds");
+
+        auto deadline = std::chrono::system_clock::from_time_t(nextRefreshAt_);
+        cv_.wait_until(lock, deadline, [this] { return !running_; });
+        if (!running_) {
+            break;
+        }
+
+        // Refresh outside the lock so listeners and getNextRefreshAt() are not
+        // held up; stop() still joins, so it waits for an in-flight refresh
+        lock.unlock();
+        LOG_INFO("Proactively refreshing OAuth access token");
+        bool refreshed = manager_.forceRefresh();
+        std::string accessToken = refreshed ? manager_.getAccessToken() : "";
+        lock.lock();
+
+        if (refreshed) {
+            failures = 0;
+            lock.unlock();
+            notifyListeners(accessToken);
+            lock.lock();
+        } else {
+            failures++;
+            LOG_WARNING("Proactive OAuth refresh failed (attempt " + std::to_string(failures) + ")");
+        }
+    }
+    nextRefreshAt_ = 0;
+}
+
+void TokenRefresher::notifyListeners(const std::string& accessToken) {
+    std::vector<Listener> listeners;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listeners = listeners_;
+    }
+    for (const auto& listener : listeners) {
+        listener(accessToken);
+    }
+}
+
+} // namespace Pens
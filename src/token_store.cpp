@@ -0,0 +1,306 @@
+#include "token_store.hpp"
+#include "logger.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Pens {
+
+namespace {
+
+bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+std::string directoryOf(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    if (slash == std::string::npos) return ".";
+    if (slash == 0) return "/";
+    return path.substr(0, slash);
+}
+
+// Holds an flock for the lifetime of the scope
+class FileLock {
+public:
+    explicit FileLock(int fd) : fd_(fd) {
+        while (::flock(fd_, LOCK_EX) != 0 && errno == EINTR) {}
+    }
+    ~FileLock() { ::flock(fd_, LOCK_UN); }
+private:
+    int fd_;
+};
+
+constexpr uint32_t kMagic = 0x50544B54; // "PTKT"
+constexpr uint32_t kVersion = 1;
+constexpr size_t kHeaderSize = 64;
+constexpr int kMaxReadAttempts = 1000;
+
+} // namespace
+
+bool TokenStore::writeFileAtomically(const std::string& path, const std::string& contents, unsigned mode) {
+    // The temp file lives next to the target so rename() stays on one filesystem
+    std::string tempPath = path + ".tmp." + std::to_string(::getpid());
+
+    int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (fd < 0) {
+        LOG_ERROR("Failed to create " + tempPath + ": " + std::strerror(errno));
+        return false;
+    }
+
+    bool ok = writeAll(fd, contents.data(), contents.size()) && ::fsync(fd) == 0;
+    int savedErrno = errno;
+    ::close(fd);
+
+    if (!ok || ::rename(tempPath.c_str(), path.c_str()) != 0) {
+        if (ok) savedErrno = errno;
+        LOG_ERROR("Failed to write " + path + ": " + std::strerror(savedErrno));
+        ::unlink(tempPath.c_str());
+        return false;
+    }
+
+    // Persist the directory entry so the rename survives a crash
+    int dirFd = ::open(directoryOf(path).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+    return true;
+}
+
+bool TokenStore::readFile(const std::string& path, std::string& contents) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    contents.clear();
+    char buffer[4096];
+    for (;;) {
+        ssize_t n = ::read(fd, buffer, sizeof(buffer));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            return false;
+        }
+        if (n == 0) break;
+        contents.append(buffer, static_cast<size_t>(n));
+    }
+    ::close(fd);
+    return true;
+}
+
+struct SharedTokenTable::Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t slotSize;
+};
+
+struct SharedTokenTable::Slot {
+    std::atomic<uint32_t> sequence;   // odd while a writer is mid-update
+    uint32_t tokenLength;
+    int64_t expiresAt;
+    char account[kMaxAccountLength + 1];
+    char token[kSlotSize - 16 - (kMaxAccountLength + 1)];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "seqlock needs a lock-free counter");
+
+SharedTokenTable::SharedTokenTable() : fd_(-1), base_(nullptr), size_(0) {
+    static_assert(sizeof(Slot) == kSlotSize, "slot layout must match the on-disk format");
+}
+
+SharedTokenTable::~SharedTokenTable() {
+    close();
+}
+
+size_t SharedTokenTable::maxTokenLength() {
+    return sizeof(Slot::token);
+}
+
+bool SharedTokenTable::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open shared token table " + path + ": " + std::strerror(errno));
+        return false;
+    }
+
+    size_t size = kHeaderSize + static_cast<size_t>(kSlotCount) * kSlotSize;
+    FileLock lock(fd);
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    bool fresh = st.st_size == 0;
+    if (fresh && ::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        LOG_ERROR("Failed to size shared token table " + path + ": " + std::strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    if (!fresh && static_cast<size_t>(st.st_size) != size) {
+        LOG_ERROR("Shared token table " + path + " has an unexpected size");
+        ::close(fd);
+        return false;
+    }
+
+    void* base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        LOG_ERROR("Failed to map shared token table " + path + ": " + std::strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    Header* hdr = static_cast<Header*>(base);
+    if (fresh) {
+        hdr->version = kVersion;
+        hdr->slotCount = kSlotCount;
+        hdr->slotSize = static_cast<uint32_t>(kSlotSize);
+        hdr->magic = kMagic;
+    } else if (hdr->magic != kMagic || hdr->version != kVersion ||
+               hdr->slotCount != kSlotCount || hdr->slotSize != kSlotSize) {
+        LOG_ERROR("Shared token table " + path + " has an incompatible layout");
+        ::munmap(base, size);
+        ::close(fd);
+        return false;
+    }
+
+    fd_ = fd;
+    base_ = base;
+    size_ = size;
+    return true;
+}
+
+void SharedTokenTable::close() {
+    if (base_) {
+        ::munmap(base_, size_);
+        base_ = nullptr;
+        size_ = 0;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool SharedTokenTable::isOpen() const {
+    return base_ != nullptr;
+}
+
+SharedTokenTable::Slot* SharedTokenTable::slot(uint32_t index) const {
+    return reinterpret_cast<Slot*>(static_cast<char*>(base_) + kHeaderSize + index * kSlotSize);
+}
+
+SharedTokenTable::Slot* SharedTokenTable::findSlot(const std::string& account) const {
+    // Callers hold the file lock, so slot contents are stable here
+    for (uint32_t i = 0; i < kSlotCount; i++) {
+        Slot* s = slot(i);
+        if (account.compare(0, std::string::npos, s->account,
+                            strnlen(s->account, sizeof(s->account))) == 0) {
+            return s;
+        }
+    }
+    return nullptr;
+}
+
+bool SharedTokenTable::publish(const std::string& account, const std::string& accessToken, long expiresAt) {
+    if (!isOpen() || account.empty() || account.size() > kMaxAccountLength ||
+        accessToken.size() > maxTokenLength()) {
+        return false;
+    }
+
+    FileLock lock(fd_);
+
+    Slot* target = findSlot(account);
+    if (!target) {
+        for (uint32_t i = 0; i < kSlotCount && !target; i++) {
+            if (slot(i)->account[0] == '\0') {
+                target = slot(i);
+            }
+        }
+        if (!target) {
+            LOG_ERROR("Shared token table is full; not publishing token for " + account);
+            return false;
+        }
+    }
+
+    // A writer that died mid-update leaves the counter odd; skip past it
+    uint32_t seq = target->sequence.load(std::memory_order_relaxed);
+    seq += (seq & 1) ? 1 : 2;
+
+    target->sequence.store(seq - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    std::memset(target->account, 0, sizeof(target->account));
+    std::memcpy(target->account, account.data(), account.size());
+    std::memcpy(target->token, accessToken.data(), accessToken.size());
+    target->tokenLength = static_cast<uint32_t>(accessToken.size());
+    target->expiresAt = expiresAt;
+
+    target->sequence.store(seq, std::memory_order_release);
+    return true;
+}
+
+bool SharedTokenTable::read(const std::string& account, std::string& accessToken, long& expiresAt) const {
+    if (!isOpen() || account.empty() || account.size() > kMaxAccountLength) {
+        return false;
+    }
+
+    char name[kMaxAccountLength + 1];
+    for (uint32_t i = 0; i < kSlotCount; i++) {
+        Slot* s = slot(i);
+        for (int attempt = 0; attempt < kMaxReadAttempts; attempt++) {
+            uint32_t before = s->sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+
+            std::memcpy(name, s->account, sizeof(name));
+            bool match = std::strncmp(name, account.c_str(), sizeof(name)) == 0;
+            uint32_t length = 0;
+            int64_t expires = 0;
+            if (match) {
+                length = s->tokenLength;
+                expires = s->expiresAt;
+                if (length > maxTokenLength()) {
+                    length = 0;
+                }
+                accessToken.assign(s->token, length);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s->sequence.load(std::memory_order_relaxed) != before) {
+                continue;
+            }
+
+            if (!match) {
+                if (name[0] == '\0') {
+                    return false; // slots are claimed in order; the rest are empty
+                }
+                break;
+            }
+            expiresAt = static_cast<long>(expires);
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace Pens
@@ -1,37 +1,143 @@
 #include "verification_code.hpp"
 #include "logger.hpp"
-#include <sstream>
-#include <iomanip>
+#include <openssl/rand.h>
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <pthread.h>
+#include <sys/random.h>
 
 namespace Pens {
 
-VerificationCodeGenerator::VerificationCodeGenerator()
-    : rd_(),
-      gen_(rd_()),
-      dist_(100000, 999999) {  // 6-digit range
+namespace {
+
+constexpr uint32_t kCodeSpace = 1000000;
+// Largest multiple of kCodeSpace that fits in 32 bits; draws at or above it
+// are rejected so every code is equally likely
+constexpr uint64_t kRejectionLimit = (uint64_t(1) << 32) - ((uint64_t(1) << 32) % kCodeSpace);
+
+void discardAfterFork();
+
+std::atomic<VerificationCodeGenerator::EntropySource> entropySource(nullptr);
+
+// getrandom, topped up from OpenSSL's DRBG if the kernel comes up short
+bool kernelRandom(unsigned char* out, size_t length) {
+    size_t filled = 0;
+    while (filled < length) {
+        ssize_t n = getrandom(out + filled, length - filled, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        filled += static_cast<size_t>(n);
+    }
+    return filled == length || RAND_bytes(out + filled, static_cast<int>(length - filled)) == 1;
+}
+
+// Per-thread pool of kernel randomness, refilled 4 KB at a time
+struct EntropyBuffer {
+    unsigned char bytes[4096];
+    size_t position = sizeof(bytes);
+
+    // On failure the buffer stays empty, so no byte is ever handed out twice
+    bool refill() {
+        static const bool forkHandlerInstalled = pthread_atfork(nullptr, nullptr, discardAfterFork) == 0;
+        (void)forkHandlerInstalled;
+
+        VerificationCodeGenerator::EntropySource source = entropySource.load();
+        if (!(source ? source : kernelRandom)(bytes, sizeof(bytes))) {
+            LOG_ERROR("No randomness available for verification codes");
+            position = sizeof(bytes);
+            return false;
+        }
+        position = 0;
+        return true;
+    }
+
+    bool next(uint32_t& value) {
+        if (position + sizeof(uint32_t) > sizeof(bytes) && !refill()) {
+            return false;
+        }
+        std::memcpy(&value, bytes + position, sizeof(value));
+        position += sizeof(value);
+        return true;
+    }
+};
+
+thread_local EntropyBuffer entropy;
+
+// A forked child must not hand out codes from its parent's buffered bytes;
+// the forking thread is the only one left in the child
+void discardAfterFork() {
+    entropy.position = sizeof(entropy.bytes);
+}
+
+} // namespace
+
+VerificationCodeGenerator::VerificationCodeGenerator() {
     LOG_DEBUG("Verification code generator initialized");
 }
 
 std::string VerificationCodeGenerator::generate() {
-    int code = dist_(gen_);
-    
-    std::ostringstream oss;
-    oss << std::setw(6) << std::setfill('0') << code;
-    
-    std::string codeStr = oss.str();
+    char digits[kCodeLength];
+    if (!generate(digits)) {
+        return "";
+    }
+
+    std::string codeStr(digits, kCodeLength);
     LOG_INFO("Generated verification code: " + codeStr.substr(0, 3) + "***");
-    
+
     return codeStr;
 }
 
+bool VerificationCodeGenerator::generate(char* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t value;
+        do {
+            if (!entropy.next(value)) {
+                return false;
+            }
+        } while (value >= kRejectionLimit);
+        value %= kCodeSpace;
+
+        char* code = out + i * kCodeLength;
+        for (size_t d = kCodeLength; d > 0; d--) {
+            code[d - 1] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        }
+    }
+    return true;
+}
+
+std::vector<std::string> VerificationCodeGenerator::generateBatch(size_t count) {
+    std::string digits(count * kCodeLength, '\0');
+    if (!generate(&digits[0], count)) {
+        return {};
+    }
+
+    std::vector<std::string> codes;
+    codes.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        codes.emplace_back(digits, i * kCodeLength, kCodeLength);
+    }
+    LOG_DEBUG("Generated " + std::to_string(count) + " verification codes");
+    return codes;
+}
+
 bool VerificationCodeGenerator::validate(const std::string& code) {
-    if (code.length() != 6) {
+    if (code.length() != kCodeLength) {
         return false;
     }
-    
+
     return std::all_of(code.begin(), code.end(), ::isdigit);
 }
 
-} // namespace Pens
+void VerificationCodeGenerator::setEntropySource(EntropySource source) {
+    entropySource.store(source);
+}
 
+} // namespace Pens
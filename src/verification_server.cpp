@@ -0,0 +1,485 @@
+#include "verification_server.hpp"
+#include "rate_limiter.hpp"
+#include "smtp_connection_pool.hpp"
+#include "logger.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace Pens {
+
+namespace {
+// Longest request line accepted from a client
+constexpr size_t kMaxRequestLine = 1024;
+// Longest recipient address (RFC 5321 path limit less the angle brackets)
+constexpr size_t kMaxAddressLength = 254;
+// Stop reading from a client while this much of its output is unsent
+constexpr size_t kMaxPendingOutput = 256 * 1024;
+constexpr int kMaxEvents = 64;
+
+bool fillSocketAddress(const std::string& path, sockaddr_un& addr) {
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOG_ERROR("Verification server socket path too long: " + path);
+        return false;
+    }
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return true;
+}
+
+const char* statusName(VerificationServer::DeliveryStatus status) {
+    switch (status) {
+        case VerificationServer::DeliveryStatus::Queued: return "queued";
+        case VerificationServer::DeliveryStatus::Sent: return "sent";
+        case VerificationServer::DeliveryStatus::Failed: return "failed";
+    }
+    return "unknown";
+}
+}
+
+VerificationServer::VerificationServer(VerificationServerSettings settings,
+                                       VerificationService& service,
+                                       Sender sender)
+    : settings_(std::move(settings)),
+      service_(service),
+      sender_(std::move(sender)),
+      rateLimiter_(nullptr),
+      listenFd_(-1),
+      epollFd_(-1),
+      wakeFd_(-1),
+      running_(false),
+      stopWorkers_(false),
+      nextId_(1) {
+}
+
+VerificationServer::~VerificationServer() {
+    stop();
+}
+
+void VerificationServer::setRateLimiter(RateLimiter* limiter) {
+    rateLimiter_ = limiter;
+}
+
+bool VerificationServer::start() {
+    if (running_) {
+        return true;
+    }
+
+    sockaddr_un addr;
+    if (!fillSocketAddress(settings_.socketPath, addr)) {
+        return false;
+    }
+
+    listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd_ < 0) {
+        LOG_ERROR("Verification server: failed to create socket");
+        return false;
+    }
+
+    // Owner-only from the moment the socket file exists
+    unlink(settings_.socketPath.c_str());
+    mode_t previousMask = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+    bool bound = bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    umask(previousMask);
+    if (!bound || chmod(settings_.socketPath.c_str(), S_IRUSR | S_IWUSR) < 0 || listen(listenFd_, 512) < 0) {
+        LOG_ERROR("Verification server: failed to listen on " + settings_.socketPath + ": " + std::strerror(errno));
+        close(listenFd_);
+        listenFd_ = -1;
+        if (bound) {
+            unlink(settings_.socketPath.c_str());
+        }
+        return false;
+    }
+
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd_ < 0 || wakeFd_ < 0) {
+        LOG_ERROR("Verification server: failed to create event loop");
+        stop();
+        return false;
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = listenFd_;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd_, &event);
+    event.data.fd = wakeFd_;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &event);
+
+    stopWorkers_ = false;
+    for (int i = 0; i < settings_.deliveryWorkers; i++) {
+        workers_.emplace_back(&VerificationServer::deliveryLoop, this);
+    }
+
+    running_ = true;
+    loopThread_ = std::thread(&VerificationServer::loop, this);
+    LOG_INFO("Verification server listening on " + settings_.socketPath);
+    return true;
+}
+
+void VerificationServer::stop() {
+    if (running_) {
+        running_ = false;
+        uint64_t one = 1;
+        if (write(wakeFd_, &one, sizeof(one)) < 0) {
+            LOG_WARNING("Verification server: failed to signal event loop");
+        }
+    }
+    if (loopThread_.joinable()) {
+        loopThread_.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(deliveryMutex_);
+        stopWorkers_ = true;
+    }
+    deliveryReady_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+
+    for (const auto& [fd, connection] : connections_) {
+        close(fd);
+    }
+    connections_.clear();
+
+    if (listenFd_ >= 0) {
+        close(listenFd_);
+        listenFd_ = -1;
+        unlink(settings_.socketPath.c_str());
+        LOG_INFO("Verification server stopped");
+    }
+    if (epollFd_ >= 0) {
+        close(epollFd_);
+        epollFd_ = -1;
+    }
+    if (wakeFd_ >= 0) {
+        close(wakeFd_);
+        wakeFd_ = -1;
+    }
+}
+
+void VerificationServer::loop() {
+    epoll_event events[kMaxEvents];
+
+    while (running_) {
+        int count = epoll_wait(epollFd_, events, kMaxEvents, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("Verification server: epoll_wait failed");
+            break;
+        }
+        // Requests read in this batch are timed from here
+        Clock::time_point woke = Clock::now();
+
+        for (int i = 0; i < count && running_; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wakeFd_) {
+                continue;
+            }
+            if (fd == listenFd_) {
+                acceptClients();
+                continue;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                closeClient(fd);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                writeClient(fd);
+            }
+            if ((events[i].events & EPOLLIN) && connections_.count(fd)) {
+                readClient(fd, woke);
+            }
+        }
+    }
+}
+
+void VerificationServer::acceptClients() {
+    while (true) {
+        int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        if (connections_.size() >= settings_.maxConnections) {
+            LOG_WARNING("Verification server: connection limit reached");
+            close(fd);
+            continue;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            continue;
+        }
+        connections_[fd] = Connection();
+    }
+}
+
+void VerificationServer::readClient(int fd, Clock::time_point woke) {
+    Connection& connection = connections_[fd];
+    char chunk[16384];
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        closeClient(fd);
+        return;
+    }
+    if (n < 0) {
+        return;
+    }
+
+    connection.input.append(chunk, n);
+
+    // Answer every complete line; pipelined replies go out in one write
+    size_t start = 0;
+    size_t eol;
+    while ((eol = connection.input.find('\n', start)) != std::string::npos) {
+        size_t length = eol - start;
+        if (length > 0 && connection.input[eol - 1] == '\r') {
+            length--;
+        }
+        connection.output += handleRequest(connection.input.substr(start, length), woke);
+        start = eol + 1;
+    }
+    connection.input.erase(0, start);
+
+    if (connection.input.size() > kMaxRequestLine) {
+        connection.output += "ERR bad request\n";
+        writeClient(fd);
+        if (connections_.count(fd)) {
+            closeClient(fd);
+        }
+        return;
+    }
+    writeClient(fd);
+}
+
+void VerificationServer::writeClient(int fd) {
+    auto it = connections_.find(fd);
+    if (it == connections_.end()) {
+        return;
+    }
+    Connection& connection = it->second;
+
+    while (!connection.output.empty()) {
+        ssize_t n = send(fd, connection.output.data(), connection.output.size(), MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                closeClient(fd);
+                return;
+            }
+            break;
+        }
+        connection.output.erase(0, n);
+    }
+
+    // Wait for the socket to drain before reading more requests from a client
+    // that does not read its replies
+    epoll_event event{};
+    event.data.fd = fd;
+    if (connection.output.empty()) {
+        event.events = EPOLLIN;
+    } else if (connection.output.size() > kMaxPendingOutput) {
+        event.events = EPOLLOUT;
+    } else {
+        event.events = EPOLLIN | EPOLLOUT;
+    }
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &event);
+}
+
+void VerificationServer::closeClient(int fd) {
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections_.erase(fd);
+}
+
+std::string VerificationServer::handleRequest(const std::string& line, Clock::time_point woke) {
+    auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - woke);
+    if (waited.count() > settings_.requestBudgetMs) {
+        return "ERR deadline\n";
+    }
+
+    size_t space = line.find(' ');
+    std::string verb = line.substr(0, space);
+    std::string args = space == std::string::npos ? "" : line.substr(space + 1);
+
+    if (verb == "ISSUE" && isValidRecipient(args)) {
+        return issue(args);
+    }
+
+    if (verb == "VERIFY") {
+        size_t split = args.find(' ');
+        if (split == std::string::npos || split == 0) {
+            return "ERR bad request\n";
+        }
+        VerifyResult result = service_.verify(args.substr(0, split), args.substr(split + 1));
+        if (result == VerifyResult::Ok) {
+            return "OK\n";
+        }
+        return std::string("ERR ") + VerificationService::resultName(result) + "\n";
+    }
+
+    if (verb == "STATUS" && !args.empty()) {
+        char* end = nullptr;
+        uint64_t id = std::strtoull(args.c_str(), &end, 10);
+        if (*end != '\0') {
+            return "ERR bad request\n";
+        }
+        std::lock_guard<std::mutex> lock(statusMutex_);
+        auto it = statuses_.find(id);
+        if (it == statuses_.end()) {
+            return "ERR unknown id\n";
+        }
+        return std::string("OK ") + statusName(it->second) + "\n";
+    }
+
+    return "ERR bad request\n";
+}
+
+std::string VerificationServer::issue(const std::string& recipient) {
+    {
+        std::lock_guard<std::mutex> lock(deliveryMutex_);
+        if (deliveries_.size() >= settings_.maxQueuedDeliveries) {
+            return "ERR busy\n";
+        }
+    }
+
+    if (rateLimiter_) {
+        RateCheck check = rateLimiter_->acquire(recipient);
+        if (!check.allowed()) {
+            LOG_WARNING(std::string("Verification code to ") + recipient + " rate limited (" +
+                        RateLimiter::decisionName(check.decision) + ")");
+            return "ERR rate_limited " + std::to_string(check.retryAfterMs) + "\n";
+        }
+    }
+
+    std::string code = service_.issue(recipient);
+    if (code.empty()) {
+        // No code, no email: the send does not count against the limits
+        if (rateLimiter_) {
+            rateLimiter_->release(recipient);
+        }
+        return "ERR unavailable\n";
+    }
+
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(statusMutex_);
+        id = nextId_++;
+        statuses_[id] = DeliveryStatus::Queued;
+        while (statuses_.size() > settings_.statusHistory) {
+            statuses_.erase(statuses_.begin());
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(deliveryMutex_);
+        deliveries_.push_back({id, recipient, std::move(code)});
+    }
+    deliveryReady_.notify_one();
+    return "OK " + std::to_string(id) + "\n";
+}
+
+bool VerificationServer::isValidRecipient(const std::string& recipient) {
+    // The address ends up in an SMTP envelope and message headers: no
+    // whitespace, controls or angle brackets, and exactly one '@' with
+    // something on both sides
+    if (recipient.empty() || recipient.size() > kMaxAddressLength) {
+        return false;
+    }
+    for (unsigned char c : recipient) {
+        if (c <= ' ' || c == 0x7f || c == '<' || c == '>') {
+            return false;
+        }
+    }
+    size_t at = recipient.find('@');
+    return at != std::string::npos && at > 0 && at + 1 < recipient.size() &&
+           recipient.find('@', at + 1) == std::string::npos;
+}
+
+void VerificationServer::deliveryLoop() {
+    while (true) {
+        Delivery delivery;
+        {
+            std::unique_lock<std::mutex> lock(deliveryMutex_);
+            deliveryReady_.wait(lock, [this]() { return stopWorkers_ || !deliveries_.empty(); });
+            if (deliveries_.empty()) {
+                return;
+            }
+            delivery = std::move(deliveries_.front());
+            deliveries_.pop_front();
+        }
+
+        bool sent = sender_ && sender_(delivery.to, delivery.code);
+        if (!sent) {
+            LOG_ERROR("Failed to deliver verification code to " + delivery.to);
+        }
+        setStatus(delivery.id, sent ? DeliveryStatus::Sent : DeliveryStatus::Failed);
+    }
+}
+
+void VerificationServer::setStatus(uint64_t id, DeliveryStatus status) {
+    std::lock_guard<std::mutex> lock(statusMutex_);
+    auto it = statuses_.find(id);
+    if (it != statuses_.end()) {
+        it->second = status;
+    }
+}
+
+VerificationServer::Sender VerificationServer::smtpSender(SmtpConnectionPool& pool) {
+    return [&pool](const std::string& to, const std::string& code) {
+        return pool.sendVerificationCode(to, code);
+    };
+}
+
+std::string VerificationServer::request(const std::string& socketPath, const std::string& line) {
+    sockaddr_un addr;
+    if (!fillSocketAddress(socketPath, addr)) {
+        return "";
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return "";
+    }
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        LOG_ERROR("Verification server: cannot connect to " + socketPath);
+        close(fd);
+        return "";
+    }
+
+    std::string message = line + "\n";
+    send(fd, message.data(), message.size(), MSG_NOSIGNAL);
+
+    std::string response;
+    char chunk[512];
+    while (response.find('\n') == std::string::npos) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            break;
+        }
+        response.append(chunk, n);
+    }
+    close(fd);
+
+    size_t eol = response.find('\n');
+    return eol == std::string::npos ? "" : response.substr(0, eol);
+}
+
+} // namespace Pens
@@ -0,0 +1,203 @@
+#include "verification_service.hpp"
+#include "verification_code.hpp"
+#include "logger.hpp"
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+
+namespace Pens {
+
+namespace {
+
+// Wheel resolution; verify() checks the exact expiry, the wheel only reclaims memory
+const int64_t kWheelTickMs = 1000;
+
+} // namespace
+
+VerificationService::VerificationService(VerificationSettings settings)
+    : settings_(std::move(settings)) {
+    if (settings_.shards == 0) {
+        settings_.shards = 1;
+    }
+    if (settings_.maxAttempts < 1) {
+        settings_.maxAttempts = 1;
+    }
+    shardCapacity_ = std::max<size_t>(1, settings_.maxEntries / settings_.shards);
+
+    if (RAND_bytes(pepper_, sizeof(pepper_)) != 1) {
+        LOG_ERROR("Failed to generate verification pepper");
+    }
+
+    int64_t start = now();
+    shards_.reserve(settings_.shards);
+    for (size_t i = 0; i < settings_.shards; i++) {
+        auto shard = std::make_unique<Shard>();
+        shard->wheel = std::make_unique<TimingWheel<std::string>>(kWheelTickMs, start);
+        shards_.push_back(std::move(shard));
+    }
+}
+
+VerificationService::~VerificationService() {
+    OPENSSL_cleanse(pepper_, sizeof(pepper_));
+}
+
+std::string VerificationService::issue(const std::string& recipient) {
+    std::string code(VerificationCodeGenerator::kCodeLength, '0');
+    if (!VerificationCodeGenerator::generate(&code[0]) || !store(recipient, code)) {
+        return "";
+    }
+    return code;
+}
+
+bool VerificationService::store(const std::string& recipient, const std::string& code) {
+    std::string key = normalize(recipient);
+    Entry entry;
+    if (RAND_bytes(entry.salt, sizeof(entry.salt)) != 1 ||
+        !digest(entry.salt, key, code, entry.digest)) {
+        LOG_ERROR("Failed to hash verification code");
+        return false;
+    }
+    int64_t current = now();
+    entry.expiresAt = current + static_cast<int64_t>(settings_.ttlSeconds) * 1000;
+    entry.attempts = 0;
+
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    sweep(shard, current);
+
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        if (shard.entries.size() >= shardCapacity_) {
+            LOG_WARNING("Verification store full, refusing code for " + key);
+            return false;
+        }
+        shard.entries.emplace(key, entry);
+    } else {
+        it->second = entry;
+    }
+    shard.wheel->schedule(entry.expiresAt, key);
+    return true;
+}
+
+VerifyResult VerificationService::verify(const std::string& recipient, const std::string& code) {
+    std::string key = normalize(recipient);
+    int64_t current = now();
+
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    VerifyResult result = check(shard, key, code, current);
+    // Sweep afterwards so a code that just lapsed reports Expired rather than NotFound
+    sweep(shard, current);
+    return result;
+}
+
+VerifyResult VerificationService::check(Shard& shard, const std::string& key,
+                                        const std::string& code, int64_t now) {
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        return VerifyResult::NotFound;
+    }
+    Entry& entry = it->second;
+    if (entry.expiresAt <= now) {
+        shard.entries.erase(it);
+        return VerifyResult::Expired;
+    }
+
+    unsigned char candidate[32];
+    bool match = digest(entry.salt, key, code, candidate) &&
+                 CRYPTO_memcmp(candidate, entry.digest, sizeof(candidate)) == 0;
+    if (match) {
+        shard.entries.erase(it);
+        return VerifyResult::Ok;
+    }
+
+    if (++entry.attempts >= settings_.maxAttempts) {
+        LOG_WARNING("Too many verification attempts for " + key);
+        shard.entries.erase(it);
+        return VerifyResult::TooManyAttempts;
+    }
+    return VerifyResult::Mismatch;
+}
+
+void VerificationService::purgeExpired() {
+    int64_t current = now();
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        sweep(*shard, current);
+    }
+}
+
+size_t VerificationService::size() const {
+    size_t total = 0;
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->entries.size();
+    }
+    return total;
+}
+
+const char* VerificationService::resultName(VerifyResult result) {
+    switch (result) {
+        case VerifyResult::Ok: return "ok";
+        case VerifyResult::Mismatch: return "mismatch";
+        case VerifyResult::NotFound: return "not_found";
+        case VerifyResult::Expired: return "expired";
+        case VerifyResult::TooManyAttempts: return "too_many_attempts";
+    }
+    return "unknown";
+}
+
+VerificationService::Shard& VerificationService::shardFor(const std::string& key) {
+    return *shards_[std::hash<std::string>()(key) % shards_.size()];
+}
+
+void VerificationService::sweep(Shard& shard, int64_t now) {
+    shard.expired.clear();
+    shard.wheel->advance(now, shard.expired);
+    for (const auto& key : shard.expired) {
+        // A re-issued code leaves its old timer behind; only drop entries that are really due
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end() && it->second.expiresAt <= now) {
+            shard.entries.erase(it);
+        }
+    }
+}
+
+bool VerificationService::digest(const unsigned char* salt, const std::string& key,
+                                 const std::string& code, unsigned char* out) const {
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    if (!ctx) {
+        return false;
+    }
+    unsigned int length = 0;
+    bool ok = EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) == 1 &&
+              EVP_DigestUpdate(ctx, pepper_, sizeof(pepper_)) == 1 &&
+              EVP_DigestUpdate(ctx, salt, 16) == 1 &&
+              EVP_DigestUpdate(ctx, key.data(), key.size()) == 1 &&
+              EVP_DigestUpdate(ctx, "\0", 1) == 1 &&
+              EVP_DigestUpdate(ctx, code.data(), code.size()) == 1 &&
+              EVP_DigestFinal_ex(ctx, out, &length) == 1 &&
+              length == 32;
+    EVP_MD_CTX_free(ctx);
+    return ok;
+}
+
+int64_t VerificationService::now() const {
+    if (settings_.clock) {
+        return settings_.clock();
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::string VerificationService::normalize(const std::string& recipient) {
+    std::string key = recipient;
+    std::transform(key.begin(), key.end(), key.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return key;
+}
+
+} // namespace Pens
@@ -0,0 +1,171 @@
+/**
+ * Unit Tests for the coroutine primitives and the async IMAP client
+ */
+
+#include "catch.hpp"
+#include "../include/async_imap_client.hpp"
+#include "../include/async_task.hpp"
+#include "../include/io_executor.hpp"
+#include "test_helpers.hpp"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Pens;
+
+namespace {
+
+Task<int> answer() {
+    co_return 42;
+}
+
+Task<int> doubled() {
+    int value = co_await answer();
+    co_return value * 2;
+}
+
+AsyncGenerator<int> countTo(int limit) {
+    for (int i = 1; i <= limit; i++) {
+        co_yield i;
+    }
+}
+
+Task<int> sumOf(AsyncGenerator<int> numbers) {
+    int sum = 0;
+    while (auto value = co_await numbers.next()) {
+        sum += *value;
+    }
+    co_return sum;
+}
+
+Task<std::vector<Email>> fetchAll(AsyncImapClient& client, std::string uidSet) {
+    std::vector<Email> emails;
+    auto stream = client.fetch(uidSet);
+    while (auto email = co_await stream.next()) {
+        emails.push_back(std::move(*email));
+    }
+    co_return emails;
+}
+
+Task<bool> openSession(AsyncImapClient& client) {
+    co_return co_await client.connect() &&
+              co_await client.authenticate("user@test.com", "secret") &&
+              co_await client.selectMailbox("INBOX");
+}
+
+} // namespace
+
+TEST_CASE("Tasks and generators compose", "[async]") {
+    REQUIRE(syncWait(doubled()) == 84);
+    REQUIRE(syncWait(sumOf(countTo(10))) == 55);
+    REQUIRE(syncWait(sumOf(countTo(0))) == 0);
+
+    IoExecutor executor(2);
+    auto sleeper = [&executor]() -> Task<int64_t> {
+        auto start = std::chrono::steady_clock::now();
+        co_await executor.sleepFor(30);
+        co_return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    };
+    REQUIRE(syncWait(sleeper()) >= 30);
+
+    // A read wait with nothing to read times out with false
+    int pair[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    auto waitFor = [&executor](int fd, int timeoutMs) -> Task<bool> {
+        co_return co_await executor.readable(fd, timeoutMs);
+    };
+    REQUIRE_FALSE(syncWait(waitFor(pair[0], 20)));
+    REQUIRE(write(pair[1], "x", 1) == 1);
+    REQUIRE(syncWait(waitFor(pair[0], 1000)));
+    executor.forget(pair[0]);
+    close(pair[0]);
+    close(pair[1]);
+}
+
+TEST_CASE("Async IMAP client runs a session", "[async][imap]") {
+    PensTest::MockImapServer server;
+    server.addMessage("alice@test.com", "First", "hello\r\n");
+    server.addMessage("bob@test.com", "Second", "A0005 OK not really done\r\n* BYE nope\r\n");
+    server.addMessage("carol@test.com", "Third", "bye\r\n");
+
+    IoExecutor executor(2);
+    AsyncImapClient client(executor, "127.0.0.1", server.port(), false);
+    REQUIRE(syncWait(openSession(client)));
+    REQUIRE(client.getUidValidity() == 1);
+    REQUIRE(syncWait(client.searchUidsAfter(1)) == std::vector<uint32_t>{2, 3});
+
+    SECTION("Messages stream out of one FETCH") {
+        std::vector<Email> emails = syncWait(fetchAll(client, "1:*"));
+        REQUIRE(emails.size() == 3);
+        REQUIRE(emails[0].id == "1");
+        REQUIRE(emails[1].subject.find("Second") != std::string::npos);
+        REQUIRE(emails[2].from.find("carol") != std::string::npos);
+        REQUIRE(syncWait(client.noop()));
+    }
+
+    SECTION("A stream dropped halfway closes the session") {
+        auto firstOnly = [&client]() -> Task<std::string> {
+            auto stream = client.fetch("1:*");
+            auto email = co_await stream.next();
+            co_return email ? email->id : "";
+        };
+        REQUIRE(syncWait(firstOnly()) == "1");
+        REQUIRE_FALSE(syncWait(client.noop()));
+        REQUIRE_FALSE(client.isConnected());
+    }
+
+    SECTION("A silent server times the command out") {
+        ImapTimeouts timeouts;
+        timeouts.commandSeconds = 1;
+        client.setTimeouts(timeouts);
+        server.setStalled(true);
+        auto start = std::chrono::steady_clock::now();
+        REQUIRE_FALSE(syncWait(client.noop()));
+        REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+        REQUIRE_FALSE(client.isConnected());
+        server.setStalled(false);
+    }
+
+    syncWait(client.logout());
+    REQUIRE_FALSE(client.isConnected());
+}
+
+TEST_CASE("Async IMAP sessions share a few threads", "[async][imap]") {
+    PensTest::MockImapServer server;
+    server.addMessage("alice@test.com", "First", "hello\r\n");
+    server.addMessage("bob@test.com", "Second", "world\r\n");
+
+    const int sessions = 50;
+    IoExecutor executor(2);
+    std::atomic<int> fetched{0};
+    std::atomic<int> finished{0};
+    std::vector<std::unique_ptr<AsyncImapClient>> clients;
+    for (int i = 0; i < sessions; i++) {
+        clients.push_back(std::make_unique<AsyncImapClient>(executor, "127.0.0.1", server.port(), false));
+    }
+
+    auto session = [&](AsyncImapClient& client) -> Task<void> {
+        if (co_await openSession(client)) {
+            std::vector<Email> emails = co_await fetchAll(client, "1:*");
+            fetched += static_cast<int>(emails.size());
+            co_await client.logout();
+        }
+        finished++;
+    };
+    for (auto& client : clients) {
+        executor.spawn(session(*client));
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+    while (finished.load() < sessions && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    REQUIRE(finished.load() == sessions);
+    REQUIRE(fetched.load() == 2 * sessions);
+    REQUIRE(server.accepted() == sessions);
+    REQUIRE(executor.threadCount() == 2);
+}
@@ -22,6 +22,7 @@ TEST_CASE("Config loading from file", "[config]") {
         file << "imap_password = testpass123\n";
         file << "check_interval = 30\n";
         file << "imap_use_ssl = true\n";
+        file << "imap_kernel_tls = false\n";
         file.close();
 
         Config& config = Config::getInstance();
@@ -34,6 +35,7 @@ TEST_CASE("Config loading from file", "[config]") {
         REQUIRE(config.getImapPassword() == "testpass123");
         REQUIRE(config.getCheckInterval() == 30);
         REQUIRE(config.getImapUseSsl() == true);
+        REQUIRE(config.getImapKernelTls() == false);
         
         std::remove(testConfigFile);
     }
@@ -79,6 +81,28 @@ TEST_CASE("Config loading from file", "[config]") {
         
         std::remove(testConfigFile);
     }
+
+    SECTION("Verification API configuration") {
+        std::ofstream file(testConfigFile);
+        file << "verification_socket = /tmp/pens-verify.sock\n";
+        file << "verification_workers = 2\n";
+        file << "smtp_server = smtp.test.com\n";
+        file << "smtp_port = 465\n";
+        file.close();
+
+        Config& config = Config::getInstance();
+        REQUIRE(config.loadFromFile(testConfigFile));
+        REQUIRE(config.getVerificationSocket() == "/tmp/pens-verify.sock");
+        REQUIRE(config.getVerificationWorkers() == 2);
+        REQUIRE(config.getVerificationBudgetMs() == 50);
+        REQUIRE(config.getSmtpServer() == "smtp.test.com");
+        REQUIRE(config.getSmtpPort() == 465);
+        // SMTP credentials fall back to the IMAP account's
+        REQUIRE(config.getSmtpUsername() == config.getImapUsername());
+        REQUIRE(config.getSmtpPassword() == config.getImapPassword());
+        
+        std::remove(testConfigFile);
+    }
 }
 
 TEST_CASE("Config values", "[config]") {
@@ -0,0 +1,162 @@
+/**
+ * Unit Tests for Credential Cache Module
+ */
+
+#include "catch.hpp"
+#include "../include/credential_cache.hpp"
+#include "../include/oauth_helper.hpp"
+#include <openssl/bio.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/rsa.h>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <chrono>
+
+using namespace Pens;
+
+namespace {
+
+// Write a fresh RSA key and matching self-signed certificate as PEM files
+void writeTestCredentials(const char* keyPath, const char* certPath, const char* commonName) {
+    EVP_PKEY* key = EVP_RSA_gen(2048);
+    REQUIRE(key != nullptr);
+
+    X509* cert = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               reinterpret_cast<const unsigned char*>(commonName), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_sign(cert, key, EVP_sha256());
+
+    FILE* keyFile = fopen(keyPath, "w");
+    PEM_write_PrivateKey(keyFile, key, nullptr, nullptr, 0, nullptr, nullptr);
+    fclose(keyFile);
+
+    FILE* certFile = fopen(certPath, "w");
+    PEM_write_X509(certFile, cert);
+    fclose(certFile);
+
+    X509_free(cert);
+    EVP_PKEY_free(key);
+}
+
+// PEM text of a fresh RSA key whose encoding is exactly length bytes long
+std::string rsaKeyPem(size_t length, std::shared_ptr<EVP_PKEY>& key) {
+    while (true) {
+        key.reset(EVP_RSA_gen(2048), EVP_PKEY_free);
+        BIO* bio = BIO_new(BIO_s_mem());
+        PEM_write_bio_PrivateKey(bio, key.get(), nullptr, nullptr, 0, nullptr, nullptr);
+        char* data = nullptr;
+        long size = BIO_get_mem_data(bio, &data);
+        std::string pem(data, static_cast<size_t>(size));
+        BIO_free(bio);
+        if (length == 0 || pem.size() == length) {
+            return pem;
+        }
+    }
+}
+
+void writeFile(const char* path, const std::string& content) {
+    FILE* file = fopen(path, "w");
+    fwrite(content.data(), 1, content.size(), file);
+    fclose(file);
+}
+
+} // namespace
+
+TEST_CASE("Credential cache loads files once", "[credentials]") {
+    const char* keyPath = "test_cache_key.tmp";
+    const char* certPath = "test_cache_cert.tmp";
+    writeTestCredentials(keyPath, certPath, "pens-test");
+
+    CredentialCache& cache = CredentialCache::getInstance();
+    cache.clear();
+    cache.setFileCheckInterval(0);
+
+    SECTION("Thumbprint matches uncached calculation") {
+        std::string expected = OAuthHelper::calculateCertificateThumbprint(certPath);
+        REQUIRE(!expected.empty());
+        REQUIRE(cache.getCertificateThumbprint(certPath) == expected);
+        REQUIRE(cache.getCertificateThumbprint(certPath) == expected);
+        REQUIRE(cache.getFileLoadCount() == 1);
+    }
+
+    SECTION("Private key is shared between callers") {
+        auto first = cache.getPrivateKey(keyPath);
+        auto second = cache.getPrivateKey(keyPath);
+        REQUIRE(first != nullptr);
+        REQUIRE(first == second);
+        REQUIRE(cache.getFileLoadCount() == 1);
+    }
+
+    SECTION("Assertion is reused until the margin") {
+        std::string first = cache.getClientAssertion("client", "tenant", certPath, keyPath);
+        std::string second = cache.getClientAssertion("client", "tenant", certPath, keyPath);
+        REQUIRE(!first.empty());
+        REQUIRE(first == second);
+        REQUIRE(cache.getSignatureCount() == 1);
+
+        // Different audience gets its own assertion
+        std::string other = cache.getClientAssertion("client", "other-tenant", certPath, keyPath);
+        REQUIRE(other != first);
+        REQUIRE(cache.getSignatureCount() == 2);
+
+        // A margin larger than the lifetime forces a re-sign
+        cache.setAssertionReuseMargin(7200);
+        std::string third = cache.getClientAssertion("client", "tenant", certPath, keyPath);
+        REQUIRE(third != first);
+        REQUIRE(cache.getSignatureCount() == 3);
+        cache.setAssertionReuseMargin(300);
+    }
+
+    SECTION("Rotated credentials invalidate cached assertion") {
+        std::string before = cache.getClientAssertion("client", "tenant", certPath, keyPath);
+        std::string thumbBefore = cache.getCertificateThumbprint(certPath);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        writeTestCredentials(keyPath, certPath, "pens-rotated");
+
+        std::string thumbAfter = cache.getCertificateThumbprint(certPath);
+        std::string after = cache.getClientAssertion("client", "tenant", certPath, keyPath);
+        REQUIRE(thumbAfter != thumbBefore);
+        REQUIRE(after != before);
+        REQUIRE(cache.getSignatureCount() == 2);
+    }
+
+    SECTION("Same-size rewrites in place are noticed at once") {
+        // Rewritten straight after each load, usually inside one timestamp
+        // tick, keeping inode and size
+        std::shared_ptr<EVP_PKEY> key;
+        std::string pem = rsaKeyPem(0, key);
+        writeFile(keyPath, pem);
+        for (int i = 0; i < 5; i++) {
+            auto loaded = cache.getPrivateKey(keyPath);
+            REQUIRE(loaded != nullptr);
+            REQUIRE(EVP_PKEY_eq(loaded.get(), key.get()) == 1);
+            writeFile(keyPath, rsaKeyPem(pem.size(), key));
+        }
+        REQUIRE(EVP_PKEY_eq(cache.getPrivateKey(keyPath).get(), key.get()) == 1);
+        size_t loads = cache.getFileLoadCount();
+        // An unchanged file is not reloaded, even while it is still recent
+        REQUIRE(cache.getPrivateKey(keyPath) != nullptr);
+        REQUIRE(cache.getFileLoadCount() == loads);
+    }
+
+    SECTION("Missing files yield empty results") {
+        REQUIRE(cache.getPrivateKey("missing_key.tmp") == nullptr);
+        REQUIRE(cache.getCertificateThumbprint("missing_cert.tmp").empty());
+        REQUIRE(cache.getClientAssertion("client", "tenant", "missing_cert.tmp", keyPath).empty());
+    }
+
+    cache.setFileCheckInterval(1);
+    cache.clear();
+    std::remove(keyPath);
+    std::remove(certPath);
+}
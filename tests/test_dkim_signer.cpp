@@ -0,0 +1,195 @@
+/**
+ * Unit Tests for DKIM Signing
+ */
+
+#include "catch.hpp"
+#include "../include/credential_cache.hpp"
+#include "../include/dkim_signer.hpp"
+#include "../include/smtp_client.hpp"
+#include "test_helpers.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+using namespace Pens;
+
+namespace {
+
+const char kKeyPath[] = "test_dkim_key.pem";
+
+// Writes a fresh RSA key and returns it for verification. Keys replace each
+// other in place within milliseconds, so the credential cache must check
+// the file on every use.
+std::shared_ptr<EVP_PKEY> writeTestKey() {
+    CredentialCache::getInstance().setFileCheckInterval(0);
+    EVP_PKEY* key = EVP_RSA_gen(2048);
+    FILE* file = std::fopen(kKeyPath, "w");
+    PEM_write_PrivateKey(file, key, nullptr, nullptr, 0, nullptr, nullptr);
+    std::fclose(file);
+    return std::shared_ptr<EVP_PKEY>(key, EVP_PKEY_free);
+}
+
+std::string sha256Base64(const std::string& data) {
+    unsigned char digest[32];
+    unsigned int length = 0;
+    EVP_Digest(data.data(), data.size(), digest, &length, EVP_sha256(), nullptr);
+    unsigned char encoded[64];
+    int written = EVP_EncodeBlock(encoded, digest, length);
+    return std::string(reinterpret_cast<char*>(encoded), written);
+}
+
+std::string hashBody(const std::vector<std::string>& pieces) {
+    DkimBodyHash hash;
+    for (const auto& piece : pieces) {
+        hash.update(piece);
+    }
+    return hash.finish();
+}
+
+std::string tagValue(const std::string& header, const std::string& tag) {
+    size_t start = header.find("; " + tag + "=");
+    REQUIRE(start != std::string::npos);
+    start += tag.size() + 3;
+    size_t end = header.find_first_of(";\r", start);
+    return header.substr(start, end - start);
+}
+
+} // namespace
+
+TEST_CASE("DKIM relaxed body canonicalization", "[dkim]") {
+    SECTION("Empty body") {
+        REQUIRE(hashBody({}) == "47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=");
+        REQUIRE(hashBody({"\r\n\r\n"}) == "47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=");
+    }
+
+    SECTION("RFC 6376 example") {
+        REQUIRE(hashBody({" C \r\nD \t E\r\n\r\n\r\n"}) == sha256Base64(" C\r\nD E\r\n"));
+    }
+
+    SECTION("Missing final line break is added") {
+        REQUIRE(hashBody({"last line"}) == sha256Base64("last line\r\n"));
+    }
+
+    SECTION("Bare LF and arbitrary splits hash the same") {
+        std::string body = "Hello  world \n\n  indented\r\n\r\nend\t\n\n";
+        std::string expected = sha256Base64("Hello world\r\n\r\n indented\r\n\r\nend\r\n");
+        REQUIRE(hashBody({body}) == expected);
+
+        std::vector<std::string> characters;
+        for (char c : body) {
+            characters.push_back(std::string(1, c));
+        }
+        REQUIRE(hashBody(characters) == expected);
+    }
+
+    SECTION("Long bodies") {
+        std::string body;
+        for (int i = 0; i < 2000; i++) {
+            body += "line " + std::to_string(i) + "\r\n";
+        }
+        REQUIRE(hashBody({body}) == sha256Base64(body));
+    }
+}
+
+TEST_CASE("DKIM relaxed header canonicalization", "[dkim]") {
+    REQUIRE(DkimSigner::canonicalizeHeader("A: X") == "a:X");
+    REQUIRE(DkimSigner::canonicalizeHeader("B : Y\t\r\n\tZ  ") == "b:Y Z");
+    REQUIRE(DkimSigner::canonicalizeHeader("SUBJect:   two   words ") == "subject:two words");
+}
+
+TEST_CASE("DKIM signatures verify", "[dkim]") {
+    std::shared_ptr<EVP_PKEY> key = writeTestKey();
+    DkimSettings settings;
+    settings.domain = "example.com";
+    settings.selector = "mail";
+    settings.privateKeyPath = kKeyPath;
+    DkimSigner signer(settings);
+
+    // Headers split across pieces, as a rendered template lays them out
+    std::string body = "Your code is 123456.\n\n.leading dot\n";
+    MessageWriter writer(MessageWriter::Mode::Data);
+    writer.appendBody("From: Sender <sender@example.com>\r\nTo: ");
+    writer.appendBody("user@example.org");
+    writer.appendBody("\r\nSubject:  Your\r\n  code\r\nX-Unsigned: yes\r\n\r\n");
+    writer.appendBody(body);
+    REQUIRE(signer.sign(writer, 1700000000));
+
+    std::string wire;
+    for (const auto& segment : writer.segments()) {
+        wire.append(static_cast<const char*>(segment.iov_base), segment.iov_len);
+    }
+    REQUIRE(wire.compare(0, 16, "DKIM-Signature: ") == 0);
+    std::string header = wire.substr(0, wire.find("\r\n"));
+    REQUIRE(tagValue(header, "h") == "from:to:subject");
+    REQUIRE(tagValue(header, "t") == "1700000000");
+    REQUIRE(tagValue(header, "bh") == sha256Base64("Your code is 123456.\r\n\r\n.leading dot\r\n"));
+    // Dot-stuffing is applied on the wire only
+    REQUIRE(wire.find("\r\n..leading dot\r\n") != std::string::npos);
+
+    std::string signature = tagValue(header, "b");
+    std::string data = "from:Sender <sender@example.com>\r\n"
+                       "to:user@example.org\r\n"
+                       "subject:Your code\r\n" +
+                       DkimSigner::canonicalizeHeader(header.substr(0, header.size() - signature.size()));
+
+    std::vector<unsigned char> raw(signature.size());
+    int rawLength = EVP_DecodeBlock(raw.data(), reinterpret_cast<const unsigned char*>(signature.data()),
+                                    static_cast<int>(signature.size()));
+    REQUIRE(rawLength >= 256);
+
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    REQUIRE(EVP_DigestVerifyInit(ctx, nullptr, EVP_sha256(), nullptr, key.get()) == 1);
+    int verified = EVP_DigestVerify(ctx, raw.data(), 256,
+                                    reinterpret_cast<const unsigned char*>(data.data()), data.size());
+    EVP_MD_CTX_free(ctx);
+    REQUIRE(verified == 1);
+
+    SECTION("Signing again replaces the previous signature") {
+        REQUIRE(signer.sign(writer, 1700000001));
+        std::string again;
+        for (const auto& segment : writer.segments()) {
+            again.append(static_cast<const char*>(segment.iov_base), segment.iov_len);
+        }
+        REQUIRE(again.find("DKIM-Signature", 1) == std::string::npos);
+        REQUIRE(again.find("t=1700000001") != std::string::npos);
+    }
+
+    SECTION("A missing key leaves the message unsigned") {
+        DkimSettings broken = settings;
+        broken.privateKeyPath = "missing_dkim_key.pem";
+        DkimSigner failing(broken);
+        REQUIRE_FALSE(failing.sign(writer));
+        REQUIRE(writer.segments().size() > 0);
+        REQUIRE(std::string(static_cast<const char*>(writer.segments()[0].iov_base), 5) == "From:");
+    }
+
+    CredentialCache::getInstance().setFileCheckInterval(1);
+    std::remove(kKeyPath);
+}
+
+TEST_CASE("SMTP client signs outgoing mail", "[dkim]") {
+    writeTestKey();
+    DkimSettings settings;
+    settings.domain = "test.com";
+    settings.selector = "s1";
+    settings.privateKeyPath = kKeyPath;
+    DkimSigner signer(settings);
+
+    PensTest::MockSmtpServer server({"PIPELINING", "CHUNKING"});
+    SmtpClient client("127.0.0.1", server.port(), false);
+    client.setDkimSigner(&signer);
+    REQUIRE(client.connect());
+    REQUIRE(client.authenticate("sender@test.com", "secret"));
+    REQUIRE(client.sendVerificationCode("user@test.com", "654321"));
+
+    std::vector<std::string> messages = server.messages();
+    REQUIRE(messages.size() == 1);
+    REQUIRE(messages[0].compare(0, 16, "DKIM-Signature: ") == 0);
+    REQUIRE(messages[0].find("d=test.com; s=s1;") != std::string::npos);
+    REQUIRE(messages[0].find("h=from:to:subject:date:mime-version:content-type;") != std::string::npos);
+    client.disconnect();
+    CredentialCache::getInstance().setFileCheckInterval(1);
+    std::remove(kKeyPath);
+}
@@ -0,0 +1,471 @@
+/**
+ * Unit Tests for parallel multi-folder monitoring
+ */
+
+#include "catch.hpp"
+#include "../include/folder_monitor.hpp"
+#include "test_helpers.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Pens;
+
+namespace {
+
+const char kStatePath[] = "test_folder_monitor_state.tmp";
+
+FolderMonitor::ConnectionFactory connectTo(PensTest::MockImapServer& server) {
+    return [&server]() {
+        auto client = std::make_shared<ImapClient>("127.0.0.1", server.port(), false);
+        if (!client->connect() || !client->authenticate("user@test.com", "secret")) {
+            return std::shared_ptr<ImapClient>();
+        }
+        return client;
+    };
+}
+
+size_t fetchCount(const PensTest::MockImapServer& server) {
+    std::vector<std::string> commands = server.commands();
+    return static_cast<size_t>(std::count_if(commands.begin(), commands.end(), [](const std::string& c) {
+        return c.compare(0, 10, "UID FETCH ") == 0;
+    }));
+}
+
+bool waitFor(const std::function<bool()>& condition, int timeoutMs = 5000) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+}
+
+std::string subjectOf(const FolderEmail& entry) {
+    std::string subject = entry.email.subject;
+    subject.erase(0, subject.find_first_not_of(' '));
+    subject.erase(subject.find_last_not_of("\r ") + 1);
+    return subject;
+}
+
+} // namespace
+
+TEST_CASE("Folders are spread over connections by activity", "[imap][folders]") {
+    auto assignment = FolderMonitor::assignByActivity(
+        {{"INBOX", 9.0}, {"Work", 4.0}, {"Lists", 3.0}, {"Archive", 0.0}, {"Spam", 0.0}}, 2);
+    REQUIRE(assignment.size() == 2);
+    REQUIRE(assignment[0] == std::vector<std::string>{"INBOX", "Spam"});
+    REQUIRE(assignment[1] == std::vector<std::string>{"Work", "Lists", "Archive"});
+
+    // Never more connections than folders
+    REQUIRE(FolderMonitor::assignByActivity({{"INBOX", 0.0}}, 4).size() == 1);
+    REQUIRE(FolderMonitor::assignByActivity({}, 4).empty());
+}
+
+TEST_CASE("Folder monitor scans many folders over a bounded pool", "[imap][folders]") {
+    PensTest::MockImapServer server;
+    std::vector<std::string> folders = {"INBOX", "Work", "Lists", "Archive", "Spam", "Travel"};
+    for (const auto& folder : folders) {
+        server.addFolder(folder);
+    }
+    // Arrival times interleave across folders
+    long when = 1700000000;
+    for (int round = 0; round < 3; round++) {
+        for (const auto& folder : folders) {
+            server.addMessage("a@test.com", folder + std::to_string(round), "x\r\n", folder, when++);
+        }
+    }
+
+    FolderMonitorSettings settings;
+    settings.folders = folders;
+    settings.maxConnections = 2;
+    settings.pollIntervalMs = 60 * 1000;
+    FolderMonitor monitor(settings, connectTo(server));
+    REQUIRE(monitor.assignments().size() == 2);
+
+    monitor.start();
+    REQUIRE(waitFor([&server]() { return fetchCount(server) == 18; }));
+    monitor.stop();
+
+    std::vector<FolderEmail> emails = monitor.take();
+    REQUIRE(emails.size() == 18);
+    for (size_t i = 0; i < emails.size(); i++) {
+        // One stream, oldest first, whatever connection found it
+        REQUIRE(subjectOf(emails[i]) == emails[i].folder + std::to_string(i / folders.size()));
+        REQUIRE(emails[i].email.internalDate == 1700000000 + static_cast<long>(i));
+    }
+    REQUIRE(server.accepted() == 2);
+    REQUIRE(server.peakSessions() <= 2);
+}
+
+TEST_CASE("Folder monitor IDLEs when a connection has one folder", "[imap][folders]") {
+    PensTest::MockImapServer server;
+    server.addFolder("Work");
+
+    FolderMonitorSettings settings;
+    settings.folders = {"INBOX", "Work"};
+    settings.pollIntervalMs = 60 * 1000;
+    FolderMonitor monitor(settings, connectTo(server));
+    monitor.start();
+
+    REQUIRE(waitFor([&server]() {
+        std::vector<std::string> commands = server.commands();
+        return std::count(commands.begin(), commands.end(), "IDLE") == 2;
+    }));
+
+    // Pushed by the server long before the next poll would have found it
+    server.addMessage("a@test.com", "urgent", "x\r\n", "Work");
+    auto start = std::chrono::steady_clock::now();
+    std::vector<FolderEmail> emails = monitor.take(5000);
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+    REQUIRE(emails.size() == 1);
+    REQUIRE(emails[0].folder == "Work");
+    REQUIRE(subjectOf(emails[0]) == "urgent");
+
+    // stop() breaks out of IDLE
+    start = std::chrono::steady_clock::now();
+    monitor.stop();
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+}
+
+TEST_CASE("Folder monitor hands an IDLE folder over on rebalance", "[imap][folders]") {
+    PensTest::MockImapServer server;
+    server.addFolder("Work");
+
+    FolderMonitorSettings settings;
+    settings.folders = {"INBOX", "Work"};
+    settings.pollIntervalMs = 60 * 1000;
+    settings.idleTimeoutMs = 60 * 1000;
+    settings.rebalanceIntervalMs = 50;
+    FolderMonitor monitor(settings, connectTo(server));
+    REQUIRE(monitor.assignments() == std::vector<std::vector<std::string>>{{"INBOX"}, {"Work"}});
+    monitor.start();
+    auto idles = [&server]() {
+        std::vector<std::string> commands = server.commands();
+        return std::count(commands.begin(), commands.end(), "IDLE");
+    };
+    REQUIRE(waitFor([&]() { return idles() >= 2; }));
+
+    // Mail makes Work the busier folder, so the connections swap folders;
+    // both leave IDLE well before idleTimeout to do it
+    for (int i = 0; i < 3; i++) {
+        server.addMessage("a@test.com", "work" + std::to_string(i), "x\r\n", "Work");
+    }
+    REQUIRE(waitFor([&monitor]() {
+        return monitor.assignments() == std::vector<std::vector<std::string>>{{"Work"}, {"INBOX"}};
+    }));
+    std::vector<FolderEmail> emails = monitor.take(5000);
+    while (emails.size() < 3) {
+        std::vector<FolderEmail> more = monitor.take(5000);
+        if (more.empty()) {
+            break;
+        }
+        emails.insert(emails.end(), more.begin(), more.end());
+    }
+    REQUIRE(emails.size() == 3);
+
+    // The new owner IDLEs on Work and still gets its mail pushed, once
+    server.addMessage("a@test.com", "after", "x\r\n", "Work");
+    emails = monitor.take(5000);
+    REQUIRE(emails.size() == 1);
+    REQUIRE(subjectOf(emails[0]) == "after");
+    REQUIRE(fetchCount(server) == 4);
+    monitor.stop();
+    REQUIRE(monitor.take().empty());
+}
+
+TEST_CASE("Folder monitor delivers once while folders move between connections", "[imap][folders]") {
+    PensTest::MockImapServer server;
+    std::vector<std::string> folders = {"INBOX", "Work", "Lists", "Archive"};
+    for (const auto& folder : folders) {
+        server.addFolder(folder);
+    }
+
+    FolderMonitorSettings settings;
+    settings.folders = folders;
+    settings.maxConnections = 2;
+    settings.pollIntervalMs = 5;
+    settings.rebalanceIntervalMs = 5;
+    settings.initialBacklog = 1000;
+    FolderMonitor monitor(settings, connectTo(server));
+    monitor.start();
+
+    // Bursts move from folder to folder, so the assignment keeps changing
+    const int total = 200;
+    std::thread feeder([&server, &folders]() {
+        std::mt19937 rng(7);
+        for (int i = 0; i < total; i++) {
+            const std::string& folder = folders[(i / 20 + rng() % 2) % folders.size()];
+            server.addMessage("a@test.com", "m" + std::to_string(i), "x\r\n", folder);
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    });
+
+    std::vector<FolderEmail> emails;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (emails.size() < static_cast<size_t>(total) && std::chrono::steady_clock::now() < deadline) {
+        std::vector<FolderEmail> more = monitor.take(100);
+        emails.insert(emails.end(), more.begin(), more.end());
+    }
+    feeder.join();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::vector<FolderEmail> late = monitor.take();
+    emails.insert(emails.end(), late.begin(), late.end());
+    monitor.stop();
+
+    std::set<std::pair<std::string, uint32_t>> seen;
+    for (const auto& email : emails) {
+        REQUIRE(seen.insert({email.folder, email.uid}).second);
+    }
+    REQUIRE(emails.size() == static_cast<size_t>(total));
+    REQUIRE(fetchCount(server) == static_cast<size_t>(total));
+}
+
+TEST_CASE("Folder monitor resumes every folder from its watermark", "[imap][folders]") {
+    std::remove(kStatePath);
+    PensTest::MockImapServer server;
+    server.addFolder("Work");
+    server.addMessage("a@test.com", "old inbox", "x\r\n", "INBOX");
+    server.addMessage("a@test.com", "old work", "x\r\n", "Work");
+
+    FolderMonitorSettings settings;
+    settings.folders = {"INBOX", "Work"};
+    settings.maxConnections = 1;
+    settings.statePath = kStatePath;
+    {
+        FolderMonitor monitor(settings, connectTo(server));
+        monitor.start();
+        REQUIRE(waitFor([&server]() { return fetchCount(server) == 2; }));
+        monitor.stop();
+        std::vector<FolderEmail> handled = monitor.take();
+        REQUIRE(handled.size() == 2);
+        monitor.commit(handled);
+    }
+
+    server.addMessage("a@test.com", "new work", "x\r\n", "Work");
+    server.resetUidValidity(9, "INBOX");
+
+    FolderMonitor restarted(settings, connectTo(server));
+    restarted.start();
+    std::vector<FolderEmail> emails;
+    REQUIRE(waitFor([&]() {
+        for (auto& email : restarted.take()) {
+            emails.push_back(email);
+        }
+        return emails.size() >= 2;
+    }));
+    restarted.stop();
+
+    // Work continues after its watermark; INBOX changed epoch and resyncs
+    std::vector<std::string> seen;
+    for (const auto& email : emails) {
+        seen.push_back(email.folder + ":" + subjectOf(email));
+    }
+    std::sort(seen.begin(), seen.end());
+    REQUIRE(seen == std::vector<std::string>{"INBOX:old inbox", "Work:new work"});
+    std::remove(kStatePath);
+}
+
+TEST_CASE("Folder mail taken but never committed is delivered again", "[imap][folders]") {
+    std::remove(kStatePath);
+    PensTest::MockImapServer server;
+    server.addFolder("Work");
+
+    FolderMonitorSettings settings;
+    settings.folders = {"INBOX", "Work"};
+    settings.maxConnections = 1;
+    settings.pollIntervalMs = 50;
+    settings.statePath = kStatePath;
+
+    // Both folders are synced empty, then mail arrives and is taken but
+    // the process dies before handling it
+    {
+        FolderMonitor monitor(settings, connectTo(server));
+        monitor.start();
+        REQUIRE(waitFor([]() {
+            std::ifstream state(kStatePath);
+            std::string line;
+            int lines = 0;
+            while (std::getline(state, line)) {
+                lines++;
+            }
+            return lines == 2;
+        }));
+        server.addMessage("a@test.com", "inbox mail", "x\r\n", "INBOX");
+        server.addMessage("a@test.com", "work mail", "x\r\n", "Work");
+        std::vector<FolderEmail> taken;
+        REQUIRE(waitFor([&]() {
+            for (auto& email : monitor.take()) {
+                taken.push_back(email);
+            }
+            return taken.size() >= 2;
+        }));
+        monitor.stop();
+    }
+
+    auto drain = [&](FolderMonitor& monitor, size_t expected) {
+        std::vector<FolderEmail> emails;
+        waitFor([&]() {
+            for (auto& email : monitor.take()) {
+                emails.push_back(email);
+            }
+            return emails.size() >= expected;
+        }, expected ? 5000 : 300);
+        return emails;
+    };
+
+    // Restarted, both come back; this time they are committed
+    {
+        FolderMonitor restarted(settings, connectTo(server));
+        restarted.start();
+        std::vector<FolderEmail> emails = drain(restarted, 2);
+        restarted.stop();
+        std::vector<std::string> seen;
+        for (const auto& email : emails) {
+            seen.push_back(email.folder + ":" + subjectOf(email));
+        }
+        std::sort(seen.begin(), seen.end());
+        REQUIRE(seen == std::vector<std::string>{"INBOX:inbox mail", "Work:work mail"});
+        restarted.commit(emails);
+    }
+
+    FolderMonitor again(settings, connectTo(server));
+    again.start();
+    std::vector<FolderEmail> emails = drain(again, 0);
+    again.stop();
+    REQUIRE(emails.empty());
+    std::remove(kStatePath);
+}
+
+TEST_CASE("Folder monitor watches every folder on one NOTIFY session", "[imap][folders][notify]") {
+    PensTest::MockImapServer server({"NOTIFY"});
+    std::vector<std::string> folders = {"INBOX", "Work", "Lists", "Archive", "Spam", "Travel"};
+    for (const auto& folder : folders) {
+        server.addFolder(folder);
+    }
+
+    FolderMonitorSettings settings;
+    settings.folders = folders;
+    settings.pollIntervalMs = 60 * 1000;
+    FolderMonitor monitor(settings, connectTo(server));
+    monitor.start();
+
+    auto selects = [&server]() {
+        std::vector<std::string> commands = server.commands();
+        return std::count_if(commands.begin(), commands.end(), [](const std::string& c) {
+            return c.compare(0, 7, "SELECT ") == 0;
+        });
+    };
+    // Every folder is synced once, then the session waits for events
+    REQUIRE(waitFor([&]() { return selects() == 6; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(monitor.usingNotify());
+
+    server.addMessage("a@test.com", "travel plans", "x\r\n", "Travel");
+    server.addMessage("a@test.com", "spam", "x\r\n", "Spam");
+    std::vector<FolderEmail> emails;
+    REQUIRE(waitFor([&]() {
+        for (auto& email : monitor.take()) {
+            emails.push_back(email);
+        }
+        return emails.size() >= 2;
+    }));
+    monitor.stop();
+
+    std::vector<std::string> seen;
+    for (const auto& email : emails) {
+        seen.push_back(email.folder);
+    }
+    std::sort(seen.begin(), seen.end());
+    REQUIRE(seen == std::vector<std::string>{"Spam", "Travel"});
+
+    // One socket for the account, and only the changed folders re-selected
+    REQUIRE(server.accepted() == 1);
+    REQUIRE(selects() <= 8);
+}
+
+TEST_CASE("Folder monitor polls with one LIST-STATUS per pass", "[imap][folders][list]") {
+    PensTest::MockImapServer server({"LIST-STATUS"});
+    std::vector<std::string> folders = {"INBOX", "Work", "Lists", "Archive"};
+    for (const auto& folder : folders) {
+        server.addFolder(folder);
+    }
+
+    FolderMonitorSettings settings;
+    settings.folders = folders;
+    settings.maxConnections = 1;
+    settings.pollIntervalMs = 50;
+    FolderMonitor monitor(settings, connectTo(server));
+    monitor.start();
+
+    auto count = [&server](const std::string& verb) {
+        std::vector<std::string> commands = server.commands();
+        return std::count_if(commands.begin(), commands.end(), [&verb](const std::string& c) {
+            return c.compare(0, verb.size(), verb) == 0;
+        });
+    };
+    // First pass syncs everything; later passes find nothing changed
+    REQUIRE(waitFor([&]() { return count("LIST ") >= 3; }));
+    REQUIRE(count("SELECT ") == 4);
+
+    server.addMessage("a@test.com", "list mail", "x\r\n", "Lists");
+    std::vector<FolderEmail> emails = monitor.take(5000);
+    monitor.stop();
+    REQUIRE(emails.size() == 1);
+    REQUIRE(emails[0].folder == "Lists");
+    REQUIRE(count("SELECT ") == 5);
+    REQUIRE_FALSE(monitor.usingNotify());
+}
+
+TEST_CASE("Folder connections ask LIST-STATUS about their own folders only", "[imap][folders][list]") {
+    PensTest::MockImapServer server({"LIST-STATUS"});
+    std::vector<std::string> folders = {"INBOX", "Work", "Lists", "Archive"};
+    for (const auto& folder : folders) {
+        server.addFolder(folder);
+    }
+    server.addFolder("Unwatched");
+
+    FolderMonitorSettings settings;
+    settings.folders = folders;
+    settings.maxConnections = 2;
+    settings.pollIntervalMs = 50;
+    settings.rebalanceIntervalMs = 60 * 1000;
+    FolderMonitor monitor(settings, connectTo(server));
+    auto assignment = monitor.assignments();
+    REQUIRE(assignment.size() == 2);
+    monitor.start();
+
+    auto lists = [&server]() {
+        std::vector<std::string> result;
+        for (const auto& command : server.commands()) {
+            if (command.compare(0, 5, "LIST ") == 0) {
+                result.push_back(command);
+            }
+        }
+        return result;
+    };
+    REQUIRE(waitFor([&]() { return lists().size() >= 6; }));
+    monitor.stop();
+
+    // Each LIST names exactly one connection's folders, never the whole account
+    for (const auto& command : lists()) {
+        REQUIRE(command.compare(0, 9, "LIST \"\" (") == 0);
+        REQUIRE(command.find("Unwatched") == std::string::npos);
+        bool matches = false;
+        for (const auto& own : assignment) {
+            std::string names = ImapClient::mailboxList(own);
+            matches = matches || command.compare(8, names.size(), names) == 0;
+        }
+        REQUIRE(matches);
+    }
+}
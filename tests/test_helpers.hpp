@@ -0,0 +1,1034 @@
+/**
+ * Shared loopback stand-in servers for PENS unit tests
+ */
+
+#ifndef PENS_TEST_HELPERS_HPP
+#define PENS_TEST_HELPERS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+namespace PensTest {
+
+// Minimal keep-alive HTTP/1.1 server that answers every request with a JSON body
+class StandInTokenEndpoint {
+public:
+    explicit StandInTokenEndpoint(std::string responseBody, int delayMs = 0)
+        : responseBody_(std::move(responseBody)), delayMs_(delayMs),
+          accepted_(0), requests_(0), running_(true) {
+        listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        listen(listenFd_, 16);
+
+        socklen_t len = sizeof(addr);
+        getsockname(listenFd_, reinterpret_cast<sockaddr*>(&addr), &len);
+        port_ = ntohs(addr.sin_port);
+
+        acceptThread_ = std::thread([this] { acceptLoop(); });
+    }
+
+    ~StandInTokenEndpoint() {
+        running_ = false;
+        shutdown(listenFd_, SHUT_RDWR);
+        close(listenFd_);
+        acceptThread_.join();
+        for (int fd : clientFds_) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        for (auto& t : workers_) {
+            t.join();
+        }
+        for (int fd : clientFds_) {
+            close(fd);
+        }
+    }
+
+    std::string url() const {
+        return "http://127.0.0.1:" + std::to_string(port_);
+    }
+
+    int port() const { return port_; }
+
+    int accepted() const { return accepted_.load(); }
+    int requests() const { return requests_.load(); }
+
+private:
+    std::string responseBody_;
+    int delayMs_;
+    int listenFd_;
+    int port_;
+    std::atomic<int> accepted_;
+    std::atomic<int> requests_;
+    std::atomic<bool> running_;
+    std::thread acceptThread_;
+    std::vector<std::thread> workers_;
+    std::vector<int> clientFds_;
+
+    void acceptLoop() {
+        while (running_) {
+            int fd = accept(listenFd_, nullptr, nullptr);
+            if (fd < 0) {
+                break;
+            }
+            accepted_++;
+            clientFds_.push_back(fd);
+            workers_.emplace_back([this, fd] { serve(fd); });
+        }
+    }
+
+    void serve(int fd) {
+        std::string buffer;
+        char chunk[4096];
+        while (true) {
+            size_t headerEnd;
+            while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+                ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+                if (n <= 0) return;
+                buffer.append(chunk, n);
+            }
+
+            size_t contentLength = 0;
+            size_t pos = buffer.find("Content-Length:");
+            if (pos != std::string::npos && pos < headerEnd) {
+                contentLength = std::stoul(buffer.substr(pos + 15));
+            }
+            while (buffer.size() < headerEnd + 4 + contentLength) {
+                ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+                if (n <= 0) return;
+                buffer.append(chunk, n);
+            }
+            buffer.erase(0, headerEnd + 4 + contentLength);
+            requests_++;
+            if (delayMs_ > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(delayMs_));
+            }
+
+            std::string response = "HTTP/1.1 200 OK\r\n"
+                                   "Content-Type: application/json\r\n"
+                                   "Content-Length: " + std::to_string(responseBody_.size()) + "\r\n"
+                                   "\r\n" + responseBody_;
+            send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+        }
+    }
+};
+
+// Plain-text ESMTP server that accepts every message and records the session.
+// With fragmentReplies, replies are written a few bytes at a time so that
+// clients must reassemble lines across reads.
+class MockSmtpServer {
+public:
+    explicit MockSmtpServer(std::vector<std::string> extensions, bool fragmentReplies = false)
+        : extensions_(std::move(extensions)), fragmentReplies_(fragmentReplies),
+          accepted_(0), pipelinedBatches_(0), running_(true) {
+        listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        listen(listenFd_, 64);
+
+        socklen_t len = sizeof(addr);
+        getsockname(listenFd_, reinterpret_cast<sockaddr*>(&addr), &len);
+        port_ = ntohs(addr.sin_port);
+
+        acceptThread_ = std::thread([this] { acceptLoop(); });
+    }
+
+    ~MockSmtpServer() {
+        running_ = false;
+        shutdown(listenFd_, SHUT_RDWR);
+        close(listenFd_);
+        acceptThread_.join();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (int fd : clientFds_) {
+                shutdown(fd, SHUT_RDWR);
+            }
+        }
+        for (auto& t : workers_) {
+            t.join();
+        }
+        for (int fd : clientFds_) {
+            close(fd);
+        }
+    }
+
+    int port() const { return port_; }
+    int accepted() const { return accepted_.load(); }
+
+    // Number of reads that carried more than one command
+    int pipelinedBatches() const { return pipelinedBatches_.load(); }
+
+    // Simulate the server timing out every open session
+    void dropConnections() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int fd : clientFds_) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+
+    void rejectRecipient(const std::string& address) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rejected_.insert(address);
+    }
+
+    std::vector<std::string> commands() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return commands_;
+    }
+
+    // Accepted message contents with dot-stuffing removed
+    std::vector<std::string> messages() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return messages_;
+    }
+
+    // DATA payloads exactly as received (still dot-stuffed, no terminator)
+    std::vector<std::string> rawMessages() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return rawMessages_;
+    }
+
+private:
+    std::vector<std::string> extensions_;
+    bool fragmentReplies_;
+    int listenFd_;
+    int port_;
+    std::atomic<int> accepted_;
+    std::atomic<int> pipelinedBatches_;
+    std::atomic<bool> running_;
+    std::thread acceptThread_;
+    std::vector<std::thread> workers_;
+    std::vector<int> clientFds_;
+    mutable std::mutex mutex_;
+    std::set<std::string> rejected_;
+    std::vector<std::string> commands_;
+    std::vector<std::string> messages_;
+    std::vector<std::string> rawMessages_;
+
+    void acceptLoop() {
+        while (running_) {
+            int fd = accept(listenFd_, nullptr, nullptr);
+            if (fd < 0) {
+                break;
+            }
+            accepted_++;
+            // Replies are written one per command; don't let Nagle hold them back
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            std::lock_guard<std::mutex> lock(mutex_);
+            clientFds_.push_back(fd);
+            workers_.emplace_back([this, fd] { serve(fd); });
+        }
+    }
+
+    void reply(int fd, const std::string& text) {
+        if (!fragmentReplies_) {
+            send(fd, text.data(), text.size(), MSG_NOSIGNAL);
+            return;
+        }
+        for (size_t i = 0; i < text.size(); i += 5) {
+            send(fd, text.data() + i, std::min<size_t>(5, text.size() - i), MSG_NOSIGNAL);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    void serve(int fd) {
+        reply(fd, "220 mock ESMTP ready\r\n");
+
+        std::string buffer;
+        std::string message;
+        std::string raw;
+        bool inData = false;
+        size_t bdatRemaining = 0;
+        bool bdatLast = false;
+        int authStep = 0;
+        int recipients = 0;
+        char chunk[4096];
+
+        while (true) {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) return;
+            buffer.append(chunk, n);
+
+            int commandsInRead = 0;
+            while (true) {
+                if (bdatRemaining > 0) {
+                    size_t take = std::min(bdatRemaining, buffer.size());
+                    message.append(buffer, 0, take);
+                    buffer.erase(0, take);
+                    bdatRemaining -= take;
+                    if (bdatRemaining > 0) {
+                        break;
+                    }
+                    if (recipients == 0) {
+                        reply(fd, "554 5.5.1 no valid recipients\r\n");
+                    } else if (bdatLast) {
+                        {
+                            std::lock_guard<std::mutex> lock(mutex_);
+                            messages_.push_back(message);
+                        }
+                        reply(fd, "250 2.0.0 queued\r\n");
+                    } else {
+                        reply(fd, "250 2.0.0 chunk accepted\r\n");
+                    }
+                    continue;
+                }
+
+                size_t eol = buffer.find("\r\n");
+                if (eol == std::string::npos) {
+                    break;
+                }
+                std::string line = buffer.substr(0, eol);
+                buffer.erase(0, eol + 2);
+
+                if (inData) {
+                    if (line == ".") {
+                        inData = false;
+                        {
+                            std::lock_guard<std::mutex> lock(mutex_);
+                            messages_.push_back(message);
+                            rawMessages_.push_back(raw);
+                        }
+                        reply(fd, "250 2.0.0 queued\r\n");
+                    } else {
+                        raw += line + "\r\n";
+                        message += (line.compare(0, 1, ".") == 0 ? line.substr(1) : line) + "\r\n";
+                    }
+                    continue;
+                }
+
+                commandsInRead++;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    commands_.push_back(line);
+                }
+
+                std::string verb = line.substr(0, line.find_first_of(" :"));
+                for (auto& c : verb) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+
+                if (authStep > 0) {
+                    reply(fd, ++authStep == 3 ? "235 2.7.0 accepted\r\n" : "334 UGFzc3dvcmQ6\r\n");
+                    if (authStep == 3) authStep = 0;
+                } else if (verb == "EHLO") {
+                    std::string text = "250" + std::string(extensions_.empty() ? " " : "-") + "mock greets you\r\n";
+                    for (size_t i = 0; i < extensions_.size(); i++) {
+                        text += "250" + std::string(i + 1 == extensions_.size() ? " " : "-") + extensions_[i] + "\r\n";
+                    }
+                    reply(fd, text);
+                } else if (verb == "AUTH") {
+                    if (line.find("XOAUTH2") != std::string::npos) {
+                        reply(fd, "235 2.7.0 accepted\r\n");
+                    } else {
+                        authStep = 1;
+                        reply(fd, "334 VXNlcm5hbWU6\r\n");
+                    }
+                } else if (verb == "MAIL") {
+                    recipients = 0;
+                    message.clear();
+                    reply(fd, "250 2.1.0 ok\r\n");
+                } else if (verb == "RCPT") {
+                    std::string address = line.substr(line.find('<') + 1);
+                    address = address.substr(0, address.find('>'));
+                    bool reject;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        reject = rejected_.count(address) > 0;
+                    }
+                    if (reject) {
+                        reply(fd, "550 5.1.1 no such user\r\n");
+                    } else {
+                        recipients++;
+                        reply(fd, "250 2.1.5 ok\r\n");
+                    }
+                } else if (verb == "DATA") {
+                    if (recipients == 0) {
+                        reply(fd, "554 5.5.1 no valid recipients\r\n");
+                    } else {
+                        inData = true;
+                        message.clear();
+                        raw.clear();
+                        reply(fd, "354 go ahead\r\n");
+                    }
+                } else if (verb == "BDAT") {
+                    bdatRemaining = std::stoul(line.substr(5));
+                    bdatLast = line.find("LAST") != std::string::npos;
+                } else if (verb == "RSET") {
+                    recipients = 0;
+                    reply(fd, "250 2.0.0 ok\r\n");
+                } else if (verb == "NOOP") {
+                    reply(fd, "250 2.0.0 ok\r\n");
+                } else if (verb == "QUIT") {
+                    reply(fd, "221 2.0.0 bye\r\n");
+                    return;
+                } else {
+                    reply(fd, "502 5.5.2 not implemented\r\n");
+                }
+            }
+            if (commandsInRead > 1) {
+                pipelinedBatches_++;
+            }
+        }
+    }
+};
+
+// Plain-text IMAP4rev1 server with a set of folders. Handles the commands
+// ImapClient sends, delivers message parts as literals, pushes EXISTS to
+// IDLE sessions, and can drop, stall or BYE its sessions to exercise
+// recovery paths.
+class MockImapServer {
+public:
+    struct Message {
+        uint32_t uid;
+        long internalDate;
+        std::string header;
+        std::string text;
+    };
+
+    explicit MockImapServer(std::vector<std::string> extraCapabilities = {})
+        : capabilities_("IMAP4rev1 IDLE"), clock_(1700000000), failLogins_(0), stalled_(false),
+          accepted_(0), active_(0), peakActive_(0), running_(true) {
+        for (const auto& capability : extraCapabilities) {
+            capabilities_ += " " + capability;
+        }
+        folders_["INBOX"];
+
+        listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        listen(listenFd_, SOMAXCONN);
+
+        socklen_t len = sizeof(addr);
+        getsockname(listenFd_, reinterpret_cast<sockaddr*>(&addr), &len);
+        port_ = ntohs(addr.sin_port);
+
+        acceptThread_ = std::thread([this] { acceptLoop(); });
+    }
+
+    ~MockImapServer() {
+        running_ = false;
+        shutdown(listenFd_, SHUT_RDWR);
+        close(listenFd_);
+        acceptThread_.join();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (int fd : clientFds_) {
+                shutdown(fd, SHUT_RDWR);
+            }
+        }
+        for (auto& t : workers_) {
+            t.join();
+        }
+        for (int fd : clientFds_) {
+            close(fd);
+        }
+    }
+
+    int port() const { return port_; }
+    int accepted() const { return accepted_.load(); }
+    // Most sessions open at the same time
+    int peakSessions() const { return peakActive_.load(); }
+
+    void addFolder(const std::string& name, const std::string& specialUse = "") {
+        std::lock_guard<std::mutex> lock(mutex_);
+        folders_[name].specialUse = specialUse;
+    }
+
+    // Appends a message (INTERNALDATE defaults to a clock that ticks per
+    // message) and notifies sessions idling on the folder
+    uint32_t addMessage(const std::string& from, const std::string& subject, const std::string& text,
+                        const std::string& folder = "INBOX", long internalDate = 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Folder& target = folders_[folder];
+        uint32_t uid = target.nextUid++;
+        target.messages.push_back({uid, internalDate ? internalDate : clock_++,
+                                   "From: " + from + "\r\nSubject: " + subject + "\r\n\r\n", text});
+        std::string exists = "* " + std::to_string(target.messages.size()) + " EXISTS\r\n";
+        for (const auto& session : idling_) {
+            if (session.second == folder) {
+                send(session.first, exists.data(), exists.size(), MSG_NOSIGNAL);
+            }
+        }
+        for (const auto& session : notifying_) {
+            std::string event;
+            if (session.second.selected == folder) {
+                event = exists;
+            } else if (session.second.watches(folder)) {
+                event = statusLine(folder, target);
+            }
+            if (!event.empty()) {
+                send(session.first, event.data(), event.size(), MSG_NOSIGNAL);
+            }
+        }
+        return uid;
+    }
+
+    // New UIDVALIDITY epoch; existing messages are renumbered from 1
+    void resetUidValidity(uint32_t validity, const std::string& folder = "INBOX") {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Folder& target = folders_[folder];
+        target.uidValidity = validity;
+        target.nextUid = 1;
+        for (auto& message : target.messages) {
+            message.uid = target.nextUid++;
+        }
+    }
+
+    // Reject the next count LOGIN / AUTHENTICATE attempts
+    void failLogins(int count) { failLogins_ = count; }
+
+    // Stop answering commands (a half-open connection as seen by the client)
+    void setStalled(bool stalled) { stalled_ = stalled; }
+
+    // Simulate the server timing out every open session
+    void dropConnections() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int fd : clientFds_) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+
+    // Send an untagged BYE on every open session, then close them
+    void sayBye() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int fd : clientFds_) {
+            send(fd, "* BYE server shutting down\r\n", 28, MSG_NOSIGNAL);
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+
+    // Commands received, without their tags
+    std::vector<std::string> commands() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return commands_;
+    }
+
+private:
+    struct Folder {
+        uint32_t uidValidity = 1;
+        uint32_t nextUid = 1;
+        std::vector<Message> messages;
+        std::string specialUse;
+    };
+
+    struct Notify {
+        bool personal = false;               // every folder
+        std::vector<std::string> mailboxes;  // or just these
+        std::string selected;
+        bool watches(const std::string& folder) const {
+            return personal || std::find(mailboxes.begin(), mailboxes.end(), folder) != mailboxes.end();
+        }
+    };
+
+    std::string capabilities_;
+    long clock_;
+    int listenFd_;
+    int port_;
+    std::atomic<int> failLogins_;
+    std::atomic<bool> stalled_;
+    std::atomic<int> accepted_;
+    std::atomic<int> active_;
+    std::atomic<int> peakActive_;
+    std::atomic<bool> running_;
+    std::thread acceptThread_;
+    std::vector<std::thread> workers_;
+    std::vector<int> clientFds_;
+    mutable std::mutex mutex_;
+    std::map<std::string, Folder> folders_;
+    std::map<int, std::string> idling_;  // session fd -> folder it is IDLE on
+    std::map<int, Notify> notifying_;    // sessions with NOTIFY SET
+    std::vector<std::string> commands_;
+
+    void acceptLoop() {
+        while (running_) {
+            int fd = accept(listenFd_, nullptr, nullptr);
+            if (fd < 0) {
+                break;
+            }
+            accepted_++;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            std::lock_guard<std::mutex> lock(mutex_);
+            clientFds_.push_back(fd);
+            workers_.emplace_back([this, fd] {
+                int now = ++active_;
+                int peak = peakActive_.load();
+                while (now > peak && !peakActive_.compare_exchange_weak(peak, now)) {
+                }
+                serve(fd);
+                {
+                    std::lock_guard<std::mutex> sessionLock(mutex_);
+                    idling_.erase(fd);
+                    notifying_.erase(fd);
+                }
+                active_--;
+            });
+        }
+    }
+
+    void reply(int fd, const std::string& text) {
+        send(fd, text.data(), text.size(), MSG_NOSIGNAL);
+    }
+
+    bool loginAllowed() {
+        int remaining = failLogins_.load();
+        while (remaining > 0 && !failLogins_.compare_exchange_weak(remaining, remaining - 1)) {
+        }
+        return remaining <= 0;
+    }
+
+    static std::string unquote(std::string name) {
+        if (name.size() >= 2 && name.front() == '"' && name.back() == '"') {
+            name = name.substr(1, name.size() - 2);
+        }
+        return name;
+    }
+
+    void serve(int fd) {
+        reply(fd, "* OK mock IMAP ready\r\n");
+
+        std::string buffer;
+        std::string saslTag;  // tag of an AUTHENTICATE waiting for the client's reply
+        std::string idleTag;  // tag of a running IDLE
+        std::string selected;
+        char chunk[4096];
+
+        while (true) {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) return;
+            buffer.append(chunk, n);
+
+            size_t eol;
+            while ((eol = buffer.find("\r\n")) != std::string::npos) {
+                std::string line = buffer.substr(0, eol);
+                buffer.erase(0, eol + 2);
+                if (stalled_) {
+                    continue;
+                }
+                if (!saslTag.empty()) {
+                    reply(fd, saslTag + " NO [AUTHENTICATIONFAILED] invalid credentials\r\n");
+                    saslTag.clear();
+                    continue;
+                }
+                if (!idleTag.empty()) {
+                    if (line == "DONE") {
+                        {
+                            std::lock_guard<std::mutex> lock(mutex_);
+                            idling_.erase(fd);
+                        }
+                        reply(fd, idleTag + " OK IDLE terminated\r\n");
+                        idleTag.clear();
+                    }
+                    continue;
+                }
+
+                size_t space = line.find(' ');
+                std::string tag = line.substr(0, space);
+                std::string command = space == std::string::npos ? "" : line.substr(space + 1);
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    commands_.push_back(command);
+                }
+                std::string verb = command.substr(0, command.find(' '));
+                for (auto& c : verb) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+
+                if (verb == "LOGIN") {
+                    reply(fd, tag + (loginAllowed() ? " OK LOGIN completed\r\n" : " NO [AUTHENTICATIONFAILED] bad\r\n"));
+                } else if (verb == "AUTHENTICATE") {
+                    if (loginAllowed()) {
+                        reply(fd, tag + " OK AUTHENTICATE completed\r\n");
+                    } else {
+                        saslTag = tag;
+                        reply(fd, "+ eyJzdGF0dXMiOiI0MDEifQ==\r\n");
+                    }
+                } else if (verb == "CAPABILITY") {
+                    reply(fd, "* CAPABILITY " + capabilities_ + "\r\n" + tag + " OK CAPABILITY completed\r\n");
+                } else if (verb == "SELECT") {
+                    std::string name = unquote(command.substr(7));
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    auto folder = folders_.find(name);
+                    if (folder == folders_.end()) {
+                        reply(fd, tag + " NO [NONEXISTENT] no such mailbox\r\n");
+                        continue;
+                    }
+                    selected = name;
+                    if (notifying_.count(fd)) {
+                        notifying_[fd].selected = name;
+                    }
+                    reply(fd, "* " + std::to_string(folder->second.messages.size()) + " EXISTS\r\n"
+                              "* OK [UIDVALIDITY " + std::to_string(folder->second.uidValidity) + "] UIDs valid\r\n"
+                              "* OK [UIDNEXT " + std::to_string(folder->second.nextUid) + "] predicted next UID\r\n" +
+                              tag + " OK [READ-WRITE] SELECT completed\r\n");
+                } else if (verb == "IDLE") {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    idling_[fd] = selected;
+                    idleTag = tag;
+                    reply(fd, "+ idling\r\n");
+                } else if (verb == "NOTIFY" && capabilities_.find("NOTIFY") != std::string::npos) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (command == "NOTIFY NONE") {
+                        notifying_.erase(fd);
+                        reply(fd, tag + " OK NOTIFY completed\r\n");
+                        continue;
+                    }
+                    Notify notify;
+                    notify.personal = command.find("(personal ") != std::string::npos;
+                    notify.selected = selected;
+                    for (size_t open = command.find('"'); open != std::string::npos;
+                         open = command.find('"', command.find('"', open + 1) + 1)) {
+                        notify.mailboxes.push_back(command.substr(open + 1, command.find('"', open + 1) - open - 1));
+                    }
+                    std::string status;
+                    if (command.compare(0, 18, "NOTIFY SET STATUS ") == 0) {
+                        for (const auto& folder : folders_) {
+                            if (folder.first != selected && notify.watches(folder.first)) {
+                                status += statusLine(folder.first, folder.second);
+                            }
+                        }
+                    }
+                    notifying_[fd] = notify;
+                    reply(fd, status + tag + " OK NOTIFY completed\r\n");
+                } else if (verb == "NOOP") {
+                    reply(fd, tag + " OK NOOP completed\r\n");
+                } else if (verb == "LIST") {
+                    // Names with spaces go out as literals, the rest quoted
+                    bool withStatus = capabilities_.find("LIST-STATUS") != std::string::npos &&
+                                      command.find(" RETURN (") != std::string::npos &&
+                                      command.find("STATUS (") != std::string::npos;
+                    // LIST "" ("a" "b") (LIST-EXTENDED) names just those
+                    // folders; any single pattern lists them all
+                    std::set<std::string> named;
+                    if (command.compare(0, 9, "LIST \"\" (") == 0) {
+                        size_t end = command.find(')', 9);
+                        for (size_t open = command.find('"', 9); open < end;
+                             open = command.find('"', command.find('"', open + 1) + 1)) {
+                            size_t close = command.find('"', open + 1);
+                            named.insert(command.substr(open + 1, close - open - 1));
+                        }
+                    }
+                    std::string response;
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    for (const auto& folder : folders_) {
+                        if (!named.empty() && !named.count(folder.first)) {
+                            continue;
+                        }
+                        std::string name = folder.first.find(' ') == std::string::npos
+                            ? "\"" + folder.first + "\""
+                            : "{" + std::to_string(folder.first.size()) + "}\r\n" + folder.first;
+                        std::string attributes = "\\HasNoChildren";
+                        if (!folder.second.specialUse.empty()) {
+                            attributes += " " + folder.second.specialUse;
+                        }
+                        response += "* LIST (" + attributes + ") \"/\" " + name + "\r\n";
+                        if (withStatus) {
+                            response += statusLine(folder.first, folder.second);
+                        }
+                    }
+                    reply(fd, response + tag + " OK LIST completed\r\n");
+                } else if (verb == "STATUS") {
+                    std::string name = command.substr(7, command.find(" (", 7) - 7);
+                    name = unquote(name);
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    auto folder = folders_.find(name);
+                    if (folder == folders_.end()) {
+                        reply(fd, tag + " NO [NONEXISTENT] no such mailbox\r\n");
+                        continue;
+                    }
+                    reply(fd, statusLine(name, folder->second) + tag + " OK STATUS completed\r\n");
+                } else if (command.compare(0, 11, "UID SEARCH ") == 0) {
+                    reply(fd, search(selected, command.substr(11)) + tag + " OK SEARCH completed\r\n");
+                } else if (command.compare(0, 10, "UID FETCH ") == 0) {
+                    reply(fd, fetch(selected, command.substr(10, command.find(' ', 10) - 10)) +
+                              tag + " OK FETCH completed\r\n");
+                } else if (verb == "LOGOUT") {
+                    reply(fd, "* BYE logging out\r\n" + tag + " OK LOGOUT completed\r\n");
+                    return;
+                } else {
+                    reply(fd, tag + " BAD unknown command\r\n");
+                }
+            }
+        }
+    }
+
+    static std::string statusLine(const std::string& name, const Folder& folder) {
+        std::string count = std::to_string(folder.messages.size());
+        return "* STATUS \"" + name + "\" (MESSAGES " + count + " UNSEEN " + count +
+               " UIDNEXT " + std::to_string(folder.nextUid) +
+               " UIDVALIDITY " + std::to_string(folder.uidValidity) + ")\r\n";
+    }
+
+    // "ALL" or "UID n:*" (which, as on real servers, always matches the highest UID)
+    std::string search(const std::string& folder, const std::string& criteria) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const std::vector<Message>& messages = folders_[folder].messages;
+        uint32_t from = 1;
+        if (criteria.compare(0, 4, "UID ") == 0) {
+            from = static_cast<uint32_t>(std::stoul(criteria.substr(4)));
+        }
+        std::string result = "* SEARCH";
+        for (size_t i = 0; i < messages.size(); i++) {
+            if (messages[i].uid >= from || i + 1 == messages.size()) {
+                result += " " + std::to_string(messages[i].uid);
+            }
+        }
+        return result + "\r\n";
+    }
+
+    // A UID set such as "7", "4,9" or "1:*" ("*" is the highest UID)
+    static bool inUidSet(uint32_t uid, const std::string& set, uint32_t highest) {
+        std::istringstream ranges(set);
+        std::string range;
+        auto bound = [highest](const std::string& value) -> uint32_t {
+            return value == "*" ? highest : static_cast<uint32_t>(std::stoul(value));
+        };
+        while (std::getline(ranges, range, ',')) {
+            size_t colon = range.find(':');
+            uint32_t low = bound(range.substr(0, colon));
+            uint32_t high = colon == std::string::npos ? low : bound(range.substr(colon + 1));
+            if (std::min(low, high) <= uid && uid <= std::max(low, high)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string fetch(const std::string& folder, const std::string& uidSet) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const std::vector<Message>& messages = folders_[folder].messages;
+        uint32_t highest = messages.empty() ? 0 : messages.back().uid;
+        std::string result;
+        for (size_t i = 0; i < messages.size(); i++) {
+            const Message& message = messages[i];
+            uint32_t uid = message.uid;
+            if (inUidSet(uid, uidSet, highest)) {
+                char date[64];
+                std::time_t when = message.internalDate;
+                std::tm utc;
+                gmtime_r(&when, &utc);
+                std::strftime(date, sizeof(date), "%d-%b-%Y %H:%M:%S +0000", &utc);
+                result += "* " + std::to_string(i + 1) + " FETCH (UID " + std::to_string(uid) +
+                          " FLAGS () INTERNALDATE \"" + date + "\" RFC822.SIZE " +
+                          std::to_string(message.header.size() + message.text.size()) + " BODY[HEADER] {" +
+                          std::to_string(message.header.size()) + "}\r\n" +
+                          message.header + " BODY[TEXT] {" + std::to_string(message.text.size()) + "}\r\n" +
+                          message.text + ")\r\n";
+            }
+        }
+        return result;
+    }
+};
+
+// Terminates TLS on a loopback port and relays the plaintext to upstreamPort.
+// The server certificate is issued for localhost/127.0.0.1 by a throwaway
+// test CA; with caFile set, the CA certificate is written there in PEM so
+// clients can verify the peer.
+class TlsRelay {
+public:
+    explicit TlsRelay(int upstreamPort, const std::string& caFile = "")
+        : upstreamPort_(upstreamPort), running_(true), generation_(0), accepted_(0), resumed_(0), active_(0) {
+        EVP_PKEY* caKey = EVP_EC_gen("P-256");
+        X509* ca = makeCertificate(caKey, caKey, nullptr, "PENS Test CA", true);
+        EVP_PKEY* key = EVP_EC_gen("P-256");
+        X509* cert = makeCertificate(key, caKey, ca, "localhost", false);
+        if (!caFile.empty()) {
+            FILE* file = std::fopen(caFile.c_str(), "w");
+            PEM_write_X509(file, ca);
+            std::fclose(file);
+        }
+        context_ = SSL_CTX_new(TLS_server_method());
+        SSL_CTX_use_certificate(context_, cert);
+        SSL_CTX_use_PrivateKey(context_, key);
+        X509_free(cert);
+        X509_free(ca);
+        EVP_PKEY_free(key);
+        EVP_PKEY_free(caKey);
+
+        listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = loopback(0);
+        bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        listen(listenFd_, SOMAXCONN);
+        socklen_t len = sizeof(addr);
+        getsockname(listenFd_, reinterpret_cast<sockaddr*>(&addr), &len);
+        port_ = ntohs(addr.sin_port);
+        acceptThread_ = std::thread([this] { acceptLoop(); });
+    }
+
+    ~TlsRelay() {
+        running_ = false;
+        shutdown(listenFd_, SHUT_RDWR);
+        close(listenFd_);
+        acceptThread_.join();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+        SSL_CTX_free(context_);
+    }
+
+    int port() const { return port_; }
+
+    // Completed handshakes, and how many of them resumed an earlier session
+    int accepted() const { return accepted_.load(); }
+    int resumed() const { return resumed_.load(); }
+
+    // Closes every open connection, so the next request has to reconnect
+    void dropConnections() {
+        generation_++;
+        while (active_.load() > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+private:
+    int upstreamPort_;
+    int port_;
+    int listenFd_;
+    SSL_CTX* context_;
+    std::atomic<bool> running_;
+    std::atomic<int> generation_;
+    std::atomic<int> accepted_;
+    std::atomic<int> resumed_;
+    std::atomic<int> active_;
+    std::thread acceptThread_;
+    std::vector<std::thread> workers_;
+
+    static sockaddr_in loopback(int port) {
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        return addr;
+    }
+
+    static X509* makeCertificate(EVP_PKEY* key, EVP_PKEY* issuerKey, X509* issuer, const char* commonName,
+                                 bool authority) {
+        X509* cert = X509_new();
+        X509_set_version(cert, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), authority ? 1 : 2);
+        X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME* name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>(commonName),
+                                   -1, -1, 0);
+        X509_set_issuer_name(cert, issuer ? X509_get_subject_name(issuer) : name);
+        X509V3_CTX ctx;
+        X509V3_set_ctx_nodb(&ctx);
+        X509V3_set_ctx(&ctx, issuer ? issuer : cert, cert, nullptr, nullptr, 0);
+        const char* extensions[][2] = {
+            {"basicConstraints", authority ? "critical,CA:TRUE" : "CA:FALSE"},
+            {"keyUsage", authority ? "critical,keyCertSign" : "critical,digitalSignature"},
+            {"subjectAltName", authority ? nullptr : "DNS:localhost,IP:127.0.0.1"},
+        };
+        for (const auto& extension : extensions) {
+            if (extension[1]) {
+                X509_EXTENSION* ext = X509V3_EXT_conf(nullptr, &ctx, extension[0], extension[1]);
+                X509_add_ext(cert, ext, -1);
+                X509_EXTENSION_free(ext);
+            }
+        }
+        X509_sign(cert, issuerKey, EVP_sha256());
+        return cert;
+    }
+
+    void acceptLoop() {
+        while (running_) {
+            int fd = accept(listenFd_, nullptr, nullptr);
+            if (fd < 0) {
+                return;
+            }
+            workers_.emplace_back([this, fd] { relay(fd); });
+        }
+    }
+
+    void relay(int fd) {
+        // A client may hang up mid-reply; keep SSL_write's SIGPIPE off this thread
+        sigset_t pipe;
+        sigemptyset(&pipe);
+        sigaddset(&pipe, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipe, nullptr);
+        active_++;
+        int generation = generation_.load();
+        SSL* ssl = SSL_new(context_);
+        SSL_set_fd(ssl, fd);
+        int upstream = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = loopback(upstreamPort_);
+        if (SSL_accept(ssl) == 1 && connect(upstream, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+            accepted_++;
+            if (SSL_session_reused(ssl)) {
+                resumed_++;
+            }
+            char chunk[16384];
+            while (running_ && generation_.load() == generation) {
+                pollfd fds[2] = {{fd, POLLIN, 0}, {upstream, POLLIN, 0}};
+                if (SSL_pending(ssl) == 0 && poll(fds, 2, 20) <= 0) {
+                    continue;
+                }
+                if (SSL_pending(ssl) > 0 || fds[0].revents) {
+                    int n = SSL_read(ssl, chunk, sizeof(chunk));
+                    if (n <= 0 || send(upstream, chunk, static_cast<size_t>(n), MSG_NOSIGNAL) != n) {
+                        break;
+                    }
+                }
+                if (fds[1].revents) {
+                    ssize_t n = recv(upstream, chunk, sizeof(chunk), 0);
+                    if (n <= 0 || SSL_write(ssl, chunk, static_cast<int>(n)) != n) {
+                        break;
+                    }
+                }
+            }
+        }
+        SSL_free(ssl);
+        close(upstream);
+        close(fd);
+        active_--;
+    }
+};
+
+} // namespace PensTest
+
+#endif // PENS_TEST_HELPERS_HPP
@@ -0,0 +1,134 @@
+/**
+ * Unit Tests for Shared HTTP Client Module
+ *
+ * Runs against a loopback stand-in for the token endpoint, directly over
+ * HTTP and behind a TLS relay whose certificate chains to a test CA.
+ */
+
+#include "catch.hpp"
+#include "../include/http_client.hpp"
+#include "../include/oauth_token_manager.hpp"
+#include "../include/config.hpp"
+#include "test_helpers.hpp"
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace Pens;
+using PensTest::StandInTokenEndpoint;
+using PensTest::TlsRelay;
+
+TEST_CASE("HTTP client reuses connections", "[http]") {
+    StandInTokenEndpoint endpoint(R"({"ok":true})");
+    HttpClient& client = HttpClient::getInstance();
+
+    SECTION("Sequential requests share one connection") {
+        for (int i = 0; i < 3; i++) {
+            HttpResponse response = client.post(endpoint.url() + "/token", "a=b");
+            REQUIRE(response.transportOk);
+            REQUIRE(response.status == 200);
+            REQUIRE(response.body == R"({"ok":true})");
+        }
+        REQUIRE(endpoint.requests() == 3);
+        REQUIRE(endpoint.accepted() == 1);
+    }
+
+    SECTION("Concurrent requests overlap") {
+        std::vector<std::future<HttpResponse>> futures;
+        for (int i = 0; i < 6; i++) {
+            HttpRequest request;
+            request.url = endpoint.url() + "/token";
+            request.body = "n=" + std::to_string(i);
+            futures.push_back(client.submit(std::move(request)));
+        }
+        for (auto& future : futures) {
+            HttpResponse response = future.get();
+            REQUIRE(response.transportOk);
+            REQUIRE(response.status == 200);
+        }
+        REQUIRE(endpoint.requests() == 6);
+    }
+
+    SECTION("Unreachable endpoint reports transport error") {
+        HttpRequest request;
+        request.url = "http://127.0.0.1:1/token";
+        request.timeoutSeconds = 2;
+        HttpResponse response = client.submit(std::move(request)).get();
+        REQUIRE_FALSE(response.transportOk);
+        REQUIRE(!response.error.empty());
+    }
+}
+
+TEST_CASE("HTTPS requests verify against the CA file and reuse TLS connections", "[http][tls]") {
+    const char* caFile = "test_http_ca.tmp";
+    StandInTokenEndpoint endpoint(R"({"ok":true})");
+    TlsRelay relay(endpoint.port(), caFile);
+    const std::string url = "https://127.0.0.1:" + std::to_string(relay.port()) + "/token";
+    HttpClient& client = HttpClient::getInstance();
+
+    // The test CA is not in the system store
+    HttpResponse rejected = client.post(url, "a=b");
+    REQUIRE_FALSE(rejected.transportOk);
+    REQUIRE(relay.accepted() == 0);
+
+    client.setCaInfo(caFile);
+    for (int i = 0; i < 3; i++) {
+        HttpResponse response = client.post(url, "a=b");
+        REQUIRE(response.transportOk);
+        REQUIRE(response.status == 200);
+        REQUIRE(response.body == R"({"ok":true})");
+    }
+    REQUIRE(endpoint.requests() == 3);
+    REQUIRE(relay.accepted() == 1);
+
+    // A new connection resumes the cached TLS session instead of a full handshake
+    relay.dropConnections();
+    HttpResponse again = client.post(url, "a=b");
+    REQUIRE(again.transportOk);
+    REQUIRE(relay.accepted() == 2);
+    REQUIRE(relay.resumed() == 1);
+
+    client.setCaInfo("");
+    std::remove(caFile);
+}
+
+TEST_CASE("Token refresh against stand-in endpoint", "[http]") {
+    StandInTokenEndpoint endpoint(
+        R"({"access_token":"fresh-token","refresh_token":"r2","expires_in":3600})");
+
+    const char* tokenFile = "test_http_token.tmp";
+    const char* configFile = "test_http_config.tmp";
+    {
+        std::ofstream file(tokenFile);
+        file << "{\"access_token\": \"stale\", \"refresh_token\": \"r1\", \"expires_at\": "
+             << (std::time(nullptr) - 10) << "}";
+    }
+    {
+        std::ofstream file(configFile);
+        file << "oauth_token_file = " << tokenFile << "\n";
+        file << "oauth_client_id = client\n";
+        file << "oauth_tenant_id = tenant\n";
+        file << "oauth_client_secret = secret\n";
+        file << "oauth_certificate_path = \n";
+        file << "oauth_authority = " << endpoint.url() << "\n";
+    }
+
+    Config& config = Config::getInstance();
+    REQUIRE(config.loadFromFile(configFile));
+
+    OAuthTokenManager manager(config);
+    REQUIRE(manager.ensureValidToken());
+    REQUIRE(manager.getAccessToken() == "fresh-token");
+    REQUIRE(endpoint.requests() == 1);
+
+    std::ofstream reset(configFile);
+    reset << "oauth_client_secret = \n";
+    reset << "oauth_authority = https://login.microsoftonline.com\n";
+    reset.close();
+    config.loadFromFile(configFile);
+
+    std::remove(tokenFile);
+    std::remove(configFile);
+}
@@ -0,0 +1,271 @@
+/**
+ * Unit Tests for the IMAP Client protocol layer
+ */
+
+#include "catch.hpp"
+#include "../include/imap_client.hpp"
+#include "test_helpers.hpp"
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace Pens;
+
+TEST_CASE("IMAP commands complete on their tagged response", "[imap]") {
+    PensTest::MockImapServer server;
+    server.addMessage("alice@test.com", "First", "hello\r\n");
+    // A body line that looks like a tagged completion must stay inside its literal
+    server.addMessage("bob@test.com", "Second", "A0005 OK not really done\r\n* BYE nope\r\n");
+
+    ImapClient client("127.0.0.1", server.port(), false);
+    REQUIRE(client.connect());
+    REQUIRE(client.authenticate("user@test.com", "secret"));
+    REQUIRE(client.selectMailbox("INBOX"));
+    REQUIRE(client.getUidValidity() == 1);
+    REQUIRE(client.getUidNext() == 3);
+
+    SECTION("UID search after a watermark") {
+        REQUIRE(client.searchUidsAfter(0) == std::vector<uint32_t>{1, 2});
+        REQUIRE(client.searchUidsAfter(1) == std::vector<uint32_t>{2});
+        // "3:*" still matches UID 2 on the server; the client filters it out
+        REQUIRE(client.searchUidsAfter(2).empty());
+    }
+
+    SECTION("Literals are read in full") {
+        Email email = client.fetchEmail("2");
+        REQUIRE(email.subject.find("Second") != std::string::npos);
+        REQUIRE(client.isConnected());
+        REQUIRE(client.noop());
+
+        Email first = client.fetchEmail("1");
+        REQUIRE(first.subject.find("First") != std::string::npos);
+    }
+
+    SECTION("Commands carry unique tags") {
+        REQUIRE(client.noop());
+        REQUIRE(client.noop());
+        std::vector<std::string> commands = server.commands();
+        REQUIRE(commands.size() == 4);
+        REQUIRE(commands[0].compare(0, 6, "LOGIN ") == 0);
+        REQUIRE(commands[3] == "NOOP");
+    }
+
+    client.disconnect();
+    REQUIRE_FALSE(client.isConnected());
+}
+
+TEST_CASE("IMAP client detects dead sessions", "[imap]") {
+    PensTest::MockImapServer server;
+    ImapClient client("127.0.0.1", server.port(), false);
+    REQUIRE(client.connect());
+    REQUIRE(client.authenticate("user@test.com", "secret"));
+    REQUIRE(client.noop());
+
+    SECTION("Rejected login keeps the connection") {
+        ImapClient other("127.0.0.1", server.port(), false);
+        REQUIRE(other.connect());
+        server.failLogins(1);
+        REQUIRE_FALSE(other.authenticate("user@test.com", "wrong"));
+        REQUIRE(other.getConnectionStatus() == "Connected but not authenticated");
+        REQUIRE(other.authenticate("user@test.com", "secret"));
+    }
+
+    SECTION("Rejected XOAUTH2 challenge is answered") {
+        ImapClient other("127.0.0.1", server.port(), false);
+        REQUIRE(other.connect());
+        server.failLogins(1);
+        REQUIRE_FALSE(other.authenticateOAuth("user@test.com", "expired"));
+        REQUIRE(other.authenticateOAuth("user@test.com", "fresh"));
+    }
+
+    SECTION("Dropped connection") {
+        server.dropConnections();
+        REQUIRE_FALSE(client.noop());
+        REQUIRE_FALSE(client.isConnected());
+        REQUIRE(client.getConnectionStatus() == "Not connected");
+    }
+
+    SECTION("Untagged BYE") {
+        server.sayBye();
+        REQUIRE_FALSE(client.noop());
+        REQUIRE_FALSE(client.isConnected());
+    }
+
+    SECTION("Reconnect after a drop") {
+        server.dropConnections();
+        REQUIRE_FALSE(client.noop());
+        REQUIRE(client.connect());
+        REQUIRE(client.reauthenticate());
+        REQUIRE(client.noop());
+        REQUIRE(server.accepted() == 2);
+    }
+}
+
+TEST_CASE("IMAP command timeout ends a stalled session", "[imap]") {
+    PensTest::MockImapServer server;
+    ImapClient client("127.0.0.1", server.port(), false);
+    client.setCommandTimeout(1);
+    REQUIRE(client.connect());
+    REQUIRE(client.authenticate("user@test.com", "secret"));
+
+    server.setStalled(true);
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE_FALSE(client.noop());
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    REQUIRE_FALSE(client.isConnected());
+    REQUIRE(elapsed < std::chrono::seconds(10));
+}
+
+TEST_CASE("IMAP STATUS responses and mailbox lists", "[imap][notify]") {
+    ImapMailboxEvent event;
+    REQUIRE(ImapClient::parseStatusLine("* STATUS \"Lists/dev \\\"core\\\"\" (MESSAGES 12 UIDNEXT 40 UIDVALIDITY 7)", event));
+    REQUIRE(event.mailbox == "Lists/dev \"core\"");
+    REQUIRE(event.messages == 12);
+    REQUIRE(event.uidNext == 40);
+    REQUIRE(event.uidValidity == 7);
+
+    REQUIRE(ImapClient::parseStatusLine("* STATUS Work (uidnext 5)", event));
+    REQUIRE(event.mailbox == "Work");
+    REQUIRE(event.uidNext == 5);
+    REQUIRE(event.messages == 0);
+
+    REQUIRE_FALSE(ImapClient::parseStatusLine("* 3 EXISTS", event));
+    REQUIRE_FALSE(ImapClient::parseStatusLine("* STATUS Work", event));
+
+    REQUIRE(ImapClient::mailboxList({"INBOX", "My \"Stuff\""}) == "(\"INBOX\" \"My \\\"Stuff\\\"\")");
+}
+
+TEST_CASE("IMAP NOTIFY reports changes in unselected mailboxes", "[imap][notify]") {
+    PensTest::MockImapServer server({"NOTIFY"});
+    server.addFolder("Work");
+    server.addFolder("Lists");
+    ImapClient client("127.0.0.1", server.port(), false);
+    REQUIRE(client.connect());
+    REQUIRE(client.authenticate("user@test.com", "secret"));
+    REQUIRE(client.selectMailbox("INBOX"));
+
+    REQUIRE(client.notifySet({"mailboxes " + ImapClient::mailboxList({"Work", "Lists"})}, true));
+    std::vector<std::string> commands = server.commands();
+    REQUIRE(commands.back() == "NOTIFY SET STATUS (SELECTED (MessageNew MessageExpunge)) "
+                               "(mailboxes (\"Work\" \"Lists\") (MessageNew MessageExpunge))");
+
+    // The initial STATUS responses arrived with the NOTIFY reply and are kept
+    std::vector<ImapMailboxEvent> events;
+    REQUIRE(client.waitForEvents(0, events));
+    REQUIRE(events.size() == 2);
+
+    server.addMessage("a@test.com", "hello", "x\r\n", "Work");
+    REQUIRE(client.waitForEvents(2000, events));
+    REQUIRE(events.size() == 1);
+    REQUIRE(events[0].mailbox == "Work");
+    REQUIRE(events[0].uidNext == 2);
+
+    // The selected mailbox reports through EXISTS
+    server.addMessage("a@test.com", "hi", "x\r\n", "INBOX");
+    REQUIRE(client.waitForEvents(2000, events));
+    REQUIRE(events.size() == 1);
+    REQUIRE(events[0].mailbox == "INBOX");
+    REQUIRE(events[0].messages == 1);
+
+    // Nothing happening is a timeout, not an error
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(client.waitForEvents(100, events));
+    REQUIRE(events.empty());
+    REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(90));
+    REQUIRE(client.isConnected());
+
+    REQUIRE(client.notifyNone());
+}
+
+TEST_CASE("IMAP NOTIFY is refused without the capability", "[imap][notify]") {
+    PensTest::MockImapServer server;
+    ImapClient client("127.0.0.1", server.port(), false);
+    REQUIRE(client.connect());
+    REQUIRE(client.authenticate("user@test.com", "secret"));
+    REQUIRE_FALSE(client.notifySet({"personal"}));
+    REQUIRE(client.isConnected());
+}
+
+TEST_CASE("IMAP LIST responses are parsed fully", "[imap][list]") {
+    std::string response =
+        "* LIST (\\HasNoChildren) \"/\" INBOX\r\n"
+        "* LIST (\\Noselect \\HasChildren) \"/\" \"Lists\"\r\n"
+        "* LIST (\\HasNoChildren \\Junk) \"/\" \"Lists/Spam \\\"bulk\\\"\"\r\n"
+        "* LIST (\\HasNoChildren \\Sent) \"/\" {10}\r\nSent Items\r\n"
+        "* STATUS {10}\r\nSent Items (MESSAGES 4 UNSEEN 0 UIDNEXT 9 UIDVALIDITY 3)\r\n"
+        "* LIST (\\Archive) NIL Archive\r\n"
+        "* LIST () \".\" \"Paren)(name\"\r\n"
+        "A0003 OK LIST completed\r\n";
+    std::vector<ImapMailboxInfo> mailboxes = ImapClient::parseListResponse(response);
+    REQUIRE(mailboxes.size() == 6);
+
+    REQUIRE(mailboxes[0].name == "INBOX");
+    REQUIRE(mailboxes[0].delimiter == '/');
+    REQUIRE(mailboxes[0].selectable);
+    REQUIRE(mailboxes[0].specialUse.empty());
+
+    REQUIRE(mailboxes[1].name == "Lists");
+    REQUIRE_FALSE(mailboxes[1].selectable);
+    REQUIRE(mailboxes[1].attributes == std::vector<std::string>{"\\Noselect", "\\HasChildren"});
+
+    REQUIRE(mailboxes[2].name == "Lists/Spam \"bulk\"");
+    REQUIRE(mailboxes[2].specialUse == "\\Junk");
+
+    REQUIRE(mailboxes[3].name == "Sent Items");
+    REQUIRE(mailboxes[3].specialUse == "\\Sent");
+    REQUIRE(mailboxes[3].hasStatus);
+    REQUIRE(mailboxes[3].messages == 4);
+    REQUIRE(mailboxes[3].uidNext == 9);
+    REQUIRE(mailboxes[3].uidValidity == 3);
+
+    REQUIRE(mailboxes[4].name == "Archive");
+    REQUIRE(mailboxes[4].delimiter == 0);
+    REQUIRE(mailboxes[4].specialUse == "\\Archive");
+    REQUIRE_FALSE(mailboxes[4].hasStatus);
+
+    REQUIRE(mailboxes[5].name == "Paren)(name");
+    REQUIRE(mailboxes[5].delimiter == '.');
+
+    REQUIRE(ImapClient::findSpecialUse(mailboxes, "\\junk") == &mailboxes[2]);
+    REQUIRE(ImapClient::findSpecialUse(mailboxes, "\\Trash") == nullptr);
+}
+
+TEST_CASE("IMAP LIST-STATUS returns every folder's counters in one command", "[imap][list]") {
+    auto commandsLike = [](const PensTest::MockImapServer& server, const std::string& verb) {
+        std::vector<std::string> commands = server.commands();
+        return std::count_if(commands.begin(), commands.end(), [&verb](const std::string& c) {
+            return c.compare(0, verb.size(), verb) == 0;
+        });
+    };
+
+    for (bool listStatus : {true, false}) {
+        PensTest::MockImapServer server(listStatus ? std::vector<std::string>{"LIST-STATUS", "SPECIAL-USE"}
+                                                   : std::vector<std::string>{});
+        server.addFolder("Junk", "\\Junk");
+        server.addFolder("Sent Items", "\\Sent");
+        server.addMessage("a@test.com", "one", "x\r\n", "Junk");
+        server.addMessage("a@test.com", "two", "x\r\n", "Junk");
+
+        ImapClient client("127.0.0.1", server.port(), false);
+        REQUIRE(client.connect());
+        REQUIRE(client.authenticate("user@test.com", "secret"));
+
+        std::vector<ImapMailboxInfo> mailboxes = client.listMailboxInfo("*", true);
+        REQUIRE(mailboxes.size() == 3);
+        const ImapMailboxInfo* junk = ImapClient::findSpecialUse(mailboxes, "\\Junk");
+        REQUIRE(junk != nullptr);
+        REQUIRE(junk->name == "Junk");
+        REQUIRE(junk->hasStatus);
+        REQUIRE(junk->messages == 2);
+        REQUIRE(junk->uidNext == 3);
+        REQUIRE(ImapClient::findSpecialUse(mailboxes, "\\Sent")->name == "Sent Items");
+
+        REQUIRE(commandsLike(server, "LIST ") == 1);
+        REQUIRE(commandsLike(server, "STATUS ") == (listStatus ? 0 : 3));
+        if (listStatus) {
+            REQUIRE(server.commands().back() ==
+                    "LIST \"\" \"*\" RETURN (SPECIAL-USE STATUS (MESSAGES UNSEEN UIDNEXT UIDVALIDITY))");
+        }
+        REQUIRE(client.listMailboxes() == std::vector<std::string>{"INBOX", "Junk", "Sent Items"});
+    }
+}
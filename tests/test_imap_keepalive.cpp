@@ -0,0 +1,184 @@
+/**
+ * Unit Tests for IMAP keepalive and half-open connection detection
+ */
+
+#include "catch.hpp"
+#include "../include/imap_keepalive.hpp"
+#include "test_helpers.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Pens;
+
+namespace {
+
+std::shared_ptr<ImapClient> connectedClient(PensTest::MockImapServer& server) {
+    auto client = std::make_shared<ImapClient>("127.0.0.1", server.port(), false);
+    REQUIRE(client->connect());
+    REQUIRE(client->authenticate("user@test.com", "secret"));
+    return client;
+}
+
+size_t noopCount(const PensTest::MockImapServer& server) {
+    std::vector<std::string> commands = server.commands();
+    return static_cast<size_t>(std::count(commands.begin(), commands.end(), "NOOP"));
+}
+
+// Probes do not wait for the server, so give it a moment to log the command
+size_t awaitNoops(const PensTest::MockImapServer& server, size_t count) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (noopCount(server) < count && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return noopCount(server);
+}
+
+} // namespace
+
+TEST_CASE("Keepalive probes only idle sessions", "[imap][keepalive]") {
+    PensTest::MockImapServer server;
+    auto client = connectedClient(server);
+
+    ImapKeepaliveSettings settings;
+    settings.idleMs = 100;
+    settings.probeTimeoutMs = 1000;
+    settings.tickMs = 10;
+    ImapKeepalive keepalive(settings);
+    keepalive.add(client);
+    REQUIRE(keepalive.size() == 1);
+
+    // Not idle long enough yet
+    keepalive.runDue(ImapKeepalive::nowMs());
+    REQUIRE(keepalive.getProbesSent() == 0);
+
+    // Traffic in the meantime pushes the probe back
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    REQUIRE(client->noop());
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    keepalive.runDue(ImapKeepalive::nowMs());
+    REQUIRE(keepalive.getProbesSent() == 0);
+    REQUIRE(noopCount(server) == 1);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    keepalive.runDue(ImapKeepalive::nowMs());
+    REQUIRE(keepalive.getProbesSent() == 1);
+    REQUIRE(awaitNoops(server, 2) == 2);
+    REQUIRE(client->isConnected());
+    REQUIRE(keepalive.getDeadDetected() == 0);
+
+    SECTION("The reply is collected at its deadline") {
+        std::this_thread::sleep_for(std::chrono::milliseconds(settings.probeTimeoutMs / 10));
+        keepalive.runDue(ImapKeepalive::nowMs());
+        REQUIRE(client->isConnected());
+        REQUIRE(keepalive.getDeadDetected() == 0);
+    }
+
+    SECTION("A command before the deadline reads the reply first") {
+        REQUIRE(client->noop());
+        REQUIRE(noopCount(server) == 3);
+        REQUIRE(client->isConnected());
+    }
+
+    SECTION("Removed sessions are left alone") {
+        keepalive.remove(1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        keepalive.runDue(ImapKeepalive::nowMs());
+        REQUIRE(keepalive.getProbesSent() == 1);
+        REQUIRE(keepalive.size() == 0);
+    }
+}
+
+TEST_CASE("Keepalive detects half-open sessions without blocking", "[imap][keepalive]") {
+    PensTest::MockImapServer server;
+    std::vector<std::shared_ptr<ImapClient>> clients;
+    for (int i = 0; i < 8; i++) {
+        clients.push_back(connectedClient(server));
+    }
+
+    ImapKeepaliveSettings settings;
+    settings.idleMs = 50;
+    settings.probeTimeoutMs = 200;
+    settings.tickMs = 10;
+    ImapKeepalive keepalive(settings);
+    std::atomic<int> reported(0);
+    keepalive.setDeadCallback([&reported](uint64_t) { reported++; });
+    for (auto& client : clients) {
+        keepalive.add(client);
+    }
+
+    // The server stops answering but the TCP connections stay up
+    server.setStalled(true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(80));
+
+    // All probes go out in one tick that does not wait for any reply
+    auto start = std::chrono::steady_clock::now();
+    keepalive.runDue(ImapKeepalive::nowMs());
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100));
+    REQUIRE(keepalive.getProbesSent() == clients.size());
+    REQUIRE(reported == 0);
+
+    // The reply deadlines are their own timers, all due together
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    keepalive.runDue(ImapKeepalive::nowMs());
+    REQUIRE(reported == 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    start = std::chrono::steady_clock::now();
+    keepalive.runDue(ImapKeepalive::nowMs());
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100));
+
+    REQUIRE(reported == static_cast<int>(clients.size()));
+    REQUIRE(keepalive.getDeadDetected() == clients.size());
+    for (auto& client : clients) {
+        REQUIRE_FALSE(client->isConnected());
+    }
+
+    // A dead session is not probed again until it reconnects
+    std::this_thread::sleep_for(std::chrono::milliseconds(80));
+    keepalive.runDue(ImapKeepalive::nowMs());
+    REQUIRE(keepalive.getProbesSent() == clients.size());
+}
+
+TEST_CASE("Keepalive thread probes many sessions from one wheel", "[imap][keepalive]") {
+    PensTest::MockImapServer server;
+    std::vector<std::shared_ptr<ImapClient>> clients;
+    for (int i = 0; i < 8; i++) {
+        clients.push_back(connectedClient(server));
+    }
+
+    ImapKeepaliveSettings settings;
+    settings.idleMs = 100;
+    settings.tickMs = 10;
+    ImapKeepalive keepalive(settings);
+    for (auto& client : clients) {
+        keepalive.add(client);
+    }
+    keepalive.start();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (noopCount(server) < clients.size() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    keepalive.stop();
+
+    REQUIRE(noopCount(server) >= clients.size());
+    for (auto& client : clients) {
+        REQUIRE(client->isConnected());
+    }
+}
+
+TEST_CASE("IMAP connect gives up on an unreachable host", "[imap][keepalive]") {
+    // TEST-NET-1 (RFC 5737) is never routed, so the SYN goes unanswered
+    ImapClient client("192.0.2.1", 993, false);
+    ImapTimeouts timeouts;
+    timeouts.connectSeconds = 1;
+    client.setTimeouts(timeouts);
+
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE_FALSE(client.connect());
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+}
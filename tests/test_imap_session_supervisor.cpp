@@ -0,0 +1,225 @@
+/**
+ * Unit Tests for IMAP session recovery
+ */
+
+#include "catch.hpp"
+#include "../include/imap_session_supervisor.hpp"
+#include "test_helpers.hpp"
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace Pens;
+
+namespace {
+
+const char kStatePath[] = "test_imap_sync_state.tmp";
+
+struct Harness {
+    PensTest::MockImapServer& server;
+    int64_t now = 1000000;
+    std::shared_ptr<ImapClient> client;
+    std::unique_ptr<ImapSessionSupervisor> supervisor;
+
+    Harness(PensTest::MockImapServer& s, const std::string& statePath = "", int initialBacklog = 10)
+        : server(s) {
+        client = std::make_shared<ImapClient>("127.0.0.1", server.port(), false);
+        REQUIRE(client->connect());
+        REQUIRE(client->authenticate("user@test.com", "secret"));
+
+        ImapSessionSettings settings;
+        settings.watermarkPath = statePath;
+        settings.initialBacklog = initialBacklog;
+        settings.clock = [this]() { return now; };
+        supervisor = std::make_unique<ImapSessionSupervisor>(client, settings);
+    }
+};
+
+std::vector<std::string> subjects(const std::vector<Email>& emails) {
+    std::vector<std::string> result;
+    for (const auto& email : emails) {
+        std::string subject = email.subject;
+        subject.erase(0, subject.find_first_not_of(' '));
+        subject.erase(subject.find_last_not_of("\r ") + 1);
+        result.push_back(subject);
+    }
+    return result;
+}
+
+// Poll and commit straight away, as PensManager does after a handled batch
+std::vector<Email> pollAndCommit(ImapSessionSupervisor& supervisor) {
+    uint32_t lastUid = 0;
+    auto emails = supervisor.poll(lastUid);
+    supervisor.commit(lastUid);
+    return emails;
+}
+
+} // namespace
+
+TEST_CASE("Reconnect backoff grows with jitter and a cap", "[imap][session]") {
+    REQUIRE(ImapSessionSupervisor::backoffDelayMs(1, 1000, 60000, 0.0) == 500);
+    REQUIRE(ImapSessionSupervisor::backoffDelayMs(1, 1000, 60000, 0.999) == 999);
+    REQUIRE(ImapSessionSupervisor::backoffDelayMs(2, 1000, 60000, 0.0) == 1000);
+    REQUIRE(ImapSessionSupervisor::backoffDelayMs(4, 1000, 60000, 0.5) == 6000);
+    REQUIRE(ImapSessionSupervisor::backoffDelayMs(30, 1000, 60000, 0.0) == 30000);
+    REQUIRE(ImapSessionSupervisor::backoffDelayMs(30, 1000, 60000, 0.999) <= 60000);
+}
+
+TEST_CASE("Session supervisor resumes after a dropped connection", "[imap][session]") {
+    std::remove(kStatePath);
+    PensTest::MockImapServer server;
+    server.addMessage("a@test.com", "one", "1\r\n");
+    server.addMessage("a@test.com", "two", "2\r\n");
+    Harness h(server, kStatePath);
+
+    REQUIRE(subjects(pollAndCommit(*h.supervisor)) == std::vector<std::string>{"one", "two"});
+    REQUIRE(pollAndCommit(*h.supervisor).empty());
+    REQUIRE(h.supervisor->getWatermark() == 2);
+
+    SECTION("Drop between polls") {
+        server.addMessage("a@test.com", "three", "3\r\n");
+        server.dropConnections();
+
+        // The dead session is noticed and the reconnect waits out the backoff
+        REQUIRE(pollAndCommit(*h.supervisor).empty());
+        REQUIRE_FALSE(h.client->isConnected());
+        REQUIRE(h.supervisor->getConsecutiveFailures() == 1);
+        REQUIRE_FALSE(h.supervisor->reconnectDue());
+        REQUIRE(pollAndCommit(*h.supervisor).empty());
+        REQUIRE(server.accepted() == 1);
+
+        h.now += 1000;
+        REQUIRE(h.supervisor->reconnectDue());
+        REQUIRE(subjects(pollAndCommit(*h.supervisor)) == std::vector<std::string>{"three"});
+        REQUIRE(h.supervisor->getReconnectCount() == 1);
+        REQUIRE(h.supervisor->getConsecutiveFailures() == 0);
+        REQUIRE(server.accepted() == 2);
+    }
+
+    SECTION("BYE detected by the keepalive probe") {
+        server.sayBye();
+        REQUIRE_FALSE(h.supervisor->checkAlive());
+        h.now += 1000;
+        server.addMessage("a@test.com", "three", "3\r\n");
+        REQUIRE(subjects(pollAndCommit(*h.supervisor)) == std::vector<std::string>{"three"});
+    }
+
+    SECTION("Watermark survives a restart") {
+        server.addMessage("a@test.com", "three", "3\r\n");
+        Harness restarted(server, kStatePath);
+        REQUIRE(restarted.supervisor->getWatermark() == 2);
+        REQUIRE(subjects(pollAndCommit(*restarted.supervisor)) == std::vector<std::string>{"three"});
+    }
+
+    SECTION("Changed UIDVALIDITY starts a fresh sync") {
+        server.resetUidValidity(7);
+        server.addMessage("a@test.com", "three", "3\r\n");
+        Harness restarted(server, kStatePath, 1);
+        REQUIRE(subjects(pollAndCommit(*restarted.supervisor)) == std::vector<std::string>{"three"});
+        REQUIRE(restarted.supervisor->getUidValidity() == 7);
+        REQUIRE(restarted.supervisor->getWatermark() == 3);
+    }
+
+    std::remove(kStatePath);
+}
+
+TEST_CASE("Mail fetched but never committed is delivered again", "[imap][session]") {
+    std::remove(kStatePath);
+    PensTest::MockImapServer server;
+    server.addMessage("a@test.com", "one", "1\r\n");
+    server.addMessage("a@test.com", "two", "2\r\n");
+
+    uint32_t lastUid = 0;
+    {
+        // Fetched, then the process dies before the batch is handled
+        Harness h(server, kStatePath);
+        REQUIRE(subjects(h.supervisor->poll(lastUid)) == std::vector<std::string>{"one", "two"});
+        REQUIRE(lastUid == 2);
+        REQUIRE(h.supervisor->getWatermark() == 0);
+    }
+
+    Harness restarted(server, kStatePath);
+    REQUIRE(restarted.supervisor->getWatermark() == 0);
+    REQUIRE(subjects(restarted.supervisor->poll(lastUid)) == std::vector<std::string>{"one", "two"});
+
+    SECTION("A drop before the commit fetches the batch again") {
+        server.dropConnections();
+        REQUIRE(restarted.supervisor->poll(lastUid).empty());
+        restarted.now += 1000;
+        REQUIRE(subjects(restarted.supervisor->poll(lastUid)) == std::vector<std::string>{"one", "two"});
+    }
+
+    SECTION("Committed mail is not delivered again") {
+        restarted.supervisor->commit(lastUid);
+        REQUIRE(restarted.supervisor->getWatermark() == 2);
+        REQUIRE(restarted.supervisor->poll(lastUid).empty());
+        REQUIRE(lastUid == 0);
+        Harness again(server, kStatePath);
+        REQUIRE(again.supervisor->getWatermark() == 2);
+    }
+
+    std::remove(kStatePath);
+}
+
+TEST_CASE("First sync delivers only the newest backlog", "[imap][session]") {
+    PensTest::MockImapServer server;
+    for (int i = 1; i <= 5; i++) {
+        server.addMessage("a@test.com", "m" + std::to_string(i), "x\r\n");
+    }
+    Harness h(server, "", 2);
+    REQUIRE(subjects(pollAndCommit(*h.supervisor)) == std::vector<std::string>{"m4", "m5"});
+    REQUIRE(pollAndCommit(*h.supervisor).empty());
+}
+
+TEST_CASE("Session supervisor backs off while the server is down", "[imap][session]") {
+    int port;
+    {
+        PensTest::MockImapServer probe;
+        port = probe.port();
+    }
+    int64_t now = 0;
+    ImapSessionSettings settings;
+    settings.backoffBaseMs = 1000;
+    settings.backoffMaxMs = 8000;
+    settings.clock = [&now]() { return now; };
+    ImapSessionSupervisor supervisor(std::make_shared<ImapClient>("127.0.0.1", port, false), settings);
+
+    int64_t previousWait = 0;
+    for (int attempt = 1; attempt <= 6; attempt++) {
+        REQUIRE(supervisor.reconnectDue());
+        REQUIRE_FALSE(supervisor.ensureSession());
+        REQUIRE(supervisor.getConsecutiveFailures() == attempt);
+
+        int64_t wait = 0;
+        while (!supervisor.reconnectDue()) {
+            now += 100;
+            wait += 100;
+        }
+        REQUIRE(wait <= 8000);
+        if (attempt <= 3) {
+            REQUIRE(wait >= previousWait);
+        }
+        previousWait = wait;
+    }
+    REQUIRE(previousWait >= 4000);
+}
+
+TEST_CASE("Session supervisor refreshes a rejected OAuth token", "[imap][session]") {
+    PensTest::MockImapServer server;
+    server.addMessage("a@test.com", "one", "1\r\n");
+
+    ImapSessionSettings settings;
+    auto client = std::make_shared<ImapClient>("127.0.0.1", server.port(), false);
+    ImapSessionSupervisor supervisor(client, settings);
+    std::vector<bool> requests;
+    supervisor.setTokenProvider("user@test.com", [&requests](bool forceRefresh) {
+        requests.push_back(forceRefresh);
+        return std::string(forceRefresh ? "fresh-token" : "stale-token");
+    });
+
+    server.failLogins(1);
+    REQUIRE(subjects(pollAndCommit(supervisor)) == std::vector<std::string>{"one"});
+    REQUIRE(requests == std::vector<bool>{false, true});
+    REQUIRE(server.accepted() == 2);
+}
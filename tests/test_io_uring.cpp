@@ -0,0 +1,218 @@
+/**
+ * Unit Tests for the io_uring ring and the executor backends
+ *
+ * The "[benchmark]" case is hidden; run it with `make bench`.
+ */
+
+#include "catch.hpp"
+#include "../include/async_imap_client.hpp"
+#include "../include/io_executor.hpp"
+#include "../include/io_uring.hpp"
+#include "test_helpers.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace Pens;
+
+namespace {
+
+std::vector<IoBackend> availableBackends() {
+    std::vector<IoBackend> backends = {IoBackend::Epoll};
+    if (IoUring::supported()) {
+        backends.push_back(IoBackend::IoUring);
+    }
+    return backends;
+}
+
+const char* backendName(IoBackend backend) {
+    return backend == IoBackend::IoUring ? "io_uring" : "epoll";
+}
+
+// Connect, log in, select and fetch every message once per round
+Task<int> fetchSession(AsyncImapClient& client, int rounds) {
+    int fetched = 0;
+    if (co_await client.connect() &&
+        co_await client.authenticate("user@test.com", "secret") &&
+        co_await client.selectMailbox("INBOX")) {
+        for (int round = 0; round < rounds; round++) {
+            auto stream = client.fetch("1:*");
+            while (auto email = co_await stream.next()) {
+                fetched++;
+            }
+        }
+        co_await client.logout();
+    }
+    co_return fetched;
+}
+
+// Run sessions concurrently on executor; returns the messages fetched
+int runSessions(IoExecutor& executor, int port, int sessions, int rounds) {
+    std::vector<std::unique_ptr<AsyncImapClient>> clients;
+    // Short timeouts bound every session well inside the deadline below
+    ImapTimeouts timeouts;
+    timeouts.connectSeconds = 5;
+    timeouts.commandSeconds = 5;
+    for (int i = 0; i < sessions; i++) {
+        clients.push_back(std::make_unique<AsyncImapClient>(executor, "127.0.0.1", port, false));
+        clients.back()->setTimeouts(timeouts);
+    }
+    std::atomic<int> fetched{0};
+    std::atomic<int> finished{0};
+    auto session = [&](AsyncImapClient& client) -> Task<void> {
+        fetched += co_await fetchSession(client, rounds);
+        finished++;
+    };
+    for (auto& client : clients) {
+        executor.spawn(session(*client));
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while (finished.load() < sessions && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return finished.load() == sessions ? fetched.load() : -1;
+}
+
+} // namespace
+
+TEST_CASE("io_uring ring writes a linked chain and syncs", "[io_uring]") {
+    if (!IoUring::supported()) {
+        WARN("io_uring not available on this kernel; skipped");
+        return;
+    }
+    const std::string path = "test_io_uring_chain.tmp";
+    std::remove(path.c_str());
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    REQUIRE(fd >= 0);
+
+    IoUring ring;
+    REQUIRE(ring.init(8));
+    std::vector<char> staging(4096);
+    REQUIRE(ring.registerBuffer(staging.data(), staging.size()));
+    std::string first = "fixed buffer;";
+    std::copy(first.begin(), first.end(), staging.begin());
+    std::string second = "plain buffer";
+
+    REQUIRE(ring.writeFixed(fd, staging.data(), static_cast<unsigned>(first.size()), 1, true));
+    REQUIRE(ring.write(fd, second.data(), static_cast<unsigned>(second.size()), 2, true));
+    REQUIRE(ring.fdatasync(fd, 3));
+    REQUIRE(ring.submit());
+    std::vector<IoUring::Completion> completions;
+    while (completions.size() < 3) {
+        REQUIRE(ring.wait(1000));
+        ring.completions(completions);
+    }
+    close(fd);
+
+    for (const auto& completion : completions) {
+        if (completion.userData == 1) {
+            REQUIRE(completion.result == static_cast<int32_t>(first.size()));
+        } else if (completion.userData == 2) {
+            REQUIRE(completion.result == static_cast<int32_t>(second.size()));
+        } else {
+            REQUIRE(completion.result == 0);
+        }
+    }
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    REQUIRE(content.str() == first + second);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Executor backends wait and receive alike", "[io_uring][async]") {
+    for (IoBackend backend : availableBackends()) {
+        INFO(backendName(backend));
+        IoExecutor executor(2, backend);
+        REQUIRE(executor.backend() == backend);
+
+        int pair[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair) == 0);
+        std::string received;
+        auto receive = [&](int timeoutMs) -> Task<ssize_t> {
+            co_return co_await executor.receive(pair[0], received, timeoutMs);
+        };
+        auto readable = [&](int fd, int timeoutMs) -> Task<bool> {
+            co_return co_await executor.readable(fd, timeoutMs);
+        };
+
+        // Nothing yet: the wait times out
+        REQUIRE(syncWait(receive(20)) == -1);
+        REQUIRE(write(pair[1], "hello", 5) == 5);
+        REQUIRE(syncWait(receive(1000)) == 5);
+        REQUIRE(write(pair[1], " world", 6) == 6);
+        REQUIRE(syncWait(receive(1000)) == 6);
+        REQUIRE(received == "hello world");
+
+        // Readiness waits on the other end are unaffected
+        REQUIRE(syncWait(readable(pair[1], 20)) == false);
+
+        // forget() before close(): an io_uring poll still in flight would keep the socket open
+        executor.forget(pair[1]);
+        close(pair[1]);
+        REQUIRE(syncWait(receive(1000)) == 0);
+        executor.forget(pair[0]);
+        close(pair[0]);
+    }
+}
+
+TEST_CASE("Async IMAP sessions fetch alike on both backends", "[io_uring][imap]") {
+    PensTest::MockImapServer server;
+    for (int i = 0; i < 5; i++) {
+        server.addMessage("user" + std::to_string(i) + "@test.com", "Message " + std::to_string(i),
+                          std::string(20000, 'a' + static_cast<char>(i)) + "\r\n");
+    }
+    for (IoBackend backend : availableBackends()) {
+        INFO(backendName(backend));
+        IoExecutor executor(2, backend);
+        REQUIRE(runSessions(executor, server.port(), 20, 2) == 20 * 2 * 5);
+
+        AsyncImapClient client(executor, "127.0.0.1", server.port(), false);
+        auto fetchBodies = [&client]() -> Task<std::vector<Email>> {
+            std::vector<Email> emails;
+            if (co_await client.connect() && co_await client.authenticate("user@test.com", "secret") &&
+                co_await client.selectMailbox("INBOX")) {
+                auto stream = client.fetch("1:*");
+                while (auto email = co_await stream.next()) {
+                    emails.push_back(std::move(*email));
+                }
+            }
+            co_return emails;
+        };
+        std::vector<Email> emails = syncWait(fetchBodies());
+        REQUIRE(emails.size() == 5);
+        REQUIRE(emails[4].body.find(std::string(20000, 'e')) != std::string::npos);
+        syncWait(client.logout());
+    }
+}
+
+TEST_CASE("Executor backend benchmark on the loopback mock server", "[.benchmark]") {
+    const int sessions = 200;
+    const int rounds = 5;
+    const int messages = 20;
+    PensTest::MockImapServer server;
+    for (int i = 0; i < messages; i++) {
+        server.addMessage("user@test.com", "Message " + std::to_string(i), std::string(4096, 'x') + "\r\n");
+    }
+
+    std::printf("%d sessions x %d rounds x %d messages, 2 loop threads\n", sessions, rounds, messages);
+    for (IoBackend backend : availableBackends()) {
+        IoExecutor executor(2, backend);
+        auto start = std::chrono::steady_clock::now();
+        int fetched = runSessions(executor, server.port(), sessions, rounds);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        REQUIRE(fetched == sessions * rounds * messages);
+        std::printf("  %-8s %6lld ms  %8.0f messages/s\n", backendName(backend),
+                    static_cast<long long>(elapsed), fetched * 1000.0 / std::max<long long>(1, elapsed));
+    }
+}
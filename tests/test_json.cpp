@@ -0,0 +1,136 @@
+/**
+ * Unit Tests for JSON Reader/Writer Module
+ */
+
+#include "catch.hpp"
+#include "../include/json.hpp"
+#include <string>
+#include <vector>
+
+using namespace Pens;
+
+namespace {
+
+// Records every event as a compact string for easy comparison
+class RecordingHandler : public JsonHandler {
+public:
+    std::vector<std::string> events;
+
+    bool onObjectStart() override { events.push_back("{"); return true; }
+    bool onObjectEnd() override { events.push_back("}"); return true; }
+    bool onArrayStart() override { events.push_back("["); return true; }
+    bool onArrayEnd() override { events.push_back("]"); return true; }
+    bool onKey(std::string_view key) override { events.push_back("k:" + std::string(key)); return true; }
+    bool onString(std::string_view value) override { events.push_back("s:" + std::string(value)); return true; }
+    bool onNumber(std::string_view raw) override { events.push_back("n:" + std::string(raw)); return true; }
+    bool onBool(bool value) override { events.push_back(value ? "true" : "false"); return true; }
+    bool onNull() override { events.push_back("null"); return true; }
+};
+
+} // namespace
+
+TEST_CASE("JSON reader events", "[json]") {
+    JsonReader reader;
+    RecordingHandler handler;
+
+    SECTION("Nested document") {
+        REQUIRE(reader.parse(R"({"a": [1, -2.5e3, true, null], "b": {"c": "d"}})", handler));
+        std::vector<std::string> expected = {
+            "{", "k:a", "[", "n:1", "n:-2.5e3", "true", "null", "]",
+            "k:b", "{", "k:c", "s:d", "}", "}"
+        };
+        REQUIRE(handler.events == expected);
+    }
+
+    SECTION("Escapes are decoded") {
+        REQUIRE(reader.parse(R"(["a\"b\\c\/d\n", "\u00e9\ud83d\ude00"])", handler));
+        REQUIRE(handler.events[1] == "s:a\"b\\c/d\n");
+        REQUIRE(handler.events[2] == "s:\xC3\xA9\xF0\x9F\x98\x80");
+    }
+
+    SECTION("Unescaped strings are views into the input") {
+        class ViewCheck : public JsonHandler {
+        public:
+            const char* begin = nullptr;
+            const char* end = nullptr;
+            bool inside = false;
+            bool onString(std::string_view value) override {
+                inside = value.data() >= begin && value.data() + value.size() <= end;
+                return true;
+            }
+        } check;
+        std::string doc = R"({"token": "abc"})";
+        check.begin = doc.data();
+        check.end = doc.data() + doc.size();
+        REQUIRE(reader.parse(doc, check));
+        REQUIRE(check.inside);
+    }
+
+    SECTION("Malformed input is rejected") {
+        REQUIRE_FALSE(reader.parse(R"({"a": })", handler));
+        REQUIRE(!reader.getError().empty());
+        REQUIRE_FALSE(reader.parse(R"({"a": "unterminated)", handler));
+        REQUIRE_FALSE(reader.parse(R"([1, 2] trailing)", handler));
+        REQUIRE_FALSE(reader.parse(R"("bad \x escape")", handler));
+        REQUIRE_FALSE(reader.parse(std::string(JsonReader::kMaxDepth + 1, '['), handler));
+    }
+}
+
+TEST_CASE("JSON top-level lookup", "[json]") {
+    std::string json = R"({
+        "nested": {"access_token": "wrong"},
+        "note": "contains \"access_token\": \"also wrong\"",
+        "access_token": "right",
+        "expires_in": 3599
+    })";
+
+    SECTION("Keys inside values or nested objects are ignored") {
+        std::string token;
+        REQUIRE(JsonReader::findString(json, "access_token", token));
+        REQUIRE(token == "right");
+    }
+
+    SECTION("Integer lookup") {
+        int64_t expiresIn = 0;
+        REQUIRE(JsonReader::findInt(json, "expires_in", expiresIn));
+        REQUIRE(expiresIn == 3599);
+    }
+
+    SECTION("Missing or mistyped keys") {
+        std::string value;
+        int64_t number = 0;
+        REQUIRE_FALSE(JsonReader::findString(json, "refresh_token", value));
+        REQUIRE_FALSE(JsonReader::findInt(json, "access_token", number));
+        REQUIRE_FALSE(JsonReader::findString("not json", "access_token", value));
+    }
+}
+
+TEST_CASE("JSON writer", "[json]") {
+    std::string out;
+
+    SECTION("Compact output with escaping") {
+        JsonWriter writer(out);
+        writer.beginObject()
+              .key("token").value("a\"b\\c\n\x01")
+              .key("n").value(int64_t(-42))
+              .key("list").beginArray().value(true).null().endArray()
+              .key("empty").beginObject().endObject()
+              .endObject();
+        REQUIRE(out == R"({"token":"a\"b\\c\n\u0001","n":-42,"list":[true,null],"empty":{}})");
+    }
+
+    SECTION("Round trip through the reader") {
+        JsonWriter writer(out, true);
+        writer.beginObject()
+              .key("access_token").value("x\"y")
+              .key("expires_in").value(3600)
+              .endObject();
+
+        std::string token;
+        int64_t expiresIn = 0;
+        REQUIRE(JsonReader::findString(out, "access_token", token));
+        REQUIRE(JsonReader::findInt(out, "expires_in", expiresIn));
+        REQUIRE(token == "x\"y");
+        REQUIRE(expiresIn == 3600);
+    }
+}
@@ -0,0 +1,77 @@
+/**
+ * Unit Tests for kernel TLS offload
+ *
+ * Sessions run through a TLS relay in front of the mock IMAP server, once
+ * with kTLS requested and once without; on kernels without the "tls"
+ * module both runs take OpenSSL's userspace path.
+ */
+
+#include "catch.hpp"
+#include "../include/async_imap_client.hpp"
+#include "../include/imap_client.hpp"
+#include "../include/kernel_tls.hpp"
+#include "../include/io_uring.hpp"
+#include "test_helpers.hpp"
+#include <string>
+#include <vector>
+#include <openssl/ssl.h>
+
+using namespace Pens;
+using PensTest::TlsRelay;
+
+TEST_CASE("Kernel TLS probe is cached and gates the option", "[kernel_tls]") {
+    bool supported = KernelTls::supported();
+    REQUIRE(KernelTls::supported() == supported);
+    REQUIRE_FALSE(KernelTls::enable(nullptr));
+    REQUIRE_FALSE(KernelTls::sendOffloaded(nullptr));
+    REQUIRE_FALSE(KernelTls::receiveOffloaded(nullptr));
+
+    SSL_CTX* context = SSL_CTX_new(TLS_client_method());
+    REQUIRE(context != nullptr);
+    REQUIRE(KernelTls::enable(context) == supported);
+    REQUIRE(((SSL_CTX_get_options(context) & SSL_OP_ENABLE_KTLS) != 0) == supported);
+    SSL_CTX_free(context);
+}
+
+TEST_CASE("IMAP over TLS fetches alike with kernel TLS on and off", "[kernel_tls][imap]") {
+    PensTest::MockImapServer server;
+    server.addMessage("alice@test.com", "Small", "hello\r\n");
+    // Large enough to span many TLS records
+    server.addMessage("bob@test.com", "Bulk", std::string(200000, 'b') + "\r\n");
+    TlsRelay relay(server.port());
+
+    for (bool kernelTls : {false, true}) {
+        INFO("kernel TLS " << (kernelTls ? "requested" : "off"));
+
+        ImapClient client("127.0.0.1", relay.port(), true);
+        client.setKernelTls(kernelTls);
+        REQUIRE(client.connect());
+        REQUIRE(client.authenticate("user@test.com", "secret"));
+        REQUIRE(client.selectMailbox("INBOX"));
+        Email bulk = client.fetchEmail("2");
+        REQUIRE(bulk.subject.find("Bulk") != std::string::npos);
+        REQUIRE(bulk.body.find(std::string(200000, 'b')) != std::string::npos);
+        REQUIRE(client.noop());
+        client.disconnect();
+
+        IoExecutor executor(1);
+        AsyncImapClient asyncClient(executor, "127.0.0.1", relay.port(), true);
+        asyncClient.setKernelTls(kernelTls);
+        auto fetchAll = [&asyncClient]() -> Task<std::vector<Email>> {
+            std::vector<Email> emails;
+            if (co_await asyncClient.connect() && co_await asyncClient.authenticate("user@test.com", "secret") &&
+                co_await asyncClient.selectMailbox("INBOX")) {
+                auto stream = asyncClient.fetch("1:*");
+                while (auto email = co_await stream.next()) {
+                    emails.push_back(std::move(*email));
+                }
+            }
+            co_return emails;
+        };
+        std::vector<Email> emails = syncWait(fetchAll());
+        REQUIRE(emails.size() == 2);
+        REQUIRE(emails[0].body.find("hello") != std::string::npos);
+        REQUIRE(emails[1].body.find(std::string(200000, 'b')) != std::string::npos);
+        syncWait(asyncClient.logout());
+    }
+}
@@ -0,0 +1,289 @@
+/**
+ * Unit Tests for Persistent Mail Queue Module
+ */
+
+#include "catch.hpp"
+#include "../include/mail_queue.hpp"
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <dirent.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace Pens;
+
+namespace {
+
+const std::string kSpool = "test_mail_spool.tmp";
+
+std::vector<std::string> listSpool() {
+    std::vector<std::string> files;
+    if (DIR* dir = opendir(kSpool.c_str())) {
+        while (struct dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                files.push_back(name);
+            }
+        }
+        closedir(dir);
+    }
+    return files;
+}
+
+void removeSpool() {
+    for (const auto& name : listSpool()) {
+        std::remove((kSpool + "/" + name).c_str());
+    }
+    rmdir(kSpool.c_str());
+}
+
+MailQueueSettings testSettings() {
+    MailQueueSettings settings;
+    settings.spoolDir = kSpool;
+    settings.workers = 2;
+    settings.retryBaseMs = 10;
+    settings.retryMaxMs = 40;
+    return settings;
+}
+
+} // namespace
+
+TEST_CASE("Mail queue delivery", "[mail_queue]") {
+    removeSpool();
+
+    SECTION("Messages are delivered") {
+        std::atomic<int> sent{0};
+        MailQueue queue(testSettings(), [&](const OutboundMessage&) { sent++; return 250; });
+        REQUIRE(queue.start());
+
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(queue.enqueue("from@test.com", "to@test.com", "Subject", "Body") != 0);
+        }
+        REQUIRE(queue.flush());
+        REQUIRE(queue.waitIdle(5000));
+        REQUIRE(sent == 100);
+        REQUIRE(queue.getDeliveredCount() == 100);
+        REQUIRE(queue.getPendingCount() == 0);
+    }
+
+    SECTION("Transient failures are retried with backoff") {
+        std::mutex mutex;
+        std::map<uint64_t, int> attempts;
+        MailQueue queue(testSettings(), [&](const OutboundMessage& message) {
+            std::lock_guard<std::mutex> lock(mutex);
+            return ++attempts[message.id] < 3 ? 451 : 250;
+        });
+        REQUIRE(queue.start());
+
+        uint64_t id = queue.enqueue("from@test.com", "to@test.com", "Subject", "Body");
+        REQUIRE(queue.waitIdle(5000));
+        REQUIRE(attempts[id] == 3);
+        REQUIRE(queue.getDeliveredCount() == 1);
+        REQUIRE(queue.getDeadLetterCount() == 0);
+    }
+
+    SECTION("Permanent failures are dead-lettered without retry") {
+        std::atomic<int> calls{0};
+        MailQueue queue(testSettings(), [&](const OutboundMessage&) { calls++; return 550; });
+        REQUIRE(queue.start());
+
+        queue.enqueue("from@test.com", "nobody@test.com", "Subject", "Body");
+        REQUIRE(queue.waitIdle(5000));
+        REQUIRE(calls == 1);
+        REQUIRE(queue.getDeadLetterCount() == 1);
+
+        auto letters = queue.getDeadLetters();
+        REQUIRE(letters.size() == 1);
+        REQUIRE(letters[0].to == "nobody@test.com");
+        REQUIRE(letters[0].body == "Body");
+    }
+
+    SECTION("Retries stop after maxAttempts") {
+        MailQueueSettings settings = testSettings();
+        settings.maxAttempts = 3;
+        std::atomic<int> calls{0};
+        MailQueue queue(settings, [&](const OutboundMessage&) { calls++; return 0; });
+        REQUIRE(queue.start());
+
+        queue.enqueue("from@test.com", "to@test.com", "Subject", "Body");
+        REQUIRE(queue.waitIdle(5000));
+        REQUIRE(calls == 3);
+        REQUIRE(queue.getDeadLetterCount() == 1);
+    }
+
+    removeSpool();
+}
+
+TEST_CASE("Mail queue survives restarts", "[mail_queue]") {
+    removeSpool();
+
+    {
+        MailQueueSettings settings = testSettings();
+        settings.workers = 0;
+        MailQueue queue(settings, [](const OutboundMessage&) { return 250; });
+        REQUIRE(queue.start());
+        for (int i = 0; i < 5; i++) {
+            queue.enqueue("from@test.com", "user" + std::to_string(i) + "@test.com", "Subject", "Body");
+        }
+        REQUIRE(queue.flush());
+    }
+
+    SECTION("Queued messages are delivered after a restart") {
+        std::vector<std::string> recipients;
+        std::mutex mutex;
+        MailQueue queue(testSettings(), [&](const OutboundMessage& message) {
+            std::lock_guard<std::mutex> lock(mutex);
+            recipients.push_back(message.to);
+            return 250;
+        });
+        REQUIRE(queue.start());
+        REQUIRE(queue.waitIdle(5000));
+        REQUIRE(recipients.size() == 5);
+        REQUIRE(queue.enqueue("from@test.com", "new@test.com", "S", "B") > 5);
+    }
+
+    SECTION("A torn record at the tail is ignored") {
+        std::vector<std::string> files = listSpool();
+        REQUIRE(files.size() == 1);
+        {
+            std::ofstream segment(kSpool + "/" + files[0], std::ios::app | std::ios::binary);
+            segment << "PMQ1\x01partial";
+        }
+
+        std::atomic<int> sent{0};
+        MailQueue queue(testSettings(), [&](const OutboundMessage&) { sent++; return 250; });
+        REQUIRE(queue.start());
+        REQUIRE(queue.waitIdle(5000));
+        REQUIRE(sent == 5);
+    }
+
+    SECTION("Delivered messages are not sent again") {
+        {
+            MailQueue queue(testSettings(), [](const OutboundMessage&) { return 250; });
+            REQUIRE(queue.start());
+            REQUIRE(queue.waitIdle(5000));
+        }
+        std::atomic<int> sent{0};
+        MailQueue queue(testSettings(), [&](const OutboundMessage&) { sent++; return 250; });
+        REQUIRE(queue.start());
+        REQUIRE(queue.getPendingCount() == 0);
+        REQUIRE(sent == 0);
+    }
+
+    removeSpool();
+}
+
+TEST_CASE("Mail queue spool writes survive a restart on either write path", "[mail_queue]") {
+    for (bool useIoUring : {false, true}) {
+        removeSpool();
+        // More than one staging buffer's worth, so io_uring needs several rounds
+        const int count = 150;
+        const std::string body(8 * 1024, 'x');
+        {
+            MailQueueSettings settings = testSettings();
+            settings.workers = 0;
+            settings.useIoUring = useIoUring;
+            MailQueue queue(settings, [](const OutboundMessage&) { return 250; });
+            REQUIRE(queue.start());
+            for (int i = 0; i < count; i++) {
+                queue.enqueue("from@test.com", "user" + std::to_string(i) + "@test.com", "Subject", body);
+            }
+            REQUIRE(queue.flush());
+        }
+
+        std::atomic<int> intact{0};
+        MailQueue queue(testSettings(), [&](const OutboundMessage& message) {
+            if (message.body == body) {
+                intact++;
+            }
+            return 250;
+        });
+        REQUIRE(queue.start());
+        REQUIRE(queue.waitIdle(5000));
+        REQUIRE(intact == count);
+    }
+    removeSpool();
+}
+
+TEST_CASE("Mail queue retries a failed spool write without losing later records", "[mail_queue]") {
+    // A file size limit makes the kernel cut the next spool write short
+    std::signal(SIGXFSZ, SIG_IGN);
+    struct rlimit saved;
+    REQUIRE(getrlimit(RLIMIT_FSIZE, &saved) == 0);
+
+    for (bool useIoUring : {false, true}) {
+        removeSpool();
+        {
+            MailQueueSettings settings = testSettings();
+            settings.workers = 0;
+            settings.useIoUring = useIoUring;
+            MailQueue queue(settings, [](const OutboundMessage&) { return 250; });
+            REQUIRE(queue.start());
+            queue.enqueue("from@test.com", "first@test.com", "Subject", "Body");
+            REQUIRE(queue.flush());
+
+            std::vector<std::string> files = listSpool();
+            REQUIRE(files.size() == 1);
+            struct stat info;
+            REQUIRE(stat((kSpool + "/" + files[0]).c_str(), &info) == 0);
+
+            struct rlimit limit = saved;
+            limit.rlim_cur = info.st_size + 16;
+            REQUIRE(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+            queue.enqueue("from@test.com", "second@test.com", "Subject", std::string(256, 'x'));
+            bool flushed = queue.flush();
+            REQUIRE(setrlimit(RLIMIT_FSIZE, &saved) == 0);
+            REQUIRE_FALSE(flushed);
+
+            // The failed record is written again ahead of the next one
+            queue.enqueue("from@test.com", "third@test.com", "Subject", "Body");
+            REQUIRE(queue.flush());
+        }
+
+        std::vector<std::string> recipients;
+        std::mutex mutex;
+        MailQueue queue(testSettings(), [&](const OutboundMessage& message) {
+            std::lock_guard<std::mutex> lock(mutex);
+            recipients.push_back(message.to);
+            return 250;
+        });
+        REQUIRE(queue.start());
+        REQUIRE(queue.waitIdle(5000));
+        std::sort(recipients.begin(), recipients.end());
+        REQUIRE(recipients == std::vector<std::string>{"first@test.com", "second@test.com", "third@test.com"});
+    }
+
+    std::signal(SIGXFSZ, SIG_DFL);
+    removeSpool();
+}
+
+TEST_CASE("Mail queue reclaims delivered segments", "[mail_queue]") {
+    removeSpool();
+
+    MailQueueSettings settings = testSettings();
+    settings.segmentMaxBytes = 512;
+    {
+        MailQueue queue(settings, [](const OutboundMessage&) { return 250; });
+        REQUIRE(queue.start());
+        for (int i = 0; i < 50; i++) {
+            queue.enqueue("from@test.com", "to@test.com", "Subject", std::string(100, 'x'));
+        }
+        REQUIRE(queue.waitIdle(5000));
+        REQUIRE(queue.flush());
+        // Trigger one more flush so drained segments are collected
+        queue.enqueue("from@test.com", "to@test.com", "Subject", "last");
+        REQUIRE(queue.waitIdle(5000));
+        REQUIRE(queue.flush());
+    }
+
+    REQUIRE(listSpool().size() <= 2);
+    removeSpool();
+}
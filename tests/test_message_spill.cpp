@@ -0,0 +1,218 @@
+/**
+ * Unit Tests for spilling large messages to disk while fetching
+ */
+
+#include "catch.hpp"
+#include "../include/async_imap_client.hpp"
+#include "../include/imap_client.hpp"
+#include "../include/message_spill.hpp"
+#include "test_helpers.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+
+using namespace Pens;
+
+namespace {
+
+// A text whose bytes depend on their offset, so a misplaced chunk shows
+std::string patternedText(size_t size) {
+    std::string text;
+    text.reserve(size + 2);
+    for (size_t i = 0; text.size() < size; i++) {
+        text += "line " + std::to_string(i) + " of a very large message\r\n";
+    }
+    text.resize(size);
+    return text + "\r\n";
+}
+
+MessageSpillSettings smallSpill() {
+    MessageSpillSettings settings;
+    settings.thresholdBytes = 64 * 1024;
+    settings.prefixBytes = 4096;
+    settings.directory = ".";
+    return settings;
+}
+
+bool fileExists(const std::string& path) {
+    return access(path.c_str(), F_OK) == 0;
+}
+
+size_t openDescriptors() {
+    size_t count = 0;
+    if (DIR* dir = opendir("/proc/self/fd")) {
+        while (readdir(dir)) {
+            count++;
+        }
+        closedir(dir);
+    }
+    return count;
+}
+
+} // namespace
+
+TEST_CASE("Message spill writes, reads back and removes its file", "[spill]") {
+    std::string path;
+    {
+        MessageSpill spill(".");
+        REQUIRE(spill.valid());
+        path = spill.path();
+        REQUIRE(fileExists(path));
+
+        REQUIRE(spill.append("hello ", 6));
+        REQUIRE(spill.append("world", 5));
+        REQUIRE(spill.size() == 11);
+
+        std::string out;
+        REQUIRE(spill.read(0, 100, out));
+        REQUIRE(out == "hello world");
+        out.clear();
+        REQUIRE(spill.read(6, 3, out));
+        REQUIRE(out == "wor");
+        out.clear();
+        REQUIRE(spill.read(50, 3, out));
+        REQUIRE(out.empty());
+    }
+    REQUIRE_FALSE(fileExists(path));
+
+    SECTION("Finished spills hold no descriptor and still read back") {
+        size_t before = openDescriptors();
+        std::vector<std::unique_ptr<MessageSpill>> spills;
+        for (int i = 0; i < 50; i++) {
+            spills.push_back(std::make_unique<MessageSpill>("."));
+            REQUIRE(spills.back()->append("spill ", 6));
+            REQUIRE(spills.back()->append(std::to_string(i).data(), std::to_string(i).size()));
+            REQUIRE(spills.back()->finish());
+        }
+        REQUIRE(openDescriptors() == before);
+
+        std::string out;
+        REQUIRE(spills[42]->read(0, 100, out));
+        REQUIRE(out == "spill 42");
+        REQUIRE(openDescriptors() == before);
+        REQUIRE_FALSE(spills[42]->append("x", 1));
+    }
+
+    MessageSpill broken("/nonexistent-directory");
+    REQUIRE_FALSE(broken.valid());
+    REQUIRE_FALSE(broken.append("x", 1));
+}
+
+TEST_CASE("Large messages are fetched to a spill file with a bounded body", "[spill][imap]") {
+    PensTest::MockImapServer server;
+    const std::string large = patternedText(3 * 1024 * 1024);
+    server.addMessage("alice@test.com", "URGENT small", "hello\r\n");
+    server.addMessage("bob@test.com", "URGENT bulk", large);
+
+    ImapClient client("127.0.0.1", server.port(), false);
+    client.setSpillSettings(smallSpill());
+    REQUIRE(client.connect());
+    REQUIRE(client.authenticate("user@test.com", "secret"));
+    REQUIRE(client.selectMailbox("INBOX"));
+
+    Email small = client.fetchEmail("1");
+    REQUIRE(small.spill == nullptr);
+    REQUIRE(small.body.find("hello") != std::string::npos);
+    REQUIRE(small.size > 0);
+
+    std::string path;
+    {
+        Email bulk = client.fetchEmail("2");
+        REQUIRE(bulk.spill != nullptr);
+        path = bulk.spill->path();
+        // The classifier sees the headers and a bounded prefix
+        REQUIRE(bulk.subject.find("URGENT bulk") != std::string::npos);
+        REQUIRE(bulk.priority == 8);
+        REQUIRE(bulk.body.size() < 4096 + 256);
+        REQUIRE(large.compare(0, 1000, bulk.body, bulk.body.find("line 0 "), 1000) == 0);
+        REQUIRE(bulk.size > large.size());
+
+        REQUIRE(bulk.spill->size() == large.size());
+        std::string text;
+        REQUIRE(bulk.spill->read(0, bulk.spill->size(), text));
+        REQUIRE(text == large);
+
+        // The session stays in step after the streamed literal
+        REQUIRE(client.noop());
+        Email copy = bulk;
+        REQUIRE(copy.spill == bulk.spill);
+    }
+    REQUIRE_FALSE(fileExists(path));
+
+    SECTION("Fetched messages keep their spills without open files") {
+        size_t before = openDescriptors();
+        std::vector<Email> kept;
+        for (int i = 0; i < 10; i++) {
+            kept.push_back(client.fetchEmail("2"));
+            REQUIRE(kept.back().spill != nullptr);
+        }
+        REQUIRE(openDescriptors() == before);
+        std::string text;
+        REQUIRE(kept[7].spill->read(0, kept[7].spill->size(), text));
+        REQUIRE(text == large);
+    }
+
+    SECTION("A failed spill keeps the prefix and the session") {
+        MessageSpillSettings nowhere = smallSpill();
+        nowhere.directory = "/nonexistent-directory";
+        client.setSpillSettings(nowhere);
+        Email bulk = client.fetchEmail("2");
+        REQUIRE(bulk.spill == nullptr);
+        REQUIRE(bulk.subject.find("URGENT bulk") != std::string::npos);
+        REQUIRE(large.compare(0, 1000, bulk.body, bulk.body.find("line 0 "), 1000) == 0);
+        REQUIRE(client.noop());
+        // The warning names the message: async fetches read its UID off the item
+        REQUIRE(ImapClient::fetchUid("* 2 FETCH (UID 17 FLAGS () BODY[HEADER] {9}\r\n") == "17");
+        REQUIRE(ImapClient::fetchUid("* 2 FETCH (FLAGS ())") == "?");
+    }
+
+    SECTION("A zero threshold keeps everything in memory") {
+        MessageSpillSettings never = smallSpill();
+        never.thresholdBytes = 0;
+        client.setSpillSettings(never);
+        Email bulk = client.fetchEmail("2");
+        REQUIRE(bulk.spill == nullptr);
+        REQUIRE(bulk.body.find(large) != std::string::npos);
+    }
+}
+
+TEST_CASE("Async fetch spills large messages the same way", "[spill][async]") {
+    PensTest::MockImapServer server;
+    const std::string large = patternedText(2 * 1024 * 1024);
+    server.addMessage("alice@test.com", "Small", "hello\r\n");
+    server.addMessage("bob@test.com", "Bulk", large);
+    server.addMessage("carol@test.com", "After", "still in step\r\n");
+
+    IoExecutor executor(1);
+    AsyncImapClient client(executor, "127.0.0.1", server.port(), false);
+    client.setSpillSettings(smallSpill());
+    auto fetchAll = [&client]() -> Task<std::vector<Email>> {
+        std::vector<Email> emails;
+        if (co_await client.connect() && co_await client.authenticate("user@test.com", "secret") &&
+            co_await client.selectMailbox("INBOX")) {
+            auto stream = client.fetch("1:*");
+            while (auto email = co_await stream.next()) {
+                emails.push_back(std::move(*email));
+            }
+        }
+        co_return emails;
+    };
+    std::vector<Email> emails = syncWait(fetchAll());
+    syncWait(client.logout());
+
+    REQUIRE(emails.size() == 3);
+    REQUIRE(emails[0].spill == nullptr);
+    REQUIRE(emails[2].spill == nullptr);
+    REQUIRE(emails[2].body.find("still in step") != std::string::npos);
+
+    const Email& bulk = emails[1];
+    REQUIRE(bulk.spill != nullptr);
+    REQUIRE(bulk.subject.find("Bulk") != std::string::npos);
+    REQUIRE(bulk.body.size() < 4096 + 256);
+    REQUIRE(bulk.size > large.size());
+    std::string text;
+    REQUIRE(bulk.spill->read(0, bulk.spill->size(), text));
+    REQUIRE(text == large);
+}
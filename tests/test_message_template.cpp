@@ -0,0 +1,154 @@
+/**
+ * Unit Tests for Message Templates
+ */
+
+#include "catch.hpp"
+#include "../include/message_template.hpp"
+#include "../include/smtp_client.hpp"
+#include "test_helpers.hpp"
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace Pens;
+
+namespace {
+
+std::string flatten(MessageWriter& writer) {
+    std::string wire;
+    for (const auto& segment : writer.segments()) {
+        wire.append(static_cast<const char*>(segment.iov_base), segment.iov_len);
+    }
+    return wire;
+}
+
+} // namespace
+
+TEST_CASE("Message template rendering", "[template]") {
+    MessageTemplate tmpl;
+    REQUIRE(tmpl.parse("From: {{from}}\nTo: {{ to }}\nSubject: Hello {{name}}\n",
+                       "Hi {{name}},\nyour code is {{code}}.\n"));
+    REQUIRE(tmpl.slots() == std::vector<std::string>{"from", "to", "name", "date", "code"});
+
+    MessageWriter writer(MessageWriter::Mode::Bdat);
+    TemplateValues values;
+    values.set("from", "a@example.com");
+    values.set("to", "b@example.com");
+    values.set("name", "Bob");
+    values.set("code", "012345");
+    values.set("date", "Thu, 01 Jan 2026 00:00:00 +0000");
+
+    SECTION("Slots are substituted and headers completed") {
+        REQUIRE(tmpl.render(values, writer));
+        REQUIRE(flatten(writer) ==
+                "From: a@example.com\r\n"
+                "To: b@example.com\r\n"
+                "Subject: Hello Bob\r\n"
+                "Date: Thu, 01 Jan 2026 00:00:00 +0000\r\n"
+                "MIME-Version: 1.0\r\n"
+                "Content-Type: text/plain; charset=UTF-8\r\n"
+                "\r\n"
+                "Hi Bob,\r\nyour code is 012345.\r\n");
+    }
+
+    SECTION("Values are referenced, not copied") {
+        std::string code = "999999";
+        values.set("code", code);
+        REQUIRE(tmpl.render(values, writer));
+        bool referenced = false;
+        for (const auto& segment : writer.segments()) {
+            referenced = referenced || segment.iov_base == code.data();
+        }
+        REQUIRE(referenced);
+    }
+
+    SECTION("Date defaults to the cached current date") {
+        TemplateValues noDate;
+        noDate.set("from", "a@example.com");
+        noDate.set("to", "b@example.com");
+        noDate.set("name", "Bob");
+        noDate.set("code", "1");
+        REQUIRE(tmpl.render(noDate, writer));
+        REQUIRE(flatten(writer).find("Date: " + std::string(MailDate::now()) + "\r\n") != std::string::npos);
+    }
+
+    SECTION("Missing values fail") {
+        TemplateValues partial;
+        partial.set("from", "a@example.com");
+        REQUIRE_FALSE(tmpl.render(partial, writer));
+    }
+
+    SECTION("Line breaks in header values are refused") {
+        values.set("name", "Bob\r\nBcc: victim@example.com");
+        REQUIRE_FALSE(tmpl.render(values, writer));
+        // Body values may span lines
+        values.set("name", "Bob");
+        values.set("code", "1\n2");
+        REQUIRE(tmpl.render(values, writer));
+    }
+}
+
+TEST_CASE("Message template parts", "[template]") {
+    SECTION("HTML part makes the message multipart/alternative") {
+        MessageTemplate tmpl;
+        REQUIRE(tmpl.parse("Subject: x", "plain {{v}}", "<p>{{v}}</p>"));
+        TemplateValues values;
+        values.set("v", "42");
+        MessageWriter writer(MessageWriter::Mode::Bdat);
+        REQUIRE(tmpl.render(values, writer));
+        std::string wire = flatten(writer);
+
+        size_t boundaryAt = wire.find("boundary=\"");
+        REQUIRE(boundaryAt != std::string::npos);
+        std::string boundary = wire.substr(boundaryAt + 10, wire.find('"', boundaryAt + 10) - boundaryAt - 10);
+        REQUIRE(wire.find("--" + boundary + "\r\nContent-Type: text/plain; charset=UTF-8\r\n\r\nplain 42\r\n") != std::string::npos);
+        REQUIRE(wire.find("--" + boundary + "\r\nContent-Type: text/html; charset=UTF-8\r\n\r\n<p>42</p>\r\n") != std::string::npos);
+        REQUIRE(wire.find("--" + boundary + "--\r\n") != std::string::npos);
+    }
+
+    SECTION("Unterminated placeholders are rejected") {
+        MessageTemplate tmpl;
+        REQUIRE_FALSE(tmpl.parse("Subject: x", "broken {{code"));
+        REQUIRE(tmpl.empty());
+    }
+
+    SECTION("Templates load from files") {
+        { std::ofstream("test_template_headers.tmp") << "Subject: {{subject}}\n"; }
+        { std::ofstream("test_template_text.tmp") << "Body {{code}}\n"; }
+        MessageTemplate tmpl;
+        REQUIRE(tmpl.loadFromFiles("test_template_headers.tmp", "test_template_text.tmp"));
+        REQUIRE_FALSE(tmpl.loadFromFiles("test_template_headers.tmp", "missing_template.tmp"));
+        std::remove("test_template_headers.tmp");
+        std::remove("test_template_text.tmp");
+        REQUIRE(tmpl.slots() == std::vector<std::string>{"subject", "date", "code"});
+    }
+}
+
+TEST_CASE("Cached mail date", "[template]") {
+    std::string_view first = MailDate::now();
+    REQUIRE(first.size() >= 29);
+    REQUIRE(first[3] == ',');
+    // Same second, same buffer
+    REQUIRE(MailDate::now().data() == first.data());
+    REQUIRE(MailDate::format(0).size() == first.size());
+}
+
+TEST_CASE("Verification code emails come from the built-in template", "[template]") {
+    PensTest::MockSmtpServer server({"PIPELINING"});
+    SmtpClient client("127.0.0.1", server.port(), false);
+    REQUIRE(client.connect());
+    REQUIRE(client.authenticate("sender@test.com", "secret"));
+
+    REQUIRE(client.sendVerificationCode("user@test.com", "004217"));
+    REQUIRE(client.sendVerificationCode("other@test.com", "123456"));
+    REQUIRE(server.messages().size() == 2);
+    std::vector<std::string> messages = server.messages();
+    const std::string& message = messages[0];
+    REQUIRE(message.find("From: sender@test.com\r\n") != std::string::npos);
+    REQUIRE(message.find("To: user@test.com\r\n") != std::string::npos);
+    REQUIRE(message.find("Subject: Your Verification Code - Velivolant\r\n") != std::string::npos);
+    REQUIRE(message.find("Your verification code is: 004217\r\n") != std::string::npos);
+    REQUIRE(messages[1].find("Your verification code is: 123456\r\n") != std::string::npos);
+    client.disconnect();
+}
@@ -0,0 +1,88 @@
+/**
+ * Unit Tests for Message Writer Module
+ */
+
+#include "catch.hpp"
+#include "../include/message_writer.hpp"
+#include <string>
+
+using namespace Pens;
+
+namespace {
+
+std::string flatten(MessageWriter& writer) {
+    std::string wire;
+    for (const auto& segment : writer.segments()) {
+        wire.append(static_cast<const char*>(segment.iov_base), segment.iov_len);
+    }
+    return wire;
+}
+
+} // namespace
+
+TEST_CASE("Message writer DATA mode", "[message_writer]") {
+    MessageWriter writer(MessageWriter::Mode::Data);
+    writer.setHeaders("Subject: x\r\n\r\n");
+
+    SECTION("Lines starting with a dot are stuffed") {
+        std::string body = ".first\r\nmiddle\r\n..double\r\n.\r\nlast";
+        writer.setBody(body);
+        REQUIRE(flatten(writer) ==
+                "Subject: x\r\n\r\n..first\r\nmiddle\r\n...double\r\n..\r\nlast\r\n.\r\n");
+        REQUIRE(writer.size() == flatten(writer).size());
+    }
+
+    SECTION("Bare LF becomes CRLF") {
+        std::string body = "one\ntwo\r\n.three\n";
+        writer.setBody(body);
+        REQUIRE(flatten(writer) == "Subject: x\r\n\r\none\r\ntwo\r\n..three\r\n.\r\n");
+    }
+
+    SECTION("Body is referenced, not copied") {
+        std::string body(10000, 'a');
+        writer.setBody(body);
+        bool referenced = false;
+        for (const auto& segment : writer.segments()) {
+            if (segment.iov_base == body.data() && segment.iov_len == body.size()) {
+                referenced = true;
+            }
+        }
+        REQUIRE(referenced);
+        REQUIRE(writer.segments().size() == 3);
+    }
+}
+
+TEST_CASE("Message writer BDAT mode", "[message_writer]") {
+    MessageWriter writer(MessageWriter::Mode::Bdat);
+    writer.setHeaders("Subject: x\r\n\r\n");
+    std::string body = ".kept as is\nend";
+    writer.setBody(body);
+
+    REQUIRE(flatten(writer) == "Subject: x\r\n\r\n.kept as is\r\nend");
+    REQUIRE(writer.size() == flatten(writer).size());
+}
+
+TEST_CASE("Message writer body pieces", "[message_writer]") {
+    MessageWriter writer(MessageWriter::Mode::Data);
+
+    SECTION("Line state carries across pieces") {
+        writer.appendBody("Subject: x\r\n\r\nline\n");
+        writer.appendBody(".dot at line start");
+        writer.appendBody("\nno");
+        writer.appendBody(".dot mid-line\n");
+        REQUIRE(flatten(writer) ==
+                "Subject: x\r\n\r\nline\r\n..dot at line start\r\nno.dot mid-line\r\n.\r\n");
+    }
+
+    SECTION("Clearing keeps the segment buffer") {
+        writer.appendBody("first\r\n");
+        writer.appendBody("second");
+        writer.segments();
+        const struct iovec* buffer = writer.segments().data();
+        writer.clear();
+        writer.appendBody("third\r\n");
+        writer.appendBody("fourth");
+        REQUIRE(flatten(writer) == "third\r\nfourth\r\n.\r\n");
+        REQUIRE(writer.segments().data() == buffer);
+    }
+}
@@ -0,0 +1,191 @@
+/**
+ * Unit Tests for Send Rate Limiting
+ */
+
+#include "catch.hpp"
+#include "../include/rate_limiter.hpp"
+#include "../include/verification_code.hpp"
+#include "../include/verification_server.hpp"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Pens;
+
+namespace {
+
+RateLimiterSettings testSettings(std::atomic<int64_t>& clock) {
+    RateLimiterSettings settings;
+    settings.perRecipient = {3, 60 * 1000};
+    settings.perDomain = {10, 60 * 1000};
+    settings.global = {100, 1000};
+    settings.tableSlots = 1024;
+    settings.clock = [&clock]() { return clock.load(); };
+    return settings;
+}
+
+bool noEntropy(unsigned char*, size_t) {
+    return false;
+}
+
+} // namespace
+
+TEST_CASE("Per-recipient limits", "[rate_limiter]") {
+    std::atomic<int64_t> clock(1000000000);
+    RateLimiter limiter(testSettings(clock));
+
+    SECTION("Burst up to the count, then refuse") {
+        for (int i = 0; i < 3; i++) {
+            REQUIRE(limiter.acquire("user@example.com").allowed());
+        }
+        RateCheck check = limiter.acquire("User@Example.com");
+        REQUIRE(check.decision == RateDecision::RecipientLimited);
+        // One send is earned back every 20 seconds
+        REQUIRE(check.retryAfterMs == 20000);
+        REQUIRE(limiter.acquire("other@example.com").allowed());
+    }
+
+    SECTION("Budget refills at the steady rate") {
+        for (int i = 0; i < 3; i++) {
+            REQUIRE(limiter.acquire("user@example.com").allowed());
+        }
+        clock += 19 * 1000 * 1000;
+        REQUIRE_FALSE(limiter.acquire("user@example.com").allowed());
+        clock += 1000 * 1000;
+        REQUIRE(limiter.acquire("user@example.com").allowed());
+        REQUIRE_FALSE(limiter.acquire("user@example.com").allowed());
+    }
+
+    SECTION("Released sends are refunded") {
+        for (int i = 0; i < 3; i++) {
+            REQUIRE(limiter.acquire("user@example.com").allowed());
+        }
+        limiter.release("user@example.com");
+        REQUIRE(limiter.acquire("user@example.com").allowed());
+        REQUIRE_FALSE(limiter.acquire("user@example.com").allowed());
+        // Nothing to refund for a key that was never charged
+        limiter.release("nobody@example.com");
+        REQUIRE(limiter.acquire("nobody@example.com").allowed());
+    }
+}
+
+TEST_CASE("Domain and global limits", "[rate_limiter]") {
+    std::atomic<int64_t> clock(1000000000);
+    RateLimiter limiter(testSettings(clock));
+
+    SECTION("Many recipients at one domain share its budget") {
+        for (int i = 0; i < 10; i++) {
+            REQUIRE(limiter.acquire("user" + std::to_string(i) + "@example.com").allowed());
+        }
+        RateCheck check = limiter.acquire("late@EXAMPLE.com");
+        REQUIRE(check.decision == RateDecision::DomainLimited);
+        REQUIRE(limiter.acquire("late@example.org").allowed());
+
+        // The refused send did not use up the recipient's own budget
+        clock += 6 * 1000 * 1000;
+        for (int i = 0; i < 3; i++) {
+            clock += 6 * 1000 * 1000;
+            REQUIRE(limiter.acquire("late@example.com").allowed());
+        }
+    }
+
+    SECTION("Global limit caps every domain together") {
+        int allowed = 0;
+        for (int i = 0; i < 200; i++) {
+            std::string recipient = "u@d" + std::to_string(i) + ".example";
+            RateCheck check = limiter.acquire(recipient);
+            if (check.allowed()) {
+                allowed++;
+            } else {
+                REQUIRE(check.decision == RateDecision::GlobalLimited);
+            }
+        }
+        REQUIRE(allowed == 100);
+    }
+}
+
+TEST_CASE("Rate limit entries expire and free their slots", "[rate_limiter]") {
+    std::atomic<int64_t> clock(1000000000);
+    RateLimiterSettings settings = testSettings(clock);
+    settings.perDomain = {};
+    settings.global = {};
+    settings.tableSlots = 16;
+    RateLimiter limiter(settings);
+
+    for (int i = 0; i < 16; i++) {
+        REQUIRE(limiter.acquire("user" + std::to_string(i) + "@example.com").allowed());
+    }
+    // Every slot holds live state, so a new key is refused
+    REQUIRE(limiter.acquire("new@example.com").decision == RateDecision::RecipientLimited);
+
+    // Once the earlier sends have been paid back their slots are reusable
+    clock += 20 * 1000 * 1000;
+    REQUIRE(limiter.acquire("new@example.com").allowed());
+}
+
+TEST_CASE("Rate limiter is exact under concurrent use", "[rate_limiter]") {
+    RateLimiterSettings settings;
+    settings.perRecipient = {};
+    settings.perDomain = {};
+    settings.global = {500, 60 * 60 * 1000};
+    RateLimiter limiter(settings);
+
+    std::atomic<int> allowed(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&limiter, &allowed, t]() {
+            for (int i = 0; i < 1000; i++) {
+                if (limiter.acquire("t" + std::to_string(t) + "@example.com").allowed()) {
+                    allowed++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(allowed == 500);
+}
+
+TEST_CASE("Verification server refuses rate-limited issues", "[rate_limiter]") {
+    const std::string socketPath = "test_rate_limited.sock";
+    VerificationService service;
+    RateLimiterSettings limits;
+    limits.perRecipient = {1, 60 * 1000};
+    RateLimiter limiter(limits);
+
+    VerificationServerSettings settings;
+    settings.socketPath = socketPath;
+    VerificationServer server(settings, service, [](const std::string&, const std::string&) { return true; });
+    server.setRateLimiter(&limiter);
+    REQUIRE(server.start());
+
+    REQUIRE(VerificationServer::request(socketPath, "ISSUE once@example.com").compare(0, 3, "OK ") == 0);
+    REQUIRE(VerificationServer::request(socketPath, "ISSUE once@example.com").compare(0, 20, "ERR rate_limited 600") == 0);
+    server.stop();
+}
+
+TEST_CASE("Failed issues do not use up the rate limit", "[rate_limiter]") {
+    const std::string socketPath = "test_rate_refund.sock";
+    VerificationService service;
+    RateLimiterSettings limits;
+    limits.perRecipient = {1, 60 * 1000};
+    RateLimiter limiter(limits);
+
+    VerificationServerSettings settings;
+    settings.socketPath = socketPath;
+    VerificationServer server(settings, service, [](const std::string&, const std::string&) { return true; });
+    server.setRateLimiter(&limiter);
+    // No randomness on the (fresh) event loop thread: every ISSUE fails
+    VerificationCodeGenerator::setEntropySource(noEntropy);
+    REQUIRE(server.start());
+
+    for (int i = 0; i < 3; i++) {
+        REQUIRE(VerificationServer::request(socketPath, "ISSUE retry@example.com") == "ERR unavailable");
+    }
+    VerificationCodeGenerator::setEntropySource(nullptr);
+    REQUIRE(VerificationServer::request(socketPath, "ISSUE retry@example.com").compare(0, 3, "OK ") == 0);
+    REQUIRE(VerificationServer::request(socketPath, "ISSUE retry@example.com").compare(0, 16, "ERR rate_limited") == 0);
+    server.stop();
+}
@@ -5,7 +5,10 @@
 
 #include "catch.hpp"
 #include "../include/smtp_client.hpp"
+#include "test_helpers.hpp"
+#include <algorithm>
 #include <string>
+#include <vector>
 
 using namespace Pens;
 
@@ -113,3 +116,132 @@ TEST_CASE("SMTP error handling", "[smtp]") {
     }
 }
 
+
+TEST_CASE("SMTP multi-line replies and capabilities", "[smtp]") {
+    // Replies arrive a few bytes at a time, splitting lines across reads
+    PensTest::MockSmtpServer server({"SIZE 35882577", "8BITMIME", "pipelining", "AUTH LOGIN XOAUTH2"}, true);
+    SmtpClient client("127.0.0.1", server.port(), false);
+
+    REQUIRE(client.connect());
+    REQUIRE(client.getLastReplyCode() == 250);
+    REQUIRE(client.hasCapability("SIZE"));
+    REQUIRE(client.getCapabilityParams("SIZE") == "35882577");
+    REQUIRE(client.hasCapability("PIPELINING"));
+    REQUIRE(client.getCapabilityParams("AUTH") == "LOGIN XOAUTH2");
+    REQUIRE_FALSE(client.hasCapability("CHUNKING"));
+    client.disconnect();
+}
+
+TEST_CASE("SMTP envelope pipelining", "[smtp]") {
+    SECTION("Envelope is pipelined when advertised") {
+        PensTest::MockSmtpServer server({"PIPELINING"});
+        SmtpClient client("127.0.0.1", server.port(), false);
+        REQUIRE(client.connect());
+        REQUIRE(client.authenticate("user", "secret"));
+
+        REQUIRE(client.sendEmail("from@test.com", "to@test.com", "Subject", "Body"));
+        REQUIRE(server.pipelinedBatches() == 1);
+        REQUIRE(server.messages().size() == 1);
+        REQUIRE(server.messages()[0].find("Subject: Subject") != std::string::npos);
+
+        std::vector<std::string> commands = server.commands();
+        REQUIRE(commands[commands.size() - 3] == "MAIL FROM:<from@test.com>");
+        REQUIRE(commands[commands.size() - 2] == "RCPT TO:<to@test.com>");
+        REQUIRE(commands[commands.size() - 1] == "DATA");
+    }
+
+    SECTION("Lock-step commands without PIPELINING") {
+        PensTest::MockSmtpServer server({});
+        SmtpClient client("127.0.0.1", server.port(), false);
+        REQUIRE(client.connect());
+        REQUIRE(client.authenticate("user", "secret"));
+
+        REQUIRE(client.sendEmail("from@test.com", "to@test.com", "Subject", "Body"));
+        REQUIRE(server.pipelinedBatches() == 0);
+        REQUIRE(server.messages().size() == 1);
+    }
+
+    SECTION("Rejected recipient leaves the session usable") {
+        PensTest::MockSmtpServer server({"PIPELINING"});
+        server.rejectRecipient("nobody@test.com");
+        SmtpClient client("127.0.0.1", server.port(), false);
+        REQUIRE(client.connect());
+        REQUIRE(client.authenticate("user", "secret"));
+
+        REQUIRE_FALSE(client.sendEmail("from@test.com", "nobody@test.com", "Subject", "Body"));
+        REQUIRE(client.getLastReplyCode() == 550);
+        REQUIRE(client.sendEmail("from@test.com", "to@test.com", "Subject", "Body"));
+        REQUIRE(server.messages().size() == 1);
+    }
+}
+
+TEST_CASE("SMTP multi-recipient transactions", "[smtp]") {
+    const std::string body = "Hello\n.hidden line\n..two dots\n.\nend";
+
+    SECTION("DATA with dot-stuffing") {
+        PensTest::MockSmtpServer server({"PIPELINING"});
+        server.rejectRecipient("bad@test.com");
+        SmtpClient client("127.0.0.1", server.port(), false);
+        REQUIRE(client.connect());
+        REQUIRE(client.authenticate("user", "secret"));
+
+        std::vector<std::string> rejected;
+        REQUIRE(client.sendEmailToRecipients("from@test.com",
+                                             {"a@test.com", "bad@test.com", "c@test.com"},
+                                             "Subject", body, &rejected));
+        REQUIRE(rejected == std::vector<std::string>{"bad@test.com"});
+        REQUIRE(server.pipelinedBatches() == 1);
+
+        REQUIRE(server.messages().size() == 1);
+        std::string received = server.messages()[0];
+        REQUIRE(received.find("To: a@test.com, bad@test.com, c@test.com\r\n") != std::string::npos);
+        REQUIRE(received.find("\r\n\r\nHello\r\n.hidden line\r\n..two dots\r\n.\r\nend\r\n") != std::string::npos);
+        REQUIRE(server.rawMessages()[0].find("\r\n..hidden line\r\n...two dots\r\n..\r\n") != std::string::npos);
+    }
+
+    SECTION("BDAT when CHUNKING is advertised") {
+        PensTest::MockSmtpServer server({"PIPELINING", "CHUNKING"});
+        SmtpClient client("127.0.0.1", server.port(), false);
+        REQUIRE(client.connect());
+        REQUIRE(client.authenticate("user", "secret"));
+
+        REQUIRE(client.sendEmailToRecipients("from@test.com", {"a@test.com", "b@test.com"}, "Subject", body));
+        auto commands = server.commands();
+        REQUIRE(std::none_of(commands.begin(), commands.end(),
+                             [](const std::string& c) { return c == "DATA"; }));
+        REQUIRE(commands.back().compare(0, 5, "BDAT ") == 0);
+        REQUIRE(commands.back().find(" LAST") != std::string::npos);
+
+        REQUIRE(server.messages().size() == 1);
+        REQUIRE(server.messages()[0].find("\r\n\r\nHello\r\n.hidden line\r\n..two dots\r\n.\r\nend") != std::string::npos);
+    }
+
+    SECTION("All recipients rejected") {
+        PensTest::MockSmtpServer server({"PIPELINING", "CHUNKING"});
+        server.rejectRecipient("bad@test.com");
+        SmtpClient client("127.0.0.1", server.port(), false);
+        REQUIRE(client.connect());
+        REQUIRE(client.authenticate("user", "secret"));
+
+        REQUIRE_FALSE(client.sendEmailToRecipients("from@test.com", {"bad@test.com"}, "Subject", body));
+        REQUIRE(client.getLastReplyCode() == 550);
+        REQUIRE(client.sendEmail("from@test.com", "ok@test.com", "Subject", body));
+        REQUIRE(server.messages().size() == 1);
+    }
+}
+
+TEST_CASE("SMTP envelope addresses with line breaks are refused", "[smtp]") {
+    PensTest::MockSmtpServer server({"PIPELINING"});
+    SmtpClient client("127.0.0.1", server.port(), false);
+    REQUIRE(client.connect());
+    REQUIRE(client.authenticate("user", "secret"));
+    size_t before = server.commands().size();
+
+    REQUIRE_FALSE(client.sendEmail("from@test.com", "to@test.com>\r\nRCPT TO:<evil@test.com", "Subject", "Body"));
+    REQUIRE_FALSE(client.sendEmail("from@test.com\nRSET", "to@test.com", "Subject", "Body"));
+    REQUIRE_FALSE(client.sendEmailToRecipients("from@test.com", {"a@test.com", "b@test.com\r"}, "Subject", "Body"));
+    // Nothing reached the server, and the session is still usable
+    REQUIRE(server.commands().size() == before);
+    REQUIRE(client.sendEmail("from@test.com", "to@test.com", "Subject", "Body"));
+    REQUIRE(server.messages().size() == 1);
+}
@@ -0,0 +1,135 @@
+/**
+ * Unit Tests for SMTP Connection Pool Module
+ */
+
+#include "catch.hpp"
+#include "../include/smtp_connection_pool.hpp"
+#include "test_helpers.hpp"
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Pens;
+using PensTest::MockSmtpServer;
+
+namespace {
+
+SmtpPoolSettings mockSettings(const MockSmtpServer& server, size_t maxConnections) {
+    SmtpPoolSettings settings;
+    settings.server = "127.0.0.1";
+    settings.port = server.port();
+    settings.useSsl = false;
+    settings.username = "sender@test.com";
+    settings.password = "secret";
+    settings.maxConnections = maxConnections;
+    return settings;
+}
+
+size_t countCommand(const MockSmtpServer& server, const std::string& prefix) {
+    auto commands = server.commands();
+    return std::count_if(commands.begin(), commands.end(), [&](const std::string& c) {
+        return c.compare(0, prefix.size(), prefix) == 0;
+    });
+}
+
+} // namespace
+
+TEST_CASE("SMTP pool reuses sessions", "[smtp_pool]") {
+    MockSmtpServer server({"PIPELINING"});
+    SmtpConnectionPool pool(mockSettings(server, 2));
+
+    SECTION("Sequential sends share one connection") {
+        for (int i = 0; i < 20; i++) {
+            REQUIRE(pool.sendVerificationCode("user" + std::to_string(i) + "@test.com", "123456"));
+        }
+        REQUIRE(server.accepted() == 1);
+        REQUIRE(pool.getConnectionsOpened() == 1);
+        REQUIRE(countCommand(server, "AUTH") == 1);
+        REQUIRE(server.messages().size() == 20);
+        REQUIRE(pool.getIdleCount() == 1);
+    }
+
+    SECTION("Concurrent sends respect the per-host limit") {
+        std::atomic<int> sent{0};
+        std::vector<std::thread> senders;
+        for (int t = 0; t < 8; t++) {
+            senders.emplace_back([&pool, &sent, t] {
+                for (int i = 0; i < 10; i++) {
+                    if (pool.sendEmail("from@test.com", "to" + std::to_string(t) + "@test.com", "S", "B")) {
+                        sent++;
+                    }
+                }
+            });
+        }
+        for (auto& sender : senders) {
+            sender.join();
+        }
+        REQUIRE(sent == 80);
+        REQUIRE(server.accepted() <= 2);
+        REQUIRE(pool.getOpenCount() <= 2);
+    }
+
+    SECTION("Rejected messages keep the session") {
+        server.rejectRecipient("bad@test.com");
+        REQUIRE_FALSE(pool.sendEmail("from@test.com", "bad@test.com", "S", "B"));
+        REQUIRE(pool.sendEmail("from@test.com", "good@test.com", "S", "B"));
+        REQUIRE(server.accepted() == 1);
+        REQUIRE(countCommand(server, "RSET") == 1);
+    }
+
+    SECTION("Sessions closed by the server are replaced transparently") {
+        REQUIRE(pool.sendEmail("from@test.com", "to@test.com", "S", "B"));
+        server.dropConnections();
+        REQUIRE(pool.sendEmail("from@test.com", "to@test.com", "S", "B"));
+        REQUIRE(server.accepted() == 2);
+        REQUIRE(server.messages().size() == 2);
+    }
+}
+
+TEST_CASE("SMTP pool maintenance", "[smtp_pool]") {
+    MockSmtpServer server({"PIPELINING"});
+
+    SECTION("Idle sessions receive NOOP keepalives") {
+        SmtpPoolSettings settings = mockSettings(server, 1);
+        settings.keepaliveSeconds = 1;
+        SmtpConnectionPool pool(settings);
+
+        REQUIRE(pool.sendEmail("from@test.com", "to@test.com", "S", "B"));
+        std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+        REQUIRE(countCommand(server, "NOOP") >= 1);
+        REQUIRE(pool.getIdleCount() == 1);
+    }
+
+    SECTION("Sessions are recycled after the message limit") {
+        SmtpPoolSettings settings = mockSettings(server, 1);
+        settings.maxMessagesPerConnection = 3;
+        SmtpConnectionPool pool(settings);
+
+        for (int i = 0; i < 6; i++) {
+            REQUIRE(pool.sendEmail("from@test.com", "to@test.com", "S", "B"));
+        }
+        REQUIRE(pool.getConnectionsOpened() == 2);
+    }
+
+    SECTION("OAuth sessions authenticate with the provider's token") {
+        SmtpPoolSettings settings = mockSettings(server, 1);
+        int calls = 0;
+        settings.tokenProvider = [&calls] { calls++; return std::string("access-token"); };
+        SmtpConnectionPool pool(settings);
+
+        REQUIRE(pool.sendEmail("from@test.com", "to@test.com", "S", "B"));
+        REQUIRE(pool.sendEmail("from@test.com", "to@test.com", "S", "B"));
+        REQUIRE(calls == 1);
+        REQUIRE(countCommand(server, "AUTH XOAUTH2") == 1);
+    }
+
+    SECTION("Acquire times out when the pool is exhausted") {
+        SmtpConnectionPool pool(mockSettings(server, 1));
+        auto held = pool.acquire();
+        REQUIRE(held);
+        auto waiting = pool.acquire(100);
+        REQUIRE_FALSE(waiting);
+    }
+}
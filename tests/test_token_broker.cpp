@@ -0,0 +1,197 @@
+/**
+ * Unit Tests for Token Broker Module
+ */
+
+#include "catch.hpp"
+#include "../include/token_broker.hpp"
+#include "test_helpers.hpp"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace Pens;
+using PensTest::StandInTokenEndpoint;
+
+namespace {
+
+OAuthAccountSettings writeAccount(const std::string& tokenFile, const std::string& accessToken,
+                                  long expiresAt, const std::string& authority) {
+    std::ofstream file(tokenFile);
+    file << "{\"access_token\": \"" << accessToken << "\", \"refresh_token\": \"r1\", "
+         << "\"expires_at\": " << expiresAt << "}";
+
+    OAuthAccountSettings settings;
+    settings.tokenFile = tokenFile;
+    settings.clientId = "client";
+    settings.tenantId = "tenant";
+    settings.clientSecret = "secret";
+    settings.authority = authority;
+    return settings;
+}
+
+} // namespace
+
+TEST_CASE("Token broker serves cached tokens", "[broker]") {
+    long future = std::time(nullptr) + 7200;
+    TokenBroker broker;
+    broker.addAccount("alice", writeAccount("test_broker_alice.tmp", "alice-token", future, ""));
+    broker.addAccount("bob", writeAccount("test_broker_bob.tmp", "bob-token", future, ""));
+
+    SECTION("Accounts are isolated") {
+        REQUIRE(broker.getAccounts().size() == 2);
+        REQUIRE(broker.getAccessToken("alice") == "alice-token");
+        REQUIRE(broker.getAccessToken("bob") == "bob-token");
+        REQUIRE(broker.getAccessToken("carol").empty());
+        REQUIRE(broker.getManager("carol") == nullptr);
+    }
+
+    SECTION("Cached reads do not reload") {
+        REQUIRE(broker.getAccessToken("alice") == "alice-token");
+        size_t loads = broker.getRefreshCount();
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(broker.getAccessToken("alice") == "alice-token");
+        }
+        REQUIRE(broker.getRefreshCount() == loads);
+    }
+
+    SECTION("Tokens are served over the Unix socket") {
+        const std::string socketPath = "test_broker.sock";
+        REQUIRE(broker.startServer(socketPath));
+        REQUIRE(TokenBroker::requestToken(socketPath, "bob") == "bob-token");
+        REQUIRE(TokenBroker::requestToken(socketPath, "carol").empty());
+        broker.stopServer();
+        REQUIRE(TokenBroker::requestToken(socketPath, "bob").empty());
+    }
+
+    std::remove("test_broker_alice.tmp");
+    std::remove("test_broker_bob.tmp");
+}
+
+TEST_CASE("Token broker deduplicates concurrent refreshes", "[broker]") {
+    StandInTokenEndpoint endpoint(
+        R"({"access_token":"fresh-token","refresh_token":"r2","expires_in":3600})", 200);
+
+    TokenBroker broker;
+    broker.addAccount("alice", writeAccount("test_broker_expired.tmp", "stale",
+                                            std::time(nullptr) - 10, endpoint.url()));
+
+    std::vector<std::thread> workers;
+    std::vector<std::string> results(8);
+    for (int i = 0; i < 8; i++) {
+        workers.emplace_back([&broker, &results, i] {
+            results[i] = broker.getAccessToken("alice");
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    for (const auto& token : results) {
+        REQUIRE(token == "fresh-token");
+    }
+    REQUIRE(endpoint.requests() == 1);
+
+    std::remove("test_broker_expired.tmp");
+}
+
+TEST_CASE("Token broker socket answers from cache while a refresh runs", "[broker]") {
+    StandInTokenEndpoint endpoint(
+        R"({"access_token":"fresh-token","refresh_token":"r2","expires_in":3600})", 1000);
+
+    TokenBroker broker;
+    broker.addAccount("alice", writeAccount("test_broker_slow.tmp", "stale",
+                                            std::time(nullptr) - 10, endpoint.url()));
+    broker.addAccount("bob", writeAccount("test_broker_cached.tmp", "bob-token",
+                                          std::time(nullptr) + 7200, ""));
+
+    const std::string socketPath = "test_broker_refresh.sock";
+    REQUIRE(broker.startServer(socketPath));
+    struct stat info;
+    REQUIRE(stat(socketPath.c_str(), &info) == 0);
+    REQUIRE((info.st_mode & 0777) == 0600);
+
+    // Alice's expired token parks her request on the slow refresh...
+    std::string aliceToken;
+    std::thread alice([&] { aliceToken = TokenBroker::requestToken(socketPath, "alice"); });
+    while (endpoint.requests() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    // ...while Bob is still served straight from the cache
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(TokenBroker::requestToken(socketPath, "bob") == "bob-token");
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+
+    alice.join();
+    REQUIRE(aliceToken == "fresh-token");
+    REQUIRE(endpoint.requests() == 1);
+
+    broker.stopServer();
+    std::remove("test_broker_slow.tmp");
+    std::remove("test_broker_cached.tmp");
+}
+
+TEST_CASE("Token broker keeps serving while a client ignores its replies", "[broker]") {
+    TokenBroker broker;
+    broker.addAccount("bob", writeAccount("test_broker_greedy.tmp", "bob-token",
+                                          std::time(nullptr) + 7200, ""));
+    const std::string socketPath = "test_broker_greedy.sock";
+    REQUIRE(broker.startServer(socketPath));
+
+    // Pipeline requests until the broker stops reading them
+    int greedy = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    REQUIRE(greedy >= 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    socketPath.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+    REQUIRE(connect(greedy, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+
+    std::string requests;
+    for (int i = 0; i < 1000; i++) {
+        requests += "TOKEN bob\n";
+    }
+    size_t sent = 0;
+    for (int idle = 0; idle < 20;) {
+        ssize_t n = send(greedy, requests.data(), requests.size(), MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+            idle = 0;
+        } else {
+            REQUIRE(errno == EAGAIN);
+            idle++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    REQUIRE(sent > 0);
+
+    std::atomic<bool> done{false};
+    std::string token;
+    std::thread bob([&] {
+        token = TokenBroker::requestToken(socketPath, "bob");
+        done = true;
+    });
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (!done && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    bool served = done;
+
+    // Closing the greedy client releases a broker stuck writing to it
+    close(greedy);
+    bob.join();
+    REQUIRE(served);
+    REQUIRE(token == "bob-token");
+
+    broker.stopServer();
+    std::remove("test_broker_greedy.tmp");
+}
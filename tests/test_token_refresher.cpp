@@ -0,0 +1,80 @@
+/**
+ * Unit Tests for Token Refresher Module
+ */
+
+#include "catch.hpp"
+#include "../include/token_refresher.hpp"
+#include "../include/config.hpp"
+#include <fstream>
+#include <cstdio>
+#include <ctime>
+
+using namespace Pens;
+
+TEST_CASE("Refresh time computation", "[refresher]") {
+    long now = 1700000000;
+
+    SECTION("Refresh lead and jitter are subtracted from expiry") {
+        REQUIRE(TokenRefresher::computeRefreshTime(now + 3600, now, 300, 0) == now + 3300);
+        REQUIRE(TokenRefresher::computeRefreshTime(now + 3600, now, 300, 120) == now + 3180);
+    }
+
+    SECTION("Expired or nearly expired tokens refresh immediately") {
+        REQUIRE(TokenRefresher::computeRefreshTime(now - 10, now, 300, 0) == now);
+        REQUIRE(TokenRefresher::computeRefreshTime(now + 100, now, 300, 60) == now);
+    }
+
+    SECTION("Unknown expiry assumes a one hour lifetime") {
+        REQUIRE(TokenRefresher::computeRefreshTime(0, now, 300, 0) == now + 3300);
+    }
+}
+
+TEST_CASE("Token manager publishes snapshots", "[refresher]") {
+    const char* tokenFile = "test_refresher_token.tmp";
+    const char* configFile = "test_refresher_config.tmp";
+
+    long expiresAt = std::time(nullptr) + 7200;
+    {
+        std::ofstream file(tokenFile);
+        file << "{\"access_token\": \"abc123\", \"refresh_token\": \"r1\", "
+             << "\"expires_at\": " << expiresAt << "}";
+    }
+    {
+        std::ofstream file(configFile);
+        file << "oauth_token_file = " << tokenFile << "\n";
+    }
+
+    Config& config = Config::getInstance();
+    REQUIRE(config.loadFromFile(configFile));
+
+    OAuthTokenManager manager(config);
+    REQUIRE(manager.getTokenSnapshot() == nullptr);
+    REQUIRE(manager.getAccessToken().empty());
+
+    REQUIRE(manager.ensureValidToken());
+    auto snapshot = manager.getTokenSnapshot();
+    REQUIRE(snapshot != nullptr);
+    REQUIRE(snapshot->accessToken == "abc123");
+    REQUIRE(snapshot->expiresAt == expiresAt);
+    REQUIRE(manager.getAccessToken() == "abc123");
+    REQUIRE(manager.canRefresh());
+
+    SECTION("Refresher schedules before expiry and stops cleanly") {
+        TokenRefresher refresher(manager, 300, 60);
+        refresher.start();
+        REQUIRE(refresher.isRunning());
+
+        for (int i = 0; i < 100 && refresher.getNextRefreshAt() == 0; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        long next = refresher.getNextRefreshAt();
+        REQUIRE(next >= expiresAt - 360);
+        REQUIRE(next <= expiresAt - 300);
+
+        refresher.stop();
+        REQUIRE_FALSE(refresher.isRunning());
+    }
+
+    std::remove(tokenFile);
+    std::remove(configFile);
+}
@@ -0,0 +1,117 @@
+/**
+ * Unit Tests for Token Store Module
+ */
+
+#include "catch.hpp"
+#include "../include/token_store.hpp"
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace Pens;
+
+TEST_CASE("Atomic token file writes", "[token_store]") {
+    const std::string path = "test_token_store.tmp";
+
+    SECTION("Contents are replaced and permissions are owner-only") {
+        REQUIRE(TokenStore::writeFileAtomically(path, "first"));
+        REQUIRE(TokenStore::writeFileAtomically(path, "second"));
+
+        std::string contents;
+        REQUIRE(TokenStore::readFile(path, contents));
+        REQUIRE(contents == "second");
+
+        struct stat st;
+        REQUIRE(stat(path.c_str(), &st) == 0);
+        REQUIRE((st.st_mode & 0777) == 0600);
+
+        std::string tempPath = path + ".tmp." + std::to_string(getpid());
+        REQUIRE(access(tempPath.c_str(), F_OK) != 0);
+    }
+
+    SECTION("Failed writes leave the original untouched") {
+        REQUIRE(TokenStore::writeFileAtomically(path, "original"));
+        REQUIRE_FALSE(TokenStore::writeFileAtomically("no_such_dir/token.json", "x"));
+
+        std::string contents;
+        REQUIRE(TokenStore::readFile(path, contents));
+        REQUIRE(contents == "original");
+        REQUIRE_FALSE(TokenStore::readFile("no_such_dir/token.json", contents));
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Shared token table", "[token_store]") {
+    const std::string path = "test_token_table.tmp";
+    std::remove(path.c_str());
+
+    SharedTokenTable writer;
+    REQUIRE(writer.open(path));
+
+    SECTION("Tokens are visible through a second mapping") {
+        REQUIRE(writer.publish("alice", "alice-token", 1000));
+        REQUIRE(writer.publish("bob", "bob-token", 2000));
+        REQUIRE(writer.publish("alice", "alice-token-2", 3000));
+
+        SharedTokenTable reader;
+        REQUIRE(reader.open(path));
+
+        std::string token;
+        long expiresAt = 0;
+        REQUIRE(reader.read("alice", token, expiresAt));
+        REQUIRE(token == "alice-token-2");
+        REQUIRE(expiresAt == 3000);
+        REQUIRE(reader.read("bob", token, expiresAt));
+        REQUIRE(token == "bob-token");
+        REQUIRE_FALSE(reader.read("carol", token, expiresAt));
+    }
+
+    SECTION("Oversized entries are rejected") {
+        REQUIRE_FALSE(writer.publish(std::string(SharedTokenTable::kMaxAccountLength + 1, 'a'), "t", 0));
+        REQUIRE_FALSE(writer.publish("alice", std::string(SharedTokenTable::maxTokenLength() + 1, 't'), 0));
+        REQUIRE(writer.publish("alice", std::string(SharedTokenTable::maxTokenLength(), 't'), 0));
+    }
+
+    SECTION("The table fills up") {
+        for (uint32_t i = 0; i < SharedTokenTable::kSlotCount; i++) {
+            REQUIRE(writer.publish("account" + std::to_string(i), "token", 0));
+        }
+        REQUIRE_FALSE(writer.publish("one-too-many", "token", 0));
+        REQUIRE(writer.publish("account0", "updated", 0));
+    }
+
+    SECTION("Readers never observe a torn token") {
+        SharedTokenTable reader;
+        REQUIRE(reader.open(path));
+        REQUIRE(writer.publish("alice", std::string(16, 'a'), 'a'));
+
+        std::atomic<bool> done{false};
+        std::thread publisher([&] {
+            for (int i = 0; i < 20000; i++) {
+                char c = static_cast<char>('a' + i % 26);
+                writer.publish("alice", std::string(16 + i % 2000, c), c);
+            }
+            done = true;
+        });
+
+        bool consistent = true;
+        std::string token;
+        long expiresAt = 0;
+        while (!done) {
+            if (reader.read("alice", token, expiresAt)) {
+                if (token.find_first_not_of(static_cast<char>(expiresAt)) != std::string::npos) {
+                    consistent = false;
+                }
+            }
+        }
+        publisher.join();
+        REQUIRE(consistent);
+    }
+
+    writer.close();
+    std::remove(path.c_str());
+}
@@ -4,11 +4,31 @@
 
 #include "catch.hpp"
 #include "../include/verification_code.hpp"
+#include <cstring>
 #include <string>
 #include <set>
+#include <thread>
+#include <vector>
 
 using namespace Pens;
 
+namespace {
+
+// Entropy that is one repeated byte chosen per thread, so every code shows
+// which thread's refill produced it
+thread_local unsigned char threadByte = 0;
+
+bool threadPatternEntropy(unsigned char* out, size_t length) {
+    std::memset(out, threadByte, length);
+    return true;
+}
+
+bool noEntropy(unsigned char*, size_t) {
+    return false;
+}
+
+} // namespace
+
 TEST_CASE("Verification code generation", "[verification]") {
     VerificationCodeGenerator generator;
     
@@ -113,3 +133,96 @@ TEST_CASE("Verification code security", "[verification]") {
     }
 }
 
+
+TEST_CASE("Verification code batch generation", "[verification]") {
+    VerificationCodeGenerator generator;
+
+    SECTION("Batch codes are valid and distinct enough") {
+        std::vector<std::string> codes = generator.generateBatch(5000);
+        REQUIRE(codes.size() == 5000);
+        std::set<std::string> unique(codes.begin(), codes.end());
+        // Birthday bound over 10^6 codes: about 12 collisions expected
+        REQUIRE(unique.size() > 4900);
+        for (const auto& code : codes) {
+            REQUIRE(generator.validate(code));
+        }
+    }
+
+    SECTION("Allocation-free generation fills back-to-back digits") {
+        char digits[VerificationCodeGenerator::kCodeLength * 3 + 1];
+        digits[sizeof(digits) - 1] = 'x';
+        VerificationCodeGenerator::generate(digits, 3);
+        for (size_t i = 0; i + 1 < sizeof(digits); i++) {
+            REQUIRE(isdigit(static_cast<unsigned char>(digits[i])));
+        }
+        REQUIRE(digits[sizeof(digits) - 1] == 'x');
+    }
+
+    SECTION("Codes cover the full range including leading zeros") {
+        std::vector<std::string> codes = generator.generateBatch(20000);
+        size_t belowHundredThousand = 0;
+        size_t digitCounts[10] = {0};
+        for (const auto& code : codes) {
+            if (code[0] == '0') {
+                belowHundredThousand++;
+            }
+            for (char c : code) {
+                digitCounts[c - '0']++;
+            }
+        }
+        // About 10% of codes start with 0; the old generator never produced one
+        REQUIRE(belowHundredThousand > 1500);
+        REQUIRE(belowHundredThousand < 2500);
+        for (size_t count : digitCounts) {
+            REQUIRE(count > 10000);
+            REQUIRE(count < 14000);
+        }
+    }
+}
+
+TEST_CASE("Each thread draws codes from its own entropy buffer", "[verification]") {
+    VerificationCodeGenerator::setEntropySource(threadPatternEntropy);
+    std::vector<std::string> first;
+    std::vector<std::string> second;
+    // Interleave refills: each batch drains its thread's 4 KB buffer many times
+    std::thread a([&first]() {
+        threadByte = 0x11;
+        first = VerificationCodeGenerator().generateBatch(5000);
+    });
+    std::thread b([&second]() {
+        threadByte = 0x22;
+        second = VerificationCodeGenerator().generateBatch(5000);
+    });
+    a.join();
+    b.join();
+    VerificationCodeGenerator::setEntropySource(nullptr);
+
+    // 0x11111111 % 1000000 and 0x22222222 % 1000000
+    REQUIRE(first == std::vector<std::string>(5000, "331153"));
+    REQUIRE(second == std::vector<std::string>(5000, "662306"));
+}
+
+TEST_CASE("Code generation fails closed without randomness", "[verification]") {
+    VerificationCodeGenerator::setEntropySource(noEntropy);
+    std::string code = "unset";
+    std::vector<std::string> batch = {"unset"};
+    bool raw = true;
+    // A fresh thread has nothing buffered, so its first draw needs a refill
+    std::thread worker([&]() {
+        VerificationCodeGenerator generator;
+        code = generator.generate();
+        batch = generator.generateBatch(10);
+        char digits[VerificationCodeGenerator::kCodeLength];
+        raw = VerificationCodeGenerator::generate(digits);
+    });
+    worker.join();
+    VerificationCodeGenerator::setEntropySource(nullptr);
+
+    REQUIRE(code.empty());
+    REQUIRE(batch.empty());
+    REQUIRE_FALSE(raw);
+
+    std::thread recovered([&code]() { code = VerificationCodeGenerator().generate(); });
+    recovered.join();
+    REQUIRE(code.size() == VerificationCodeGenerator::kCodeLength);
+}
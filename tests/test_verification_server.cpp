@@ -0,0 +1,305 @@
+/**
+ * Unit Tests for the Verification API Server
+ */
+
+#include "catch.hpp"
+#include "../include/verification_code.hpp"
+#include "../include/verification_server.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace Pens;
+
+namespace {
+
+// Records sent codes; deliveries block until release() when gated
+class RecordingSender {
+public:
+    explicit RecordingSender(bool gated = false) : open_(!gated) {}
+
+    VerificationServer::Sender sender() {
+        return [this](const std::string& to, const std::string& code) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            gate_.wait(lock, [this]() { return open_; });
+            codes_[to] = code;
+            return to.find("fail") == std::string::npos;
+        };
+    }
+
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            open_ = true;
+        }
+        gate_.notify_all();
+    }
+
+    std::string code(const std::string& to) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return codes_[to];
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable gate_;
+    bool open_;
+    std::map<std::string, std::string> codes_;
+};
+
+std::string waitForStatus(const std::string& socketPath, const std::string& id, const std::string& expected) {
+    std::string reply;
+    for (int i = 0; i < 200; i++) {
+        reply = VerificationServer::request(socketPath, "STATUS " + id);
+        if (reply == expected) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return reply;
+}
+
+int connectTo(const std::string& socketPath) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads until count reply lines have arrived
+std::string readReplies(int fd, int count) {
+    std::string replies;
+    char chunk[4096];
+    while (std::count(replies.begin(), replies.end(), '\n') < count) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            break;
+        }
+        replies.append(chunk, n);
+    }
+    return replies;
+}
+
+bool noEntropy(unsigned char*, size_t) {
+    return false;
+}
+
+} // namespace
+
+TEST_CASE("Verification server issues and verifies codes", "[verification_server]") {
+    const std::string socketPath = "test_verification.sock";
+    VerificationService service;
+    RecordingSender recorder;
+    VerificationServerSettings settings;
+    settings.socketPath = socketPath;
+    settings.deliveryWorkers = 2;
+    VerificationServer server(settings, service, recorder.sender());
+    REQUIRE(server.start());
+
+    SECTION("Issue, deliver and verify") {
+        std::string reply = VerificationServer::request(socketPath, "ISSUE user@example.com");
+        REQUIRE(reply.compare(0, 3, "OK ") == 0);
+        std::string id = reply.substr(3);
+        REQUIRE(waitForStatus(socketPath, id, "OK sent") == "OK sent");
+
+        std::string code = recorder.code("user@example.com");
+        REQUIRE(code.size() == 6);
+        REQUIRE(VerificationServer::request(socketPath, "VERIFY user@example.com 999999x") == "ERR mismatch");
+        REQUIRE(VerificationServer::request(socketPath, "VERIFY user@example.com " + code) == "OK");
+        REQUIRE(VerificationServer::request(socketPath, "VERIFY user@example.com " + code) == "ERR not_found");
+    }
+
+    SECTION("Failed deliveries are reported") {
+        std::string reply = VerificationServer::request(socketPath, "ISSUE fail@example.com");
+        REQUIRE(reply.compare(0, 3, "OK ") == 0);
+        REQUIRE(waitForStatus(socketPath, reply.substr(3), "OK failed") == "OK failed");
+    }
+
+    SECTION("Malformed requests") {
+        REQUIRE(VerificationServer::request(socketPath, "HELLO") == "ERR bad request");
+        REQUIRE(VerificationServer::request(socketPath, "VERIFY nobody") == "ERR bad request");
+        REQUIRE(VerificationServer::request(socketPath, "STATUS 12x") == "ERR bad request");
+        REQUIRE(VerificationServer::request(socketPath, "STATUS 9999") == "ERR unknown id");
+    }
+
+    SECTION("Pipelined requests are answered in order") {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+        REQUIRE(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+
+        std::string batch;
+        for (int i = 0; i < 100; i++) {
+            batch += "STATUS " + std::to_string(100000 + i) + "\r\n";
+        }
+        batch += "ISSUE a@example.com\nVERIFY a@example.com 12345";
+        REQUIRE(send(fd, batch.data(), batch.size(), 0) == static_cast<ssize_t>(batch.size()));
+        // The last line arrives in a separate segment
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        REQUIRE(send(fd, "6\n", 2, 0) == 2);
+
+        std::string replies;
+        char chunk[4096];
+        while (std::count(replies.begin(), replies.end(), '\n') < 102) {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            REQUIRE(n > 0);
+            replies.append(chunk, n);
+        }
+        close(fd);
+
+        size_t pos = 0;
+        for (int i = 0; i < 100; i++) {
+            size_t eol = replies.find('\n', pos);
+            REQUIRE(replies.substr(pos, eol - pos) == "ERR unknown id");
+            pos = eol + 1;
+        }
+        REQUIRE(replies.compare(pos, 3, "OK ") == 0);
+        pos = replies.find('\n', pos) + 1;
+        std::string last = replies.substr(pos, replies.find('\n', pos) - pos);
+        REQUIRE((last == "ERR mismatch" || last == "OK"));
+    }
+
+    server.stop();
+}
+
+TEST_CASE("Verification server answers before delivery completes", "[verification_server]") {
+    const std::string socketPath = "test_verification_gated.sock";
+    VerificationService service;
+    RecordingSender recorder(true);
+    VerificationServerSettings settings;
+    settings.socketPath = socketPath;
+    settings.deliveryWorkers = 1;
+    settings.maxQueuedDeliveries = 2;
+    VerificationServer server(settings, service, recorder.sender());
+    REQUIRE(server.start());
+
+    // The single worker is stuck on the first message; two more fill the queue
+    std::string first = VerificationServer::request(socketPath, "ISSUE one@example.com");
+    REQUIRE(first.compare(0, 3, "OK ") == 0);
+    REQUIRE(VerificationServer::request(socketPath, "STATUS " + first.substr(3)) == "OK queued");
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    REQUIRE(VerificationServer::request(socketPath, "ISSUE two@example.com").compare(0, 3, "OK ") == 0);
+    REQUIRE(VerificationServer::request(socketPath, "ISSUE three@example.com").compare(0, 3, "OK ") == 0);
+    REQUIRE(VerificationServer::request(socketPath, "ISSUE four@example.com") == "ERR busy");
+
+    recorder.release();
+    REQUIRE(waitForStatus(socketPath, first.substr(3), "OK sent") == "OK sent");
+    server.stop();
+}
+
+TEST_CASE("Verification server sheds requests past the latency budget", "[verification_server]") {
+    const std::string socketPath = "test_verification_budget.sock";
+    // The service reads its clock on the event loop; a pending stall holds
+    // the loop up for that long
+    std::atomic<int> stallMs(0);
+    VerificationSettings serviceSettings;
+    serviceSettings.clock = [&stallMs]() {
+        if (int ms = stallMs.exchange(0)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        }
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    };
+    VerificationService service(serviceSettings);
+    RecordingSender recorder;
+    VerificationServerSettings settings;
+    settings.socketPath = socketPath;
+    settings.requestBudgetMs = 50;
+    VerificationServer server(settings, service, recorder.sender());
+    REQUIRE(server.start());
+
+    int fd = connectTo(socketPath);
+    REQUIRE(fd >= 0);
+
+    SECTION("Requests behind a stalled loop are shed") {
+        stallMs = 200;
+        std::string batch = "VERIFY first@example.com 123456\nISSUE late@example.com\nSTATUS 1\n";
+        REQUIRE(send(fd, batch.data(), batch.size(), 0) == static_cast<ssize_t>(batch.size()));
+        REQUIRE(readReplies(fd, 3) == "ERR not_found\nERR deadline\nERR deadline\n");
+        REQUIRE(service.size() == 0);
+
+        // Without the stall the same requests are served
+        REQUIRE(send(fd, batch.data(), batch.size(), 0) == static_cast<ssize_t>(batch.size()));
+        std::string replies = readReplies(fd, 3);
+        REQUIRE(replies.compare(0, 17, "ERR not_found\nOK ") == 0);
+        REQUIRE(replies.find("deadline") == std::string::npos);
+    }
+
+    SECTION("A client's own slow send is not counted") {
+        REQUIRE(send(fd, "ISSUE slow@", 11, 0) == 11);
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        REQUIRE(send(fd, "example.com\n", 12, 0) == 12);
+        REQUIRE(readReplies(fd, 1).compare(0, 3, "OK ") == 0);
+    }
+
+    close(fd);
+    server.stop();
+}
+
+TEST_CASE("Verification server rejects malformed recipients", "[verification_server]") {
+    const std::string socketPath = "test_verification_address.sock";
+    VerificationService service;
+    RecordingSender recorder;
+    VerificationServerSettings settings;
+    settings.socketPath = socketPath;
+    VerificationServer server(settings, service, recorder.sender());
+    REQUIRE(server.start());
+
+    // Owner-only socket
+    struct stat info;
+    REQUIRE(stat(socketPath.c_str(), &info) == 0);
+    REQUIRE((info.st_mode & 0777) == 0600);
+
+    for (const char* recipient : {"", "nobody", "@example.com", "user@", "a@b@example.com", "user@exa\rmple.com",
+                                  "user@example.com>", "<user@example.com", "user\t@example.com",
+                                  "user@example.com\x7f"}) {
+        INFO("recipient: " << recipient);
+        REQUIRE(VerificationServer::request(socketPath, std::string("ISSUE ") + recipient) == "ERR bad request");
+    }
+
+    // A CR inside the line, as an SMTP command injection would need
+    int fd = connectTo(socketPath);
+    REQUIRE(fd >= 0);
+    std::string injected = "ISSUE victim@example.com>\rRCPT TO:<evil@example.com\n";
+    REQUIRE(send(fd, injected.data(), injected.size(), 0) == static_cast<ssize_t>(injected.size()));
+    REQUIRE(readReplies(fd, 1) == "ERR bad request\n");
+    close(fd);
+
+    REQUIRE(service.size() == 0);
+    REQUIRE(VerificationServer::request(socketPath, "ISSUE first.last+tag@mail.example.com").compare(0, 3, "OK ") == 0);
+    server.stop();
+}
+
+TEST_CASE("Verification server reports missing randomness as unavailable", "[verification_server]") {
+    const std::string socketPath = "test_verification_entropy.sock";
+    VerificationService service;
+    RecordingSender recorder;
+    VerificationServerSettings settings;
+    settings.socketPath = socketPath;
+    VerificationServer server(settings, service, recorder.sender());
+    // The event loop thread starts with an empty entropy buffer
+    VerificationCodeGenerator::setEntropySource(noEntropy);
+    REQUIRE(server.start());
+
+    REQUIRE(VerificationServer::request(socketPath, "ISSUE user@example.com") == "ERR unavailable");
+    REQUIRE(service.size() == 0);
+    VerificationCodeGenerator::setEntropySource(nullptr);
+    REQUIRE(VerificationServer::request(socketPath, "ISSUE user@example.com").compare(0, 3, "OK ") == 0);
+    server.stop();
+}
@@ -0,0 +1,159 @@
+/**
+ * Unit Tests for Verification Service and Timing Wheel
+ */
+
+#include "catch.hpp"
+#include "../include/verification_service.hpp"
+#include "../include/timing_wheel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Pens;
+
+TEST_CASE("Timing wheel expires items at their deadline", "[timing_wheel]") {
+    TimingWheel<int> wheel(10, 0);
+    std::vector<int> expired;
+
+    SECTION("Near deadlines on level 0") {
+        wheel.schedule(50, 1);
+        wheel.schedule(120, 2);
+        wheel.advance(40, expired);
+        REQUIRE(expired.empty());
+        wheel.advance(50, expired);
+        REQUIRE(expired == std::vector<int>{1});
+        wheel.advance(200, expired);
+        REQUIRE(expired == std::vector<int>{1, 2});
+        REQUIRE(wheel.size() == 0);
+    }
+
+    SECTION("Far deadlines cascade from the upper levels") {
+        // 64 ticks, 64^2 ticks, 64^3 ticks and beyond the top level
+        std::vector<int64_t> deadlines = {650, 41000, 2630000, 200000000};
+        for (size_t i = 0; i < deadlines.size(); i++) {
+            wheel.schedule(deadlines[i], static_cast<int>(i));
+        }
+        for (size_t i = 0; i < deadlines.size(); i++) {
+            wheel.advance(deadlines[i] - 10, expired);
+            REQUIRE(expired.size() == i);
+            wheel.advance(deadlines[i], expired);
+            REQUIRE(expired.size() == i + 1);
+            REQUIRE(expired.back() == static_cast<int>(i));
+        }
+    }
+
+    SECTION("Past deadlines fire on the next advance") {
+        wheel.advance(1000, expired);
+        wheel.schedule(500, 7);
+        wheel.advance(1000, expired);
+        REQUIRE(expired == std::vector<int>{7});
+    }
+
+    SECTION("Many timers at random offsets all fire in order of tick") {
+        for (int i = 0; i < 5000; i++) {
+            wheel.schedule((i * 7919) % 100000 + 10, i);
+        }
+        size_t fired = 0;
+        for (int64_t t = 0; t <= 100010; t += 10) {
+            wheel.advance(t, expired);
+            for (size_t j = fired; j < expired.size(); j++) {
+                int64_t deadline = (expired[j] * 7919) % 100000 + 10;
+                REQUIRE(deadline <= t);
+                REQUIRE(deadline > t - 10);
+            }
+            fired = expired.size();
+        }
+        REQUIRE(fired == 5000);
+    }
+}
+
+TEST_CASE("Verification service issues and checks codes", "[verification_service]") {
+    std::atomic<int64_t> clock(1000000);
+    VerificationSettings settings;
+    settings.ttlSeconds = 60;
+    settings.maxAttempts = 3;
+    settings.clock = [&clock]() { return clock.load(); };
+    VerificationService service(settings);
+
+    SECTION("Correct code verifies once") {
+        std::string code = service.issue("User@Example.com");
+        REQUIRE(code.size() == 6);
+        REQUIRE(service.verify("user@example.com", code) == VerifyResult::Ok);
+        REQUIRE(service.verify("user@example.com", code) == VerifyResult::NotFound);
+    }
+
+    SECTION("Wrong guesses burn the code") {
+        REQUIRE(service.store("a@example.com", "123456"));
+        REQUIRE(service.verify("a@example.com", "000000") == VerifyResult::Mismatch);
+        REQUIRE(service.verify("a@example.com", "111111") == VerifyResult::Mismatch);
+        REQUIRE(service.verify("a@example.com", "222222") == VerifyResult::TooManyAttempts);
+        REQUIRE(service.verify("a@example.com", "123456") == VerifyResult::NotFound);
+    }
+
+    SECTION("Codes expire after the TTL") {
+        REQUIRE(service.store("a@example.com", "123456"));
+        clock += 60 * 1000;
+        REQUIRE(service.verify("a@example.com", "123456") == VerifyResult::Expired);
+    }
+
+    SECTION("Reissuing replaces the old code and its expiry") {
+        REQUIRE(service.store("a@example.com", "123456"));
+        clock += 50 * 1000;
+        REQUIRE(service.store("a@example.com", "654321"));
+        clock += 20 * 1000;
+        service.purgeExpired();
+        REQUIRE(service.size() == 1);
+        REQUIRE(service.verify("a@example.com", "123456") == VerifyResult::Mismatch);
+        REQUIRE(service.verify("a@example.com", "654321") == VerifyResult::Ok);
+    }
+
+    SECTION("Expired entries are reclaimed") {
+        for (int i = 0; i < 1000; i++) {
+            REQUIRE(service.store("user" + std::to_string(i) + "@example.com", "123456"));
+        }
+        REQUIRE(service.size() == 1000);
+        clock += 61 * 1000;
+        service.purgeExpired();
+        REQUIRE(service.size() == 0);
+    }
+}
+
+TEST_CASE("Verification service bounds memory", "[verification_service]") {
+    VerificationSettings settings;
+    settings.maxEntries = 4;
+    settings.shards = 1;
+    VerificationService service(settings);
+
+    for (int i = 0; i < 4; i++) {
+        REQUIRE(service.store("user" + std::to_string(i) + "@example.com", "123456"));
+    }
+    REQUIRE_FALSE(service.store("other@example.com", "123456"));
+    REQUIRE(service.issue("other@example.com").empty());
+    // Replacing an existing recipient's code is still allowed
+    REQUIRE(service.store("user0@example.com", "654321"));
+    REQUIRE(service.size() == 4);
+}
+
+TEST_CASE("Verification service is safe under concurrent use", "[verification_service]") {
+    VerificationService service;
+    std::atomic<int> verified(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&service, &verified, t]() {
+            for (int i = 0; i < 2000; i++) {
+                std::string recipient = "t" + std::to_string(t) + "-" + std::to_string(i) + "@example.com";
+                std::string code = service.issue(recipient);
+                if (service.verify(recipient, code) == VerifyResult::Ok) {
+                    verified++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(verified == 8000);
+    REQUIRE(service.size() == 0);
+}